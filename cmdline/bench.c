@@ -0,0 +1,1231 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+/* Benchmarks.  bench_base64() and bench_crypto() are run using the `bench`
+command, they compare the current implementation against a straight-forward
+reference implementation that corresponds to the code used before the function
+was optimized.  bench_json() runs micro- and macrobenchmarks and is used by the
+`bench` executable, see bench_main.c.  The sync benchmarks of bench_json() run
+against the stand-in server from standin.c. */
+
+
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <netpgp-extra.h>
+#include "../src/mrmailbox_internal.h"
+#include "../src/mrkey.h"
+#include "../src/mrkeyring.h"
+#include "../src/mrpgp.h"
+#include "../src/mrmimeparser.h"
+#include "../src/mrsimplify.h"
+#include "../src/mrdehtml.h"
+#include "../src/mrimap.h"
+#include "../src/mrloginparam.h"
+#include "bench.h"
+#include "standin.h"
+
+
+#define BENCH_MIN_SECONDS 0.5
+
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1000000000.0;
+}
+
+
+static double bench_gbps(size_t bytes, int rounds, double seconds)
+{
+	return seconds>0.0? ((double)bytes*rounds)/seconds/1000000000.0 : 0.0;
+}
+
+
+static double bench_mbps(size_t bytes, double seconds)
+{
+	return seconds>0.0? (double)bytes/seconds/1000000.0 : 0.0;
+}
+
+
+/*******************************************************************************
+ * base64 and quoted-printable
+ ******************************************************************************/
+
+
+static signed char ref_base64_value(char ch)
+{
+	if( ch >= 'A' && ch <= 'Z' ) { return ch - 'A'; }
+	if( ch >= 'a' && ch <= 'z' ) { return ch - 'a' + 26; }
+	if( ch >= '0' && ch <= '9' ) { return ch - '0' + 52; }
+	if( ch == '+' ) { return 62; }
+	if( ch == '/' ) { return 63; }
+	return -1;
+}
+
+
+/* byte-wise decoding as done by libetpan before vectorization */
+static MMAPString* ref_base64_decode(const char* in, size_t in_bytes)
+{
+	MMAPString* out = mmap_string_sized_new(in_bytes*3/4);
+	char        chunk[4], buf[3];
+	int         chunk_index = 0;
+	size_t      i;
+
+	for( i = 0; i < in_bytes; i++ ) {
+		signed char value = ref_base64_value(in[i]);
+		if( value < 0 ) {
+			continue;
+		}
+		chunk[chunk_index++] = value;
+		if( chunk_index == 4 ) {
+			buf[0] = (chunk[0] << 2) | (chunk[1] >> 4);
+			buf[1] = (chunk[1] << 4) | (chunk[2] >> 2);
+			buf[2] = (chunk[2] << 6) | (chunk[3]);
+			mmap_string_append_len(out, buf, 3);
+			chunk_index = 0;
+		}
+	}
+	return out;
+}
+
+
+static int ref_hex_value(char ch)
+{
+	if( ch >= '0' && ch <= '9' ) { return ch - '0'; }
+	if( ch >= 'a' && ch <= 'f' ) { return ch - 'a' + 10; }
+	if( ch >= 'A' && ch <= 'F' ) { return ch - 'A' + 10; }
+	return 0;
+}
+
+
+/* character-wise quoted-printable decoding as done by libetpan before vectorization */
+static MMAPString* ref_qp_decode(const char* in, size_t in_bytes)
+{
+	MMAPString* out = mmap_string_sized_new(in_bytes);
+	size_t      i = 0;
+
+	while( i < in_bytes ) {
+		if( in[i] == '=' && i+1 < in_bytes && in[i+1] == '\n' ) {
+			i += 2;
+		}
+		else if( in[i] == '=' && i+2 < in_bytes && in[i+1] == '\r' && in[i+2] == '\n' ) {
+			i += 3;
+		}
+		else if( in[i] == '=' && i+2 < in_bytes ) {
+			mmap_string_append_c(out, (ref_hex_value(in[i+1])<<4) | ref_hex_value(in[i+2]));
+			i += 3;
+		}
+		else if( in[i] == '\r' && i+1 < in_bytes && in[i+1] == '\n' ) {
+			mmap_string_append_len(out, "\r\n", 2);
+			i += 2;
+		}
+		else {
+			mmap_string_append_c(out, in[i]);
+			i++;
+		}
+	}
+	return out;
+}
+
+
+/*******************************************************************************
+ * Hash tables
+ ******************************************************************************/
+
+
+/* the chained hash table with case-insensitive string keys as used by mrhash_t before
+it was changed to open addressing: one malloc() per element and per key, byte-wise hashing */
+typedef struct ref_hashelem_t
+{
+	struct ref_hashelem_t *next, *prev;
+	void*                  data;
+	char*                  key;
+	int                    key_bytes;
+} ref_hashelem_t;
+
+
+typedef struct ref_hash_t
+{
+	int              copy_key;
+	int              count;
+	ref_hashelem_t*  first;
+	int              htsize;
+	struct { int count; ref_hashelem_t* chain; } *ht;
+} ref_hash_t;
+
+
+static int ref_hash_key(const char* z, int n)
+{
+	int h = 0;
+	while( n-- > 0 ) {
+		h = (h<<3) ^ h ^ tolower((unsigned char)*z++);
+	}
+	return h & 0x7fffffff;
+}
+
+
+static ref_hashelem_t* ref_hash_find_elem(const ref_hash_t* hash, const char* key, int key_bytes, int h)
+{
+	ref_hashelem_t* elem;
+	int             count;
+
+	if( hash->ht ) {
+		for( elem = hash->ht[h].chain, count = hash->ht[h].count; count-- && elem; elem = elem->next ) {
+			if( elem->key_bytes==key_bytes && strncasecmp(elem->key, key, key_bytes)==0 ) {
+				return elem;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+static void ref_hash_link(ref_hash_t* hash, ref_hashelem_t* elem, int h)
+{
+	ref_hashelem_t* head = hash->ht[h].chain;
+	if( head ) {
+		elem->next = head;
+		elem->prev = head->prev;
+		if( head->prev ) { head->prev->next = elem; } else { hash->first = elem; }
+		head->prev = elem;
+	}
+	else {
+		elem->next = hash->first;
+		if( hash->first ) { hash->first->prev = elem; }
+		elem->prev = NULL;
+		hash->first = elem;
+	}
+	hash->ht[h].count++;
+	hash->ht[h].chain = elem;
+}
+
+
+static void ref_hash_insert(ref_hash_t* hash, const char* key, int key_bytes, void* data)
+{
+	ref_hashelem_t* elem, *cur, *next;
+	int             raw = ref_hash_key(key, key_bytes);
+
+	if( hash->htsize && (elem=ref_hash_find_elem(hash, key, key_bytes, raw & (hash->htsize-1))) != NULL ) {
+		elem->data = data;
+		return;
+	}
+
+	if( (elem=calloc(1, sizeof(ref_hashelem_t)))==NULL ) {
+		exit(72);
+	}
+	if( hash->copy_key ) {
+		if( (elem->key=malloc(key_bytes))==NULL ) {
+			exit(72);
+		}
+		memcpy(elem->key, key, key_bytes);
+	}
+	else {
+		elem->key = (char*)key;
+	}
+	elem->key_bytes = key_bytes;
+	elem->data = data;
+	hash->count++;
+
+	if( hash->htsize==0 || hash->count > hash->htsize ) {
+		int new_size = hash->htsize? hash->htsize*2 : 8;
+		free(hash->ht);
+		if( (hash->ht=calloc(new_size, sizeof(hash->ht[0])))==NULL ) {
+			exit(73);
+		}
+		hash->htsize = new_size;
+		for( cur = hash->first, hash->first = NULL; cur; cur = next ) {
+			next = cur->next;
+			ref_hash_link(hash, cur, ref_hash_key(cur->key, cur->key_bytes) & (new_size-1));
+		}
+	}
+
+	ref_hash_link(hash, elem, raw & (hash->htsize-1));
+}
+
+
+static void* ref_hash_find(const ref_hash_t* hash, const char* key, int key_bytes)
+{
+	ref_hashelem_t* elem;
+	if( hash->htsize==0 ) {
+		return NULL;
+	}
+	elem = ref_hash_find_elem(hash, key, key_bytes, ref_hash_key(key, key_bytes) & (hash->htsize-1));
+	return elem? elem->data : NULL;
+}
+
+
+static void ref_hash_clear(ref_hash_t* hash)
+{
+	ref_hashelem_t* elem, *next;
+	for( elem = hash->first; elem; elem = next ) {
+		next = elem->next;
+		if( hash->copy_key ) {
+			free(elem->key);
+		}
+		free(elem);
+	}
+	free(hash->ht);
+	memset(hash, 0, sizeof(ref_hash_t));
+}
+
+
+char* bench_base64(mrmailbox_t* mailbox)
+{
+	#define       BENCH_BINARY_BYTES (4*1024*1024)
+	unsigned char* binary = malloc(BENCH_BINARY_BYTES);
+	char*         base64 = NULL, *qp = NULL, *result = NULL, *ret = NULL;
+	MMAPString*   ref_qp = NULL;
+	size_t        base64_bytes, qp_bytes = 0, result_bytes = 0, indx, i;
+	int           rounds, ok = 1;
+	double        start, ref_seconds, cur_seconds;
+	mrstrbuilder_t report;
+	mrstrbuilder_init(&report, 0);
+
+	/* test data: random binary data, base64 encoded with line breaks as in MIME bodies,
+	and a mostly-ASCII text quoted-printable encoded */
+	srand(1);
+	for( i = 0; i < BENCH_BINARY_BYTES; i++ ) {
+		binary[i] = (unsigned char)rand();
+	}
+	base64 = mr_render_base64(binary, BENCH_BINARY_BYTES, 76, "\r\n", 0);
+	base64_bytes = strlen(base64);
+
+	qp = malloc(BENCH_BINARY_BYTES*3);
+	for( i = 0; i < BENCH_BINARY_BYTES; i++ ) {
+		int c = 32 + binary[i]%95;
+		if( c == '=' || binary[i] >= 250 ) {
+			qp_bytes += sprintf(&qp[qp_bytes], "=%02X", c == '=' ? '=' : binary[i]);
+		}
+		else {
+			qp[qp_bytes++] = c;
+		}
+		if( i%72 == 71 ) {
+			memcpy(&qp[qp_bytes], "=\r\n", 3);
+			qp_bytes += 3;
+		}
+	}
+
+	/* base64 decoding */
+	for( ref_seconds = 0.0, rounds = 0, start = bench_now(); ref_seconds < BENCH_MIN_SECONDS; rounds++, ref_seconds = bench_now()-start ) {
+		mmap_string_free(ref_base64_decode(base64, base64_bytes));
+	}
+	ref_seconds /= rounds;
+
+	for( cur_seconds = 0.0, rounds = 0, start = bench_now(); cur_seconds < BENCH_MIN_SECONDS; rounds++, cur_seconds = bench_now()-start ) {
+		indx = 0;
+		mailmime_base64_body_parse(base64, base64_bytes, &indx, &result, &result_bytes);
+		if( result_bytes != BENCH_BINARY_BYTES || memcmp(result, binary, BENCH_BINARY_BYTES)!=0 ) {
+			ok = 0;
+		}
+		mmap_string_unref(result);
+	}
+	cur_seconds /= rounds;
+
+	mrstrbuilder_catf(&report, "base64 decode:  reference %.2f GB/s, current %.2f GB/s, %.1fx\n",
+		bench_gbps(base64_bytes, 1, ref_seconds), bench_gbps(base64_bytes, 1, cur_seconds), ref_seconds/cur_seconds);
+
+	/* base64 encoding, the reference is libEtPan's encoder plus mr_insert_breaks() */
+	for( ref_seconds = 0.0, rounds = 0, start = bench_now(); ref_seconds < BENCH_MIN_SECONDS; rounds++, ref_seconds = bench_now()-start ) {
+		char* temp = encode_base64((const char*)binary, BENCH_BINARY_BYTES);
+		free(mr_insert_breaks(temp, 76, "\r\n"));
+		free(temp);
+	}
+	ref_seconds /= rounds;
+
+	for( cur_seconds = 0.0, rounds = 0, start = bench_now(); cur_seconds < BENCH_MIN_SECONDS; rounds++, cur_seconds = bench_now()-start ) {
+		char* temp = mr_render_base64(binary, BENCH_BINARY_BYTES, 76, "\r\n", 0);
+		if( strcmp(temp, base64)!=0 ) {
+			ok = 0;
+		}
+		free(temp);
+	}
+	cur_seconds /= rounds;
+
+	mrstrbuilder_catf(&report, "base64 encode:  reference %.2f GB/s, current %.2f GB/s, %.1fx\n",
+		bench_gbps(BENCH_BINARY_BYTES, 1, ref_seconds), bench_gbps(BENCH_BINARY_BYTES, 1, cur_seconds), ref_seconds/cur_seconds);
+
+	/* quoted-printable decoding, the result of the scalar reference decoder is kept for comparison */
+	ref_qp = ref_qp_decode(qp, qp_bytes);
+	for( ref_seconds = 0.0, rounds = 0, start = bench_now(); ref_seconds < BENCH_MIN_SECONDS; rounds++, ref_seconds = bench_now()-start ) {
+		mmap_string_free(ref_qp_decode(qp, qp_bytes));
+	}
+	ref_seconds /= rounds;
+
+	for( cur_seconds = 0.0, rounds = 0, start = bench_now(); cur_seconds < BENCH_MIN_SECONDS; rounds++, cur_seconds = bench_now()-start ) {
+		indx = 0;
+		mailmime_quoted_printable_body_parse(qp, qp_bytes, &indx, &result, &result_bytes, 0);
+		if( result_bytes != ref_qp->len || memcmp(result, ref_qp->str, result_bytes)!=0 ) {
+			ok = 0;
+		}
+		mmap_string_unref(result);
+	}
+	cur_seconds /= rounds;
+	mmap_string_free(ref_qp);
+
+	mrstrbuilder_catf(&report, "qp decode:      reference %.2f GB/s, current %.2f GB/s, %.1fx\n",
+		bench_gbps(qp_bytes, 1, ref_seconds), bench_gbps(qp_bytes, 1, cur_seconds), ref_seconds/cur_seconds);
+
+	mrstrbuilder_catf(&report, "results %s", ok? "ok" : "DIFFER");
+
+	mrmailbox_log_info(mailbox, 0, "base64 benchmark done.");
+
+	ret = report.m_buf;
+	free(binary);
+	free(base64);
+	free(qp);
+	return ret;
+}
+
+
+/*******************************************************************************
+ * OpenPGP symmetric encryption and hashing
+ ******************************************************************************/
+
+
+#define BENCH_CHAT_BYTES       1024
+#define BENCH_ATTACHMENT_BYTES (20*1024*1024)
+
+
+typedef void (*bench_cfb_t)(pgp_symm_alg_t, const uint8_t* key, const uint8_t* in, uint8_t* out, size_t bytes, int enc);
+
+
+/* AES-CFB directly with a new EVP context per message, this is the lower bound for netpgp's overhead;
+the low-level AES_*() functions netpgp used before are deprecated since OpenSSL 3 */
+static void ref_aes_cfb(pgp_symm_alg_t alg, const uint8_t* key, const uint8_t* in, uint8_t* out, size_t bytes, int enc)
+{
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+	uint8_t         iv[16];
+	int             outl;
+
+	memset(iv, 0, sizeof(iv));
+	EVP_CipherInit_ex(ctx, alg==PGP_SA_AES_256? EVP_aes_256_cfb128() : EVP_aes_128_cfb128(), NULL, key, iv, enc);
+	EVP_CipherUpdate(ctx, out, &outl, in, (int)bytes);
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+
+/* the same using netpgp's pgp_crypt_t, as done when encrypting/decrypting a message */
+static void cur_pgp_cfb(pgp_symm_alg_t alg, const uint8_t* key, const uint8_t* in, uint8_t* out, size_t bytes, int enc)
+{
+	pgp_crypt_t crypt;
+	uint8_t     iv[PGP_MAX_BLOCK_SIZE];
+
+	memset(iv, 0, sizeof(iv));
+	pgp_crypt_any(&crypt, alg);
+	crypt.set_iv(&crypt, iv);
+	crypt.set_crypt_key(&crypt, key);
+	pgp_encrypt_init(&crypt);
+	if( enc ) {
+		crypt.cfb_encrypt(&crypt, out, in, bytes);
+	}
+	else {
+		crypt.cfb_decrypt(&crypt, out, in, bytes);
+	}
+	crypt.decrypt_finish(&crypt);
+}
+
+
+static double bench_cfb_seconds(bench_cfb_t func, pgp_symm_alg_t alg, const uint8_t* key, const uint8_t* in, uint8_t* out, size_t bytes, int enc)
+{
+	double start = bench_now(), seconds = 0.0;
+	int    rounds;
+
+	for( rounds = 0; seconds < BENCH_MIN_SECONDS; rounds++, seconds = bench_now()-start ) {
+		func(alg, key, in, out, bytes, enc);
+	}
+	return seconds/rounds;
+}
+
+
+static void bench_cfb(mrstrbuilder_t* report, const char* name, pgp_symm_alg_t alg, const uint8_t* plain, uint8_t* ctext, uint8_t* back, size_t bytes, int* ok)
+{
+	uint8_t key[PGP_MAX_KEY_SIZE];
+	double  ref_seconds, cur_seconds;
+	size_t  i;
+
+	for( i = 0; i < sizeof(key); i++ ) {
+		key[i] = (uint8_t)(i*7);
+	}
+
+	/* encryption, the reference result must match the current one */
+	ref_seconds = bench_cfb_seconds(ref_aes_cfb, alg, key, plain, back, bytes, 1);
+	cur_seconds = bench_cfb_seconds(cur_pgp_cfb, alg, key, plain, ctext, bytes, 1);
+	if( memcmp(ctext, back, bytes)!=0 ) {
+		*ok = 0;
+	}
+	mrstrbuilder_catf(report, "%s encrypt %8i bytes: reference %8.1f MB/s, current %8.1f MB/s, %.1fx\n", name, (int)bytes,
+		bench_mbps(bytes, ref_seconds), bench_mbps(bytes, cur_seconds), ref_seconds/cur_seconds);
+
+	ref_seconds = bench_cfb_seconds(ref_aes_cfb, alg, key, ctext, back, bytes, 0);
+	cur_seconds = bench_cfb_seconds(cur_pgp_cfb, alg, key, ctext, back, bytes, 0);
+	if( memcmp(plain, back, bytes)!=0 ) {
+		*ok = 0;
+	}
+	mrstrbuilder_catf(report, "%s decrypt %8i bytes: reference %8.1f MB/s, current %8.1f MB/s, %.1fx\n", name, (int)bytes,
+		bench_mbps(bytes, ref_seconds), bench_mbps(bytes, cur_seconds), ref_seconds/cur_seconds);
+}
+
+
+static void bench_sha(mrstrbuilder_t* report, const uint8_t* data, size_t bytes, int* ok)
+{
+	uint8_t    ref_digest[EVP_MAX_MD_SIZE], cur_digest[EVP_MAX_MD_SIZE];
+	double     start, ref_seconds, cur_seconds;
+	int        rounds;
+	pgp_hash_t hash;
+
+	for( ref_seconds = 0.0, rounds = 0, start = bench_now(); ref_seconds < BENCH_MIN_SECONDS; rounds++, ref_seconds = bench_now()-start ) {
+		EVP_Digest(data, bytes, ref_digest, NULL, EVP_sha256(), NULL);
+	}
+	ref_seconds /= rounds;
+
+	for( cur_seconds = 0.0, rounds = 0, start = bench_now(); cur_seconds < BENCH_MIN_SECONDS; rounds++, cur_seconds = bench_now()-start ) {
+		memset(&hash, 0, sizeof(hash));
+		pgp_hash_sha256(&hash);
+		hash.init(&hash);
+		hash.add(&hash, data, (unsigned)bytes);
+		hash.finish(&hash, cur_digest);
+	}
+	cur_seconds /= rounds;
+
+	if( memcmp(ref_digest, cur_digest, 32)!=0 ) {
+		*ok = 0;
+	}
+	mrstrbuilder_catf(report, "sha256         %8i bytes: reference %8.1f MB/s, current %8.1f MB/s, %.1fx\n", (int)bytes,
+		bench_mbps(bytes, ref_seconds), bench_mbps(bytes, cur_seconds), ref_seconds/cur_seconds);
+}
+
+
+/* complete messages as sent and received: signed, encrypted and armored */
+static void bench_pgp_message(mrstrbuilder_t* report, mrmailbox_t* mailbox, const mrkeyring_t* public_keys, const mrkeyring_t* private_keys,
+                              mrkey_t* public_key, mrkey_t* private_key, const uint8_t* plain, size_t bytes, int* ok)
+{
+	void*  ctext = NULL, *back = NULL;
+	size_t ctext_bytes = 0, back_bytes = 0;
+	double start, encrypt_seconds, decrypt_seconds;
+	int    rounds, validation_errors = 0;
+
+	for( encrypt_seconds = 0.0, rounds = 0, start = bench_now(); encrypt_seconds < BENCH_MIN_SECONDS; rounds++, encrypt_seconds = bench_now()-start ) {
+		free(ctext);
+		ctext = NULL;
+		if( !mrpgp_pk_encrypt(mailbox, plain, bytes, public_keys, private_key, 1, &ctext, &ctext_bytes) ) {
+			*ok = 0;
+			goto cleanup;
+		}
+	}
+	encrypt_seconds /= rounds;
+
+	for( decrypt_seconds = 0.0, rounds = 0, start = bench_now(); decrypt_seconds < BENCH_MIN_SECONDS; rounds++, decrypt_seconds = bench_now()-start ) {
+		free(back);
+		back = NULL;
+		if( !mrpgp_pk_decrypt(mailbox, ctext, ctext_bytes, private_keys, public_key, 1, &back, &back_bytes, &validation_errors) ) {
+			*ok = 0;
+			goto cleanup;
+		}
+	}
+	decrypt_seconds /= rounds;
+
+	if( back_bytes != bytes || memcmp(back, plain, bytes)!=0 || validation_errors ) {
+		*ok = 0;
+	}
+
+	mrstrbuilder_catf(report, "message        %8i bytes: encrypt %8.1f MB/s, decrypt %8.1f MB/s\n", (int)bytes,
+		bench_mbps(bytes, encrypt_seconds), bench_mbps(bytes, decrypt_seconds));
+
+cleanup:
+	free(ctext);
+	free(back);
+}
+
+
+char* bench_crypto(mrmailbox_t* mailbox)
+{
+	uint8_t*       plain = malloc(BENCH_ATTACHMENT_BYTES);
+	uint8_t*       ctext = malloc(BENCH_ATTACHMENT_BYTES);
+	uint8_t*       back = malloc(BENCH_ATTACHMENT_BYTES);
+	mrkey_t*       public_key = mrkey_new();
+	mrkey_t*       private_key = mrkey_new();
+	mrkeyring_t*   public_keys = mrkeyring_new();
+	mrkeyring_t*   private_keys = mrkeyring_new();
+	int            ok = 1;
+	size_t         i;
+	mrstrbuilder_t report;
+	mrstrbuilder_init(&report, 0);
+
+	if( plain==NULL || ctext==NULL || back==NULL ) {
+		exit(49);
+	}
+
+	srand(1);
+	for( i = 0; i < BENCH_ATTACHMENT_BYTES; i++ ) {
+		plain[i] = (unsigned char)rand();
+	}
+
+	/* the symmetric layer and the hashes */
+	bench_cfb(&report, "aes128", PGP_SA_AES_128, plain, ctext, back, BENCH_CHAT_BYTES, &ok);
+	bench_cfb(&report, "aes128", PGP_SA_AES_128, plain, ctext, back, BENCH_ATTACHMENT_BYTES, &ok);
+	bench_cfb(&report, "aes256", PGP_SA_AES_256, plain, ctext, back, BENCH_CHAT_BYTES, &ok);
+	bench_cfb(&report, "aes256", PGP_SA_AES_256, plain, ctext, back, BENCH_ATTACHMENT_BYTES, &ok);
+	bench_sha(&report, plain, BENCH_CHAT_BYTES, &ok);
+	bench_sha(&report, plain, BENCH_ATTACHMENT_BYTES, &ok);
+
+	/* complete messages, this includes the public key operations */
+	mrmailbox_log_info(mailbox, 0, "Generating keypair for crypto benchmark ...");
+	if( !mrpgp_create_keypair(mailbox, "bench@localhost", public_key, private_key) ) {
+		ok = 0;
+		goto cleanup;
+	}
+	mrkeyring_add(public_keys, public_key);
+	mrkeyring_add(private_keys, private_key);
+
+	bench_pgp_message(&report, mailbox, public_keys, private_keys, public_key, private_key, plain, BENCH_CHAT_BYTES, &ok);
+	bench_pgp_message(&report, mailbox, public_keys, private_keys, public_key, private_key, plain, BENCH_ATTACHMENT_BYTES, &ok);
+
+cleanup:
+	mrstrbuilder_catf(&report, "results %s", ok? "ok" : "DIFFER");
+
+	mrmailbox_log_info(mailbox, 0, "crypto benchmark done.");
+
+	mrkeyring_unref(public_keys);
+	mrkeyring_unref(private_keys);
+	mrkey_unref(public_key);
+	mrkey_unref(private_key);
+	free(plain);
+	free(ctext);
+	free(back);
+	return report.m_buf;
+}
+
+
+/*******************************************************************************
+ * Benchmarks with JSON results, used by the `bench` executable
+ ******************************************************************************/
+
+
+/* The results are written as {"version":..., "benchmarks":[{"name":..., ...}, ...], "ok":...}
+so that they can be compared across releases.  Microbenchmarks repeat an
+operation for at least BENCH_MIN_SECONDS, macrobenchmarks work on a database
+filled with generated messages.  The mailbox given to bench_json() must be
+opened on an empty database. */
+
+
+#define BENCH_CONTACTS 20
+
+
+/* the private key used for the PGP benchmarks, fixed for reproducible results; the public key is split off */
+static const char* s_bench_private_key =
+	"xcSYBGrVYEMBDAC7F/rWwqmCzzR/zggPuaTrU7HAItiU0e7Ee1m8QGE+7hy89PkhAQN9it0wuN/h\n"
+	"fbdmNWLbi5ImY6XK4gfn6SmZ6kaMj9rZ5iaOOvS57cibOLI/nsLgNZNdQ1iNbEbfMGG3f0hX4yLu\n"
+	"YkHPOMCCVx/TCGaMY7/2gXXlLNKz7apbu9VHh1bcoK9q1PQrArLGkMd1GFSu9MQd12keWRyLs0oQ\n"
+	"3vYjJ9OnsVAkOsF+Gsj4R9dxtSgNdHZbiG6zY9CyMfbs9Z+tVq0aqxccQ3kJyjHIYWxMdOBSVhE5\n"
+	"SBD5tnds3eHkcYe7pAPbX9a+HIqDAEijSinzlsG4zv4qJupnS8E3CfasdMcamLkIPK0kjKjxiObr\n"
+	"Jj6lkz2tbkuqpkZvutzeXddiT33eklJqPRGdo9QpimRLR3oKlHaBqwxj30j5+gohrG8w6Ww3S4iP\n"
+	"QsMu4PNdwm9qAT09v1a1ldeaZBm3rukLWTzQgLbPbjm49CgUx1JHHBQbcNEzeqNeD7wMekcAEQEA\n"
+	"AQAL+QEvtZkOK81JQjfSZMb6ds+uoS5Yk10BphGFK9xbBLmzSbDKwyo5+4/ThSqvyEg4eklhxiNr\n"
+	"HLjZ4cRA3T1l8PUpnG3FLXepHGCey17DBj0NvI3nlD7Ek6Gkw9LXd1sCqtCHxoTyb6BpWRd7cIB+\n"
+	"gu/dNaFCjc81EGC/OCiIx/0NNgFwiYvA4/K550C/I32k2IXLtCExmG1WTQ8OECxrLVcy50/M5mxB\n"
+	"p3ADX/AnxVNTbd4qAKBNNy7q1UVxFHKzrYnwePlTbnjeC5Zi6pg48Wz3UX9ucAurUqZpJDWJZQdR\n"
+	"kaA5GAne1hk8PPds8PrJGDuWMhnfIxNNkXvtxKzExQJaByKPvdI/WBItE2CAwk7rhzkQm666Na2e\n"
+	"UVAoeWw6zKI4V8Gi6xWhUuVn+Dlc4erMeaI4PFQfvvDpaDKauiAHPLNniy6bmf4pwxGufWKzo6+M\n"
+	"vRg6xRBgRO3xeZ6/C/EFTmVvXn0E45IFsFGySFlVo8qsZsSJ8+/xEIfvuibdwQYA9lK4zn7NSTqh\n"
+	"1+LEcpSMEMFu6i5K5JwU2/3wkZz7s6TIvb+ZLuplOR/08ErQdS2iSXu8OcRkTRjyILLqX9e6db9s\n"
+	"n/3nToejzBlDQtrReSGBxziJVyKF8gKGFKiA46iycjMVe2HXZgal2uf6DLEergh8HC1C0agHt80N\n"
+	"Vfp9awwqhkQjh24BVpWVIiz+Rkhnd7fislNCVnNNFcRAtBzdhdRb72Xj6mkZch//FN0KbbjdPz6O\n"
+	"g90il5nwrgQs+5LhBgDCcZXxsKlWF7wyBt3HR6QDYISfTSdyhAT6EBpbUbiIt64uFXpR7aX7XWom\n"
+	"wkCwwhgSFY0Z8zj7BeieHD3UDMKQ9G/QFSGhSJevxYancOyGUi+1ltRAsLW51unQYUwFjc5FjF3x\n"
+	"md4aTqDCBETyY7U9IsYNCa95/+3mQO6XOXHFLgSzdSJ4r5XKxemPgHmi4eDK8F4vAcD+8MQ8NuK1\n"
+	"pFu/CJVz7ACRpCTa/WiEZACVX/U72A7TPSVjuxf6bKjWWicF/j6RClu77btpn2tyap11DspUFXIT\n"
+	"P7T0nxr2BRLWdWTYh4JBmjiyp7qmsTLV0ZCtDSID6AHFC6gSSCoYo0bmEDbHsDPyjb6+JFIYDNsv\n"
+	"Elt0lqzuIV+Nc8vFMM3qjIGYs0r3Hb6ZedwTRXTQiYDrOEdiN4ryavK5MwK00UzCZCGfmGOCPMb2\n"
+	"YQdatOjuBaGaSyF2aHo7q+UIK/Y9WjYFSjJHOpWXVlURRJwwZp2RXx/Zfq6Bi3VWxpFWM+LYe2lk\n"
+	"7t2bzQk8YUBiLm9yZz7CwPwEEwEIACYFAmrVYEQFCQAAAAACGQECGwMGCwkHAwIBBhUICQoLAgIW\n"
+	"AgIeAQAKCRBEvFW1oeUwGEhbC/9bkXv2Ad05SiGbsmkKgHw9h40xJ+xCs7hdh8Rv/TXYCZ4cfJ3n\n"
+	"2LM+frQDYmTWRL4/HK0xbTx/6+oCgD0ttKevp9xiXhSgXDq+d0e4V6VQwb1SrxDMP+2W5XJjTMwi\n"
+	"Vi++toB4mGwh93k/2tVsZtXJDq+0cbrSIcoSzVKLEJSre0+Nus7O1XQyoaawTAj3pWi4LFSn6qBp\n"
+	"M2SW+ZjJ1S53y+be95Sv7pHxGOJIb2v6JNtjOuAWtBcfhiNLqlOa6sfyr+PICpg+tFRz5O6I84i7\n"
+	"fBDSekuyzDGtuFI30ZgAb3KyqxrEZrqbyprlxQulbgQnCyRo/nBHdSET1ub2qwJ5wceEBXWLYMRW\n"
+	"TbqbgrIeiphAfv1TXrSNxQelCUN2e0tABTfaGx4O2rofF6US8sWzcbMCQi0BBYNr5R3ycsClLKq8\n"
+	"s+VUk5M4B67HMTL8wbHRhCgHIow2DO9wkMyxP+v++ElFrO1on3o+Cjxd7f5NdWWjlhJfdxRl9pN8\n"
+	"6K6NE3zHxJcEatVgRAEMANmgdKmn3wM4xyyT97LqYDA4Rh1W3Ywm+jzJG6oDfg0sJ4qIq7UxkpLL\n"
+	"uDIN6ZaczJF+DU0iGBS+gfryIcJg5/kmdJHDGlAASoQ2w1/hQL3El+EMIqe9E/W2n9dHSU14hFjS\n"
+	"lcNCvX7yY4roXuOp58Hpc4uCX2zECz3yXApCXp+8xbaUCB75daEGa3nQUMuNr81LJv+jTNWgQQ1S\n"
+	"VWbMNQc1pG3YH9mZYiYLRsXby6TQ4gd8+9Wlrp+GwES2eFP4Ez3B7wQknNvrOVPeOLxw8pb5bdhK\n"
+	"u0B48QbQ1wHLiNdQ4WrKnE5cn8Z0RpHbcp97YjLYNz+YfhmIZLpscaAsmR4UQ61XXGhft18a9OhO\n"
+	"MyapvmccA7s3bgLciDIAtXuKvJuBOXuHCbhIDiurlRJHodbMtBkx3WYzcFoEafahqs/IQhoRUxiP\n"
+	"AeLZg5moR2cszZqUR8NjuKsOlZHI5Nnzx+A+bfexrjMasYUmXSmOMy9zyzDyT89acYHA2dWXPFwu\n"
+	"ZwARAQABAAv3bcFgEUd3gBdREVjx9+kPCBBpYiLscxwH9J2fpu8MC5PBKy9RsOy1Dhe8ZGranVDd\n"
+	"6aiWiugC2KbhK3iQMjwB1uRtAgZsR1wi0JKuDqH6BMX0EttstPYinfClH5Bl+rEszTql4W/MS6u6\n"
+	"0bbGkC1nWPK3QiaglARIxcpM1uSiF6Qd/JhiS3K2f5uhFYTMzGyI6L5ovieWLy0zxmp09iJVc7a2\n"
+	"N/WYGo95HwtDsUAFCKc49W85MSh96lYVLVZQMNHu65SLm9dd76cjOSC+Q2Ec03U3zAK97/0AUYxc\n"
+	"WDXC+MxGBTMbFQvwfbnxKB7irMcKHH+qa36MV9tf/P+D+VmH7WjJ14JTgB9hALoB64NPA6HWGjVr\n"
+	"5QdgtFwcrYFAXAnoZC7x7F+X9spDPFyVhB0L1ZT0zN9VSVmvp7p3N510yi0yXL3W80ZARaeQ2zm0\n"
+	"f0bNel+P+7NbYAaAeN61dSlp0VA83lxuQG/03C05/XPl+gY3aQyUuGuylS1swxmkpIEGAPG+CF1c\n"
+	"PZYICvdozmQvzACqlf3MJqHe0605fig9zuihGBEAwdK9f2gH1pPj5mdTBM0QyUQpf2gVmIkoPZ21\n"
+	"Yv6ewd2djSZodYTcjmwJ+/T50G3TmIeGe1vA7l0ijg8uKIXkyKoFpet/AkqMKQ7sqzydpYnfriN1\n"
+	"LbywuKeaLQ8I9MLtU8uSdLSXUHT98Lc8RBij6k/QPFndOEfelDI3aMpFWgzQub6Kfjh3FZGkY/ec\n"
+	"KBBVLH5EI/e4lVKlXqyffwYA5nZQAq+mR4cAITAmfGdtEU5biDb8JpWT+bm1rOUoWkfJQ+SwaJKl\n"
+	"XWXKoGUPI4lz8PDWSJQWFoSCWSGq1X0lK5Qdvwu178WHHaibX/CvCJohaGuhW7ATYXYoldrl6JbZ\n"
+	"eWfLPx+prU4oCu/20v3+hfH8eorhb5vxTwE82TXH+WlRn2wAofumQMZamijdbEQ8TeUUn6dGXZzB\n"
+	"eQCorA2K7brKG3+o0tBRoNsb8dn1pyCvPAbXcMLl+w2kKp9XLOUZBgCrnkyCxGRlf1GWqi+b0Oil\n"
+	"9gGxabTXJ/Wu1DxrPefngSIwj/QzF9nEdCk0bhB/eK/zhzfsIS1oMP6J4q/+yYpqU+puwm4P/Ykz\n"
+	"6bQ07ITP8s57LAjOoEFhwFRGG7hY8DqD3UdnaOAAeE28Em/xB680eX7ULKUpJT0qC8qI92wrZ3Ot\n"
+	"kxxODvZFVefKlXM9YYrqKR5H7dSlGlTRDo0qKpR5rf0zY8jm6O4iieuR0CVSI21W8Mb8cunua+MW\n"
+	"tiKKPFTiucLA5QQYAQgADwUCatVgRAUJAAAAAAIbDAAKCRBEvFW1oeUwGKN+C/49pvcCXTY/EhoW\n"
+	"NGYNsXrv2MHYN82AyvY7Btsw99RNDIe9c3CG6+kd14lyY6CJjrM8EmAoD81fvaFCmbgzKb9XFcxf\n"
+	"Wr4gk7Dvd78Cd+fpvw+qoPA6jb9lCShdMS7NeLjdjNmxq47ksDT4xYu2MSVrUbY0QyPOZAC14NNm\n"
+	"XeIaTVE5Y+g9pq6WjWI3xK4h2nmtJavfB3tX12woDgmNM25G8qnE2iEw6F9JLxcgSd4vlav1JOmG\n"
+	"i3zouuRBYi+Us7CKvhXLke8fpfd0VKwhJuGAbXN6BDKdkeRjHXc5blrXGg5odagIssdzMzu2Hhnt\n"
+	"pWHljIFh4c1TAxDMz40jlEFrChWgf2NRDyW5fsGLW9Q/GVRQ7kS5sLO+88Czy5rQTO1KBR23L7Av\n"
+	"tlGZe8RzfBkPQHSwi+ejWGV1w8k1JVDKJJij/0+12Yd7Tvv4bXjzHkXwp5ZtKEMet/fUGEPwOlCf\n"
+	"J9a1YaQP6MT2BiXx3Qu2MF5gTF4eFS572FvTD0k136c=\n";
+
+
+typedef struct bench_t
+{
+	mrmailbox_t*    m_mailbox;
+	const char*     m_filter;
+	int             m_latency_ms;
+	int             m_bytes_per_second;
+	mrstrbuilder_t  m_json;
+	int             m_cnt;
+	int             m_ok;
+} bench_t;
+
+
+static int bench_wanted(bench_t* bench, const char* name)
+{
+	return bench->m_filter==NULL || bench->m_filter[0]==0 || strstr(name, bench->m_filter)!=NULL;
+}
+
+
+static void bench_add_result(bench_t* bench, const char* name, int ops, double seconds, size_t bytes_per_op)
+{
+	mrstrbuilder_catf(&bench->m_json, "%s\n{\"name\":\"%s\",\"ops\":%i,\"seconds\":%.6f,\"ns_per_op\":%.1f,\"ops_per_s\":%.1f",
+		bench->m_cnt? "," : "", name, ops, seconds,
+		ops>0? seconds*1000000000.0/ops : 0.0, seconds>0.0? ops/seconds : 0.0);
+	if( bytes_per_op ) {
+		mrstrbuilder_catf(&bench->m_json, ",\"mb_per_s\":%.2f", bench_mbps(bytes_per_op*ops, seconds));
+	}
+	mrstrbuilder_cat(&bench->m_json, "}");
+	bench->m_cnt++;
+
+	mrmailbox_log_info(bench->m_mailbox, 0, "Benchmark %s: %.1f ns/op", name, ops>0? seconds*1000000000.0/ops : 0.0);
+}
+
+
+/* repeat `body` for at least BENCH_MIN_SECONDS and add the result */
+#define BENCH_LOOP(bench, name, bytes_per_op, ...) \
+	if( bench_wanted((bench), (name)) ) { \
+		double bench_start = bench_now(), bench_seconds = 0.0; \
+		int    bench_ops; \
+		for( bench_ops = 0; bench_seconds < BENCH_MIN_SECONDS; bench_ops++, bench_seconds = bench_now()-bench_start ) { \
+			__VA_ARGS__; \
+		} \
+		bench_add_result((bench), (name), bench_ops, bench_seconds, (bytes_per_op)); \
+	}
+
+
+static char* bench_create_text(int words, unsigned int seed)
+{
+	static const char* s_words[] = { "hello", "delta", "chat", "message", "tomorrow", "meeting", "the", "a", "is", "we",
+		"coffee", "project", "weekend", "photo", "see", "you", "later", "thanks", "great", "idea" };
+	mrstrbuilder_t ret;
+	int            i;
+
+	mrstrbuilder_init(&ret, 0);
+	for( i = 0; i < words; i++ ) {
+		seed = seed*1103515245 + 12345;
+		mrstrbuilder_cat(&ret, s_words[(seed>>16) % (sizeof(s_words)/sizeof(s_words[0]))]);
+		mrstrbuilder_cat(&ret, i%12==11? ".\r\n" : " ");
+	}
+	return ret.m_buf;
+}
+
+
+/* a message as received from one of the generated contacts */
+static char* bench_create_msg(const char* prefix, int index, const char* text)
+{
+	int contact = index % BENCH_CONTACTS;
+	return mr_mprintf(
+		"Return-Path: <contact%i@bench.localhost>\r\n"
+		"Message-ID: <%s-%i@bench.localhost>\r\n"
+		"Date: Mon, 2 Oct 2017 %02i:%02i:%02i +0000\r\n"
+		"From: Contact %i <contact%i@bench.localhost>\r\n"
+		"To: bench@localhost\r\n"
+		"Subject: Message %i\r\n"
+		"Chat-Version: 1.0\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"Content-Transfer-Encoding: 8bit\r\n"
+		"\r\n"
+		"%s\r\n"
+		"\r\n"
+		"> quoted text of the message before\r\n"
+		"> that is removed by the simplifier\r\n"
+		"\r\n"
+		"-- \r\n"
+		"signature of contact %i\r\n",
+		contact, prefix, index, (index/3600)%24, (index/60)%60, index%60, contact, contact, index, text, contact);
+}
+
+
+static void bench_micro(bench_t* bench)
+{
+	mrmailbox_t*  mailbox = bench->m_mailbox;
+	char*         text = bench_create_text(200, 1);
+	char*         msg = bench_create_msg("bench", 1, text);
+	char*         html = NULL, *base64 = NULL, *temp;
+	size_t        msg_bytes = strlen(msg), text_bytes = strlen(text), html_bytes, base64_bytes, indx, result_bytes;
+	uint8_t*      binary = malloc(BENCH_BINARY_BYTES);
+	mrstrbuilder_t html_builder;
+	int           i;
+
+	if( binary == NULL ) {
+		exit(57);
+	}
+
+	/* MIME parsing, incl. the check for encryption */
+	BENCH_LOOP(bench, "mrmimeparser_parse", msg_bytes, {
+		mrmimeparser_t* parser = mrmimeparser_new(mailbox->m_blobdir, mailbox);
+		mrmimeparser_parse(parser, msg, msg_bytes);
+		if( carray_count(parser->m_parts) == 0 ) { bench->m_ok = 0; }
+		mrmimeparser_unref(parser);
+	});
+
+	/* simplifying plain text and HTML */
+	BENCH_LOOP(bench, "mrsimplify_simplify_text", text_bytes, {
+		mrsimplify_t* simplify = mrsimplify_new();
+		free(mrsimplify_simplify(simplify, text, text_bytes, 0));
+		mrsimplify_unref(simplify);
+	});
+
+	mrstrbuilder_init(&html_builder, 0);
+	mrstrbuilder_cat(&html_builder, "<!DOCTYPE html><html><head><title>Bench</title><style>p { margin: 0; }</style></head><body>");
+	for( i = 0; i < 20; i++ ) {
+		mrstrbuilder_catf(&html_builder, "<p>%.*s <b>bold</b> <a href=\"https://delta.chat/%i\">link &amp; more</a></p><br/>\n", 120, text+i, i);
+	}
+	mrstrbuilder_cat(&html_builder, "<blockquote>quoted</blockquote></body></html>");
+	html = html_builder.m_buf;
+	html_bytes = strlen(html);
+
+	BENCH_LOOP(bench, "mrsimplify_simplify_html", html_bytes, {
+		mrsimplify_t* simplify = mrsimplify_new();
+		free(mrsimplify_simplify(simplify, html, html_bytes, 1));
+		mrsimplify_unref(simplify);
+	});
+
+	BENCH_LOOP(bench, "mr_dehtml", html_bytes, {
+		temp = safe_strdup(html); /* mr_dehtml() modifies the buffer */
+		free(mr_dehtml(temp));
+		free(temp);
+	});
+
+	/* parameters as stored in the database */
+	BENCH_LOOP(bench, "mrparam", 0, {
+		mrparam_t* param = mrparam_new();
+		mrparam_set_packed(param, "f=/data/blobs/image.jpg\nm=image/jpeg\nw=1280\nh=720\nt=Contact\nu=1");
+		mrparam_set_int(param, MRP_WIDTH, 640);
+		mrparam_set(param, MRP_FILE, "/data/blobs/other.jpg");
+		if( mrparam_get_int(param, MRP_HEIGHT, 0) != 720 ) { bench->m_ok = 0; }
+		free(mrparam_get(param, MRP_MIMETYPE, NULL));
+		mrparam_unref(param);
+	});
+
+	/* hash tables as used by the caches */
+	{
+		#define BENCH_HASH_KEYS 1000
+		char* keys[BENCH_HASH_KEYS];
+		for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+			keys[i] = mr_mprintf("contact%i@bench.localhost", i);
+		}
+
+		BENCH_LOOP(bench, "mrhash_insert_find_1000", 0, {
+			mrhash_t hash;
+			mrhash_init(&hash, MRHASH_STRING, 1/*copy key*/);
+			for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+				mrhash_insert(&hash, keys[i], strlen(keys[i]), keys[i]);
+			}
+			for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+				if( mrhash_find(&hash, keys[i], strlen(keys[i])) != keys[i] ) { bench->m_ok = 0; }
+			}
+			mrhash_clear(&hash);
+		});
+
+		BENCH_LOOP(bench, "ref_hash_insert_find_1000", 0, {
+			ref_hash_t hash;
+			memset(&hash, 0, sizeof(ref_hash_t));
+			hash.copy_key = 1;
+			for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+				ref_hash_insert(&hash, keys[i], strlen(keys[i]), keys[i]);
+			}
+			for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+				if( ref_hash_find(&hash, keys[i], strlen(keys[i])) != keys[i] ) { bench->m_ok = 0; }
+			}
+			ref_hash_clear(&hash);
+		});
+
+		for( i = 0; i < BENCH_HASH_KEYS; i++ ) {
+			free(keys[i]);
+		}
+	}
+
+	/* header lookups as done by the MIME parser, the table is built once per message and queried some times */
+	{
+		static const char* s_headers[] = { "Return-Path", "Received", "Message-ID", "Date", "From", "To", "Cc", "Subject",
+			"In-Reply-To", "References", "MIME-Version", "Content-Type", "Content-Transfer-Encoding", "Autocrypt",
+			"Chat-Version", "Chat-Group-ID", "Chat-Group-Name", "Chat-Disposition-Notification-To", "X-Mailer", "DKIM-Signature" };
+		static const char* s_lookups[] = { "chat-version", "autocrypt", "chat-group-id", "chat-group-name", "chat-group-member-added",
+			"chat-predecessor", "chat-disposition-notification-to", "content-type", "subject", "secure-join", "list-id", "precedence" };
+		#define BENCH_HEADERS (int)(sizeof(s_headers)/sizeof(s_headers[0]))
+		#define BENCH_LOOKUPS (int)(sizeof(s_lookups)/sizeof(s_lookups[0]))
+
+		BENCH_LOOP(bench, "mrhash_header_lookup", 0, {
+			mrhash_t hash;
+			mrhash_init(&hash, MRHASH_STRING, 0/*do not copy key*/);
+			for( i = 0; i < BENCH_HEADERS; i++ ) {
+				mrhash_insert(&hash, s_headers[i], strlen(s_headers[i]), (void*)s_headers[i]);
+			}
+			for( i = 0; i < BENCH_LOOKUPS; i++ ) {
+				mrhash_find(&hash, s_lookups[i], strlen(s_lookups[i]));
+			}
+			if( mrhash_find(&hash, "content-type", 12) != s_headers[11] ) { bench->m_ok = 0; }
+			mrhash_clear(&hash);
+		});
+
+		BENCH_LOOP(bench, "ref_hash_header_lookup", 0, {
+			ref_hash_t hash;
+			memset(&hash, 0, sizeof(ref_hash_t));
+			for( i = 0; i < BENCH_HEADERS; i++ ) {
+				ref_hash_insert(&hash, s_headers[i], strlen(s_headers[i]), (void*)s_headers[i]);
+			}
+			for( i = 0; i < BENCH_LOOKUPS; i++ ) {
+				ref_hash_find(&hash, s_lookups[i], strlen(s_lookups[i]));
+			}
+			if( ref_hash_find(&hash, "content-type", 12) != s_headers[11] ) { bench->m_ok = 0; }
+			ref_hash_clear(&hash);
+		});
+	}
+
+	/* base64 as used for attachments */
+	srand(1);
+	for( i = 0; i < BENCH_BINARY_BYTES; i++ ) {
+		binary[i] = (uint8_t)rand();
+	}
+	base64 = mr_render_base64(binary, BENCH_BINARY_BYTES, 76, "\r\n", 0);
+	base64_bytes = strlen(base64);
+
+	BENCH_LOOP(bench, "base64_encode", BENCH_BINARY_BYTES, {
+		free(mr_render_base64(binary, BENCH_BINARY_BYTES, 76, "\r\n", 0));
+	});
+
+	BENCH_LOOP(bench, "base64_decode", base64_bytes, {
+		indx = 0;
+		if( mailmime_base64_body_parse(base64, base64_bytes, &indx, &temp, &result_bytes) != MAILIMF_NO_ERROR ) { bench->m_ok = 0; }
+		mmap_string_unref(temp);
+	});
+
+	/* PGP with a fixed key */
+	if( bench_wanted(bench, "pgp_") )
+	{
+		mrkey_t*     public_key = mrkey_new();
+		mrkey_t*     private_key = mrkey_new();
+		mrkeyring_t* public_keys = mrkeyring_new();
+		mrkeyring_t* private_keys = mrkeyring_new();
+		void*        ctext = NULL, *plain = NULL;
+		size_t       ctext_bytes = 0, plain_bytes = 0;
+		int          validation_errors = 0;
+
+		if( !mrkey_set_from_base64(private_key, s_bench_private_key, MR_PRIVATE)
+		 || !mrpgp_split_key(mailbox, private_key, public_key) ) {
+			bench->m_ok = 0;
+		}
+		else {
+			mrkeyring_add(public_keys, public_key);
+			mrkeyring_add(private_keys, private_key);
+
+			BENCH_LOOP(bench, "pgp_encrypt_sign", text_bytes, {
+				free(ctext);
+				ctext = NULL;
+				if( !mrpgp_pk_encrypt(mailbox, text, text_bytes, public_keys, private_key, 1, &ctext, &ctext_bytes) ) { bench->m_ok = 0; break; }
+			});
+
+			BENCH_LOOP(bench, "pgp_decrypt_validate", text_bytes, {
+				free(plain);
+				plain = NULL;
+				if( !mrpgp_pk_decrypt(mailbox, ctext, ctext_bytes, private_keys, public_key, 1, &plain, &plain_bytes, &validation_errors)
+				 || plain_bytes != text_bytes || validation_errors ) { bench->m_ok = 0; break; }
+			});
+		}
+
+		free(ctext);
+		free(plain);
+		mrkeyring_unref(public_keys);
+		mrkeyring_unref(private_keys);
+		mrkey_unref(public_key);
+		mrkey_unref(private_key);
+	}
+
+	free(binary);
+	free(base64);
+	free(html);
+	free(msg);
+	free(text);
+}
+
+
+static void bench_macro(bench_t* bench, int msg_cnt)
+{
+	mrmailbox_t*  mailbox = bench->m_mailbox;
+	uint32_t      chat_id = 0;
+	double        start, seconds;
+	size_t        bytes = 0;
+	int           i;
+
+	/* the contacts are known, so the received messages go to normal chats and not to the deaddrop */
+	mrmailbox_set_config(mailbox, "configured_addr", "bench@localhost");
+	for( i = 0; i < BENCH_CONTACTS; i++ ) {
+		char*    addr = mr_mprintf("contact%i@bench.localhost", i);
+		uint32_t contact_id = mrmailbox_create_contact(mailbox, NULL, addr);
+		uint32_t id = mrmailbox_create_chat_by_contact_id(mailbox, contact_id);
+		chat_id = chat_id? chat_id : id;
+		free(addr);
+	}
+
+	/* receiving, this also fills the database for the following benchmarks */
+	start = bench_now();
+	for( i = 0; i < msg_cnt; i++ ) {
+		char* text = bench_create_text(30 + i%100, i);
+		char* msg = bench_create_msg("bench", i, text);
+		bytes += strlen(msg);
+		mrmailbox_receive_imf(mailbox, msg, strlen(msg), "INBOX", i+1, 0);
+		free(msg);
+		free(text);
+	}
+	seconds = bench_now() - start;
+	if( bench_wanted(bench, "receive_imf") ) {
+		bench_add_result(bench, "receive_imf", msg_cnt, seconds, msg_cnt? bytes/msg_cnt : 0);
+	}
+
+	BENCH_LOOP(bench, "get_chatlist", 0, {
+		mrchatlist_t* chatlist = mrmailbox_get_chatlist(mailbox, 0, NULL);
+		if( mrchatlist_get_cnt(chatlist) < BENCH_CONTACTS ) { bench->m_ok = 0; }
+		mrchatlist_unref(chatlist);
+	});
+
+	BENCH_LOOP(bench, "get_chatlist_query", 0, {
+		mrchatlist_unref(mrmailbox_get_chatlist(mailbox, 0, "contact1"));
+	});
+
+	BENCH_LOOP(bench, "search_msgs", 0, {
+		mrarray_t* found = mrmailbox_search_msgs(mailbox, 0, "coffee weekend");
+		mrarray_unref(found);
+	});
+
+	BENCH_LOOP(bench, "search_msgs_in_chat", 0, {
+		mrarray_unref(mrmailbox_search_msgs(mailbox, chat_id, "coffee"));
+	});
+
+	BENCH_LOOP(bench, "get_chat_msgs", 0, {
+		mrarray_t* msgs = mrmailbox_get_chat_msgs(mailbox, chat_id, 0, 0);
+		if( msg_cnt >= BENCH_CONTACTS && mrarray_get_cnt(msgs) == 0 ) { bench->m_ok = 0; }
+		mrarray_unref(msgs);
+	});
+}
+
+
+#define BENCH_SYNC_RECEIVE_CNT 200
+#define BENCH_SYNC_SEND_CNT     50
+#define BENCH_SYNC_TIMEOUT      120.0 /* seconds */
+
+
+static int bench_count_msgs(mrmailbox_t* mailbox, const char* rfc724_mid_pattern)
+{
+	sqlite3_stmt* stmt;
+	int           cnt = 0;
+
+	mrsqlite3_lock(mailbox->m_sql);
+		stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT COUNT(*) FROM msgs WHERE rfc724_mid LIKE ?;");
+		if( stmt ) {
+			sqlite3_bind_text(stmt, 1, rfc724_mid_pattern, -1, SQLITE_STATIC);
+			if( sqlite3_step(stmt) == SQLITE_ROW ) {
+				cnt = sqlite3_column_int(stmt, 0);
+			}
+			sqlite3_finalize(stmt);
+		}
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	return cnt;
+}
+
+
+/* the first fetch pass has stored lastseenuid and the watch thread waits in IDLE,
+so new messages are announced by EXISTS while idling and not in the middle of a fetch */
+static int bench_is_idling(mrmailbox_t* mailbox)
+{
+	char* value = mrmailbox_get_config(mailbox, "imap.mailbox.INBOX", NULL);
+	int   ret = value!=NULL && mailbox->m_imap->m_enter_watch_wait_time!=0;
+	free(value);
+	return ret;
+}
+
+
+/* poll `cond` until it is true; sets `ret_ok` to 0 on timeout */
+#define BENCH_WAIT_UNTIL(cond, ret_ok) \
+	{ \
+		double bench_wait_start = bench_now(); \
+		while( !(cond) ) { \
+			if( bench_now()-bench_wait_start > BENCH_SYNC_TIMEOUT ) { (ret_ok) = 0; break; } \
+			usleep(1000); \
+		} \
+	}
+
+
+/* receiving and sending via the stand-in server with the configured latency and bandwidth;
+this includes IDLE, the IMAP fetches and the job loop with the SMTP connection */
+static void bench_sync(bench_t* bench)
+{
+	mrmailbox_t*  mailbox = bench->m_mailbox;
+	standin_t*    standin = NULL;
+	uint32_t      chat_id;
+	double        start;
+	size_t        bytes = 0;
+	int           i, ok = 1;
+	char*         temp;
+
+	if( !bench_wanted(bench, "sync_") ) {
+		return;
+	}
+
+	standin = standin_new(bench->m_latency_ms, bench->m_bytes_per_second);
+	if( !standin_start(standin) ) {
+		mrmailbox_log_error(mailbox, 0, "Cannot start stand-in server.");
+		bench->m_ok = 0;
+		goto cleanup;
+	}
+
+	/* a message already on the server, the first sync only remembers its UID */
+	temp = bench_create_msg("sync", 0, "hello");
+	standin_add_msg(standin, "INBOX", temp, strlen(temp));
+	free(temp);
+
+	/* the fixed key avoids the key generation on the first send */
+	{
+		mrkey_t* public_key = mrkey_new(), *private_key = mrkey_new();
+		if( mrkey_set_from_base64(private_key, s_bench_private_key, MR_PRIVATE) && mrpgp_split_key(mailbox, private_key, public_key) ) {
+			mrsqlite3_lock(mailbox->m_sql);
+				mrkey_save_self_keypair__(public_key, private_key, "bench@localhost", 1, mailbox->m_sql);
+			mrsqlite3_unlock(mailbox->m_sql);
+		}
+		mrkey_unref(public_key);
+		mrkey_unref(private_key);
+	}
+
+	mrmailbox_set_config    (mailbox, "configured_addr",         "bench@localhost");
+	mrmailbox_set_config    (mailbox, "configured_mail_server",  "127.0.0.1");
+	mrmailbox_set_config_int(mailbox, "configured_mail_port",    standin_get_imap_port(standin));
+	mrmailbox_set_config    (mailbox, "configured_mail_user",    "bench@localhost");
+	mrmailbox_set_config    (mailbox, "configured_mail_pw",      "bench");
+	mrmailbox_set_config    (mailbox, "configured_send_server",  "127.0.0.1");
+	mrmailbox_set_config_int(mailbox, "configured_send_port",    standin_get_smtp_port(standin));
+	mrmailbox_set_config    (mailbox, "configured_send_user",    "bench@localhost");
+	mrmailbox_set_config    (mailbox, "configured_send_pw",      "bench");
+	mrmailbox_set_config_int(mailbox, "configured_server_flags", MR_AUTH_NORMAL|MR_IMAP_SOCKET_PLAIN|MR_SMTP_SOCKET_PLAIN);
+	mrmailbox_set_config_int(mailbox, "configured",              1);
+
+	mrmailbox_connect(mailbox);
+	BENCH_WAIT_UNTIL(bench_is_idling(mailbox), ok)
+	if( !ok ) {
+		mrmailbox_log_error(mailbox, 0, "Cannot sync with the stand-in server.");
+		bench->m_ok = 0;
+		goto cleanup;
+	}
+
+	/* receiving: the messages arrive while the client idles, mrimap_fetch() is called as on a push notification */
+	start = bench_now();
+	for( i = 1; i <= BENCH_SYNC_RECEIVE_CNT; i++ ) {
+		char* text = bench_create_text(30 + i%100, i);
+		char* msg = bench_create_msg("sync", i, text);
+		bytes += strlen(msg);
+		standin_add_msg(standin, "INBOX", msg, strlen(msg));
+		free(msg);
+		free(text);
+	}
+	mrimap_fetch(mailbox->m_imap);
+	BENCH_WAIT_UNTIL(bench_count_msgs(mailbox, "sync-%") >= BENCH_SYNC_RECEIVE_CNT, ok)
+	if( !ok ) {
+		mrmailbox_log_error(mailbox, 0, "Timeout while receiving from the stand-in server.");
+		bench->m_ok = 0;
+		goto cleanup;
+	}
+	bench_add_result(bench, "sync_receive", BENCH_SYNC_RECEIVE_CNT, bench_now()-start, bytes/BENCH_SYNC_RECEIVE_CNT);
+
+	/* sending: the job loop connects to SMTP and sends the messages one after another */
+	temp = mr_mprintf("contact%i@bench.localhost", 0);
+	chat_id = mrmailbox_create_chat_by_contact_id(mailbox, mrmailbox_create_contact(mailbox, NULL, temp));
+	free(temp);
+
+	start = bench_now();
+	for( i = 0; i < BENCH_SYNC_SEND_CNT; i++ ) {
+		mrmailbox_send_text_msg(mailbox, chat_id, "hello from the benchmark");
+	}
+	BENCH_WAIT_UNTIL(standin_get_sent_cnt(standin) >= BENCH_SYNC_SEND_CNT, ok)
+	if( !ok ) {
+		mrmailbox_log_error(mailbox, 0, "Timeout while sending to the stand-in server.");
+		bench->m_ok = 0;
+		goto cleanup;
+	}
+	bench_add_result(bench, "sync_send", BENCH_SYNC_SEND_CNT, bench_now()-start, 0);
+
+cleanup:
+	mrmailbox_disconnect(mailbox);
+	standin_unref(standin);
+}
+
+
+char* bench_json(mrmailbox_t* mailbox, const char* filter, int msg_cnt, int latency_ms, int bytes_per_second)
+{
+	bench_t bench;
+	char*   version = mrmailbox_get_version_str();
+
+	memset(&bench, 0, sizeof(bench_t));
+	bench.m_mailbox = mailbox;
+	bench.m_filter  = filter;
+	bench.m_latency_ms       = latency_ms;
+	bench.m_bytes_per_second = bytes_per_second;
+	bench.m_ok      = 1;
+	mrstrbuilder_init(&bench.m_json, 0);
+
+	mrstrbuilder_catf(&bench.m_json, "{\"version\":\"%s\",\"min_seconds\":%.2f,\"messages\":%i,\"latency_ms\":%i,\"bytes_per_second\":%i,\"benchmarks\":[",
+		version, BENCH_MIN_SECONDS, msg_cnt, latency_ms, bytes_per_second);
+
+	bench_micro(&bench);
+	bench_macro(&bench, msg_cnt);
+	bench_sync(&bench);
+
+	mrstrbuilder_catf(&bench.m_json, "\n],\"ok\":%s}\n", bench.m_ok? "true" : "false");
+
+	free(version);
+	return bench.m_json.m_buf;
+}
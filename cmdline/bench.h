@@ -0,0 +1,39 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Microbenchmarks for some hot paths; the functions return a report that must be free()'d */
+char* bench_base64(mrmailbox_t*);
+char* bench_crypto(mrmailbox_t*);
+char* bench_json  (mrmailbox_t*, const char* filter, int msg_cnt, int latency_ms, int bytes_per_second); /* the mailbox must be opened on an empty database; latency and bandwidth are used by the stand-in server */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __BENCH_H__ */
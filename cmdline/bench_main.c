@@ -0,0 +1,149 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+/* The `bench` executable runs the benchmarks of bench_json() on a temporary
+database and prints the results as JSON, usage:
+
+    bench [--filter <name>] [--messages <count>] [--latency <ms>]
+          [--bandwidth <bytes/s>] [--out <file>] [--keep]
+
+--filter runs only the benchmarks containing the given string, --messages
+is the number of generated messages for the macrobenchmarks (default 2000),
+--latency and --bandwidth configure the stand-in server used by the sync_
+benchmarks (default 20 ms, unlimited), --out writes the results to a file
+instead of stdout and --keep does not delete the temporary database. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/mrmailbox_internal.h"
+#include "bench.h"
+
+
+static int s_verbose = 0;
+
+
+static uintptr_t receive_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	switch( event )
+	{
+		case MR_EVENT_GET_STRING:
+		case MR_EVENT_GET_QUANTITY_STRING:
+		case MR_EVENT_IS_OFFLINE:
+		case MR_EVENT_HTTP_GET:
+			return 0;
+
+		case MR_EVENT_ERROR:
+		case MR_EVENT_WARNING:
+			fprintf(stderr, "%s\n", (char*)data2);
+			break;
+
+		case MR_EVENT_INFO:
+			if( s_verbose ) {
+				fprintf(stderr, "%s\n", (char*)data2);
+			}
+			break;
+	}
+	return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+	mrmailbox_t* mailbox = mrmailbox_new(receive_event, NULL, "Bench");
+	const char*  filter = NULL, *out = NULL;
+	int          msg_cnt = 2000, latency_ms = 20, bytes_per_second = 0, keep = 0, i, exitcode = 1;
+	char         dir[] = "/tmp/deltachat-bench-XXXXXX";
+	char*        dbfile = NULL, *blobdir = NULL, *json = NULL;
+
+	for( i = 1; i < argc; i++ ) {
+		if( strcmp(argv[i], "--filter")==0 && i+1 < argc ) {
+			filter = argv[++i];
+		}
+		else if( strcmp(argv[i], "--messages")==0 && i+1 < argc ) {
+			msg_cnt = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--latency")==0 && i+1 < argc ) {
+			latency_ms = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--bandwidth")==0 && i+1 < argc ) {
+			bytes_per_second = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--out")==0 && i+1 < argc ) {
+			out = argv[++i];
+		}
+		else if( strcmp(argv[i], "--keep")==0 ) {
+			keep = 1;
+		}
+		else if( strcmp(argv[i], "--verbose")==0 ) {
+			s_verbose = 1;
+		}
+		else {
+			fprintf(stderr, "usage: %s [--filter <name>] [--messages <count>] [--latency <ms>] [--bandwidth <bytes/s>] [--out <file>] [--keep] [--verbose]\n", argv[0]);
+			goto cleanup;
+		}
+	}
+
+	if( mkdtemp(dir) == NULL ) {
+		fprintf(stderr, "ERROR: Cannot create temporary directory.\n");
+		goto cleanup;
+	}
+	dbfile  = mr_mprintf("%s/bench.db", dir);
+	blobdir = mr_mprintf("%s/blobs", dir);
+	mr_create_folder(blobdir, mailbox);
+
+	if( !mrmailbox_open(mailbox, dbfile, blobdir) ) {
+		fprintf(stderr, "ERROR: Cannot open %s.\n", dbfile);
+		goto cleanup;
+	}
+
+	json = bench_json(mailbox, filter, msg_cnt, latency_ms, bytes_per_second);
+
+	if( out ) {
+		if( !mr_write_file(out, json, strlen(json), mailbox) ) {
+			goto cleanup;
+		}
+	}
+	else {
+		fputs(json, stdout);
+	}
+
+	exitcode = strstr(json, "\"ok\":true")? 0 : 2;
+
+cleanup:
+	mrmailbox_close(mailbox);
+	mrmailbox_unref(mailbox);
+	if( dbfile && !keep ) {
+		unlink(dbfile);
+		rmdir(blobdir);
+		rmdir(dir);
+	}
+	else if( dbfile ) {
+		fprintf(stderr, "Database kept at %s\n", dbfile);
+	}
+	free(json);
+	free(dbfile);
+	free(blobdir);
+	return exitcode;
+}
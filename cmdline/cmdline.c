@@ -24,12 +24,12 @@
 your library */
 
 
-#include <dirent.h>
 #include "../src/mrmailbox_internal.h"
 #include "../src/mraheader.h"
 #include "../src/mrapeerstate.h"
 #include "../src/mrkey.h"
 #include "../src/mrpgp.h"
+#include "bench.h"
 
 
 /*
@@ -56,6 +56,7 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 
 		if( bits & 2 ) {
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM acpeerstates;");
+			mrapeerstate_clear_cache__(ths);
 			mrmailbox_log_info(ths, 0, "(2) Peerstates reset.");
 		}
 
@@ -71,6 +72,7 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM msgs WHERE id>" MR_STRINGIFY(MR_MSG_ID_LAST_SPECIAL) ";");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM config WHERE keyname LIKE 'imap.%' OR keyname LIKE 'configured%';");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM leftgrps;");
+			mrmailbox_clear_contact_cache__(ths);
 			mrmailbox_log_info(ths, 0, "(8) Rest but server config reset.");
 		}
 
@@ -103,37 +105,13 @@ static int mrmailbox_cleanup_contacts(mrmailbox_t* ths)
 	mrsqlite3_lock(ths->m_sql);
 
 		mrsqlite3_execute__(ths->m_sql, "DELETE FROM contacts WHERE id>" MR_STRINGIFY(MR_CONTACT_ID_LAST_SPECIAL) " AND blocked=0 AND NOT EXISTS (SELECT contact_id FROM chats_contacts where contacts.id = chats_contacts.contact_id) AND NOT EXISTS (select from_id from msgs WHERE msgs.from_id = contacts.id);");
+		mrmailbox_clear_contact_cache__(ths);
 
 	mrsqlite3_unlock(ths->m_sql);
 
 	return 1;
 }
 
-static int mrmailbox_poke_eml_file(mrmailbox_t* ths, const char* filename)
-{
-	/* mainly for testing, may be called by mrmailbox_import_spec() */
-	int     success = 0;
-	char*   data = NULL;
-	size_t  data_bytes;
-
-	if( ths == NULL || ths->m_magic != MR_MAILBOX_MAGIC ) {
-		return 0;
-	}
-
-	if( mr_read_file(filename, (void**)&data, &data_bytes, ths) == 0 ) {
-		goto cleanup;
-	}
-
-	mrmailbox_receive_imf(ths, data, data_bytes, "import", 0, 0); /* this static function is the reason why this function is not moved to mrmailbox_imex.c */
-	success = 1;
-
-cleanup:
-	free(data);
-
-	return success;
-}
-
-
 static int poke_public_key(mrmailbox_t* mailbox, const char* addr, const char* public_key_file)
 {
 	/* mainly for testing: if the partner does not support Autocrypt,
@@ -196,10 +174,6 @@ static int poke_spec(mrmailbox_t* mailbox, const char* spec)
 	int            success = 0;
 	char*          real_spec = NULL;
 	char*          suffix = NULL;
-	DIR*           dir = NULL;
-	struct dirent* dir_entry;
-	int            read_cnt = 0;
-	char*          name;
 
 	if( mailbox == NULL ) {
 		return 0;
@@ -229,13 +203,7 @@ static int poke_spec(mrmailbox_t* mailbox, const char* spec)
 	}
 
 	suffix = mr_get_filesuffix_lc(real_spec);
-	if( suffix && strcmp(suffix, "eml")==0 ) {
-		/* import a single file */
-		if( mrmailbox_poke_eml_file(mailbox, real_spec) ) { /* errors are logged in any case */
-			read_cnt++;
-		}
-	}
-	else if( suffix && (strcmp(suffix, "pem")==0||strcmp(suffix, "asc")==0) ) {
+	if( suffix && (strcmp(suffix, "pem")==0||strcmp(suffix, "asc")==0) ) {
 		/* import a publix key */
 		char* separator = strchr(real_spec, ' ');
 		if( separator==NULL ) {
@@ -244,39 +212,22 @@ static int poke_spec(mrmailbox_t* mailbox, const char* spec)
 		}
 		*separator = 0;
 		if( poke_public_key(mailbox, real_spec, separator+1) ) {
-			read_cnt++;
+			mrmailbox_log_info(mailbox, 0, "Import: Key for \"%s\" read from \"%s\".", real_spec, separator+1);
+			mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 		}
 		*separator = ' ';
 	}
 	else {
-		/* import a directory */
-		if( (dir=opendir(real_spec))==NULL ) {
-			mrmailbox_log_error(mailbox, 0, "Import: Cannot open directory \"%s\".", real_spec);
+		/* import a single .eml file, a directory with .eml files, a maildir or an mbox file;
+		the mails are parsed in parallel and written in large transactions, MR_EVENT_MSGS_CHANGED is sent by mrmailbox_imex() */
+		if( !mrmailbox_imex(mailbox, MR_IMEX_IMPORT_MAILS, real_spec, NULL) ) {
 			goto cleanup;
 		}
-
-		while( (dir_entry=readdir(dir))!=NULL ) {
-			name = dir_entry->d_name; /* name without path; may also be `.` or `..` */
-			if( strlen(name)>=4 && strcmp(&name[strlen(name)-4], ".eml")==0 ) {
-				char* path_plus_name = mr_mprintf("%s/%s", real_spec, name);
-				mrmailbox_log_info(mailbox, 0, "Import: %s", path_plus_name);
-				if( mrmailbox_poke_eml_file(mailbox, path_plus_name) ) { /* no abort on single errors errors are logged in any case */
-					read_cnt++;
-				}
-				free(path_plus_name);
-            }
-		}
-	}
-
-	mrmailbox_log_info(mailbox, 0, "Import: %i items read from \"%s\".", read_cnt, real_spec);
-	if( read_cnt > 0 ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0); /* even if read_cnt>0, the number of messages added to the database may be 0. While we regard this issue using IMAP, we ignore it here. */
 	}
 
 	success = 1;
 
 cleanup:
-	if( dir ) { closedir(dir); }
 	free(real_spec);
 	free(suffix);
 	return success;
@@ -428,7 +379,7 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 				"export-keys\n"
 				"import-keys\n"
 				"export-setup\n"
-				"poke [<eml-file>|<folder>|<addr> <key-file>]\n"
+				"poke [<eml-file>|<folder>|<maildir>|<mbox-file>|<addr> <key-file>]\n"
 				"reset <flags>\n"
 				"============================================="
 			);
@@ -438,6 +389,9 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			ret = safe_strdup(
 				"==========================Database commands==\n"
 				"info\n"
+				"metrics\n"
+				"locks [<n>]\n"
+				"trace <file>|off\n"
 				"open <file to open or create>\n"
 				"close\n"
 				"set <configuration-key> [<value>]\n"
@@ -488,6 +442,7 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 				"event <event-id to test>\n"
 				"fileinfo <file>\n"
 				"heartbeat\n"
+				"bench base64|crypto\n"
 				"clear -- clear screen\n" /* must be implemented by  the caller */
 				"exit\n" /* must be implemented by  the caller */
 				"============================================="
@@ -686,6 +641,33 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			ret = COMMAND_FAILED;
 		}
 	}
+	else if( strcmp(cmd, "metrics")==0 )
+	{
+		ret = mrmailbox_get_metrics(mailbox);
+		if( ret == NULL ) {
+			ret = COMMAND_FAILED;
+		}
+	}
+	else if( strcmp(cmd, "locks")==0 )
+	{
+		ret = mrmailbox_get_lock_report(mailbox, arg1? atoi(arg1) : 0);
+		if( ret == NULL ) {
+			ret = COMMAND_FAILED;
+		}
+	}
+	else if( strcmp(cmd, "trace")==0 )
+	{
+		if( arg1 && strcmp(arg1, "off")==0 ) {
+			mrmailbox_stop_trace(mailbox);
+			ret = COMMAND_SUCCEEDED;
+		}
+		else if( arg1 ) {
+			ret = mrmailbox_start_trace(mailbox, arg1)? COMMAND_SUCCEEDED : COMMAND_FAILED;
+		}
+		else {
+			ret = safe_strdup("ERROR: Argument <file> or \"off\" missing.");
+		}
+	}
 
 	/*******************************************************************************
 	 * Chat commands
@@ -1210,6 +1192,18 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			ret = safe_strdup("ERROR: Argument <file> missing.");
 		}
 	}
+	else if( strcmp(cmd, "bench")==0 )
+	{
+		if( arg1 && strcmp(arg1, "base64")==0 ) {
+			ret = bench_base64(mailbox);
+		}
+		else if( arg1 && strcmp(arg1, "crypto")==0 ) {
+			ret = bench_crypto(mailbox);
+		}
+		else {
+			ret = safe_strdup("ERROR: Argument <benchmark> missing or unknown, use one of: base64, crypto");
+		}
+	}
 	else if( strcmp(cmd, "heartbeat")==0 )
 	{
 		mrmailbox_heartbeat(mailbox);
@@ -0,0 +1,624 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+/* Synthetic mailboxes for load tests.  gen_mailbox() creates contacts, 1:1 and
+group chats and a stream of messages between them and renders every message
+using mrmimefactory_t exactly as it would be sent.  The messages are written as
+.eml files and/or given to mrmailbox_receive_imf() of a target mailbox, so the
+target ends up with a fully populated database and blob directory.
+
+The messages are rendered by a scratch mailbox that impersonates the sender of
+each message: its configured address is changed before each message and it
+holds the keypairs of all senders and the peerstates of all recipients.  The
+keypairs are taken from a small pool, generating one key per contact would
+take hours for larger mailboxes.
+
+All choices are taken from a pseudo random generator initialized by the seed,
+so the same seed and the same key file result in the same contacts, chats,
+members, senders, texts, attachments, timestamps, Message-IDs and group IDs.
+MIME boundaries, the References: of new threads and the PGP packets contain
+time-dependent or random data and differ between runs. */
+
+
+#include "../src/mrmailbox_internal.h"
+#include "../src/mrapeerstate.h"
+#include "../src/mrkey.h"
+#include "../src/mrpgp.h"
+#include "../src/mrmimefactory.h"
+#include "gen.h"
+
+
+typedef struct gen_contact_t
+{
+	char*    m_addr;
+	char*    m_name;
+	int      m_key;                   /* index into the key pool, -1 for contacts not using Autocrypt */
+	uint32_t m_scratch_contact_id;
+} gen_contact_t;
+
+
+typedef struct gen_chat_t
+{
+	uint32_t m_scratch_chat_id;
+	char*    m_grpid;                 /* NULL for 1:1 chats */
+	int*     m_members;               /* indices into m_contacts, the first member is always the target (index 0) */
+	int      m_member_cnt;
+} gen_chat_t;
+
+
+typedef struct gen_t
+{
+	mrmailbox_t*       m_scratch;
+	mrmailbox_t*       m_target;
+	const gen_param_t* m_param;
+	uint64_t           m_rand;
+
+	mrkey_t**          m_public_keys;
+	mrkey_t**          m_private_keys;
+	int                m_key_cnt;
+
+	gen_contact_t*     m_contacts;    /* the first contact is the owner of the target mailbox */
+	int                m_contact_cnt;
+
+	gen_chat_t*        m_chats;
+	int                m_chat_cnt;
+} gen_t;
+
+
+#define GEN_SELF_ADDR    "me@example.org"
+#define GEN_SELF_NAME    "Me"
+#define GEN_SCRATCH_ADDR "gen@localhost"
+
+
+void gen_param_defaults(gen_param_t* param)
+{
+	memset(param, 0, sizeof(gen_param_t));
+	param->m_seed               = 1;
+	param->m_contact_cnt        = 200;
+	param->m_group_cnt          = 50;
+	param->m_msg_cnt            = 10000;
+	param->m_autocrypt_percent  = 50;
+	param->m_attachment_percent = 5;
+	param->m_key_cnt            = 4;
+	param->m_start_timestamp    = 1500000000; /* July 2017 */
+}
+
+
+/*******************************************************************************
+ * Random numbers
+ ******************************************************************************/
+
+
+static uint32_t gen_rand(gen_t* gen)
+{
+	/* xorshift64*, good enough for test data and the same on all platforms */
+	gen->m_rand ^= gen->m_rand >> 12;
+	gen->m_rand ^= gen->m_rand << 25;
+	gen->m_rand ^= gen->m_rand >> 27;
+	return (uint32_t)((gen->m_rand * 2685821657736338717ULL) >> 32);
+}
+
+
+static int gen_rand_below(gen_t* gen, int max)
+{
+	return max > 0? (int)(gen_rand(gen) % (uint32_t)max) : 0;
+}
+
+
+static int gen_rand_skewed(gen_t* gen, int max, int skew)
+{
+	/* returns values below max, small values are more likely the larger skew is; this results in
+	some large groups and many small ones and in some long threads and many short ones */
+	double r = (double)gen_rand(gen) / 4294967296.0, f = 1.0;
+	int    ret;
+
+	while( skew-- > 0 ) {
+		f *= r;
+	}
+
+	ret = (int)(f * max);
+	return ret < max? ret : (max > 0? max-1 : 0);
+}
+
+
+static char* gen_create_id(gen_t* gen)
+{
+	/* same length and characters as mr_create_id() */
+	static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	char* ret = malloc(12);
+	int   i;
+
+	if( ret == NULL ) {
+		exit(66);
+	}
+
+	for( i = 0; i < 11; i++ ) {
+		ret[i] = chars[gen_rand(gen) & 63];
+	}
+	ret[11] = 0;
+	return ret;
+}
+
+
+static char* gen_create_text(gen_t* gen)
+{
+	static const char* s_words[] = { "hello", "delta", "chat", "message", "tomorrow", "meeting", "the", "a", "is", "we",
+		"coffee", "project", "weekend", "photo", "see", "you", "later", "thanks", "great", "idea", "train", "late",
+		"dinner", "tonight", "maybe", "sure", "call", "me", "when", "home", "office", "holiday", "ticket", "and", "or" };
+	mrstrbuilder_t ret;
+	int            words = 1 + gen_rand_skewed(gen, 150, 3), i;
+
+	mrstrbuilder_init(&ret, 0);
+	for( i = 0; i < words; i++ ) {
+		mrstrbuilder_cat(&ret, s_words[gen_rand_below(gen, sizeof(s_words)/sizeof(s_words[0]))]);
+		mrstrbuilder_cat(&ret, i==words-1? "" : (i%12==11? ".\n" : " "));
+	}
+	return ret.m_buf;
+}
+
+
+/*******************************************************************************
+ * Keys, contacts and chats
+ ******************************************************************************/
+
+
+static int gen_load_keys(gen_t* gen)
+{
+	/* the key file contains one base64-encoded private key per line; missing keys are generated and the file is rewritten */
+	char*          buf = NULL, *line, *next;
+	size_t         buf_bytes = 0;
+	int            success = 0, loaded = 0;
+	mrstrbuilder_t out;
+
+	mrstrbuilder_init(&out, 0);
+
+	gen->m_key_cnt      = gen->m_param->m_key_cnt > 0? gen->m_param->m_key_cnt : 1;
+	gen->m_public_keys  = calloc(gen->m_key_cnt, sizeof(mrkey_t*));
+	gen->m_private_keys = calloc(gen->m_key_cnt, sizeof(mrkey_t*));
+	if( gen->m_public_keys == NULL || gen->m_private_keys == NULL ) {
+		exit(67);
+	}
+
+	if( gen->m_param->m_keys_file && mr_file_exist(gen->m_param->m_keys_file)
+	 && mr_read_file(gen->m_param->m_keys_file, (void**)&buf, &buf_bytes, gen->m_scratch) ) {
+		for( line = buf; line && loaded < gen->m_key_cnt; line = next ) {
+			if( (next=strchr(line, '\n')) != NULL ) { *next = 0; next++; }
+			mr_trim(line);
+			if( line[0] ) {
+				gen->m_private_keys[loaded] = mrkey_new();
+				gen->m_public_keys[loaded]  = mrkey_new();
+				if( !mrkey_set_from_base64(gen->m_private_keys[loaded], line, MR_PRIVATE)
+				 || !mrpgp_split_key(gen->m_scratch, gen->m_private_keys[loaded], gen->m_public_keys[loaded]) ) {
+					mrmailbox_log_error(gen->m_scratch, 0, "Bad key in %s.", gen->m_param->m_keys_file);
+					goto cleanup;
+				}
+				loaded++;
+			}
+		}
+	}
+
+	for( int i = 0; i < gen->m_key_cnt; i++ ) {
+		if( i >= loaded ) {
+			char* addr = mr_mprintf("key%i@example.org", i);
+			mrmailbox_log_info(gen->m_scratch, 0, "Generating key %i of %i...", i+1, gen->m_key_cnt);
+			gen->m_private_keys[i] = mrkey_new();
+			gen->m_public_keys[i]  = mrkey_new();
+			if( !mrpgp_create_keypair(gen->m_scratch, addr, gen->m_public_keys[i], gen->m_private_keys[i]) ) {
+				free(addr);
+				goto cleanup;
+			}
+			free(addr);
+		}
+
+		char* base64 = mrkey_render_base64(gen->m_private_keys[i], 0, NULL, 0);
+		mrstrbuilder_cat(&out, base64);
+		mrstrbuilder_cat(&out, "\n");
+		free(base64);
+	}
+
+	if( gen->m_param->m_keys_file && loaded < gen->m_key_cnt ) {
+		if( !mr_write_file(gen->m_param->m_keys_file, out.m_buf, strlen(out.m_buf), gen->m_scratch) ) {
+			goto cleanup;
+		}
+	}
+
+	success = 1;
+
+cleanup:
+	free(out.m_buf);
+	free(buf);
+	return success;
+}
+
+
+static void gen_create_contacts(gen_t* gen)
+{
+	static const char* s_first[] = { "Alice", "Bob", "Carol", "Dave", "Eve", "Frank", "Grace", "Heidi", "Ivan", "Judy",
+		"Mallory", "Niaj", "Olivia", "Peggy", "Rupert", "Sybil", "Trent", "Victor", "Walter", "Zoe" };
+	static const char* s_last[] = { "Smith", "Jones", "Miller", "Garcia", "Nguyen", "Schmidt", "Rossi", "Dubois",
+		"Kowalski", "Tanaka", "Silva", "Larsen" };
+	static const char* s_domains[] = { "example.org", "example.net", "example.com", "mail.example" };
+	int i;
+
+	gen->m_contact_cnt = 1 + (gen->m_param->m_contact_cnt > 0? gen->m_param->m_contact_cnt : 1);
+	if( (gen->m_contacts=calloc(gen->m_contact_cnt, sizeof(gen_contact_t)))==NULL ) {
+		exit(68);
+	}
+
+	gen->m_contacts[0].m_addr = safe_strdup(GEN_SELF_ADDR);
+	gen->m_contacts[0].m_name = safe_strdup(GEN_SELF_NAME);
+	gen->m_contacts[0].m_key  = 0;
+
+	for( i = 1; i < gen->m_contact_cnt; i++ ) {
+		const char* first = s_first[gen_rand_below(gen, sizeof(s_first)/sizeof(s_first[0]))];
+		const char* last = s_last[gen_rand_below(gen, sizeof(s_last)/sizeof(s_last[0]))];
+		gen_contact_t* contact = &gen->m_contacts[i];
+		contact->m_name = mr_mprintf("%s %s", first, last);
+		contact->m_addr = mr_mprintf("%s.%s.%i@%s", first, last, i, s_domains[gen_rand_below(gen, sizeof(s_domains)/sizeof(s_domains[0]))]);
+		mr_strlower_in_place(contact->m_addr);
+		contact->m_key = -1;
+		if( gen_rand_below(gen, 100) < gen->m_param->m_autocrypt_percent ) {
+			/* the first key is used by the target only, if possible */
+			contact->m_key = gen->m_key_cnt > 1? 1 + gen_rand_below(gen, gen->m_key_cnt-1) : 0;
+		}
+		contact->m_scratch_contact_id = mrmailbox_create_contact(gen->m_scratch, contact->m_name, contact->m_addr);
+	}
+}
+
+
+static int gen_add_keys__(gen_t* gen, mrsqlite3_t* sql)
+{
+	/* the scratch mailbox needs the keypairs of all Autocrypt-senders and the peerstates of all Autocrypt-recipients */
+	int i;
+
+	for( i = 0; i < gen->m_contact_cnt; i++ ) {
+		gen_contact_t* contact = &gen->m_contacts[i];
+		if( contact->m_key >= 0 ) {
+			mrapeerstate_t* peerstate = mrapeerstate_new(gen->m_scratch);
+			peerstate->m_addr                = safe_strdup(contact->m_addr);
+			peerstate->m_last_seen           = gen->m_param->m_start_timestamp;
+			peerstate->m_last_seen_autocrypt = gen->m_param->m_start_timestamp;
+			peerstate->m_prefer_encrypt      = MRA_PE_MUTUAL;
+			peerstate->m_public_key          = mrkey_ref(gen->m_public_keys[contact->m_key]);
+			mrapeerstate_recalc_fingerprint(peerstate);
+			if( !mrapeerstate_save_to_db__(peerstate, sql, 1)
+			 || !mrkey_save_self_keypair__(gen->m_public_keys[contact->m_key], gen->m_private_keys[contact->m_key], contact->m_addr, 1, sql) ) {
+				mrapeerstate_unref(peerstate);
+				return 0;
+			}
+			mrapeerstate_unref(peerstate);
+		}
+	}
+
+	return 1;
+}
+
+
+static void gen_create_chats(gen_t* gen)
+{
+	/* one 1:1 chat per contact and the groups; the group sizes are skewed, there are many small groups and only some large ones */
+	int group_cnt = gen->m_param->m_group_cnt > 0? gen->m_param->m_group_cnt : 0, i, j;
+	int max_members = gen->m_contact_cnt < 200? gen->m_contact_cnt : 200;
+
+	gen->m_chat_cnt = (gen->m_contact_cnt-1) + group_cnt;
+	if( (gen->m_chats=calloc(gen->m_chat_cnt, sizeof(gen_chat_t)))==NULL ) {
+		exit(69);
+	}
+
+	for( i = 0; i < gen->m_chat_cnt; i++ ) {
+		gen_chat_t* chat = &gen->m_chats[i];
+		if( i < group_cnt ) {
+			chat->m_member_cnt = 3 + gen_rand_skewed(gen, max_members-2, 3);
+			if( chat->m_member_cnt > gen->m_contact_cnt ) {
+				chat->m_member_cnt = gen->m_contact_cnt;
+			}
+		}
+		else {
+			chat->m_member_cnt = 2;
+		}
+
+		if( (chat->m_members=calloc(chat->m_member_cnt, sizeof(int)))==NULL ) {
+			exit(70);
+		}
+
+		if( i < group_cnt ) {
+			char* name = mr_mprintf("Group %i", i+1);
+			chat->m_members[0] = 0;
+			for( j = 1; j < chat->m_member_cnt; j++ ) {
+				int k, member;
+				do {
+					member = 1 + gen_rand_below(gen, gen->m_contact_cnt-1);
+					for( k = 0; k < j && chat->m_members[k] != member; k++ ) { ; }
+				} while( k < j );
+				chat->m_members[j] = member;
+			}
+			chat->m_grpid = gen_create_id(gen);
+			chat->m_scratch_chat_id = mrmailbox_create_group_chat(gen->m_scratch, name);
+			free(name);
+
+			mrsqlite3_lock(gen->m_scratch->m_sql);
+				sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(gen->m_scratch->m_sql, "UPDATE chats SET grpid=? WHERE id=?;");
+				sqlite3_bind_text(stmt, 1, chat->m_grpid, -1, SQLITE_STATIC);
+				sqlite3_bind_int (stmt, 2, chat->m_scratch_chat_id);
+				sqlite3_step(stmt);
+				sqlite3_finalize(stmt);
+			mrsqlite3_unlock(gen->m_scratch->m_sql);
+		}
+		else {
+			chat->m_members[0] = 0;
+			chat->m_members[1] = 1 + (i-group_cnt);
+			chat->m_scratch_chat_id = mrmailbox_create_chat_by_contact_id(gen->m_scratch, gen->m_contacts[chat->m_members[1]].m_scratch_contact_id);
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * Messages
+ ******************************************************************************/
+
+
+static uint32_t gen_insert_msg__(gen_t* gen, gen_chat_t* chat, int from, time_t timestamp, int type, const char* text, const char* file)
+{
+	/* the message is added to the scratch mailbox in the same way mrmailbox_send_msg() does it, but no job is added */
+	const gen_contact_t* sender = &gen->m_contacts[from];
+	mrsqlite3_t*         sql = gen->m_scratch->m_sql;
+	mrparam_t*           param = mrparam_new();
+	char*                rfc724_mid = NULL, *rand1 = gen_create_id(gen), *rand2 = NULL;
+	uint32_t             msg_id = 0;
+	sqlite3_stmt*        stmt;
+
+	if( chat->m_grpid ) {
+		rfc724_mid = mr_mprintf("Gr.%s.%s%s", chat->m_grpid, rand1, strchr(sender->m_addr, '@'));
+	}
+	else {
+		rand2 = gen_create_id(gen);
+		rfc724_mid = mr_mprintf("Mr.%s.%s%s", rand1, rand2, strchr(sender->m_addr, '@'));
+	}
+
+	if( sender->m_key < 0 ) {
+		mrparam_set_int(param, MRP_FORCE_UNENCRYPTED, 2); /* no Autocrypt header */
+	}
+
+	if( file ) {
+		mrparam_set(param, MRP_FILE, file);
+		mrparam_set(param, MRP_MIMETYPE, "application/octet-stream");
+	}
+
+	mrsqlite3_set_config__(sql, "configured_addr", sender->m_addr);
+	mrsqlite3_set_config__(sql, "displayname", sender->m_name);
+
+	stmt = mrsqlite3_prepare_v2_(sql,
+		"INSERT INTO msgs (rfc724_mid,chat_id,from_id,to_id, timestamp,type,state, txt,param,hidden) VALUES (?,?,?,?, ?,?,?, ?,?,0);");
+	sqlite3_bind_text (stmt,  1, rfc724_mid, -1, SQLITE_STATIC);
+	sqlite3_bind_int  (stmt,  2, chat->m_scratch_chat_id);
+	sqlite3_bind_int  (stmt,  3, MR_CONTACT_ID_SELF);
+	sqlite3_bind_int  (stmt,  4, chat->m_grpid? 0 : gen->m_contacts[chat->m_members[1]].m_scratch_contact_id);
+	sqlite3_bind_int64(stmt,  5, timestamp);
+	sqlite3_bind_int  (stmt,  6, type);
+	sqlite3_bind_int  (stmt,  7, MR_STATE_OUT_PENDING);
+	sqlite3_bind_text (stmt,  8, text, -1, SQLITE_STATIC);
+	sqlite3_bind_text (stmt,  9, param->m_packed, -1, SQLITE_STATIC);
+	if( sqlite3_step(stmt) == SQLITE_DONE ) {
+		msg_id = sqlite3_last_insert_rowid(sql->m_cobj);
+	}
+	sqlite3_finalize(stmt);
+
+	mrparam_unref(param);
+	free(rfc724_mid);
+	free(rand1);
+	free(rand2);
+	return msg_id;
+}
+
+
+static char* gen_create_file(gen_t* gen, int index)
+{
+	/* attachments between 1 KB and 1 MB, most of them small */
+	size_t   bytes = 1024 + gen_rand_skewed(gen, 1024*1024, 4), i;
+	uint8_t* buf = malloc(bytes);
+	char*    file = mr_mprintf("%s/document-%i.bin", gen->m_scratch->m_blobdir, index);
+
+	if( buf == NULL ) {
+		exit(71);
+	}
+
+	for( i = 0; i < bytes; i++ ) {
+		buf[i] = (uint8_t)gen_rand(gen);
+	}
+
+	if( !mr_write_file(file, buf, bytes, gen->m_scratch) ) {
+		free(file);
+		file = NULL;
+	}
+
+	free(buf);
+	return file;
+}
+
+
+static int gen_msg(gen_t* gen, int index, time_t timestamp, int* ret_encrypted)
+{
+	int             success = 0, from, i;
+	gen_chat_t*     chat = &gen->m_chats[gen_rand_skewed(gen, gen->m_chat_cnt, 2)]; /* some long threads */
+	char*           text = NULL, *file = NULL, *eml = NULL;
+	uint32_t        msg_id;
+	mrmimefactory_t factory;
+
+	mrmimefactory_init(&factory, gen->m_scratch);
+
+	/* about a third of the messages are sent by the owner of the target mailbox */
+	from = gen_rand_below(gen, 3)==0? 0 : chat->m_members[1 + gen_rand_below(gen, chat->m_member_cnt-1)];
+
+	text = gen_create_text(gen);
+	if( gen_rand_below(gen, 100) < gen->m_param->m_attachment_percent ) {
+		file = gen_create_file(gen, index);
+	}
+
+	mrsqlite3_lock(gen->m_scratch->m_sql);
+		msg_id = gen_insert_msg__(gen, chat, from, timestamp, file? MR_MSG_FILE : MR_MSG_TEXT, text, file);
+	mrsqlite3_unlock(gen->m_scratch->m_sql);
+
+	if( msg_id == 0 || !mrmimefactory_load_msg(&factory, msg_id) ) {
+		goto cleanup;
+	}
+
+	/* the recipients are all members but the sender; the scratch mailbox does not know about this */
+	clist_free_content(factory.m_recipients_names);
+	clist_free_content(factory.m_recipients_addr);
+	clist_free(factory.m_recipients_names);
+	clist_free(factory.m_recipients_addr);
+	factory.m_recipients_names = clist_new();
+	factory.m_recipients_addr  = clist_new();
+	for( i = 0; i < chat->m_member_cnt; i++ ) {
+		if( chat->m_members[i] != from ) {
+			clist_append(factory.m_recipients_names, safe_strdup(gen->m_contacts[chat->m_members[i]].m_name));
+			clist_append(factory.m_recipients_addr,  safe_strdup(gen->m_contacts[chat->m_members[i]].m_addr));
+		}
+	}
+
+	if( !mrmimefactory_render(&factory) ) {
+		goto cleanup;
+	}
+
+	if( gen->m_param->m_eml_dir ) {
+		eml = mr_mprintf("%s/%08i.eml", gen->m_param->m_eml_dir, index+1);
+		if( !mr_write_file(eml, factory.m_out->str, factory.m_out->len, gen->m_scratch) ) {
+			goto cleanup;
+		}
+	}
+
+	if( gen->m_target ) {
+		mrmailbox_receive_imf(gen->m_target, factory.m_out->str, factory.m_out->len, "INBOX", index+1, 0);
+	}
+
+	*ret_encrypted = factory.m_out_encrypted;
+	success = 1;
+
+cleanup:
+	mrmimefactory_empty(&factory);
+	if( file ) {
+		mr_delete_file(file, gen->m_scratch);
+	}
+	free(file);
+	free(text);
+	free(eml);
+	return success;
+}
+
+
+/**
+ * Generate a synthetic mailbox.  The messages are written to param->m_eml_dir
+ * and/or received by the target mailbox, which gets the address `me@example.org`
+ * and a keypair from the key pool.  The scratch mailbox is used for rendering
+ * and is not useful afterwards.
+ *
+ * @param scratch Mailbox opened on an empty database.
+ *
+ * @param target Mailbox opened on an empty database, may be NULL.
+ *
+ * @param param Scale and seed, initialize using gen_param_defaults().
+ *
+ * @return 1=success, 0=error.
+ */
+int gen_mailbox(mrmailbox_t* scratch, mrmailbox_t* target, const gen_param_t* param)
+{
+	gen_t  gen;
+	int    success = 0, i, encrypted = 0, encrypted_cnt = 0;
+	time_t timestamp;
+
+	memset(&gen, 0, sizeof(gen_t));
+	gen.m_scratch = scratch;
+	gen.m_target  = target;
+	gen.m_param   = param;
+	gen.m_rand    = ((uint64_t)param->m_seed << 32) ^ 0x9E3779B97F4A7C15ULL;
+
+	if( scratch == NULL || param == NULL ) {
+		goto cleanup;
+	}
+
+	if( param->m_eml_dir && !mr_create_folder(param->m_eml_dir, scratch) ) {
+		goto cleanup;
+	}
+
+	if( !gen_load_keys(&gen) ) {
+		goto cleanup;
+	}
+
+	mrmailbox_set_config(scratch, "configured_addr", GEN_SCRATCH_ADDR);
+	gen_create_contacts(&gen);
+	gen_create_chats(&gen);
+
+	mrsqlite3_lock(scratch->m_sql);
+		if( !gen_add_keys__(&gen, scratch->m_sql) ) {
+			mrsqlite3_unlock(scratch->m_sql);
+			goto cleanup;
+		}
+	mrsqlite3_unlock(scratch->m_sql);
+
+	if( target ) {
+		mrmailbox_set_config    (target, "addr",            GEN_SELF_ADDR);
+		mrmailbox_set_config    (target, "configured_addr", GEN_SELF_ADDR);
+		mrmailbox_set_config    (target, "displayname",     GEN_SELF_NAME);
+		mrmailbox_set_config_int(target, "configured",      1);
+		mrsqlite3_lock(target->m_sql);
+			mrkey_save_self_keypair__(gen.m_public_keys[0], gen.m_private_keys[0], GEN_SELF_ADDR, 1, target->m_sql);
+		mrsqlite3_unlock(target->m_sql);
+	}
+
+	timestamp = param->m_start_timestamp;
+	for( i = 0; i < param->m_msg_cnt; i++ ) {
+		timestamp += 10 + gen_rand_skewed(&gen, 4*60*60, 4);
+		if( !gen_msg(&gen, i, timestamp, &encrypted) ) {
+			mrmailbox_log_error(scratch, 0, "Cannot generate message %i.", i+1);
+			goto cleanup;
+		}
+		encrypted_cnt += encrypted;
+
+		if( (i+1)%1000 == 0 ) {
+			mrmailbox_log_info(scratch, 0, "%i of %i messages generated.", i+1, param->m_msg_cnt);
+		}
+	}
+
+	mrmailbox_log_info(scratch, 0, "%i messages in %i chats with %i contacts generated, %i messages are encrypted.",
+		param->m_msg_cnt, gen.m_chat_cnt, gen.m_contact_cnt-1, encrypted_cnt);
+	success = 1;
+
+cleanup:
+	for( i = 0; i < gen.m_key_cnt; i++ ) {
+		mrkey_unref(gen.m_public_keys? gen.m_public_keys[i] : NULL);
+		mrkey_unref(gen.m_private_keys? gen.m_private_keys[i] : NULL);
+	}
+	free(gen.m_public_keys);
+	free(gen.m_private_keys);
+	for( i = 0; i < gen.m_contact_cnt; i++ ) {
+		free(gen.m_contacts[i].m_addr);
+		free(gen.m_contacts[i].m_name);
+	}
+	free(gen.m_contacts);
+	for( i = 0; i < gen.m_chat_cnt; i++ ) {
+		free(gen.m_chats[i].m_grpid);
+		free(gen.m_chats[i].m_members);
+	}
+	free(gen.m_chats);
+	return success;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+#ifndef __GEN_H__
+#define __GEN_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Synthetic mailboxes for load tests, see gen.c */
+typedef struct gen_param_t
+{
+	uint32_t    m_seed;
+	int         m_contact_cnt;
+	int         m_group_cnt;
+	int         m_msg_cnt;
+	int         m_autocrypt_percent;  /* percentage of the contacts using Autocrypt; messages between them are encrypted */
+	int         m_attachment_percent;
+	int         m_key_cnt;            /* size of the key pool, the keys are shared by the contacts */
+	const char* m_keys_file;          /* may be NULL; keys are read from this file or generated and written to it */
+	const char* m_eml_dir;            /* may be NULL; if set, each message is written to <m_eml_dir>/<number>.eml */
+	time_t      m_start_timestamp;
+} gen_param_t;
+
+void gen_param_defaults(gen_param_t*);
+int  gen_mailbox       (mrmailbox_t* scratch, mrmailbox_t* target, const gen_param_t*); /* target may be NULL, both mailboxes must be opened on empty databases */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __GEN_H__ */
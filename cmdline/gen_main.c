@@ -0,0 +1,182 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+/* The `gen` executable creates a synthetic mailbox for load tests, usage:
+
+    gen [--seed <n>] [--contacts <n>] [--groups <n>] [--messages <n>]
+        [--autocrypt <percent>] [--attachments <percent>] [--keys <file>]
+        [--eml <dir>] [--db <file>] [--verbose]
+
+--eml writes the messages as .eml files to the given directory, --db receives
+them into a new database, the blobs are written to <file>-blobs.  At least
+one of both is needed.  --keys caches the generated keys; with the same seed
+and key file, the output is reproducible, see gen.c.  The defaults are 200
+contacts, 50 groups, 10000 messages, 50% Autocrypt and 5% attachments. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/mrmailbox_internal.h"
+#include "gen.h"
+
+
+static int s_verbose = 0;
+
+
+static uintptr_t receive_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2, int is_scratch)
+{
+	switch( event )
+	{
+		case MR_EVENT_GET_STRING:
+		case MR_EVENT_GET_QUANTITY_STRING:
+		case MR_EVENT_IS_OFFLINE:
+		case MR_EVENT_HTTP_GET:
+			return 0;
+
+		case MR_EVENT_ERROR:
+		case MR_EVENT_WARNING:
+			fprintf(stderr, "%s\n", (char*)data2);
+			break;
+
+		case MR_EVENT_INFO:
+			if( s_verbose || is_scratch ) { /* the scratch mailbox reports the progress */
+				fprintf(stderr, "%s\n", (char*)data2);
+			}
+			break;
+	}
+	return 0;
+}
+
+
+static uintptr_t receive_scratch_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	return receive_event(mailbox, event, data1, data2, 1);
+}
+
+
+static uintptr_t receive_target_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	return receive_event(mailbox, event, data1, data2, 0);
+}
+
+
+int main(int argc, char ** argv)
+{
+	mrmailbox_t* scratch = mrmailbox_new(receive_scratch_event, NULL, "Gen");
+	mrmailbox_t* target = NULL;
+	gen_param_t  param;
+	const char*  db = NULL;
+	int          i, exitcode = 1;
+	char         dir[] = "/tmp/deltachat-gen-XXXXXX";
+	char*        scratch_dbfile = NULL, *scratch_blobdir = NULL, *target_blobdir = NULL;
+
+	gen_param_defaults(&param);
+
+	for( i = 1; i < argc; i++ ) {
+		if( strcmp(argv[i], "--seed")==0 && i+1 < argc ) {
+			param.m_seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if( strcmp(argv[i], "--contacts")==0 && i+1 < argc ) {
+			param.m_contact_cnt = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--groups")==0 && i+1 < argc ) {
+			param.m_group_cnt = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--messages")==0 && i+1 < argc ) {
+			param.m_msg_cnt = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--autocrypt")==0 && i+1 < argc ) {
+			param.m_autocrypt_percent = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--attachments")==0 && i+1 < argc ) {
+			param.m_attachment_percent = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "--keys")==0 && i+1 < argc ) {
+			param.m_keys_file = argv[++i];
+		}
+		else if( strcmp(argv[i], "--eml")==0 && i+1 < argc ) {
+			param.m_eml_dir = argv[++i];
+		}
+		else if( strcmp(argv[i], "--db")==0 && i+1 < argc ) {
+			db = argv[++i];
+		}
+		else if( strcmp(argv[i], "--verbose")==0 ) {
+			s_verbose = 1;
+		}
+		else {
+			break;
+		}
+	}
+
+	if( i < argc || (param.m_eml_dir==NULL && db==NULL) ) {
+		fprintf(stderr, "usage: %s [--seed <n>] [--contacts <n>] [--groups <n>] [--messages <n>] [--autocrypt <percent>] [--attachments <percent>] [--keys <file>] [--eml <dir>] [--db <file>] [--verbose]\n", argv[0]);
+		goto cleanup;
+	}
+
+	if( db ) {
+		if( mr_file_exist(db) ) {
+			fprintf(stderr, "ERROR: %s already exists.\n", db);
+			goto cleanup;
+		}
+		target = mrmailbox_new(receive_target_event, NULL, "Gen");
+		target_blobdir = mr_mprintf("%s-blobs", db);
+		mr_create_folder(target_blobdir, target);
+		if( !mrmailbox_open(target, db, target_blobdir) ) {
+			fprintf(stderr, "ERROR: Cannot open %s.\n", db);
+			goto cleanup;
+		}
+	}
+
+	if( mkdtemp(dir) == NULL ) {
+		fprintf(stderr, "ERROR: Cannot create temporary directory.\n");
+		goto cleanup;
+	}
+	scratch_dbfile  = mr_mprintf("%s/scratch.db", dir);
+	scratch_blobdir = mr_mprintf("%s/blobs", dir);
+	mr_create_folder(scratch_blobdir, scratch);
+
+	if( !mrmailbox_open(scratch, scratch_dbfile, scratch_blobdir) ) {
+		fprintf(stderr, "ERROR: Cannot open %s.\n", scratch_dbfile);
+		goto cleanup;
+	}
+
+	if( gen_mailbox(scratch, target, &param) ) {
+		exitcode = 0;
+	}
+
+cleanup:
+	mrmailbox_close(scratch);
+	mrmailbox_unref(scratch);
+	mrmailbox_close(target);
+	mrmailbox_unref(target);
+	if( scratch_dbfile ) {
+		unlink(scratch_dbfile);
+		rmdir(scratch_blobdir);
+		rmdir(dir);
+	}
+	free(scratch_dbfile);
+	free(scratch_blobdir);
+	free(target_blobdir);
+	return exitcode;
+}
@@ -80,7 +80,7 @@ static uintptr_t receive_event(mrmailbox_t* mailbox, int event, uintptr_t data1,
 		case MR_EVENT_HTTP_GET:
 			{
 				char* ret = NULL;
-				char* tempFile = mr_get_fine_pathNfilename(mailbox->m_blobdir, "curl.result");
+				char* tempFile = mr_create_fine_file(mailbox->m_blobdir, "curl.result", NULL, 0, mailbox);
 				char* cmd = mr_mprintf("curl --silent --location --fail --insecure %s > %s", (char*)data1, tempFile); /* --location = follow redirects */
 				int error = system(cmd);
 				if( error == 0 ) { /* -1=system() error, !0=curl errors forced by -f, 0=curl success */
@@ -0,0 +1,1445 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+/* A stand-in IMAP4rev1 and SMTP server for tests and benchmarks.
+
+The server listens on 127.0.0.1 at ports chosen by the system, without TLS,
+and serves folders held in memory.  It implements what mrimap_t and mrsmtp_t
+use: IMAP4rev1 with IDLE, UIDPLUS and MOVE; SMTP with EHLO and AUTH PLAIN/LOGIN.
+Any credentials are accepted.  Each response is delayed by the configured
+latency and written at the configured bandwidth, so round-trip-bound changes
+can be measured reproducibly and without network.
+
+Each connection is served by its own thread; the folders are protected by a
+single mutex. */
+
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../src/mrmailbox_internal.h"
+#include "standin.h"
+
+
+#define STANDIN_MAX_CONNS   32
+#define STANDIN_POLL_MS     20  /* how often idling connections check for new messages */
+
+#define STANDIN_SEEN        0x01
+#define STANDIN_ANSWERED    0x02
+#define STANDIN_FLAGGED     0x04
+#define STANDIN_DELETED     0x08
+#define STANDIN_DRAFT       0x10
+#define STANDIN_MDNSENT     0x20
+#define STANDIN_MARKED      0x10000 /* not an IMAP flag, used to mark the messages to move */
+
+
+typedef struct standin_msg_t
+{
+	uint32_t          m_uid;
+	int               m_flags;
+	char*             m_data;
+	size_t            m_bytes;
+} standin_msg_t;
+
+
+typedef struct standin_folder_t
+{
+	char*             m_name;
+	uint32_t          m_uidvalidity;
+	uint32_t          m_uidnext;
+	carray*           m_msgs; /* standin_msg_t*, ordered by UID, the index+1 is the sequence number */
+} standin_folder_t;
+
+
+typedef struct standin_conn_t
+{
+	standin_t*        m_standin;
+	int               m_fd;
+	int               m_is_smtp;
+	pthread_t         m_thread;
+	int               m_done;
+
+	char              m_buf[4096];
+	size_t            m_buf_start, m_buf_end;
+
+	standin_folder_t* m_selected;
+	int               m_known_exists;
+} standin_conn_t;
+
+
+struct standin_t
+{
+	int               m_latency_ms;
+	int               m_bytes_per_second;
+
+	int               m_imap_fd, m_smtp_fd;
+	int               m_imap_port, m_smtp_port;
+	pthread_t         m_accept_thread;
+	int               m_accept_thread_running;
+	int               m_stop;
+
+	pthread_mutex_t   m_mutex; /* protects the folders, m_sent_cnt, m_drop_on_fetch and m_conns */
+	carray*           m_folders;
+	int               m_sent_cnt;
+	int               m_drop_on_fetch;
+	standin_conn_t*   m_conns[STANDIN_MAX_CONNS];
+};
+
+
+/*******************************************************************************
+ * Folders and messages, the caller must hold m_mutex
+ ******************************************************************************/
+
+
+static standin_folder_t* get_folder__(standin_t* standin, const char* name, int create)
+{
+	standin_folder_t* folder;
+	int               i;
+
+	for( i = 0; i < carray_count(standin->m_folders); i++ ) {
+		folder = carray_get(standin->m_folders, i);
+		if( strcmp(folder->m_name, name)==0 || (strcasecmp(name, "INBOX")==0 && strcasecmp(folder->m_name, "INBOX")==0) ) {
+			return folder;
+		}
+	}
+
+	if( !create ) {
+		return NULL;
+	}
+
+	if( (folder=calloc(1, sizeof(standin_folder_t)))==NULL ) {
+		exit(61);
+	}
+	folder->m_name        = safe_strdup(name);
+	folder->m_uidvalidity = 1000 + carray_count(standin->m_folders);
+	folder->m_uidnext     = 1;
+	folder->m_msgs        = carray_new(64);
+	carray_add(standin->m_folders, folder, NULL);
+	return folder;
+}
+
+
+static uint32_t add_msg__(standin_folder_t* folder, const char* data, size_t bytes, int flags)
+{
+	standin_msg_t* msg;
+
+	if( (msg=calloc(1, sizeof(standin_msg_t)))==NULL || (msg->m_data=malloc(bytes+1))==NULL ) {
+		exit(62);
+	}
+	memcpy(msg->m_data, data, bytes);
+	msg->m_data[bytes] = 0;
+	msg->m_bytes = bytes;
+	msg->m_flags = flags;
+	msg->m_uid   = folder->m_uidnext++;
+	carray_add(folder->m_msgs, msg, NULL);
+	return msg->m_uid;
+}
+
+
+static void free_msg(standin_msg_t* msg)
+{
+	free(msg->m_data);
+	free(msg);
+}
+
+
+/* checks if `value` is in an IMAP sequence set as `1,3:5,7:*`; `*` stands for `max` */
+static int in_set(const char* set, uint32_t value, uint32_t max)
+{
+	const char* p = set;
+	uint32_t    lo, hi, temp;
+
+	while( *p )
+	{
+		if( *p=='*' ) { lo = max; p++; } else { lo = (uint32_t)strtoul(p, (char**)&p, 10); }
+		hi = lo;
+		if( *p==':' ) {
+			p++;
+			if( *p=='*' ) { hi = max; p++; } else { hi = (uint32_t)strtoul(p, (char**)&p, 10); }
+		}
+		if( lo > hi ) { temp = lo; lo = hi; hi = temp; }
+
+		if( value >= lo && value <= hi ) {
+			return 1;
+		}
+
+		if( *p!=',' ) {
+			break;
+		}
+		p++;
+	}
+	return 0;
+}
+
+
+static int is_msg_in_set(standin_folder_t* folder, int index, const char* set, int use_uid)
+{
+	int count = carray_count(folder->m_msgs);
+	if( use_uid ) {
+		return in_set(set, ((standin_msg_t*)carray_get(folder->m_msgs, index))->m_uid,
+			count? ((standin_msg_t*)carray_get(folder->m_msgs, count-1))->m_uid : 0);
+	}
+	return in_set(set, index+1, count);
+}
+
+
+static const char* find_nocase(const char* haystack, const char* needle)
+{
+	size_t len = strlen(needle);
+	for( ; *haystack; haystack++ ) {
+		if( strncasecmp(haystack, needle, len)==0 ) {
+			return haystack;
+		}
+	}
+	return NULL;
+}
+
+
+static int parse_flags(const char* str)
+{
+	int flags = 0;
+	if( find_nocase(str, "\\Seen") )     { flags |= STANDIN_SEEN; }
+	if( find_nocase(str, "\\Answered") ) { flags |= STANDIN_ANSWERED; }
+	if( find_nocase(str, "\\Flagged") )  { flags |= STANDIN_FLAGGED; }
+	if( find_nocase(str, "\\Deleted") )  { flags |= STANDIN_DELETED; }
+	if( find_nocase(str, "\\Draft") )    { flags |= STANDIN_DRAFT; }
+	if( find_nocase(str, "$MDNSent") )   { flags |= STANDIN_MDNSENT; }
+	return flags;
+}
+
+
+static void cat_flags(MMAPString* out, int flags)
+{
+	int first = 1;
+	mmap_string_append(out, "(");
+	#define CAT_FLAG(f, name) if( flags&(f) ) { mmap_string_append(out, first? name : " " name); first = 0; }
+	CAT_FLAG(STANDIN_SEEN,     "\\Seen")
+	CAT_FLAG(STANDIN_ANSWERED, "\\Answered")
+	CAT_FLAG(STANDIN_FLAGGED,  "\\Flagged")
+	CAT_FLAG(STANDIN_DELETED,  "\\Deleted")
+	CAT_FLAG(STANDIN_DRAFT,    "\\Draft")
+	CAT_FLAG(STANDIN_MDNSENT,  "$MDNSent")
+	mmap_string_append(out, ")");
+}
+
+
+static size_t get_header_bytes(const standin_msg_t* msg)
+{
+	const char* p = strstr(msg->m_data, "\r\n\r\n");
+	return p? (size_t)(p - msg->m_data) + 4 : msg->m_bytes;
+}
+
+
+/* returns the header lines of the given fields, incl. continuation lines, followed by an empty line */
+static void cat_header_fields(MMAPString* out, const standin_msg_t* msg, carray* fields)
+{
+	const char* p = msg->m_data, *end = msg->m_data + get_header_bytes(msg), *line_end;
+	int         i, include = 0;
+
+	while( p < end && !(p[0]=='\r' && p[1]=='\n') )
+	{
+		if( (line_end=strstr(p, "\r\n"))==NULL || line_end > end ) {
+			line_end = end;
+		}
+		else {
+			line_end += 2;
+		}
+
+		if( *p!=' ' && *p!='\t' ) {
+			include = 0;
+			for( i = 0; i < carray_count(fields); i++ ) {
+				const char* field = carray_get(fields, i);
+				size_t      len = strlen(field);
+				if( strncasecmp(p, field, len)==0 && p[len]==':' ) {
+					include = 1;
+					break;
+				}
+			}
+		}
+
+		if( include ) {
+			mmap_string_append_len(out, p, line_end-p);
+		}
+		p = line_end;
+	}
+	mmap_string_append(out, "\r\n");
+}
+
+
+static char* get_header_value(const standin_msg_t* msg, const char* field)
+{
+	MMAPString* line = mmap_string_new("");
+	carray*     fields = carray_new(1);
+	char*       ret = NULL, *p;
+
+	carray_add(fields, (void*)field, NULL);
+	cat_header_fields(line, msg, fields);
+	if( (p=strchr(line->str, ':'))!=NULL ) {
+		ret = safe_strdup(p+1);
+		mr_trim(ret);
+	}
+
+	carray_free(fields);
+	mmap_string_free(line);
+	return ret; /* may be NULL */
+}
+
+
+/*******************************************************************************
+ * Reading and writing
+ ******************************************************************************/
+
+
+static void catf(MMAPString* out, const char* format, ...)
+{
+	char    temp[256], *str = temp;
+	int     bytes;
+	va_list args;
+
+	va_start(args, format);
+	bytes = vsnprintf(temp, sizeof(temp), format, args);
+	va_end(args);
+
+	if( bytes >= (int)sizeof(temp) ) {
+		if( (str=malloc(bytes+1))==NULL ) {
+			exit(65);
+		}
+		va_start(args, format);
+		vsnprintf(str, bytes+1, format, args);
+		va_end(args);
+	}
+
+	mmap_string_append_len(out, str, bytes > 0? bytes : 0);
+	if( str != temp ) {
+		free(str);
+	}
+}
+
+
+static void sleep_ms(int ms)
+{
+	if( ms > 0 ) {
+		usleep(ms*1000);
+	}
+}
+
+
+/* returns 1 if data is available, 0 on timeout and -1 on errors or if the connection was closed */
+static int conn_fill(standin_conn_t* conn, int timeout_ms)
+{
+	struct pollfd pfd;
+	ssize_t       r;
+
+	if( conn->m_buf_start < conn->m_buf_end ) {
+		return 1;
+	}
+
+	pfd.fd      = conn->m_fd;
+	pfd.events  = POLLIN;
+	pfd.revents = 0;
+	if( (r=poll(&pfd, 1, timeout_ms)) <= 0 ) {
+		return (r==0 || errno==EINTR)? 0 : -1;
+	}
+
+	if( (r=recv(conn->m_fd, conn->m_buf, sizeof(conn->m_buf), 0)) <= 0 ) {
+		return -1;
+	}
+	conn->m_buf_start = 0;
+	conn->m_buf_end   = r;
+	return 1;
+}
+
+
+/* appends a line without the line end to `line`; returns 0 if the connection was closed */
+static int conn_read_line(standin_conn_t* conn, MMAPString* line)
+{
+	char ch;
+
+	while( 1 )
+	{
+		if( conn_fill(conn, 1000) < 0 || conn->m_standin->m_stop ) {
+			return 0;
+		}
+
+		while( conn->m_buf_start < conn->m_buf_end ) {
+			ch = conn->m_buf[conn->m_buf_start++];
+			if( ch=='\n' ) {
+				if( line->len > 0 && line->str[line->len-1]=='\r' ) {
+					mmap_string_truncate(line, line->len-1);
+				}
+				return 1;
+			}
+			mmap_string_append_c(line, ch);
+		}
+	}
+}
+
+
+static int conn_read_bytes(standin_conn_t* conn, MMAPString* data, size_t bytes)
+{
+	size_t avail;
+
+	while( bytes > 0 )
+	{
+		if( conn_fill(conn, 1000) < 0 || conn->m_standin->m_stop ) {
+			return 0;
+		}
+
+		avail = conn->m_buf_end - conn->m_buf_start;
+		avail = avail < bytes? avail : bytes;
+		mmap_string_append_len(data, &conn->m_buf[conn->m_buf_start], avail);
+		conn->m_buf_start += avail;
+		bytes -= avail;
+	}
+	return 1;
+}
+
+
+/* writes `out` after the configured latency and at the configured bandwidth, `out` is emptied */
+static int conn_respond(standin_conn_t* conn, MMAPString* out)
+{
+	int     bytes_per_second = conn->m_standin->m_bytes_per_second;
+	size_t  pos = 0, chunk;
+	ssize_t r;
+
+	sleep_ms(conn->m_standin->m_latency_ms);
+
+	while( pos < out->len )
+	{
+		chunk = out->len - pos;
+		if( bytes_per_second > 0 ) {
+			size_t max_chunk = bytes_per_second/100 > 512? bytes_per_second/100 : 512;
+			chunk = chunk < max_chunk? chunk : max_chunk;
+		}
+
+		if( (r=send(conn->m_fd, out->str+pos, chunk, MSG_NOSIGNAL)) <= 0 ) {
+			if( r < 0 && errno==EINTR ) {
+				continue;
+			}
+			return 0;
+		}
+		pos += r;
+
+		if( bytes_per_second > 0 ) {
+			usleep((useconds_t)((uint64_t)r*1000000/bytes_per_second));
+		}
+	}
+
+	mmap_string_truncate(out, 0);
+	return 1;
+}
+
+
+/* gets the next token of an IMAP command: an atom (incl. any [...] and <...> parts), a quoted string,
+a literal or a parenthesized list; lists are returned as they are, incl. the parentheses */
+static char* get_token(const MMAPString* cmd, size_t* pos)
+{
+	const char* p = cmd->str + *pos, *end = cmd->str + cmd->len, *start;
+	MMAPString* ret = NULL;
+	char*       ret_str;
+	int         depth;
+
+	while( p < end && *p==' ' ) {
+		p++;
+	}
+
+	if( p >= end ) {
+		*pos = cmd->len;
+		return NULL;
+	}
+
+	ret = mmap_string_new("");
+
+	if( *p=='"' )
+	{
+		for( p++; p < end && *p!='"'; p++ ) {
+			if( *p=='\\' && p+1 < end ) {
+				p++;
+			}
+			mmap_string_append_c(ret, *p);
+		}
+		p++;
+	}
+	else if( *p=='{' )
+	{
+		size_t bytes = strtoul(p+1, NULL, 10);
+		while( p < end && *p!='\n' ) {
+			p++;
+		}
+		p++;
+		bytes = p+bytes <= end? bytes : (size_t)(end-p);
+		mmap_string_append_len(ret, p, bytes);
+		p += bytes;
+	}
+	else if( *p=='(' )
+	{
+		start = p;
+		for( depth = 0; p < end; p++ ) {
+			if( *p=='(' ) { depth++; }
+			if( *p==')' && --depth==0 ) { p++; break; }
+		}
+		mmap_string_append_len(ret, start, p-start);
+	}
+	else
+	{
+		start = p;
+		for( depth = 0; p < end && (depth > 0 || (*p!=' ' && *p!=')')); p++ ) {
+			if( *p=='[' ) { depth++; }
+			if( *p==']' ) { depth--; }
+		}
+		mmap_string_append_len(ret, start, p-start);
+	}
+
+	*pos = p <= end? (size_t)(p - cmd->str) : cmd->len;
+	ret_str = safe_strdup(ret->str);
+	mmap_string_free(ret);
+	return ret_str;
+}
+
+
+/* splits a parenthesized list or a single item into its tokens */
+static carray* get_list_tokens(const char* list)
+{
+	MMAPString* temp = mmap_string_new(list);
+	carray*     ret = carray_new(8);
+	size_t      pos = 0;
+	char*       token;
+
+	if( temp->len >= 2 && temp->str[0]=='(' && temp->str[temp->len-1]==')' ) {
+		mmap_string_erase(temp, temp->len-1, 1);
+		mmap_string_erase(temp, 0, 1);
+	}
+
+	while( (token=get_token(temp, &pos))!=NULL ) {
+		carray_add(ret, token, NULL);
+	}
+
+	mmap_string_free(temp);
+	return ret;
+}
+
+
+static void free_tokens(carray* tokens)
+{
+	int i;
+	if( tokens ) {
+		for( i = 0; i < carray_count(tokens); i++ ) {
+			free(carray_get(tokens, i));
+		}
+		carray_free(tokens);
+	}
+}
+
+
+/*******************************************************************************
+ * IMAP
+ ******************************************************************************/
+
+
+#define IMAP_CAPABILITIES "IMAP4rev1 IDLE UIDPLUS MOVE AUTH=PLAIN"
+
+
+/* reads a command incl. the literals, the literals are left in the command as `{n}\r\n<data>` */
+static int imap_read_cmd(standin_conn_t* conn, MMAPString* cmd, MMAPString* out)
+{
+	size_t line_start, bytes;
+	char*  p;
+
+	while( 1 )
+	{
+		line_start = cmd->len;
+		if( !conn_read_line(conn, cmd) ) {
+			return 0;
+		}
+
+		if( cmd->len == line_start || cmd->str[cmd->len-1]!='}' || (p=strrchr(cmd->str+line_start, '{'))==NULL ) {
+			return 1;
+		}
+
+		bytes = strtoul(p+1, NULL, 10);
+		if( cmd->str[cmd->len-2]!='+' ) {
+			mmap_string_append(out, "+ go ahead\r\n");
+			if( !conn_respond(conn, out) ) {
+				return 0;
+			}
+		}
+		mmap_string_append(cmd, "\r\n");
+		if( !conn_read_bytes(conn, cmd, bytes) ) {
+			return 0;
+		}
+	}
+}
+
+
+static void imap_cat_exists__(standin_conn_t* conn, MMAPString* out)
+{
+	int exists;
+	if( conn->m_selected ) {
+		exists = carray_count(conn->m_selected->m_msgs);
+		if( exists != conn->m_known_exists ) {
+			catf(out, "* %i EXISTS\r\n", exists);
+			conn->m_known_exists = exists;
+		}
+	}
+}
+
+
+static void imap_cat_fetch__(standin_conn_t* conn, MMAPString* out, int index, const char* items, int use_uid)
+{
+	standin_msg_t* msg = carray_get(conn->m_selected->m_msgs, index);
+	carray*        tokens = get_list_tokens(items);
+	size_t         header_bytes = get_header_bytes(msg);
+	int            i, first = 1;
+
+	catf(out, "* %i FETCH (", index+1);
+
+	if( use_uid ) {
+		catf(out, "UID %u", msg->m_uid);
+		first = 0;
+	}
+
+	for( i = 0; i < carray_count(tokens); i++ )
+	{
+		char* item = carray_get(tokens, i), *section, *partial;
+
+		if( strcasecmp(item, "UID")==0 ) {
+			if( !use_uid ) {
+				catf(out, "%sUID %u", first? "" : " ", msg->m_uid);
+			}
+		}
+		else if( strcasecmp(item, "FLAGS")==0 ) {
+			mmap_string_append(out, first? "FLAGS " : " FLAGS ");
+			cat_flags(out, msg->m_flags);
+		}
+		else if( strcasecmp(item, "RFC822.SIZE")==0 ) {
+			catf(out, "%sRFC822.SIZE %lu", first? "" : " ", (unsigned long)msg->m_bytes);
+		}
+		else if( strcasecmp(item, "INTERNALDATE")==0 ) {
+			catf(out, "%sINTERNALDATE \"02-Oct-2017 00:00:00 +0000\"", first? "" : " ");
+		}
+		else if( strcasecmp(item, "ENVELOPE")==0 ) {
+			/* only the Message-ID is filled, this is what mrimap_t uses the envelope for */
+			char* message_id = get_header_value(msg, "Message-ID");
+			catf(out, "%sENVELOPE (NIL NIL NIL NIL NIL NIL NIL NIL NIL %s%s%s)", first? "" : " ",
+				message_id? "\"" : "", message_id? message_id : "NIL", message_id? "\"" : "");
+			free(message_id);
+		}
+		else if( strncasecmp(item, "BODY[", 5)==0 || strncasecmp(item, "BODY.PEEK[", 10)==0 )
+		{
+			MMAPString* data = mmap_string_new("");
+			size_t      offset = 0, bytes;
+
+			section = strchr(item, '[') + 1;
+			partial = strchr(section, ']');
+			if( partial ) {
+				*partial = 0;
+				partial++;
+			}
+
+			if( section[0]==0 ) {
+				mmap_string_append_len(data, msg->m_data, msg->m_bytes);
+			}
+			else if( strncasecmp(section, "HEADER.FIELDS ", 14)==0 ) {
+				carray* fields = get_list_tokens(section+14);
+				cat_header_fields(data, msg, fields);
+				free_tokens(fields);
+			}
+			else if( strcasecmp(section, "HEADER")==0 ) {
+				mmap_string_append_len(data, msg->m_data, header_bytes);
+			}
+			else if( strcasecmp(section, "TEXT")==0 ) {
+				mmap_string_append_len(data, msg->m_data+header_bytes, msg->m_bytes-header_bytes);
+			}
+
+			bytes = data->len;
+			if( partial && partial[0]=='<' ) {
+				offset = strtoul(partial+1, NULL, 10);
+				offset = offset < data->len? offset : data->len;
+				bytes  = data->len - offset;
+				if( strchr(partial, '.') ) {
+					size_t max = strtoul(strchr(partial, '.')+1, NULL, 10);
+					bytes = bytes < max? bytes : max;
+				}
+			}
+
+			catf(out, "%sBODY[%s]", first? "" : " ", section);
+			if( partial && partial[0]=='<' ) {
+				catf(out, "<%lu>", (unsigned long)offset);
+			}
+			catf(out, " {%lu}\r\n", (unsigned long)bytes);
+			mmap_string_append_len(out, data->str+offset, bytes);
+			mmap_string_free(data);
+
+			if( strncasecmp(item, "BODY[", 5)==0 ) {
+				msg->m_flags |= STANDIN_SEEN;
+			}
+		}
+		else {
+			continue;
+		}
+		first = 0;
+	}
+
+	mmap_string_append(out, ")\r\n");
+	free_tokens(tokens);
+}
+
+
+static int imap_search_matches__(standin_msg_t* msg, carray* keys)
+{
+	int i;
+
+	for( i = 0; i < carray_count(keys); i++ )
+	{
+		const char* key = carray_get(keys, i);
+
+		if( strcasecmp(key, "HEADER")==0 && i+2 < carray_count(keys) ) {
+			char* value = get_header_value(msg, carray_get(keys, i+1));
+			int   matches = value && find_nocase(value, carray_get(keys, i+2));
+			free(value);
+			if( !matches ) {
+				return 0;
+			}
+			i += 2;
+		}
+		else if( strcasecmp(key, "SEEN")==0 ) {
+			if( !(msg->m_flags&STANDIN_SEEN) ) { return 0; }
+		}
+		else if( strcasecmp(key, "UNSEEN")==0 ) {
+			if( msg->m_flags&STANDIN_SEEN ) { return 0; }
+		}
+		else if( strcasecmp(key, "CHARSET")==0 ) {
+			i++;
+		}
+		/* ALL and unknown keys match all messages */
+	}
+
+	return 1;
+}
+
+
+static void imap_expunge__(standin_conn_t* conn, MMAPString* out, int (*should_remove)(standin_msg_t*, void*), void* userdata)
+{
+	carray* msgs = conn->m_selected->m_msgs;
+	int     i;
+
+	for( i = carray_count(msgs)-1; i >= 0; i-- ) {
+		standin_msg_t* msg = carray_get(msgs, i);
+		if( should_remove(msg, userdata) ) {
+			carray_delete_slow(msgs, i);
+			free_msg(msg);
+			catf(out, "* %i EXPUNGE\r\n", i+1);
+			conn->m_known_exists--;
+		}
+	}
+}
+
+
+static int is_deleted(standin_msg_t* msg, void* userdata)
+{
+	return (msg->m_flags&STANDIN_DELETED)!=0;
+}
+
+
+static int is_marked(standin_msg_t* msg, void* userdata)
+{
+	return (msg->m_flags&STANDIN_MARKED)!=0;
+}
+
+
+/* handles one command, returns 0 if the connection should be closed */
+static int imap_handle_cmd(standin_conn_t* conn, MMAPString* cmd, MMAPString* out)
+{
+	standin_t* standin = conn->m_standin;
+	size_t     pos = 0;
+	char*      tag = get_token(cmd, &pos), *name = get_token(cmd, &pos), *arg1 = NULL, *arg2 = NULL, *arg3 = NULL;
+	int        use_uid = 0, i, keep_open = 1;
+
+	if( tag==NULL || name==NULL ) {
+		catf(out, "%s BAD empty command\r\n", tag? tag : "*");
+		goto cleanup;
+	}
+
+	if( strcasecmp(name, "UID")==0 ) {
+		use_uid = 1;
+		free(name);
+		name = get_token(cmd, &pos);
+		if( name==NULL ) {
+			catf(out, "%s BAD command missing\r\n", tag);
+			goto cleanup;
+		}
+	}
+
+	arg1 = get_token(cmd, &pos);
+	arg2 = get_token(cmd, &pos);
+
+	pthread_mutex_lock(&standin->m_mutex);
+
+	if( strcasecmp(name, "CAPABILITY")==0 ) {
+		catf(out, "* CAPABILITY %s\r\n%s OK CAPABILITY completed\r\n", IMAP_CAPABILITIES, tag);
+	}
+	else if( strcasecmp(name, "LOGIN")==0 || strcasecmp(name, "AUTHENTICATE")==0 ) {
+		catf(out, "%s OK [CAPABILITY %s] logged in\r\n", tag, IMAP_CAPABILITIES);
+	}
+	else if( strcasecmp(name, "NOOP")==0 || strcasecmp(name, "CHECK")==0 || strcasecmp(name, "SUBSCRIBE")==0 || strcasecmp(name, "UNSUBSCRIBE")==0 ) {
+		imap_cat_exists__(conn, out);
+		catf(out, "%s OK %s completed\r\n", tag, name);
+	}
+	else if( strcasecmp(name, "LOGOUT")==0 ) {
+		catf(out, "* BYE stand-in logging out\r\n%s OK LOGOUT completed\r\n", tag);
+		keep_open = 0;
+	}
+	else if( strcasecmp(name, "LIST")==0 || strcasecmp(name, "LSUB")==0 || strcasecmp(name, "XLIST")==0 ) {
+		for( i = 0; i < carray_count(standin->m_folders); i++ ) {
+			catf(out, "* %s (\\HasNoChildren) \"/\" \"%s\"\r\n", name, ((standin_folder_t*)carray_get(standin->m_folders, i))->m_name);
+		}
+		catf(out, "%s OK %s completed\r\n", tag, name);
+	}
+	else if( strcasecmp(name, "CREATE")==0 && arg1 ) {
+		if( get_folder__(standin, arg1, 0) ) {
+			catf(out, "%s NO [ALREADYEXISTS] mailbox exists\r\n", tag);
+		}
+		else {
+			get_folder__(standin, arg1, 1);
+			catf(out, "%s OK CREATE completed\r\n", tag);
+		}
+	}
+	else if( (strcasecmp(name, "SELECT")==0 || strcasecmp(name, "EXAMINE")==0) && arg1 ) {
+		if( (conn->m_selected=get_folder__(standin, arg1, 0))==NULL ) {
+			catf(out, "%s NO no such mailbox\r\n", tag);
+		}
+		else {
+			conn->m_known_exists = carray_count(conn->m_selected->m_msgs);
+			catf(out,
+				"* FLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft $MDNSent)\r\n"
+				"* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft $MDNSent \\*)] flags permitted\r\n"
+				"* %i EXISTS\r\n"
+				"* 0 RECENT\r\n"
+				"* OK [UIDVALIDITY %u] UIDs valid\r\n"
+				"* OK [UIDNEXT %u] predicted next UID\r\n"
+				"%s OK [%s] %s completed\r\n",
+				conn->m_known_exists, conn->m_selected->m_uidvalidity, conn->m_selected->m_uidnext,
+				tag, strcasecmp(name, "SELECT")==0? "READ-WRITE" : "READ-ONLY", name);
+		}
+	}
+	else if( strcasecmp(name, "APPEND")==0 && arg1 && arg2 ) {
+		/* APPEND <folder> [(<flags>)] ["<date>"] <literal>; the literal is the last token */
+		standin_folder_t* folder = get_folder__(standin, arg1, 0);
+		int               flags = arg2[0]=='('? parse_flags(arg2) : 0;
+		char*             data = arg2, *next;
+		while( (next=get_token(cmd, &pos))!=NULL ) {
+			if( data!=arg2 ) { free(data); }
+			data = next;
+		}
+		if( folder==NULL ) {
+			catf(out, "%s NO [TRYCREATE] no such mailbox\r\n", tag);
+		}
+		else {
+			uint32_t uid = add_msg__(folder, data, strlen(data), flags);
+			imap_cat_exists__(conn, out);
+			catf(out, "%s OK [APPENDUID %u %u] APPEND completed\r\n", tag, folder->m_uidvalidity, uid);
+		}
+		if( data!=arg2 ) { free(data); }
+	}
+	else if( conn->m_selected==NULL ) {
+		catf(out, "%s BAD no mailbox selected\r\n", tag);
+	}
+	else if( strcasecmp(name, "FETCH")==0 && arg1 && arg2 ) {
+		imap_cat_exists__(conn, out);
+		for( i = 0; i < carray_count(conn->m_selected->m_msgs); i++ ) {
+			if( is_msg_in_set(conn->m_selected, i, arg1, use_uid) ) {
+				imap_cat_fetch__(conn, out, i, arg2, use_uid);
+			}
+		}
+		catf(out, "%s OK FETCH completed\r\n", tag);
+		if( strchr(arg2, '<') && standin->m_drop_on_fetch > 0 && --standin->m_drop_on_fetch == 0 ) {
+			mmap_string_truncate(out, out->len/2); /* the connection gets lost in the middle of a chunk */
+			keep_open = 0;
+		}
+	}
+	else if( strcasecmp(name, "SEARCH")==0 ) {
+		carray* keys = carray_new(8);
+		char*   key;
+		if( arg1 ) { carray_add(keys, arg1, NULL); arg1 = NULL; }
+		if( arg2 ) { carray_add(keys, arg2, NULL); arg2 = NULL; }
+		while( (key=get_token(cmd, &pos))!=NULL ) {
+			carray_add(keys, key, NULL);
+		}
+		mmap_string_append(out, "* SEARCH");
+		for( i = 0; i < carray_count(conn->m_selected->m_msgs); i++ ) {
+			standin_msg_t* msg = carray_get(conn->m_selected->m_msgs, i);
+			if( imap_search_matches__(msg, keys) ) {
+				catf(out, " %u", use_uid? msg->m_uid : (uint32_t)i+1);
+			}
+		}
+		catf(out, "\r\n%s OK SEARCH completed\r\n", tag);
+		free_tokens(keys);
+	}
+	else if( strcasecmp(name, "STORE")==0 && arg1 && arg2 && (arg3=get_token(cmd, &pos))!=NULL ) {
+		int flags = parse_flags(arg3), silent = find_nocase(arg2, ".SILENT")!=NULL;
+		for( i = 0; i < carray_count(conn->m_selected->m_msgs); i++ ) {
+			standin_msg_t* msg = carray_get(conn->m_selected->m_msgs, i);
+			if( is_msg_in_set(conn->m_selected, i, arg1, use_uid) ) {
+				if( arg2[0]=='+' )      { msg->m_flags |= flags; }
+				else if( arg2[0]=='-' ) { msg->m_flags &= ~flags; }
+				else                    { msg->m_flags = flags; }
+				if( !silent ) {
+					catf(out, "* %i FETCH (", i+1);
+					if( use_uid ) { catf(out, "UID %u ", msg->m_uid); }
+					mmap_string_append(out, "FLAGS ");
+					cat_flags(out, msg->m_flags);
+					mmap_string_append(out, ")\r\n");
+				}
+			}
+		}
+		catf(out, "%s OK STORE completed\r\n", tag);
+	}
+	else if( (strcasecmp(name, "COPY")==0 || strcasecmp(name, "MOVE")==0) && arg1 && arg2 ) {
+		standin_folder_t* dest = get_folder__(standin, arg2, 0);
+		MMAPString*       src_uids = mmap_string_new(""), *dest_uids = mmap_string_new(""), *copyuid = mmap_string_new("");
+		int               is_move = strcasecmp(name, "MOVE")==0;
+		if( dest==NULL ) {
+			catf(out, "%s NO [TRYCREATE] no such mailbox\r\n", tag);
+		}
+		else {
+			int cnt = carray_count(conn->m_selected->m_msgs);
+			for( i = 0; i < cnt; i++ ) {
+				standin_msg_t* msg = carray_get(conn->m_selected->m_msgs, i);
+				if( is_msg_in_set(conn->m_selected, i, arg1, use_uid) ) {
+					uint32_t dest_uid = add_msg__(dest, msg->m_data, msg->m_bytes, msg->m_flags);
+					catf(src_uids, "%s%u", src_uids->len? "," : "", msg->m_uid);
+					catf(dest_uids, "%s%u", dest_uids->len? "," : "", dest_uid);
+					msg->m_flags |= STANDIN_MARKED;
+				}
+			}
+			if( src_uids->len ) {
+				catf(copyuid, "[COPYUID %u %s %s] ", dest->m_uidvalidity, src_uids->str, dest_uids->str);
+			}
+			if( is_move ) {
+				if( copyuid->len ) {
+					catf(out, "* OK %s\r\n", copyuid->str);
+				}
+				imap_expunge__(conn, out, is_marked, NULL);
+				catf(out, "%s OK MOVE completed\r\n", tag);
+			}
+			else {
+				for( i = 0; i < carray_count(conn->m_selected->m_msgs); i++ ) {
+					((standin_msg_t*)carray_get(conn->m_selected->m_msgs, i))->m_flags &= ~STANDIN_MARKED;
+				}
+				catf(out, "%s OK %sCOPY completed\r\n", tag, copyuid->str);
+			}
+		}
+		mmap_string_free(src_uids);
+		mmap_string_free(dest_uids);
+		mmap_string_free(copyuid);
+	}
+	else if( strcasecmp(name, "EXPUNGE")==0 ) {
+		imap_expunge__(conn, out, is_deleted, NULL);
+		catf(out, "%s OK EXPUNGE completed\r\n", tag);
+	}
+	else if( strcasecmp(name, "CLOSE")==0 ) {
+		MMAPString* ignored = mmap_string_new("");
+		imap_expunge__(conn, ignored, is_deleted, NULL); /* CLOSE does not send EXPUNGE responses */
+		mmap_string_free(ignored);
+		conn->m_selected = NULL;
+		catf(out, "%s OK CLOSE completed\r\n", tag);
+	}
+	else if( strcasecmp(name, "IDLE")==0 ) {
+		pthread_mutex_unlock(&standin->m_mutex);
+
+		mmap_string_append(out, "+ idling\r\n");
+		if( !conn_respond(conn, out) ) {
+			keep_open = 0;
+			goto cleanup;
+		}
+
+		while( !standin->m_stop )
+		{
+			int r = conn_fill(conn, STANDIN_POLL_MS);
+			if( r < 0 ) {
+				keep_open = 0;
+				goto cleanup;
+			}
+			else if( r > 0 ) {
+				MMAPString* line = mmap_string_new("");
+				keep_open = conn_read_line(conn, line);
+				mmap_string_free(line);
+				catf(out, "%s OK IDLE terminated\r\n", tag);
+				goto cleanup;
+			}
+
+			pthread_mutex_lock(&standin->m_mutex);
+				imap_cat_exists__(conn, out);
+			pthread_mutex_unlock(&standin->m_mutex);
+			if( out->len && !conn_respond(conn, out) ) {
+				keep_open = 0;
+				goto cleanup;
+			}
+		}
+		keep_open = 0;
+		goto cleanup;
+	}
+	else {
+		catf(out, "%s BAD unknown command\r\n", tag);
+	}
+
+	pthread_mutex_unlock(&standin->m_mutex);
+
+cleanup:
+	free(tag);
+	free(name);
+	free(arg1);
+	free(arg2);
+	free(arg3);
+	return keep_open;
+}
+
+
+static void imap_serve(standin_conn_t* conn)
+{
+	MMAPString* cmd = mmap_string_new(""), *out = mmap_string_new("");
+
+	mmap_string_append(out, "* OK [CAPABILITY " IMAP_CAPABILITIES "] stand-in ready\r\n");
+	if( !conn_respond(conn, out) ) {
+		goto cleanup;
+	}
+
+	while( !conn->m_standin->m_stop )
+	{
+		mmap_string_truncate(cmd, 0);
+		if( !imap_read_cmd(conn, cmd, out) ) {
+			break;
+		}
+
+		if( !imap_handle_cmd(conn, cmd, out) ) {
+			conn_respond(conn, out);
+			break;
+		}
+
+		if( !conn_respond(conn, out) ) {
+			break;
+		}
+	}
+
+cleanup:
+	mmap_string_free(cmd);
+	mmap_string_free(out);
+}
+
+
+/*******************************************************************************
+ * SMTP
+ ******************************************************************************/
+
+
+static void smtp_serve(standin_conn_t* conn)
+{
+	standin_t*  standin = conn->m_standin;
+	MMAPString* line = mmap_string_new(""), *out = mmap_string_new(""), *data = mmap_string_new("");
+	int         rcpt_cnt = 0;
+
+	mmap_string_append(out, "220 stand-in ESMTP ready\r\n");
+	if( !conn_respond(conn, out) ) {
+		goto cleanup;
+	}
+
+	while( !standin->m_stop )
+	{
+		mmap_string_truncate(line, 0);
+		if( !conn_read_line(conn, line) ) {
+			break;
+		}
+
+		if( strncasecmp(line->str, "EHLO", 4)==0 ) {
+			mmap_string_append(out, "250-stand-in\r\n250-PIPELINING\r\n250-8BITMIME\r\n250-AUTH PLAIN LOGIN\r\n250 SIZE 104857600\r\n");
+		}
+		else if( strncasecmp(line->str, "HELO", 4)==0 ) {
+			mmap_string_append(out, "250 stand-in\r\n");
+		}
+		else if( strncasecmp(line->str, "AUTH PLAIN", 10)==0 ) {
+			if( line->len <= 11 ) {
+				/* no initial response, the credentials follow on the next line */
+				mmap_string_append(out, "334 \r\n");
+				mmap_string_truncate(line, 0);
+				if( !conn_respond(conn, out) || !conn_read_line(conn, line) ) {
+					break;
+				}
+			}
+			mmap_string_append(out, "235 2.7.0 authentication successful\r\n");
+		}
+		else if( strncasecmp(line->str, "AUTH LOGIN", 10)==0 ) {
+			int i;
+			for( i = (line->len > 11? 1 : 0); i < 2; i++ ) {
+				mmap_string_append(out, i==0? "334 VXNlcm5hbWU6\r\n" : "334 UGFzc3dvcmQ6\r\n");
+				mmap_string_truncate(line, 0);
+				if( !conn_respond(conn, out) || !conn_read_line(conn, line) ) {
+					goto cleanup;
+				}
+			}
+			mmap_string_append(out, "235 2.7.0 authentication successful\r\n");
+		}
+		else if( strncasecmp(line->str, "MAIL FROM:", 10)==0 ) {
+			rcpt_cnt = 0;
+			mmap_string_append(out, "250 2.1.0 sender ok\r\n");
+		}
+		else if( strncasecmp(line->str, "RCPT TO:", 8)==0 ) {
+			rcpt_cnt++;
+			mmap_string_append(out, "250 2.1.5 recipient ok\r\n");
+		}
+		else if( strcasecmp(line->str, "DATA")==0 ) {
+			if( rcpt_cnt == 0 ) {
+				mmap_string_append(out, "503 5.5.1 no recipients\r\n");
+			}
+			else {
+				mmap_string_append(out, "354 end data with <CR><LF>.<CR><LF>\r\n");
+				if( !conn_respond(conn, out) ) {
+					break;
+				}
+
+				mmap_string_truncate(data, 0);
+				while( 1 ) {
+					mmap_string_truncate(line, 0);
+					if( !conn_read_line(conn, line) ) {
+						goto cleanup;
+					}
+					if( strcmp(line->str, ".")==0 ) {
+						break;
+					}
+					mmap_string_append(data, line->str[0]=='.'? line->str+1 : line->str);
+					mmap_string_append(data, "\r\n");
+				}
+
+				pthread_mutex_lock(&standin->m_mutex);
+					standin->m_sent_cnt++;
+				pthread_mutex_unlock(&standin->m_mutex);
+
+				rcpt_cnt = 0;
+				mmap_string_append(out, "250 2.0.0 ok queued\r\n");
+			}
+		}
+		else if( strcasecmp(line->str, "RSET")==0 ) {
+			rcpt_cnt = 0;
+			mmap_string_append(out, "250 2.0.0 ok\r\n");
+		}
+		else if( strcasecmp(line->str, "NOOP")==0 ) {
+			mmap_string_append(out, "250 2.0.0 ok\r\n");
+		}
+		else if( strcasecmp(line->str, "QUIT")==0 ) {
+			mmap_string_append(out, "221 2.0.0 bye\r\n");
+			conn_respond(conn, out);
+			break;
+		}
+		else {
+			mmap_string_append(out, "502 5.5.2 command not implemented\r\n");
+		}
+
+		if( !conn_respond(conn, out) ) {
+			break;
+		}
+	}
+
+cleanup:
+	mmap_string_free(line);
+	mmap_string_free(out);
+	mmap_string_free(data);
+}
+
+
+/*******************************************************************************
+ * Main interface
+ ******************************************************************************/
+
+
+static void* conn_thread_entry_point(void* entry_arg)
+{
+	standin_conn_t* conn = (standin_conn_t*)entry_arg;
+
+	if( conn->m_is_smtp ) {
+		smtp_serve(conn);
+	}
+	else {
+		imap_serve(conn);
+	}
+
+	shutdown(conn->m_fd, SHUT_RDWR);
+
+	pthread_mutex_lock(&conn->m_standin->m_mutex);
+		conn->m_done = 1;
+	pthread_mutex_unlock(&conn->m_standin->m_mutex);
+	return NULL;
+}
+
+
+static void free_conn(standin_conn_t* conn)
+{
+	pthread_join(conn->m_thread, NULL);
+	close(conn->m_fd);
+	free(conn);
+}
+
+
+static void accept_conn(standin_t* standin, int listen_fd, int is_smtp)
+{
+	standin_conn_t* conn;
+	int             fd, i, slot = -1;
+
+	if( (fd=accept(listen_fd, NULL, NULL)) < 0 ) {
+		return;
+	}
+
+	pthread_mutex_lock(&standin->m_mutex);
+		for( i = 0; i < STANDIN_MAX_CONNS; i++ ) {
+			if( standin->m_conns[i] && standin->m_conns[i]->m_done ) {
+				free_conn(standin->m_conns[i]); /* the thread has finished, so the join does not block */
+				standin->m_conns[i] = NULL;
+			}
+			if( standin->m_conns[i]==NULL && slot < 0 ) {
+				slot = i;
+			}
+		}
+
+		if( slot < 0 ) {
+			close(fd);
+		}
+		else {
+			if( (conn=calloc(1, sizeof(standin_conn_t)))==NULL ) {
+				exit(63);
+			}
+			conn->m_standin = standin;
+			conn->m_fd      = fd;
+			conn->m_is_smtp = is_smtp;
+			if( pthread_create(&conn->m_thread, NULL, conn_thread_entry_point, conn)==0 ) {
+				standin->m_conns[slot] = conn;
+			}
+			else {
+				close(fd);
+				free(conn);
+			}
+		}
+	pthread_mutex_unlock(&standin->m_mutex);
+}
+
+
+static void* accept_thread_entry_point(void* entry_arg)
+{
+	standin_t*    standin = (standin_t*)entry_arg;
+	struct pollfd pfd[2];
+
+	while( !standin->m_stop )
+	{
+		pfd[0].fd = standin->m_imap_fd; pfd[0].events = POLLIN; pfd[0].revents = 0;
+		pfd[1].fd = standin->m_smtp_fd; pfd[1].events = POLLIN; pfd[1].revents = 0;
+		if( poll(pfd, 2, 100) > 0 ) {
+			if( pfd[0].revents & POLLIN ) { accept_conn(standin, standin->m_imap_fd, 0); }
+			if( pfd[1].revents & POLLIN ) { accept_conn(standin, standin->m_smtp_fd, 1); }
+		}
+	}
+	return NULL;
+}
+
+
+static int open_listen_socket(int* ret_port)
+{
+	struct sockaddr_in addr;
+	socklen_t          addr_len = sizeof(addr);
+	int                fd, one = 1;
+
+	if( (fd=socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port        = 0;
+	if( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+	 || listen(fd, 16) < 0
+	 || getsockname(fd, (struct sockaddr*)&addr, &addr_len) < 0 ) {
+		close(fd);
+		return -1;
+	}
+
+	*ret_port = ntohs(addr.sin_port);
+	return fd;
+}
+
+
+standin_t* standin_new(int latency_ms, int bytes_per_second)
+{
+	standin_t* standin = NULL;
+
+	if( (standin=calloc(1, sizeof(standin_t)))==NULL ) {
+		exit(64);
+	}
+
+	standin->m_latency_ms       = latency_ms;
+	standin->m_bytes_per_second = bytes_per_second;
+	standin->m_imap_fd          = -1;
+	standin->m_smtp_fd          = -1;
+	standin->m_folders          = carray_new(8);
+	pthread_mutex_init(&standin->m_mutex, NULL);
+
+	get_folder__(standin, "INBOX", 1);
+
+	return standin;
+}
+
+
+void standin_unref(standin_t* standin)
+{
+	int i, j;
+
+	if( standin == NULL ) {
+		return;
+	}
+
+	standin->m_stop = 1;
+	if( standin->m_accept_thread_running ) {
+		pthread_join(standin->m_accept_thread, NULL);
+	}
+
+	/* the connection threads check m_stop at least every second; shutting down the sockets stops them at once */
+	for( i = 0; i < STANDIN_MAX_CONNS; i++ ) {
+		if( standin->m_conns[i] ) {
+			shutdown(standin->m_conns[i]->m_fd, SHUT_RDWR);
+			free_conn(standin->m_conns[i]);
+		}
+	}
+
+	if( standin->m_imap_fd >= 0 ) { close(standin->m_imap_fd); }
+	if( standin->m_smtp_fd >= 0 ) { close(standin->m_smtp_fd); }
+
+	for( i = 0; i < carray_count(standin->m_folders); i++ ) {
+		standin_folder_t* folder = carray_get(standin->m_folders, i);
+		for( j = 0; j < carray_count(folder->m_msgs); j++ ) {
+			free_msg(carray_get(folder->m_msgs, j));
+		}
+		carray_free(folder->m_msgs);
+		free(folder->m_name);
+		free(folder);
+	}
+	carray_free(standin->m_folders);
+
+	pthread_mutex_destroy(&standin->m_mutex);
+	free(standin);
+}
+
+
+int standin_start(standin_t* standin)
+{
+	if( standin == NULL || standin->m_accept_thread_running ) {
+		return 0;
+	}
+
+	if( (standin->m_imap_fd=open_listen_socket(&standin->m_imap_port)) < 0
+	 || (standin->m_smtp_fd=open_listen_socket(&standin->m_smtp_port)) < 0 ) {
+		return 0;
+	}
+
+	if( pthread_create(&standin->m_accept_thread, NULL, accept_thread_entry_point, standin)!=0 ) {
+		return 0;
+	}
+	standin->m_accept_thread_running = 1;
+
+	return 1;
+}
+
+
+int standin_get_imap_port(const standin_t* standin)
+{
+	return standin? standin->m_imap_port : 0;
+}
+
+
+int standin_get_smtp_port(const standin_t* standin)
+{
+	return standin? standin->m_smtp_port : 0;
+}
+
+
+uint32_t standin_add_msg(standin_t* standin, const char* folder, const char* data, size_t bytes)
+{
+	uint32_t uid = 0;
+
+	if( standin == NULL || folder == NULL || data == NULL ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&standin->m_mutex);
+		uid = add_msg__(get_folder__(standin, folder, 1), data, bytes, 0);
+	pthread_mutex_unlock(&standin->m_mutex);
+
+	return uid;
+}
+
+
+int standin_get_msg_cnt(standin_t* standin, const char* folder)
+{
+	standin_folder_t* f;
+	int               cnt = 0;
+
+	if( standin == NULL || folder == NULL ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&standin->m_mutex);
+		if( (f=get_folder__(standin, folder, 0))!=NULL ) {
+			cnt = carray_count(f->m_msgs);
+		}
+	pthread_mutex_unlock(&standin->m_mutex);
+
+	return cnt;
+}
+
+
+int standin_get_sent_cnt(standin_t* standin)
+{
+	int cnt;
+
+	if( standin == NULL ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&standin->m_mutex);
+		cnt = standin->m_sent_cnt;
+	pthread_mutex_unlock(&standin->m_mutex);
+
+	return cnt;
+}
+
+
+void standin_drop_on_fetch(standin_t* standin, int partial_fetch_cnt)
+{
+	if( standin == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&standin->m_mutex);
+		standin->m_drop_on_fetch = partial_fetch_cnt;
+	pthread_mutex_unlock(&standin->m_mutex);
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+#ifndef __STANDIN_H__
+#define __STANDIN_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* A stand-in IMAP4rev1 and SMTP server for tests and benchmarks, see standin.c */
+typedef struct standin_t standin_t;
+
+standin_t* standin_new          (int latency_ms, int bytes_per_second); /* 0 = no latency, no bandwidth limit */
+void       standin_unref        (standin_t*); /* stops the server and closes all connections */
+int        standin_start        (standin_t*); /* returns 0 if the ports cannot be opened */
+int        standin_get_imap_port(const standin_t*);
+int        standin_get_smtp_port(const standin_t*);
+uint32_t   standin_add_msg      (standin_t*, const char* folder, const char* data, size_t bytes); /* returns the UID, idling clients are notified */
+int        standin_get_msg_cnt  (standin_t*, const char* folder);
+int        standin_get_sent_cnt (standin_t*); /* messages received via SMTP */
+void       standin_drop_on_fetch(standin_t*, int partial_fetch_cnt); /* the n-th following partial body fetch is answered only half, then the connection is closed; 0 = never */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __STANDIN_H__ */
@@ -28,6 +28,12 @@ $ valgrind --leak-check=full --tool=memcheck ./deltachat-core <db>
 
 #include <ctype.h>
 #include <assert.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "../src/mrmailbox_internal.h"
 #include "../src/mrsimplify.h"
 #include "../src/mrmimeparser.h"
@@ -36,6 +42,10 @@ $ valgrind --leak-check=full --tool=memcheck ./deltachat-core <db>
 #include "../src/mrapeerstate.h"
 #include "../src/mraheader.h"
 #include "../src/mrkeyring.h"
+#include "../src/mrimap.h"
+#include "../src/mrsmtp.h"
+#include "../src/mrloginparam.h"
+#include "standin.h"
 
 
 /* some data used for testing
@@ -172,6 +182,326 @@ static const char* s_em_setupfile =
 "-----END PGP MESSAGE-----\n";
 
 
+/* copies a key and flips the case of its letters (letters=1) or of the characters that differ from letters only
+in the case bit (letters=0); returns 1 if the copy differs from the key */
+static int stress_hash_variant(char* dst, const char* src, int len, int letters)
+{
+	int i, changed = 0;
+
+	for( i = 0; i < len; i++ ) {
+		dst[i] = src[i];
+		if( letters? isalpha((unsigned char)src[i]) : (src[i]=='@' || src[i]=='`' || src[i]=='[' || src[i]=='{') ) {
+			dst[i] ^= 0x20;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+
+/* helpers for the tests against the stand-in server from standin.c; each mailbox uses a temporary database
+ ******************************************************************************/
+
+#define STRESS_SYNC_TIMEOUT 60 /* seconds */
+
+
+/* poll `cond` until it is true, fails on timeout */
+#define STRESS_WAIT_UNTIL(cond) \
+	{ \
+		time_t stress_wait_start = time(NULL); \
+		while( !(cond) ) { \
+			if( time(NULL)-stress_wait_start > STRESS_SYNC_TIMEOUT ) { assert( cond ); break; } \
+			usleep(1000); \
+		} \
+	}
+
+
+static uintptr_t stress_sync_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	return 0; /* no strings, not offline, no HTTP */
+}
+
+
+/* a mailbox on a temporary database, remove it using stress_unref_standin_mailbox() */
+static mrmailbox_t* stress_new_temp_mailbox(mrmailboxcb_t cb, mrengine_t* engine)
+{
+	mrmailbox_t* mailbox = engine? mrmailbox_new_with_engine(cb, NULL, "Stress", engine) : mrmailbox_new(cb, NULL, "Stress");
+	char         dir[] = "/tmp/deltachat-stress-XXXXXX";
+	char*        dbfile = NULL, *blobdir = NULL;
+
+	assert( mkdtemp(dir) );
+	dbfile  = mr_mprintf("%s/stress.db", dir);
+	blobdir = mr_mprintf("%s/blobs", dir);
+	mr_create_folder(blobdir, mailbox);
+	assert( mrmailbox_open(mailbox, dbfile, blobdir) );
+
+	free(dbfile);
+	free(blobdir);
+	return mailbox;
+}
+
+
+static mrmailbox_t* stress_new_standin_mailbox(standin_t* standin, mrengine_t* engine, const char* addr)
+{
+	mrmailbox_t* mailbox = stress_new_temp_mailbox(stress_sync_event, engine);
+
+	mrmailbox_set_config    (mailbox, "configured_addr",         addr);
+	mrmailbox_set_config    (mailbox, "configured_mail_server",  "127.0.0.1");
+	mrmailbox_set_config_int(mailbox, "configured_mail_port",    standin_get_imap_port(standin));
+	mrmailbox_set_config    (mailbox, "configured_mail_user",    addr);
+	mrmailbox_set_config    (mailbox, "configured_mail_pw",      "stress");
+	mrmailbox_set_config    (mailbox, "configured_send_server",  "127.0.0.1");
+	mrmailbox_set_config_int(mailbox, "configured_send_port",    standin_get_smtp_port(standin));
+	mrmailbox_set_config    (mailbox, "configured_send_user",    addr);
+	mrmailbox_set_config    (mailbox, "configured_send_pw",      "stress");
+	mrmailbox_set_config_int(mailbox, "configured_server_flags", MR_AUTH_NORMAL|MR_IMAP_SOCKET_PLAIN|MR_SMTP_SOCKET_PLAIN);
+	mrmailbox_set_config_int(mailbox, "configured",              1);
+
+	return mailbox;
+}
+
+
+static void stress_unref_standin_mailbox(mrmailbox_t* mailbox)
+{
+	char*          dbfile = safe_strdup(mailbox->m_dbfile), *blobdir = safe_strdup(mailbox->m_blobdir), *p;
+	DIR*           dir_handle;
+	struct dirent* dir_entry;
+
+	mrmailbox_disconnect(mailbox);
+	mrmailbox_close(mailbox);
+	mrmailbox_unref(mailbox);
+
+	if( (dir_handle=opendir(blobdir))!=NULL ) {
+		while( (dir_entry=readdir(dir_handle))!=NULL ) {
+			if( strcmp(dir_entry->d_name, ".")!=0 && strcmp(dir_entry->d_name, "..")!=0 ) {
+				char* path = mr_mprintf("%s/%s", blobdir, dir_entry->d_name);
+				unlink(path);
+				free(path);
+			}
+		}
+		closedir(dir_handle);
+	}
+	rmdir(blobdir);
+	unlink(dbfile);
+	if( (p=strrchr(dbfile, '/'))!=NULL ) {
+		*p = 0;
+		rmdir(dbfile);
+	}
+
+	free(dbfile);
+	free(blobdir);
+}
+
+
+static int stress_has_config(mrmailbox_t* mailbox, const char* key)
+{
+	char* value = mrmailbox_get_config(mailbox, key, NULL);
+	int   ret = value!=NULL;
+	free(value);
+	return ret;
+}
+
+
+/* the watch thread has finished the first fetch pass and waits in IDLE */
+static int stress_is_idling(mrmailbox_t* mailbox)
+{
+	return mailbox->m_imap->m_enter_watch_wait_time != 0;
+}
+
+
+static uint32_t stress_get_msg_id(mrmailbox_t* mailbox, const char* rfc724_mid)
+{
+	uint32_t msg_id;
+	mrsqlite3_lock(mailbox->m_sql);
+		msg_id = mrmailbox_rfc724_mid_exists__(mailbox, rfc724_mid, NULL, NULL);
+	mrsqlite3_unlock(mailbox->m_sql);
+	return msg_id;
+}
+
+
+/* creates a message with the given attachment as the only part or a text message if the attachment is NULL */
+static char* stress_create_msg(const char* rfc724_mid, const char* attachment, size_t attachment_bytes)
+{
+	mrstrbuilder_t ret;
+	size_t         pos;
+
+	mrstrbuilder_init(&ret, attachment_bytes*4/3 + 1024);
+	mrstrbuilder_catf(&ret,
+		"From: sender@stress.localhost\r\n"
+		"To: stress@localhost\r\n"
+		"Subject: stress\r\n"
+		"Message-ID: <%s>\r\n"
+		"Date: Mon, 02 Oct 2017 00:00:00 +0000\r\n"
+		"MIME-Version: 1.0\r\n", rfc724_mid);
+
+	if( attachment ) {
+		mrstrbuilder_cat(&ret,
+			"Content-Type: application/octet-stream\r\n"
+			"Content-Disposition: attachment; filename=\"stress.bin\"\r\n"
+			"Content-Transfer-Encoding: base64\r\n"
+			"\r\n");
+		for( pos = 0; pos < attachment_bytes; pos += 57 ) {
+			char* line = encode_base64(&attachment[pos], attachment_bytes-pos < 57? attachment_bytes-pos : 57);
+			mrstrbuilder_cat(&ret, line);
+			mrstrbuilder_cat(&ret, "\r\n");
+			free(line);
+		}
+	}
+	else {
+		mrstrbuilder_cat(&ret,
+			"Content-Type: text/plain\r\n"
+			"\r\n"
+			"hello\r\n");
+	}
+
+	return ret.m_buf;
+}
+
+
+/* the configure test answers the autoconfig requests itself; each answer is delayed, so that fetching the URLs
+one after another takes noticeably longer than fetching them in parallel */
+#define STRESS_AUTOCONF_DELAY_MS 500
+#define STRESS_AUTOCONF_XML \
+	"<clientConfig version=\"1.1\"><emailProvider id=\"stress.localhost\">" \
+	"<incomingServer type=\"imap\"><hostname>127.0.0.1</hostname><port>%i</port><socketType>plain</socketType><username>%%EMAILADDRESS%%</username></incomingServer>" \
+	"<outgoingServer type=\"smtp\"><hostname>127.0.0.1</hostname><port>%i</port><socketType>plain</socketType><username>%%EMAILADDRESS%%</username></outgoingServer>" \
+	"</emailProvider></clientConfig>"
+
+
+static int             s_autoconf_imap_port = 0;
+static int             s_autoconf_smtp_port = 0;
+static int             s_autoconf_get_cnt = 0;
+static pthread_mutex_t s_autoconf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uintptr_t stress_configure_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	const char* url = (const char*)data1;
+
+	if( event != MR_EVENT_HTTP_GET ) {
+		return 0; /* no strings, not offline */
+	}
+
+	pthread_mutex_lock(&s_autoconf_mutex);
+		s_autoconf_get_cnt++;
+	pthread_mutex_unlock(&s_autoconf_mutex);
+
+	if( strncmp(url, "https://autoconfig.stress.localhost/", 36)==0 ) {
+		usleep(STRESS_AUTOCONF_DELAY_MS*3*1000); /* the most specific source answers last, but must win */
+		return (uintptr_t)mr_mprintf(STRESS_AUTOCONF_XML, s_autoconf_imap_port, s_autoconf_smtp_port);
+	}
+	else if( strncmp(url, "http://stress.localhost/.well-known/", 36)==0 ) {
+		return (uintptr_t)mr_mprintf(STRESS_AUTOCONF_XML, 1, 1); /* a less specific source answers at once with unusable ports */
+	}
+
+	usleep(STRESS_AUTOCONF_DELAY_MS*1000);
+	return 0;
+}
+
+
+/* set the servers as the user would do, this disables autoconfig */
+static void stress_set_server_config(mrmailbox_t* mailbox, const char* server, int imap_port, int smtp_port)
+{
+	mrmailbox_set_config    (mailbox, "mail_server",  server);
+	mrmailbox_set_config_int(mailbox, "mail_port",    imap_port);
+	mrmailbox_set_config    (mailbox, "send_server",  server);
+	mrmailbox_set_config_int(mailbox, "send_port",    smtp_port);
+	mrmailbox_set_config_int(mailbox, "server_flags", MR_AUTH_NORMAL|MR_IMAP_SOCKET_PLAIN|MR_SMTP_SOCKET_PLAIN);
+}
+
+
+/* returns the milliseconds mrmailbox_configure_and_connect() took or -1 if it failed */
+static long stress_configure(mrmailbox_t* mailbox)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if( !mrmailbox_configure_and_connect(mailbox) ) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec-start.tv_sec)*1000 + (end.tv_nsec-start.tv_nsec)/1000000;
+}
+
+
+/* a loopback port nobody listens on, connecting to it is refused */
+static int stress_get_closed_port()
+{
+	struct sockaddr_in addr;
+	socklen_t          addr_len = sizeof(addr);
+	int                fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert( fd >= 0 );
+	assert( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 );
+	assert( getsockname(fd, (struct sockaddr*)&addr, &addr_len) == 0 );
+	close(fd);
+
+	return ntohs(addr.sin_port);
+}
+
+
+/* 1=the resolver returns ::1 before 127.0.0.1 for "localhost" */
+static int stress_localhost_prefers_ipv6()
+{
+	struct addrinfo  hints, *res = NULL, *ai;
+	int              has_ipv4 = 0, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if( getaddrinfo("localhost", "143", &hints, &res) != 0 ) {
+		return 0;
+	}
+
+	for( ai = res; ai != NULL; ai = ai->ai_next ) {
+		has_ipv4 |= ai->ai_family==AF_INET;
+	}
+	ret = res->ai_family==AF_INET6 && has_ipv4;
+
+	freeaddrinfo(res);
+	return ret;
+}
+
+
+/* make [::1]:port a dead address: the port listens but never accepts, once the backlog is full, connection
+attempts hang until they time out.  fds must have room for STRESS_DEAD_FDS descriptors, returns 0 on errors. */
+#define STRESS_DEAD_FDS 4
+static int stress_kill_ipv6_port(int port, int* fds)
+{
+	struct sockaddr_in6 addr;
+	int                 i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr   = in6addr_loopback;
+	addr.sin6_port   = htons(port);
+
+	for( i = 0; i < STRESS_DEAD_FDS; i++ ) {
+		fds[i] = -1;
+	}
+
+	if( (fds[0]=socket(AF_INET6, SOCK_STREAM, 0)) < 0
+	 || bind(fds[0], (struct sockaddr*)&addr, sizeof(addr)) != 0
+	 || listen(fds[0], 0) != 0 ) {
+		return 0;
+	}
+
+	for( i = 1; i < STRESS_DEAD_FDS; i++ ) {
+		if( (fds[i]=socket(AF_INET6, SOCK_STREAM|SOCK_NONBLOCK, 0)) < 0 ) {
+			return 0;
+		}
+		connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)); /* completes or hangs in the background */
+	}
+
+	return 1;
+}
+
+
 void stress_functions(mrmailbox_t* mailbox)
 {
 	/* test mrsimplify and mrsaxparser (indirectly used by mrsimplify)
@@ -451,6 +781,116 @@ void stress_functions(mrmailbox_t* mailbox)
 		mrarray_unref(arr);
 	}
 
+	/* test mrhash_t against a simple model: all key classes, copied and uncopied keys and key lengths around the
+	inline key size and the 8-byte words used for hashing; only a quarter of the keys are in the table at a time
+	while keys are added and removed at random, so deleted slots pile up and the table is rebuilt at its size
+	 **************************************************************************/
+
+	{
+		#define HASH_TEST_KEYS   400
+		#define HASH_TEST_LIVE   (HASH_TEST_KEYS/4)
+		#define HASH_TEST_OPS    60000
+		#define HASH_TEST_MAXLEN (MRHASH_INLINE_KEY+16)
+		#define HASH_TEST_PKEY(k) (keyClass==MRHASH_INT? NULL : (const void*)keys[(k)])
+		#define HASH_TEST_NKEY(k) (keyClass==MRHASH_INT? (int)((k)*0x9E3779B1U) : (keyClass==MRHASH_POINTER? 0 : lens[(k)]))
+		static const int s_modes[][2] = { {MRHASH_INT, 0}, {MRHASH_POINTER, 0}, {MRHASH_STRING, 0}, {MRHASH_STRING, 1}, {MRHASH_BINARY, 0}, {MRHASH_BINARY, 1} };
+		char             keys[HASH_TEST_KEYS][HASH_TEST_MAXLEN], query[HASH_TEST_MAXLEN];
+		int              lens[HASH_TEST_KEYS];
+		void*            model[HASH_TEST_KEYS];
+		uint32_t         seed = 1;
+
+		/* the keys are 3..40 bytes long and end with a unique number */
+		for( int k = 0; k < HASH_TEST_KEYS; k++ ) {
+			lens[k] = 3 + k%(HASH_TEST_MAXLEN-2);
+			for( int j = 0; j < lens[k]-3; j++ ) {
+				keys[k][j] = "abcXYZ[{@`"[(k*7+j)%10];
+			}
+			keys[k][lens[k]-3] = '0' + k/100;
+			keys[k][lens[k]-2] = '0' + k/10%10;
+			keys[k][lens[k]-1] = '0' + k%10;
+		}
+
+		for( int m = 0; m < (int)(sizeof(s_modes)/sizeof(s_modes[0])); m++ )
+		{
+			int           keyClass = s_modes[m][0], copyKey = s_modes[m][1], live = 0, rebuilt = 0, i, k;
+			mrhash_t      hash;
+			mrhashelem_t* elem;
+
+			mrhash_init(&hash, keyClass, copyKey);
+			memset(model, 0, sizeof(model));
+
+			for( i = 0; i < HASH_TEST_OPS; i++ )
+			{
+				const void* pKey;
+				void*       data = (void*)(uintptr_t)(i+1);
+				int         htsize = hash.htsize, tombstones = hash.tombstones;
+
+				seed = seed*1103515245 + 12345;
+				k = (seed>>8) % HASH_TEST_KEYS;
+				pKey = HASH_TEST_PKEY(k);
+				if( copyKey ) {
+					memcpy(query, keys[k], lens[k]); /* insert from a buffer that is overwritten afterwards */
+					pKey = query;
+				}
+
+				if( model[k]==NULL && live < HASH_TEST_LIVE ) {
+					assert( mrhash_insert(&hash, pKey, HASH_TEST_NKEY(k), data) == NULL );
+					model[k] = data;
+					live++;
+				}
+				else if( model[k] && (live >= HASH_TEST_LIVE || (seed>>30)==0) ) {
+					assert( mrhash_insert(&hash, pKey, HASH_TEST_NKEY(k), NULL) == model[k] );
+					model[k] = NULL;
+					live--;
+				}
+				else if( model[k] && (seed>>30)==1 ) {
+					assert( mrhash_insert(&hash, pKey, HASH_TEST_NKEY(k), data) == model[k] );
+					model[k] = data;
+				}
+				memset(query, '#', sizeof(query));
+
+				if( hash.htsize==htsize && tombstones > 1 && hash.tombstones==0 ) {
+					rebuilt++; /* an insert reuses at most one deleted slot */
+				}
+
+				assert( mrhash_count(&hash) == live );
+				assert( mrhash_find(&hash, HASH_TEST_PKEY(k), HASH_TEST_NKEY(k)) == model[k] );
+				if( keyClass==MRHASH_STRING || keyClass==MRHASH_BINARY ) {
+					/* case is ignored for A-Z in string keys only */
+					int changed = stress_hash_variant(query, keys[k], lens[k], 1);
+					assert( mrhash_find(&hash, query, lens[k]) == ((keyClass==MRHASH_STRING || !changed)? model[k] : NULL) );
+					if( stress_hash_variant(query, keys[k], lens[k], 0) ) {
+						assert( mrhash_find(&hash, query, lens[k]) == NULL );
+					}
+					assert( mrhash_find(&hash, keys[k], lens[k]-1) == NULL );
+				}
+			}
+			assert( rebuilt > 0 );
+
+			for( k = 0; k < HASH_TEST_KEYS; k++ ) {
+				assert( mrhash_find(&hash, HASH_TEST_PKEY(k), HASH_TEST_NKEY(k)) == model[k] );
+			}
+
+			for( elem = mrhash_first(&hash), i = 0; elem; elem = mrhash_next(elem), i++ ) {
+				assert( mrhash_find(&hash, mrhash_key(elem), mrhash_keysize(elem)) == mrhash_data(elem) );
+				if( copyKey ) {
+					assert( (mrhash_key(elem)==elem->inlineKey) == (mrhash_keysize(elem) <= MRHASH_INLINE_KEY) );
+				}
+				else if( keyClass != MRHASH_INT ) {
+					assert( (char*)mrhash_key(elem) >= keys[0] && (char*)mrhash_key(elem) < keys[HASH_TEST_KEYS] );
+				}
+			}
+			assert( i == live );
+
+			mrhash_clear(&hash);
+			assert( mrhash_count(&hash)==0 && mrhash_first(&hash)==NULL );
+			assert( mrhash_find(&hash, HASH_TEST_PKEY(0), HASH_TEST_NKEY(0)) == NULL );
+			assert( mrhash_insert(&hash, HASH_TEST_PKEY(0), HASH_TEST_NKEY(0), keys) == NULL );
+			assert( mrhash_find(&hash, HASH_TEST_PKEY(0), HASH_TEST_NKEY(0)) == keys );
+			mrhash_clear(&hash);
+		}
+	}
+
 	/* test mrparam
 	 **************************************************************************/
 
@@ -751,6 +1191,46 @@ void stress_functions(mrmailbox_t* mailbox)
 			free(plain);
 		}
 
+		{
+			/* a message encrypted in chunks of varying sizes, the armor and the partial body lengths span several chunks */
+			#define STREAM_TEST_BYTES (100*1024)
+			mrkeyring_t* public_keyring = mrkeyring_new(), *private_keyring = mrkeyring_new();
+			mrkeyring_add(public_keyring, public_key);
+			mrkeyring_add(private_keyring, private_key);
+			char* text = malloc(STREAM_TEST_BYTES);
+			for( size_t i = 0; i < STREAM_TEST_BYTES; i++ ) {
+				text[i] = (i%64==63)? '\n' : 'A' + (i*7)%57;
+			}
+			for( int use_armor = 0; use_armor <= 1; use_armor++ ) {
+				char* ctext = NULL;
+				size_t ctext_bytes = 0;
+				mrpgp_encrypt_t* encrypt = mrpgp_pk_encrypt_open(mailbox, public_keyring, private_key, use_armor);
+				assert( encrypt );
+				size_t pos = 0, chunk = 1;
+				while( pos < STREAM_TEST_BYTES ) {
+					size_t n = chunk < STREAM_TEST_BYTES-pos? chunk : STREAM_TEST_BYTES-pos;
+					assert( mrpgp_pk_encrypt_write(encrypt, &text[pos], n) );
+					pos += n;
+					chunk = chunk*3 + 1; /* 1, 4, 13, ... 9841, 29524 bytes */
+				}
+				assert( mrpgp_pk_encrypt_close(encrypt, (void**)&ctext, &ctext_bytes) );
+				assert( ctext && ctext_bytes > 0 );
+				assert( (strncmp(ctext, "-----BEGIN PGP MESSAGE-----", 27)==0) == use_armor );
+
+				void* plain = NULL;
+				int validation_errors = 0;
+				int ok = mrpgp_pk_decrypt(mailbox, ctext, ctext_bytes, private_keyring, public_key/*for validate*/, use_armor, &plain, &plain_bytes, &validation_errors);
+				assert( ok && plain );
+				assert( plain_bytes == STREAM_TEST_BYTES && memcmp(plain, text, STREAM_TEST_BYTES)==0 );
+				assert( validation_errors == 0 );
+				free(plain);
+				free(ctext);
+			}
+			free(text);
+			mrkeyring_unref(private_keyring);
+			mrkeyring_unref(public_keyring);
+		}
+
 		free(ctext_signed);
 		free(ctext_unsigned);
 		mrkey_unref(public_key2);
@@ -787,4 +1267,212 @@ void stress_functions(mrmailbox_t* mailbox)
 		assert( res->m_id != 0 );
 		mrlot_unref(res);
 	}
+
+
+	/* test resuming chunked downloads: the stand-in drops the connection in the middle of a chunk,
+	the message is resumed from the spool file on the next fetch and must arrive unchanged;
+	older libetpan versions do not notice the dropped connection inside the literal and would hang here
+	 **************************************************************************/
+
+	#ifdef MAILIMAP_LITERAL_EOF_IS_ERROR
+	{
+		#define LARGE_TEST_BYTES (3*1024*1024) /* base64 makes this > MR_IMAP_CHUNKED_MIN */
+		standin_t*   standin = standin_new(0, 0);
+		char*        attachment = malloc(LARGE_TEST_BYTES), *msg;
+		uint32_t     seed = 1;
+		assert( standin_start(standin) );
+		for( size_t i = 0; i < LARGE_TEST_BYTES; i++ ) {
+			seed = seed*1103515245 + 12345;
+			attachment[i] = (char)(seed>>16);
+		}
+
+		msg = stress_create_msg("first@stress.localhost", NULL, 0); /* the first sync only remembers the UID */
+		standin_add_msg(standin, "INBOX", msg, strlen(msg));
+		free(msg);
+
+		mrmailbox_t* mailbox2 = stress_new_standin_mailbox(standin, NULL, "stress@localhost");
+		mrmailbox_connect(mailbox2);
+		STRESS_WAIT_UNTIL(stress_is_idling(mailbox2))
+
+		for( int truncate_spool = 0; truncate_spool <= 1; truncate_spool++ )
+		{
+			char* large_mid = mr_mprintf("large%i@stress.localhost", truncate_spool);
+			char* trigger_mid = mr_mprintf("trigger%i@stress.localhost", truncate_spool);
+			char* spool_filename = mr_mprintf("%s/" MR_IMAP_SPOOL_FILE, mailbox2->m_blobdir);
+
+			/* the second resp. third chunk is lost, the fetch is tried again after reconnecting */
+			standin_drop_on_fetch(standin, 2+truncate_spool);
+			msg = stress_create_msg(large_mid, attachment, LARGE_TEST_BYTES);
+			standin_add_msg(standin, "INBOX", msg, strlen(msg));
+			free(msg);
+			STRESS_WAIT_UNTIL(stress_has_config(mailbox2, "imap.spool") && stress_is_idling(mailbox2))
+			assert( stress_get_msg_id(mailbox2, large_mid) == 0 );
+
+			/* a spool file shorter than the saved state must not be padded, the download starts over */
+			if( truncate_spool ) {
+				assert( truncate(spool_filename, 1000) == 0 );
+			}
+
+			/* the next message triggers a fetch that continues the large one */
+			msg = stress_create_msg(trigger_mid, NULL, 0);
+			standin_add_msg(standin, "INBOX", msg, strlen(msg));
+			free(msg);
+			STRESS_WAIT_UNTIL(stress_get_msg_id(mailbox2, large_mid) && stress_get_msg_id(mailbox2, trigger_mid))
+			assert( !stress_has_config(mailbox2, "imap.spool") && !mr_file_exist(spool_filename) );
+
+			mrmsg_t* large_msg = mrmailbox_get_msg(mailbox2, stress_get_msg_id(mailbox2, large_mid));
+			char*    file = mrmsg_get_file(large_msg);
+			void*    buf = NULL;
+			size_t   buf_bytes = 0;
+			assert( mr_read_file(file, &buf, &buf_bytes, mailbox2) );
+			assert( buf_bytes == LARGE_TEST_BYTES && memcmp(buf, attachment, LARGE_TEST_BYTES)==0 );
+			free(buf);
+			free(file);
+			mrmsg_unref(large_msg);
+
+			free(spool_filename);
+			free(trigger_mid);
+			free(large_mid);
+		}
+
+		stress_unref_standin_mailbox(mailbox2);
+		standin_unref(standin);
+		free(attachment);
+	}
+	#else
+	mrmailbox_log_info(mailbox, 0, "Resume test skipped, libetpan does not detect connections closed inside a literal.");
+	#endif
+
+
+	/* test the engine: several mailboxes share a thread pool, receive from the stand-in and are shut down cleanly;
+	with one thread, the fetch task must not wait for parse tasks that have no thread left to run on
+	 **************************************************************************/
+
+	{
+		#define ENGINE_TEST_MAILBOXES 4
+		#define ENGINE_TEST_MSGS      20
+		static const int s_threads[] = { 1, 2, 3, 8 };
+		for( int t = 0; t < (int)(sizeof(s_threads)/sizeof(s_threads[0])); t++ )
+		{
+			standin_t*   standin = standin_new(0, 0);
+			mrengine_t*  engine = mrengine_new(s_threads[t]);
+			mrmailbox_t* mailboxes[ENGINE_TEST_MAILBOXES];
+			char*        msg;
+			assert( standin_start(standin) );
+			assert( mrengine_get_threads(engine) == s_threads[t] );
+
+			msg = stress_create_msg("first@stress.localhost", NULL, 0); /* the first sync only remembers the UID */
+			standin_add_msg(standin, "INBOX", msg, strlen(msg));
+			free(msg);
+
+			for( int m = 0; m < ENGINE_TEST_MAILBOXES; m++ ) {
+				char* addr = mr_mprintf("engine%i@localhost", m);
+				mailboxes[m] = stress_new_standin_mailbox(standin, engine, addr);
+				mrmailbox_connect(mailboxes[m]);
+				free(addr);
+			}
+			for( int m = 0; m < ENGINE_TEST_MAILBOXES; m++ ) {
+				STRESS_WAIT_UNTIL(stress_is_idling(mailboxes[m]))
+			}
+
+			/* all mailboxes log in to the same INBOX, so each of them receives all messages */
+			for( int i = 0; i < ENGINE_TEST_MSGS; i++ ) {
+				char* rfc724_mid = mr_mprintf("engine%i@stress.localhost", i);
+				msg = stress_create_msg(rfc724_mid, NULL, 0);
+				standin_add_msg(standin, "INBOX", msg, strlen(msg));
+				free(msg);
+				free(rfc724_mid);
+			}
+			for( int m = 0; m < ENGINE_TEST_MAILBOXES; m++ ) {
+				for( int i = 0; i < ENGINE_TEST_MSGS; i++ ) {
+					char* rfc724_mid = mr_mprintf("engine%i@stress.localhost", i);
+					STRESS_WAIT_UNTIL(stress_get_msg_id(mailboxes[m], rfc724_mid))
+					free(rfc724_mid);
+				}
+			}
+
+			/* the mailboxes are disconnected while the engine is running; afterwards, the engine has no tasks left */
+			for( int m = 0; m < ENGINE_TEST_MAILBOXES; m++ ) {
+				stress_unref_standin_mailbox(mailboxes[m]);
+			}
+			mrengine_unref(engine);
+			standin_unref(standin);
+		}
+	}
+
+
+	/* test configuring against the stand-in: the autoconfig URLs are fetched in parallel and the most specific
+	result wins; entered settings race the SMTP port against a STARTTLS probe on port 587; and if "localhost"
+	resolves to ::1 first, a dead ::1 must only cost the Happy Eyeballs attempt delay, not the connect timeout
+	 **************************************************************************/
+
+	{
+		standin_t*   standin = standin_new(0, 0);
+		mrmailbox_t* mailbox2;
+		long         ms;
+		int          dead_fds[2*STRESS_DEAD_FDS], i;
+		assert( standin_start(standin) );
+		for( i = 0; i < 2*STRESS_DEAD_FDS; i++ ) {
+			dead_fds[i] = -1;
+		}
+		s_autoconf_imap_port = standin_get_imap_port(standin);
+		s_autoconf_smtp_port = standin_get_smtp_port(standin);
+
+		/* autoconfig, one after another, the fetches would take 7 delays */
+		s_autoconf_get_cnt = 0;
+		mailbox2 = stress_new_temp_mailbox(stress_configure_event, NULL);
+		mrmailbox_set_config(mailbox2, "addr",    "configure@stress.localhost");
+		mrmailbox_set_config(mailbox2, "mail_pw", "stress");
+		ms = stress_configure(mailbox2);
+		assert( ms >= STRESS_AUTOCONF_DELAY_MS*3 && ms < STRESS_AUTOCONF_DELAY_MS*6 );
+		assert( s_autoconf_get_cnt == 6 ); /* Thunderbird's database is not asked if there is a result */
+		assert( mrmailbox_get_config_int(mailbox2, "configured_mail_port", 0) == s_autoconf_imap_port );
+		assert( mrmailbox_get_config_int(mailbox2, "configured_send_port", 0) == s_autoconf_smtp_port );
+		assert( mrimap_is_connected(mailbox2->m_imap) && mrsmtp_is_connected(mailbox2->m_smtp) );
+		stress_unref_standin_mailbox(mailbox2);
+
+		/* entered settings: the plain SMTP port wins, the STARTTLS probe on 127.0.0.1:587 finds no server */
+		s_autoconf_get_cnt = 0;
+		mailbox2 = stress_new_temp_mailbox(stress_configure_event, NULL);
+		mrmailbox_set_config(mailbox2, "addr",    "configure@stress.localhost");
+		mrmailbox_set_config(mailbox2, "mail_pw", "stress");
+		stress_set_server_config(mailbox2, "127.0.0.1", s_autoconf_imap_port, s_autoconf_smtp_port);
+		assert( stress_configure(mailbox2) >= 0 );
+		assert( s_autoconf_get_cnt == 0 );
+		assert( mrmailbox_get_config_int(mailbox2, "configured_send_port", 0) == s_autoconf_smtp_port );
+		assert( mrmailbox_get_config_int(mailbox2, "configured_server_flags", 0) & MR_SMTP_SOCKET_PLAIN );
+		assert( mrsmtp_is_connected(mailbox2->m_smtp) );
+
+		/* if both SMTP probes fail, configuring fails, disconnects and keeps the previous configuration */
+		stress_set_server_config(mailbox2, "127.0.0.1", s_autoconf_imap_port, stress_get_closed_port());
+		assert( stress_configure(mailbox2) == -1 );
+		assert( !mrimap_is_connected(mailbox2->m_imap) && !mrsmtp_is_connected(mailbox2->m_smtp) );
+		assert( mrmailbox_get_config_int(mailbox2, "configured_send_port", 0) == s_autoconf_smtp_port );
+
+		/* Happy Eyeballs; the stand-in listens on 127.0.0.1 only, so this needs "localhost" to be dual-stack.
+		Only the bundled libetpan races the addresses, others try them one after another. */
+		#ifdef LIBETPAN_HAPPY_EYEBALLS
+		if( stress_localhost_prefers_ipv6()
+		 && stress_kill_ipv6_port(s_autoconf_imap_port, &dead_fds[0])
+		 && stress_kill_ipv6_port(s_autoconf_smtp_port, &dead_fds[STRESS_DEAD_FDS]) )
+		{
+			stress_set_server_config(mailbox2, "localhost", s_autoconf_imap_port, s_autoconf_smtp_port);
+			ms = stress_configure(mailbox2);
+			assert( ms >= 0 && ms < 5000 /* the IMAP connect timeout is 30 seconds */ );
+			assert( mrimap_is_connected(mailbox2->m_imap) && mrsmtp_is_connected(mailbox2->m_smtp) );
+		}
+		else
+		{
+			mrmailbox_log_info(mailbox, 0, "Happy Eyeballs test skipped, \"localhost\" does not resolve to ::1 first or ::1 cannot be used.");
+		}
+		#else
+		mrmailbox_log_info(mailbox, 0, "Happy Eyeballs test skipped, libetpan does not support it.");
+		#endif
+
+		for( i = 0; i < 2*STRESS_DEAD_FDS; i++ ) {
+			if( dead_fds[i] >= 0 ) { close(dead_fds[i]); }
+		}
+		stress_unref_standin_mailbox(mailbox2);
+		standin_unref(standin);
+	}
 }
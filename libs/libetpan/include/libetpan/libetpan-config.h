@@ -14,6 +14,8 @@
 #include <inttypes.h>
 #define MAIL_DIR_SEPARATOR '/'
 #define MAIL_DIR_SEPARATOR_S "/"
+/* mail_tcp_connect*() race the addresses of a host as described in RFC 8305 (Happy Eyeballs) */
+#define LIBETPAN_HAPPY_EYEBALLS 1
 #ifdef _MSC_VER
 # ifdef LIBETPAN_DLL
 # define LIBETPAN_EXPORT __declspec(dllexport)
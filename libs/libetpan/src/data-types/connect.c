@@ -61,6 +61,7 @@
 #	endif
 #	include <unistd.h>
 #	include <arpa/inet.h>
+#	include <sys/time.h>
 #endif
 
 uint16_t mail_get_service_port(const char * name, char * protocol)
@@ -167,6 +168,233 @@ static int wait_connect(int s, int r, time_t timeout_seconds)
   return 0;
 }
 
+#if defined(HAVE_IPV6) && !defined(WIN32)
+/*
+  Happy Eyeballs, RFC 8305: instead of waiting for every address to time out
+  before the next one is tried, a new attempt is started after
+  HE_ATTEMPT_DELAY_MS while the earlier ones are still pending.  The address
+  families are interleaved, so a broken IPv6 route only costs the attempt
+  delay.  The first socket that connects wins, the others are closed.
+*/
+
+#define HE_ATTEMPT_DELAY_MS 250
+#define HE_MAX_ADDRS 16
+
+static int he_order_addrs(struct addrinfo * res, struct addrinfo ** addrs, int max)
+{
+  struct addrinfo * first[HE_MAX_ADDRS];
+  struct addrinfo * second[HE_MAX_ADDRS];
+  struct addrinfo * ai;
+  int first_count = 0;
+  int second_count = 0;
+  int count = 0;
+  int i;
+  
+  /* the first family is the one the resolver preferred */
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if (ai->ai_family == res->ai_family) {
+      if (first_count < HE_MAX_ADDRS)
+        first[first_count ++] = ai;
+    }
+    else {
+      if (second_count < HE_MAX_ADDRS)
+        second[second_count ++] = ai;
+    }
+  }
+  
+  for (i = 0 ; (i < first_count || i < second_count) && count < max ; i ++) {
+    if (i < first_count)
+      addrs[count ++] = first[i];
+    if (i < second_count && count < max)
+      addrs[count ++] = second[i];
+  }
+  
+  return count;
+}
+
+static int he_start_attempt(struct addrinfo * ai, int * connected)
+{
+  int s;
+  int r;
+  
+  * connected = 0;
+  
+  s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (s == -1)
+    return -1;
+  
+#ifdef SO_NOSIGPIPE
+  int kOne = 1;
+  if (setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &kOne, sizeof(kOne)) != 0) {
+    close(s);
+    return -1;
+  }
+#endif
+  
+  if (prepare_fd(s) == -1) {
+    close(s);
+    return -1;
+  }
+  
+  r = connect(s, ai->ai_addr, ai->ai_addrlen);
+  if (r == 0) {
+    * connected = 1;
+  }
+  else if (errno != EINPROGRESS) {
+    close(s);
+    return -1;
+  }
+  
+  return s;
+}
+
+static void he_add_ms(struct timeval * tv, const struct timeval * from, long ms)
+{
+  tv->tv_sec = from->tv_sec + ms / 1000;
+  tv->tv_usec = from->tv_usec + (ms % 1000) * 1000;
+  if (tv->tv_usec >= 1000000) {
+    tv->tv_sec ++;
+    tv->tv_usec -= 1000000;
+  }
+}
+
+static int he_connect(struct addrinfo * res, time_t timeout_seconds)
+{
+  struct addrinfo * addrs[HE_MAX_ADDRS];
+  int fds[HE_MAX_ADDRS];
+  int addr_count;
+  int started = 0;
+  int pending = 0;
+  int winner = -1;
+  int connected;
+  int ready;
+  int i;
+  int r;
+  long timeout_ms;
+  struct timeval now;
+  struct timeval next_attempt;
+  struct timeval deadline;
+  struct timeval wait;
+#if !USE_POLL
+  fd_set fds_set;
+  int max_fd;
+#else
+  /* select() cannot wait for descriptors >= FD_SETSIZE */
+  struct pollfd pfds[HE_MAX_ADDRS];
+  int poll_count;
+  int j;
+#endif
+  
+  if (timeout_seconds == 0)
+    timeout_ms = mailstream_network_delay.tv_sec * 1000 + mailstream_network_delay.tv_usec / 1000;
+  else
+    timeout_ms = timeout_seconds * 1000;
+  
+  addr_count = he_order_addrs(res, addrs, HE_MAX_ADDRS);
+  
+  gettimeofday(&now, NULL);
+  next_attempt = now;
+  deadline = now;
+  
+  while (winner == -1) {
+    gettimeofday(&now, NULL);
+    
+    /* start the next attempt when the previous ones failed or the attempt delay has passed */
+    if (started < addr_count && (pending == 0 || !timercmp(&now, &next_attempt, <))) {
+      fds[started] = he_start_attempt(addrs[started], &connected);
+      if (fds[started] != -1) {
+        if (connected) {
+          winner = started;
+        }
+        pending ++;
+        he_add_ms(&next_attempt, &now, HE_ATTEMPT_DELAY_MS);
+        he_add_ms(&deadline, &now, timeout_ms); /* the last attempt gets the full timeout */
+      }
+      started ++;
+      continue;
+    }
+    
+    if (pending == 0 || !timercmp(&now, &deadline, <))
+      break;
+    
+    /* wait until an attempt completes, the next attempt is due or the deadline is reached */
+    if (started < addr_count && timercmp(&next_attempt, &deadline, <))
+      timersub(&next_attempt, &now, &wait);
+    else
+      timersub(&deadline, &now, &wait);
+    if (wait.tv_sec < 0) {
+      wait.tv_sec = 0;
+      wait.tv_usec = 0;
+    }
+    
+#if !USE_POLL
+    FD_ZERO(&fds_set);
+    max_fd = -1;
+    for (i = 0 ; i < started ; i ++) {
+      if (fds[i] != -1) {
+        FD_SET(fds[i], &fds_set);
+        if (fds[i] > max_fd)
+          max_fd = fds[i];
+      }
+    }
+    
+    r = select(max_fd + 1, NULL, &fds_set, NULL, &wait);
+#else
+    poll_count = 0;
+    for (i = 0 ; i < started ; i ++) {
+      if (fds[i] != -1) {
+        pfds[poll_count].fd = fds[i];
+        pfds[poll_count].events = POLLOUT;
+        pfds[poll_count].revents = 0;
+        poll_count ++;
+      }
+    }
+    
+    r = poll(pfds, poll_count, wait.tv_sec * 1000 + (wait.tv_usec + 999) / 1000);
+#endif
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    
+#if USE_POLL
+    j = 0;
+#endif
+    for (i = 0 ; i < started && winner == -1 ; i ++) {
+      if (fds[i] == -1)
+        continue;
+#if !USE_POLL
+      ready = FD_ISSET(fds[i], &fds_set);
+#else
+      ready = (pfds[j ++].revents != 0); /* pfds has the pending attempts in the order of fds */
+#endif
+      if (ready) {
+        if (verify_sock_errors(fds[i]) == 0) {
+          winner = i;
+        }
+        else {
+          close(fds[i]);
+          fds[i] = -1;
+          pending --;
+          next_attempt = now; /* a failed attempt does not delay the next one */
+        }
+      }
+    }
+  }
+  
+  for (i = 0 ; i < started ; i ++) {
+    if (i != winner && fds[i] != -1)
+      close(fds[i]);
+  }
+  
+  if (winner == -1)
+    return -1;
+  
+  return fds[winner];
+}
+#endif
+
 int mail_tcp_connect(const char * server, uint16_t port)
 {
   return mail_tcp_connect_with_local_address(server, port, NULL, 0);
@@ -259,6 +487,16 @@ int mail_tcp_connect_with_local_address_timeout(const char * server, uint16_t po
   if (getaddrinfo(server, port_str, &hints, &res) != 0)
     goto err;
 
+#ifndef WIN32
+  if ((local_address == NULL) && (local_port == 0)) {
+    s = he_connect(res, timeout);
+    freeaddrinfo(res);
+    if (s == -1)
+      goto err;
+    return s;
+  }
+#endif
+
   s = -1;
   for (ai = res; ai != NULL; ai = ai->ai_next) {
     s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
@@ -113,6 +113,7 @@ struct mailstream_ssl_context
   SSL_CTX * openssl_ssl_ctx;
   X509* client_x509;
   EVP_PKEY *client_pkey;
+  SSL_SESSION * session;
 #else
   gnutls_session session;
   gnutls_x509_crt client_x509;
@@ -463,6 +464,10 @@ static struct mailstream_ssl_data * ssl_data_new_full(int fd, time_t timeout,
   if (ssl_conn == NULL)
     goto free_ctx;
   
+  /* try to resume the session given by mailstream_ssl_set_session_data() */
+  if (ssl_context != NULL && ssl_context->session != NULL)
+    SSL_set_session(ssl_conn, ssl_context->session);
+  
   if (SSL_set_fd(ssl_conn, fd) == 0)
     goto free_ssl_conn;
   
@@ -1372,6 +1377,7 @@ static struct mailstream_ssl_context * mailstream_ssl_context_new(SSL_CTX * open
   ssl_ctx->openssl_ssl_ctx = open_ssl_ctx;
   ssl_ctx->client_x509 = NULL;
   ssl_ctx->client_pkey = NULL;
+  ssl_ctx->session = NULL;
   ssl_ctx->fd = fd;
   
   return ssl_ctx;
@@ -1379,8 +1385,11 @@ static struct mailstream_ssl_context * mailstream_ssl_context_new(SSL_CTX * open
 
 static void mailstream_ssl_context_free(struct mailstream_ssl_context * ssl_ctx)
 {
-  if (ssl_ctx)
+  if (ssl_ctx) {
+    if (ssl_ctx->session)
+      SSL_SESSION_free(ssl_ctx->session);
     free(ssl_ctx);
+  }
 }
 #else
 static struct mailstream_ssl_context * mailstream_ssl_context_new(gnutls_session session, int fd)
@@ -1427,6 +1436,101 @@ int mailstream_ssl_get_fd(struct mailstream_ssl_context * ssl_context)
   return ssl_context->fd;
 }
 
+int mailstream_ssl_set_session_data(struct mailstream_ssl_context * ssl_context,
+    const unsigned char * data, size_t len)
+{
+#ifdef USE_SSL
+#ifdef USE_GNUTLS
+  /* not implemented */
+  return -1;
+#else
+  const unsigned char * p = data;
+  SSL_SESSION * session;
+
+  if (ssl_context == NULL || data == NULL || len == 0)
+    return -1;
+
+  session = d2i_SSL_SESSION(NULL, &p, (long) len);
+  if (session == NULL)
+    return -1;
+
+  if (ssl_context->session != NULL)
+    SSL_SESSION_free(ssl_context->session);
+  ssl_context->session = session;
+  return 0;
+#endif /* USE_GNUTLS */
+#else
+  return -1;
+#endif /* USE_SSL */
+}
+
+#ifdef USE_SSL
+#ifndef USE_GNUTLS
+static SSL * mailstream_ssl_get_ssl_conn(mailstream * stream)
+{
+  struct mailstream_ssl_data * data;
+
+  if (stream == NULL || stream->low == NULL || stream->low->driver != mailstream_ssl_driver)
+    return NULL;
+
+  data = stream->low->data;
+  if (data == NULL)
+    return NULL;
+
+  return data->ssl_conn;
+}
+#endif
+#endif
+
+ssize_t mailstream_ssl_get_session_data(mailstream * stream, unsigned char ** data)
+{
+#ifdef USE_SSL
+#ifdef USE_GNUTLS
+  /* not implemented */
+  return -1;
+#else
+  SSL * ssl_conn;
+  SSL_SESSION * session;
+  unsigned char * p;
+  int len;
+
+  if (data == NULL || (ssl_conn = mailstream_ssl_get_ssl_conn(stream)) == NULL)
+    return -1;
+
+  session = SSL_get1_session(ssl_conn);
+  if (session == NULL)
+    return -1;
+
+  len = i2d_SSL_SESSION(session, NULL);
+  if (len <= 0 || (* data = malloc(len)) == NULL) {
+    SSL_SESSION_free(session);
+    return -1;
+  }
+
+  p = * data;
+  i2d_SSL_SESSION(session, &p);
+  SSL_SESSION_free(session);
+  return len;
+#endif /* USE_GNUTLS */
+#else
+  return -1;
+#endif /* USE_SSL */
+}
+
+int mailstream_ssl_session_reused(mailstream * stream)
+{
+#ifdef USE_SSL
+#ifdef USE_GNUTLS
+  return 0;
+#else
+  SSL * ssl_conn = mailstream_ssl_get_ssl_conn(stream);
+  return (ssl_conn != NULL && SSL_session_reused(ssl_conn)) ? 1 : 0;
+#endif /* USE_GNUTLS */
+#else
+  return 0;
+#endif /* USE_SSL */
+}
+
 static struct mailstream_cancel * mailstream_low_ssl_get_cancel(mailstream_low * s)
 {
 #ifdef USE_SSL
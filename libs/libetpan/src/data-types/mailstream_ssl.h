@@ -129,6 +129,21 @@ void * mailstream_ssl_get_openssl_ssl_ctx(struct mailstream_ssl_context * ssl_co
 LIBETPAN_EXPORT
 int mailstream_ssl_get_fd(struct mailstream_ssl_context * ssl_context);
 
+/* TLS session resumption: get the session data of a connected stream, the
+   result must be free()'d; give the data to the ssl_context in the callback
+   of the next connect to resume the session there. */
+#define MAILSTREAM_SSL_HAS_SESSION_DATA 1
+
+LIBETPAN_EXPORT
+int mailstream_ssl_set_session_data(struct mailstream_ssl_context * ssl_context,
+    const unsigned char * data, size_t len);
+
+LIBETPAN_EXPORT
+ssize_t mailstream_ssl_get_session_data(mailstream * stream, unsigned char ** data);
+
+LIBETPAN_EXPORT
+int mailstream_ssl_session_reused(mailstream * stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,9 @@
 
 #define MAILIMAP_H
 
+/* a connection closed in the middle of a literal fails with MAILIMAP_ERROR_STREAM instead of waiting for more data */
+#define MAILIMAP_LITERAL_EOF_IS_ERROR 1
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -6118,7 +6118,8 @@ static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
         }
       }
 
-      if (read_bytes == -1) {
+      if (read_bytes <= 0) {
+        /* 0 is returned if the connection was closed in the middle of the literal */
         res = MAILIMAP_ERROR_STREAM;
         goto free_literal;
       }
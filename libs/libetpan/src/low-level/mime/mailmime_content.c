@@ -1592,24 +1592,235 @@ int mailmime_get_section(struct mailmime * mime,
 /* ************************************************************************* */
 /* MIME part decoding */
 
-static inline signed char get_base64_value(char ch)
+/*
+  base64 and quoted-printable decoding is done for every attachment and for
+  every encrypted message, so the hot loops are table driven and, on x86,
+  vectorized.  The SSSE3 and AVX2 kernels are compiled with target attributes
+  and selected at runtime, so the binary still runs on CPUs without them.
+  The vector kernels only handle blocks consisting of valid characters;
+  everything else (line breaks, padding, garbage) is handled by the scalar
+  code with the original semantics.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86_DISPATCH 1
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const signed char base64_values[256] = {
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+  52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+  -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+  15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+  -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+  41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+/* number of bytes a vector kernel may write beyond the decoded data */
+#define BASE64_DECODE_SLACK 16
+
+#if defined(BASE64_X86_DISPATCH)
+
+/*
+  translate 16 base64 characters to their 6-bit values;
+  returns 0 if there is any character that is not in the base64 alphabet
+*/
+static inline BASE64_TARGET("ssse3") int base64_translate_sse(__m128i * str)
 {
-  if ((ch >= 'A') && (ch <= 'Z'))
-    return ch - 'A';
-  if ((ch >= 'a') && (ch <= 'z'))
-    return ch - 'a' + 26;
-  if ((ch >= '0') && (ch <= '9'))
-    return ch - '0' + 52;
-  switch (ch) {
-  case '+':
-    return 62;
-  case '/':
-    return 63;
-  case '=': /* base64 padding */
-    return -1;
-  default:
-    return -1;
+  const __m128i lut_lo = _mm_setr_epi8(
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(
+    0, 16, 19, 4, -65, -65, -71, -71,
+    0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  __m128i hi_nibbles;
+  __m128i lo_nibbles;
+  __m128i hi;
+  __m128i lo;
+  __m128i eq_2f;
+  __m128i roll;
+
+  hi_nibbles = _mm_and_si128(_mm_srli_epi32(* str, 4), mask_2f);
+  lo_nibbles = _mm_and_si128(* str, mask_2f);
+  hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+    return 0;
+
+  eq_2f = _mm_cmpeq_epi8(* str, mask_2f);
+  roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+  * str = _mm_add_epi8(* str, roll);
+  return 1;
+}
+
+/* pack 16 6-bit values to 12 bytes at the beginning of the vector */
+static inline BASE64_TARGET("ssse3") __m128i base64_pack_sse(__m128i values)
+{
+  __m128i merged;
+
+  merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(merged, _mm_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static inline BASE64_TARGET("avx2") int base64_translate_avx2(__m256i * str)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+    0, 16, 19, 4, -65, -65, -71, -71,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 16, 19, 4, -65, -65, -71, -71,
+    0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+  __m256i hi_nibbles;
+  __m256i lo_nibbles;
+  __m256i hi;
+  __m256i lo;
+  __m256i eq_2f;
+  __m256i roll;
+
+  hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(* str, 4), mask_2f);
+  lo_nibbles = _mm256_and_si256(* str, mask_2f);
+  hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+  lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+  if (!_mm256_testz_si256(lo, hi))
+    return 0;
+
+  eq_2f = _mm256_cmpeq_epi8(* str, mask_2f);
+  roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+  * str = _mm256_add_epi8(* str, roll);
+  return 1;
+}
+
+static inline BASE64_TARGET("avx2") __m256i base64_pack_avx2(__m256i values)
+{
+  __m256i merged;
+
+  merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+  merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+  merged = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  return _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+}
+
+#endif
+
+/*
+  decode as many complete groups of valid base64 characters as possible,
+  stops at the first group containing another character;
+  returns the number of characters consumed, 3/4 of this is written to out
+*/
+static size_t base64_decode_run_scalar(const unsigned char * in, size_t in_len,
+    unsigned char * out)
+{
+  const unsigned char * start;
+  
+  start = in;
+  
+  while (in_len >= 4) {
+    int a, b, c, d;
+    
+    a = base64_values[in[0]];
+    b = base64_values[in[1]];
+    c = base64_values[in[2]];
+    d = base64_values[in[3]];
+    if ((a | b | c | d) < 0)
+      break;
+    
+    out[0] = (a << 2) | (b >> 4);
+    out[1] = (b << 4) | (c >> 2);
+    out[2] = (c << 6) | d;
+    in += 4;
+    in_len -= 4;
+    out += 3;
+  }
+  
+  return in - start;
+}
+
+#if defined(BASE64_X86_DISPATCH)
+
+static BASE64_TARGET("ssse3") size_t base64_decode_run_ssse3(
+    const unsigned char * in, size_t in_len, unsigned char * out)
+{
+  size_t count;
+  
+  count = 0;
+  while (in_len - count >= 16) {
+    __m128i str;
+    
+    str = _mm_loadu_si128((const __m128i *) (in + count));
+    if (!base64_translate_sse(&str))
+      break;
+    _mm_storeu_si128((__m128i *) out, base64_pack_sse(str));
+    count += 16;
+    out += 12;
+  }
+  
+  return count + base64_decode_run_scalar(in + count, in_len - count, out);
+}
+
+static BASE64_TARGET("avx2") size_t base64_decode_run_avx2(
+    const unsigned char * in, size_t in_len, unsigned char * out)
+{
+  size_t count;
+  
+  count = 0;
+  while (in_len - count >= 32) {
+    __m256i str;
+    
+    str = _mm256_loadu_si256((const __m256i *) (in + count));
+    if (!base64_translate_avx2(&str))
+      break;
+    _mm256_storeu_si256((__m256i *) out, base64_pack_avx2(str));
+    count += 32;
+    out += 24;
   }
+  
+  return count + base64_decode_run_ssse3(in + count, in_len - count, out);
+}
+
+#endif
+
+static size_t base64_decode_run(const unsigned char * in, size_t in_len,
+    unsigned char * out)
+{
+#if defined(BASE64_X86_DISPATCH)
+  /* __builtin_cpu_supports() only reads the CPU model filled in at startup */
+  if (__builtin_cpu_supports("avx2"))
+    return base64_decode_run_avx2(in, in_len, out);
+  if (__builtin_cpu_supports("ssse3"))
+    return base64_decode_run_ssse3(in, in_len, out);
+#endif
+  return base64_decode_run_scalar(in, in_len, out);
 }
 
 static int mailmime_base64_body_parse_impl(
@@ -1620,7 +1831,7 @@ static int mailmime_base64_body_parse_impl(
   size_t cur_token, last_full_token_end;
   char chunk[4];
   int chunk_index;
-  char out[3];
+  unsigned char * out;
   MMAPString * mmapstr;
   int res;
   int r;
@@ -1636,22 +1847,37 @@ static int mailmime_base64_body_parse_impl(
   chunk_index = 0;
   written = 0;
 
-  mmapstr = mmap_string_sized_new((length - cur_token) * 3 / 4);
+  /* the decoded data is never larger than 3/4 of the input, plus a partial chunk */
+  mmapstr = mmap_string_sized_new((length - cur_token) * 3 / 4 + 3 + BASE64_DECODE_SLACK);
   if (mmapstr == NULL) {
     res = MAILIMF_ERROR_MEMORY;
     goto err;
   }
+  out = (unsigned char *) mmapstr->str;
 
   while (1) {
     signed char value;
 
+    if (chunk_index == 0) {
+      size_t count;
+      
+      /* fast path: complete groups without line breaks or other characters */
+      count = base64_decode_run((const unsigned char *) message + cur_token,
+          length - cur_token, out + written);
+      if (count > 0) {
+        cur_token += count;
+        written += count / 4 * 3;
+        last_full_token_end = cur_token;
+      }
+    }
+
     value = -1;
     while (value == -1) {
 
       if (cur_token >= length)
         break;
 
-      value = get_base64_value(message[cur_token]);
+      value = base64_values[(unsigned char) message[cur_token]];
       cur_token ++;
     }
 
@@ -1662,9 +1888,9 @@ static int mailmime_base64_body_parse_impl(
     chunk_index ++;
 
     if (chunk_index == 4) {
-      out[0] = (chunk[0] << 2) | (chunk[1] >> 4);
-      out[1] = (chunk[1] << 4) | (chunk[2] >> 2);
-      out[2] = (chunk[2] << 6) | (chunk[3]);
+      out[written] = (chunk[0] << 2) | (chunk[1] >> 4);
+      out[written + 1] = (chunk[1] << 4) | (chunk[2] >> 2);
+      out[written + 2] = (chunk[2] << 6) | (chunk[3]);
 
       chunk[0] = 0;
       chunk[1] = 0;
@@ -1674,10 +1900,6 @@ static int mailmime_base64_body_parse_impl(
       chunk_index = 0;
       last_full_token_end = cur_token;
 
-      if (mmap_string_append_len(mmapstr, out, 3) == NULL) {
-        res = MAILIMF_ERROR_MEMORY;
-        goto free;
-      }
       written += 3;
     }
   }
@@ -1686,21 +1908,20 @@ static int mailmime_base64_body_parse_impl(
     size_t len;
 
     len = 0;
-    out[0] = (chunk[0] << 2) | (chunk[1] >> 4);
+    out[written] = (chunk[0] << 2) | (chunk[1] >> 4);
     len ++;
 
     if (chunk_index >= 3) {
-      out[1] = (chunk[1] << 4) | (chunk[2] >> 2);
+      out[written + 1] = (chunk[1] << 4) | (chunk[2] >> 2);
       len ++;
     }
 	
-    if (mmap_string_append_len(mmapstr, out, len) == NULL) {
-      res = MAILIMF_ERROR_MEMORY;
-      goto free;
-    }
     written += len;
   }
 
+  mmapstr->len = written;
+  mmapstr->str[written] = 0;
+
   if (partial) {
     cur_token = last_full_token_end;
   }
@@ -1766,7 +1987,52 @@ static int write_decoded_qp(MMAPString * mmapstr,
 }
 
 
-#define WRITE_MAX_QP 512
+/*
+  returns the number of characters at the beginning of the given string that
+  are copied unmodified by quoted-printable decoding, this is everything
+  except '=', CR, LF and, in headers, '_'
+*/
+static size_t qp_plain_run(const char * message, size_t length, int in_header)
+{
+  size_t i;
+  
+  i = 0;
+  
+#if defined(__SSE2__)
+  {
+    const __m128i eq = _mm_set1_epi8('=');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i us = _mm_set1_epi8(in_header ? '_' : '=');
+    
+    while (i + 16 <= length) {
+      __m128i str;
+      __m128i special;
+      int mask;
+      
+      str = _mm_loadu_si128((const __m128i *) (message + i));
+      special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(str, eq), _mm_cmpeq_epi8(str, us)),
+        _mm_or_si128(_mm_cmpeq_epi8(str, cr), _mm_cmpeq_epi8(str, lf)));
+      mask = _mm_movemask_epi8(special);
+      if (mask != 0)
+        return i + __builtin_ctz(mask);
+      i += 16;
+    }
+  }
+#endif
+
+  while (i < length) {
+    char ch;
+    
+    ch = message[i];
+    if ((ch == '=') || (ch == '\r') || (ch == '\n') || (in_header && (ch == '_')))
+      break;
+    i ++;
+  }
+  
+  return i;
+}
 
 static int mailmime_quoted_printable_body_parse_impl(
 					 const char * message, size_t length,
@@ -1783,6 +2049,7 @@ static int mailmime_quoted_printable_body_parse_impl(
   MMAPString * mmapstr;
   int res;
   size_t written;
+  size_t run;
 
   state = STATE_NORMAL;
   cur_token = * indx;
@@ -1983,19 +2250,14 @@ static int mailmime_quoted_printable_body_parse_impl(
         /* WARINING : must be followed by switch default action */
 
       default:
-	if (count >= WRITE_MAX_QP) {
-	  r = write_decoded_qp(mmapstr, start, count);
-	  if (r != MAILIMF_NO_ERROR) {
-	    res = r;
-	    goto free;
-	  }
-	  written += count;
-	  count = 0;
-          start = message + cur_token;
-	}
-        
+        /* the current character is copied in any case (it may be a '_'
+           outside of headers), then skip the whole run of plain characters,
+           they're written with a single call later */
 	count ++;
 	cur_token ++;
+        run = qp_plain_run(message + cur_token, length - cur_token, in_header);
+        count += run;
+        cur_token += run;
 	break;
       }
       break; /* end of STATE_NORMAL */
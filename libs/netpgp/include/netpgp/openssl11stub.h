@@ -1,5 +1,8 @@
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 
+#define EVP_MD_CTX_new  EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+
 int RSA_set0_key(RSA *r, BIGNUM *n, BIGNUM *e, BIGNUM *d)
 {
     /* If the fields n and e in r are NULL, the corresponding input
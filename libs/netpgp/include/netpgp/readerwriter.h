@@ -76,6 +76,7 @@ unsigned pgp_write_se_ip_pktset(pgp_output_t *, const uint8_t *,
 		       pgp_crypt_t *);
 void pgp_push_enc_crypt(pgp_output_t *, pgp_crypt_t *);
 int pgp_push_enc_se_ip(pgp_output_t *, const pgp_keyring_t *, const char *, unsigned);
+int pgp_push_stream_enc_se_ip(pgp_output_t *, const pgp_keyring_t *, const char *, unsigned);
 
 /* Secret Key checksum */
 void pgp_push_checksum_writer(pgp_output_t *, pgp_seckey_t *);
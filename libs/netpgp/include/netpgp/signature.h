@@ -145,6 +145,8 @@ void pgp_reader_push_dearmour(pgp_stream_t *);
 
 void pgp_reader_pop_dearmour(pgp_stream_t *);
 unsigned pgp_writer_push_clearsigned(pgp_output_t *, pgp_create_sig_t *);
+unsigned pgp_writer_push_stream_signed(pgp_output_t *, const pgp_seckey_t *,
+		pgp_hash_alg_t, const time_t, const time_t);
 void pgp_writer_push_armor_msg(pgp_output_t *);
 
 typedef enum {
@@ -96,6 +96,8 @@ typedef struct {
 	const pgp_keyring_t		*keyring;
 	pgp_validation_t		*result;
 	char				*detachname;
+	unsigned			 onepass_hashed;	/* binary One-Pass Signatures seen */
+	unsigned			 onepass_other;		/* other One-Pass Signatures seen */
 } validate_data_cb_t;
 
 #if 0 //////
@@ -114,10 +114,6 @@ unsigned pgp_write_mpi(pgp_output_t *, const BIGNUM *);
 void pgp_writer_info_delete(pgp_writer_t *);
 unsigned pgp_writer_info_finalise(pgp_error_t **, pgp_writer_t *);
 
-#if 0 //////
-void pgp_push_stream_enc_se_ip(pgp_output_t *, pgp_key_t *, const char *);
-#endif //////
-
 void pgp_push_sum16_writer(pgp_output_t *output);
 
 uint16_t pgp_pop_sum16_writer(pgp_output_t *output);
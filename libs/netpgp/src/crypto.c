@@ -646,6 +646,7 @@ pgp_decrypt_and_validate_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 
     /* Filter pkt sent to validate callback */
 	switch (pkt->tag) {
+	case PGP_PTAG_CT_1_PASS_SIG:
 	case PGP_PTAG_CT_LITDATA_BODY:
 	case PGP_PTAG_CT_SIGNED_CLEARTEXT_BODY:
 	case PGP_PTAG_CT_SIGNATURE:	/* V3 sigs */
@@ -664,17 +665,16 @@ pgp_decrypt_and_validate_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
            PGP_KEEP_MEMORY : PGP_RELEASE_MEMORY;
 }
 
-/* decrypt and validate an area of memory */
-pgp_memory_t *
-pgp_decrypt_and_validate_buf(pgp_io_t *io,
+/* decrypt and validate data read from the stream, the plaintext goes to the
+ * stream's output.  Returns 1 if the message was encrypted to us. */
+static unsigned
+decrypt_and_validate(pgp_stream_t *stream,
 			pgp_validation_t *result,
-			const void *input,
-			const size_t insize,
 			pgp_keyring_t *secring,
 			pgp_keyring_t *pubring,
 			const unsigned use_armour,
-            key_id_t **recipients_key_ids,
-            unsigned *recipients_count)
+			key_id_t **recipients_key_ids,
+			unsigned *recipients_count)
 {
     // historical code bloat...
     const unsigned sshkeys = 0;
@@ -682,26 +682,11 @@ pgp_decrypt_and_validate_buf(pgp_io_t *io,
     //int numtries = -1; -- EDIT BY MR
     //pgp_cbfunc_t *getpassfunc = NULL; -- EDIT BY MR
 
-    validate_data_cb_t	 validation;
-	pgp_stream_t	*stream = NULL;
-	pgp_memory_t	*outmem;
-	pgp_memory_t	*inmem;
+	validate_data_cb_t	 validation;
 	const int	 printerrors = 1;
 
-	if (input == NULL) {
-		(void) fprintf(io->errs,
-			"pgp_encrypt_buf: null memory\n");
-		return 0;
-	}
-
-	inmem = pgp_memory_new();
-	pgp_memory_add(inmem, input, insize);
-
-	/* set up to read from memory */
-	pgp_setup_memory_read(io, &stream, inmem,
-				    &validation,
-				    pgp_decrypt_and_validate_cb,
-				    1);
+	pgp_set_callback(stream, pgp_decrypt_and_validate_cb, &validation);
+	stream->readinfo.accumulate = 1;
 
 	/* Set verification reader and handling options */
 	(void) memset(&validation, 0x0, sizeof(validation));
@@ -710,9 +695,6 @@ pgp_decrypt_and_validate_buf(pgp_io_t *io,
 	validation.mem = pgp_memory_new();
 	pgp_memory_init(validation.mem, 128);
 
-	/* setup for writing decrypted contents */
-	pgp_setup_memory_write(&stream->cbinfo.output, &outmem, insize);
-
 	/* setup keyring and passphrase callback */
 	stream->cbinfo.cryptinfo.secring = secring;
 	stream->cbinfo.cryptinfo.pubring = pubring;
@@ -746,20 +728,56 @@ pgp_decrypt_and_validate_buf(pgp_io_t *io,
                   sizeof(key_id_t) * *recipients_count);
         }
     }
-
     if( *recipients_key_ids == NULL)
     {
-        pgp_memory_free(outmem);
         *recipients_count = 0;
-        outmem = NULL;
     }
 
+	pgp_memory_free(validation.mem);
+
+	return (*recipients_key_ids != NULL);
+}
+
+/* decrypt and validate an area of memory */
+pgp_memory_t *
+pgp_decrypt_and_validate_buf(pgp_io_t *io,
+			pgp_validation_t *result,
+			const void *input,
+			const size_t insize,
+			pgp_keyring_t *secring,
+			pgp_keyring_t *pubring,
+			const unsigned use_armour,
+            key_id_t **recipients_key_ids,
+            unsigned *recipients_count)
+{
+	pgp_stream_t	*stream;
+	pgp_memory_t	*outmem;
+
+	if (input == NULL) {
+		(void) fprintf(io->errs,
+			"pgp_encrypt_buf: null memory\n");
+		return 0;
+	}
+
+	/* set up to read from memory, the input is not copied */
+	stream = pgp_new(sizeof(*stream));
+	stream->io = stream->cbinfo.io = io;
+	pgp_reader_set_memory(stream, input, insize);
+
+	/* setup for writing decrypted contents */
+	pgp_setup_memory_write(&stream->cbinfo.output, &outmem, insize);
+
+	if (!decrypt_and_validate(stream, result, secring, pubring, use_armour,
+			recipients_key_ids, recipients_count)) {
+		pgp_memory_free(outmem);
+		outmem = NULL;
+	}
+
 	/* tidy up */
     pgp_writer_close(stream->cbinfo.output);
     pgp_output_delete(stream->cbinfo.output);
 
-	pgp_teardown_memory_read(stream, inmem); /* calls pgp_stream_delete() and pgp_memory_free() */
-	pgp_memory_free(validation.mem);
+	pgp_stream_delete(stream);
 
 	return outmem;
 }
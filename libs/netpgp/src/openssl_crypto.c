@@ -77,6 +77,7 @@ __RCSID("$NetBSD$");
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -93,33 +94,109 @@ __RCSID("$NetBSD$");
 
 
 
+/*
+ * All hashes use OpenSSL's EVP interface; the EVP implementations select the
+ * fastest code for the CPU (SHA extensions, AVX2 etc.) which the legacy
+ * SHA256_Init() & co. entry points may not.
+ */
+
+enum {
+	DIGEST_MD5,
+	DIGEST_SHA1,
+	DIGEST_SHA224,
+	DIGEST_SHA256,
+	DIGEST_SHA384,
+	DIGEST_SHA512,
+	DIGEST_COUNT
+};
+
+static const struct {
+	const char	*name;
+	const EVP_MD	*(*get)(void);
+} digest_table[DIGEST_COUNT] = {
+	{ "MD5",	EVP_md5 },
+	{ "SHA1",	EVP_sha1 },
+	{ "SHA224",	EVP_sha224 },
+	{ "SHA256",	EVP_sha256 },
+	{ "SHA384",	EVP_sha384 },
+	{ "SHA512",	EVP_sha512 }
+};
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* OpenSSL 3 looks up the implementation of EVP_sha256() & co. on every
+ * EVP_DigestInit_ex(); as we hash many small packets, fetch them only once */
+static pthread_once_t	 fetch_digests_once = PTHREAD_ONCE_INIT;
+static EVP_MD		*fetched_digests[DIGEST_COUNT];
+
+static void
+fetch_digests(void)
+{
+	int	i;
+
+	for (i = 0; i < DIGEST_COUNT; i++) {
+		fetched_digests[i] = EVP_MD_fetch(NULL, digest_table[i].name, NULL);
+	}
+}
+#endif
+
+static const EVP_MD *
+get_digest(int digest)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	pthread_once(&fetch_digests_once, fetch_digests);
+	if (fetched_digests[digest]) {
+		return fetched_digests[digest];
+	}
+#endif
+	return digest_table[digest].get();
+}
+
 static int
-md5_init(pgp_hash_t *hash)
+evp_hash_init(pgp_hash_t *hash, int digest)
 {
 	if (hash->data) {
-		(void) fprintf(stderr, "md5_init: hash data non-null\n");
+		(void) fprintf(stderr, "%s_init: hash data non-null\n", hash->name);
+	}
+	if ((hash->data = EVP_MD_CTX_new()) == NULL) {
+		(void) fprintf(stderr, "%s_init: bad alloc\n", hash->name);
+		return 0;
 	}
-	if ((hash->data = calloc(1, sizeof(MD5_CTX))) == NULL) {
-		(void) fprintf(stderr, "md5_init: bad alloc\n");
+	if (!EVP_DigestInit_ex(hash->data, get_digest(digest), NULL)) {
+		(void) fprintf(stderr, "%s_init: cannot init digest\n", hash->name);
+		EVP_MD_CTX_free(hash->data);
+		hash->data = NULL;
 		return 0;
 	}
-	MD5_Init(hash->data);
 	return 1;
 }
 
 static void
-md5_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
+evp_hash_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
 {
-	MD5_Update(hash->data, data, length);
+	if (pgp_get_debug_level(__FILE__)) {
+		hexdump(stderr, "hash_add", data, length);
+	}
+	EVP_DigestUpdate(hash->data, data, length);
 }
 
 static unsigned
-md5_finish(pgp_hash_t *hash, uint8_t *out)
+evp_hash_finish(pgp_hash_t *hash, uint8_t *out)
 {
-	MD5_Final(out, hash->data);
-	free(hash->data);
+	unsigned	len = 0;
+
+	EVP_DigestFinal_ex(hash->data, out, &len);
+	if (pgp_get_debug_level(__FILE__)) {
+		hexdump(stderr, "hash_finish", out, len);
+	}
+	EVP_MD_CTX_free(hash->data);
 	hash->data = NULL;
-	return 16;
+	return len;
+}
+
+static int
+md5_init(pgp_hash_t *hash)
+{
+	return evp_hash_init(hash, DIGEST_MD5);
 }
 
 static const pgp_hash_t md5 = {
@@ -127,8 +204,8 @@ static const pgp_hash_t md5 = {
 	MD5_DIGEST_LENGTH,
 	"MD5",
 	md5_init,
-	md5_add,
-	md5_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
@@ -146,36 +223,7 @@ pgp_hash_md5(pgp_hash_t *hash)
 static int
 sha1_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha1_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha1_init: bad alloc\n");
-		return 0;
-	}
-	SHA1_Init(hash->data);
-	return 1;
-}
-
-static void
-sha1_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_add", data, length);
-	}
-	SHA1_Update(hash->data, data, length);
-}
-
-static unsigned
-sha1_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA1_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_finish", out, PGP_SHA1_HASH_SIZE);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return PGP_SHA1_HASH_SIZE;
+	return evp_hash_init(hash, DIGEST_SHA1);
 }
 
 static const pgp_hash_t sha1 = {
@@ -183,8 +231,8 @@ static const pgp_hash_t sha1 = {
 	PGP_SHA1_HASH_SIZE,
 	"SHA1",
 	sha1_init,
-	sha1_add,
-	sha1_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
@@ -202,36 +250,7 @@ pgp_hash_sha1(pgp_hash_t *hash)
 static int
 sha256_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha256_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA256_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha256_init: bad alloc\n");
-		return 0;
-	}
-	SHA256_Init(hash->data);
-	return 1;
-}
-
-static void
-sha256_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha256_add", data, length);
-	}
-	SHA256_Update(hash->data, data, length);
-}
-
-static unsigned
-sha256_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA256_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_finish", out, SHA256_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA256_DIGEST_LENGTH;
+	return evp_hash_init(hash, DIGEST_SHA256);
 }
 
 static const pgp_hash_t sha256 = {
@@ -239,8 +258,8 @@ static const pgp_hash_t sha256 = {
 	SHA256_DIGEST_LENGTH,
 	"SHA256",
 	sha256_init,
-	sha256_add,
-	sha256_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
@@ -256,36 +275,7 @@ pgp_hash_sha256(pgp_hash_t *hash)
 static int
 sha384_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha384_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA512_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha384_init: bad alloc\n");
-		return 0;
-	}
-	SHA384_Init(hash->data);
-	return 1;
-}
-
-static void
-sha384_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha384_add", data, length);
-	}
-	SHA384_Update(hash->data, data, length);
-}
-
-static unsigned
-sha384_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA384_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha384_finish", out, SHA384_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA384_DIGEST_LENGTH;
+	return evp_hash_init(hash, DIGEST_SHA384);
 }
 
 static const pgp_hash_t sha384 = {
@@ -293,8 +283,8 @@ static const pgp_hash_t sha384 = {
 	SHA384_DIGEST_LENGTH,
 	"SHA384",
 	sha384_init,
-	sha384_add,
-	sha384_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
@@ -310,36 +300,7 @@ pgp_hash_sha384(pgp_hash_t *hash)
 static int
 sha512_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha512_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA512_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha512_init: bad alloc\n");
-		return 0;
-	}
-	SHA512_Init(hash->data);
-	return 1;
-}
-
-static void
-sha512_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha512_add", data, length);
-	}
-	SHA512_Update(hash->data, data, length);
-}
-
-static unsigned
-sha512_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA512_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha512_finish", out, SHA512_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA512_DIGEST_LENGTH;
+	return evp_hash_init(hash, DIGEST_SHA512);
 }
 
 static const pgp_hash_t sha512 = {
@@ -347,8 +308,8 @@ static const pgp_hash_t sha512 = {
 	SHA512_DIGEST_LENGTH,
 	"SHA512",
 	sha512_init,
-	sha512_add,
-	sha512_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
@@ -365,36 +326,7 @@ pgp_hash_sha512(pgp_hash_t *hash)
 static int
 sha224_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha224_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA256_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha256_init: bad alloc\n");
-		return 0;
-	}
-	SHA224_Init(hash->data);
-	return 1;
-}
-
-static void
-sha224_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha224_add", data, length);
-	}
-	SHA224_Update(hash->data, data, length);
-}
-
-static unsigned
-sha224_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA224_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha224_finish", out, SHA224_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA224_DIGEST_LENGTH;
+	return evp_hash_init(hash, DIGEST_SHA224);
 }
 
 static const pgp_hash_t sha224 = {
@@ -402,8 +334,8 @@ static const pgp_hash_t sha224 = {
 	SHA224_DIGEST_LENGTH,
 	"SHA224",
 	sha224_init,
-	sha224_add,
-	sha224_finish,
+	evp_hash_add,
+	evp_hash_finish,
 	NULL
 };
 
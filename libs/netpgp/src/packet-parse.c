@@ -91,6 +91,9 @@ __RCSID("$NetBSD$");
 #include "netpgp/crypto.h"
 #include "netpgp/netpgpdigest.h"
 
+/* Literal Data packets are passed to the callbacks in chunks of this size */
+#define LITDATA_CHUNK_SIZE	(64 * 1024)
+
 #define ERRP(cbinfo, cont, err)	do {					\
 	cont.u.error = err;						\
 	CALLBACK(PGP_PARSER_ERROR, cbinfo, &cont);			\
@@ -1550,7 +1553,6 @@ parse_userid(pgp_region_t *region, pgp_stream_t *stream)
 	return 1;
 }
 
-#if 0 // EDIT BY MR - sighash not needed
 static pgp_hash_t     *
 parse_hash_find(pgp_stream_t *stream, const uint8_t *keyid)
 {
@@ -1558,13 +1560,14 @@ parse_hash_find(pgp_stream_t *stream, const uint8_t *keyid)
 	size_t			 n;
 
 	for (n = 0, hp = stream->hashes; n < stream->hashc; n++, hp++) {
-		if (memcmp(hp->keyid, keyid, PGP_KEY_ID_SIZE) == 0) {
+		/* hashes already finished by a signature have no data */
+		if (hp->hash.data != NULL &&
+		    memcmp(hp->keyid, keyid, PGP_KEY_ID_SIZE) == 0) {
 			return &hp->hash;
 		}
 	}
 	return NULL;
 }
-#endif
 
 /**
  * \ingroup Core_Parse
@@ -1673,12 +1676,8 @@ parse_v3_sig(pgp_region_t *region,
 		return 0;
 	}
 
-	#if 0 // EDIT BY MR - sighash not needed
-	if (pkt.u.sig.info.signer_id_set) {
-		pkt.u.sig.hash = parse_hash_find(stream,
-				pkt.u.sig.info.signer_id);
-	}
-	#endif
+	pkt.u.sig.hash = (pkt.u.sig.info.signer_id_set) ?
+		parse_hash_find(stream, pkt.u.sig.info.signer_id) : NULL;
 
 	CALLBACK(PGP_PTAG_CT_SIGNATURE, &stream->cbinfo, &pkt);
 	return 1;
@@ -2219,6 +2218,11 @@ parse_v4_sig(pgp_region_t *region, pgp_stream_t *stream)
 			    region->length - region->readc);
         goto error_unalloc_v4_hashed;
 	}
+	/* the data hashed since the matching One-Pass Signature packet, the
+	 * callback may use this hash instead of hashing the data again */
+	pkt.u.sig.hash = (pkt.u.sig.info.signer_id_set) ?
+		parse_hash_find(stream, pkt.u.sig.info.signer_id) : NULL;
+
 	CALLBACK(PGP_PTAG_CT_SIGNATURE_FOOTER, &stream->cbinfo, &pkt);
 	return 1;
 
@@ -2330,7 +2334,9 @@ void parse_hash_finish(pgp_stream_t* stream)
 	if( stream->hashes ) {
 		uint8_t		hashbuf[NETPGP_BUFSIZ];
 		for (int i = 0; i<stream->hashc; i++) {
-			stream->hashes[i].hash.finish(&stream->hashes[i].hash, hashbuf);
+			if (stream->hashes[i].hash.data) {
+				stream->hashes[i].hash.finish(&stream->hashes[i].hash, hashbuf);
+			}
 		}
 		free(stream->hashes);
 		stream->hashes = NULL;
@@ -2411,7 +2417,9 @@ parse_hash_data(pgp_stream_t *stream, const void *data,
 	size_t          n;
 
 	for (n = 0; n < stream->hashc; ++n) {
-		stream->hashes[n].hash.add(&stream->hashes[n].hash, data, (unsigned)length);
+		if (stream->hashes[n].hash.data) {
+			stream->hashes[n].hash.add(&stream->hashes[n].hash, data, (unsigned)length);
+		}
 	}
 }
 
@@ -2444,19 +2452,23 @@ parse_litdata(pgp_region_t *region, pgp_stream_t *stream)
 		return 0;
 	}
 	CALLBACK(PGP_PTAG_CT_LITDATA_HEADER, &stream->cbinfo, &pkt);
+	/* the body is passed to the callback in chunks, so the memory needed
+	 * does not depend on the size of the packet */
 	mem = pkt.u.litdata_body.mem = pgp_memory_new();
 	pgp_memory_init(mem,
-			(unsigned)((region->length * 101) / 100) + 12);
+			MIN(region->length - region->readc, LITDATA_CHUNK_SIZE));
 	pkt.u.litdata_body.data = mem->buf;
 
 	while (region->readc < region->length) {
-		unsigned        readc = region->length - region->readc;
+		unsigned        readc = MIN(region->length - region->readc,
+					LITDATA_CHUNK_SIZE);
 
 		if (!limread(mem->buf, readc, region, stream)) {
+			pgp_memory_free(mem);
 			return 0;
 		}
 		pkt.u.litdata_body.length = readc;
-		parse_hash_data(stream, pkt.u.litdata_body.data, region->length);
+		parse_hash_data(stream, pkt.u.litdata_body.data, readc);
 		CALLBACK(PGP_PTAG_CT_LITDATA_BODY, &stream->cbinfo, &pkt);
 	}
 
@@ -3539,6 +3551,7 @@ parse_packet(pgp_stream_t *stream, uint32_t *pktlen)
 	pgp_region_t	region;
 	uint8_t		ptag;
 	unsigned	indeterminate = 0;
+	unsigned	accumulate = 0;
 	int		ret;
 
 	pkt.u.ptag.position = stream->readinfo.position;
@@ -3637,6 +3650,10 @@ parse_packet(pgp_stream_t *stream, uint32_t *pktlen)
 		break;
 
 	case PGP_PTAG_CT_LITDATA:
+		/* the literal data are passed to the callbacks, do not keep
+		 * another copy of the whole packet */
+		accumulate = stream->readinfo.accumulate;
+		stream->readinfo.accumulate = 0;
 		ret = parse_litdata(&region, stream);
 		break;
 
@@ -3708,6 +3725,9 @@ parse_packet(pgp_stream_t *stream, uint32_t *pktlen)
 		CALLBACK(PGP_PARSER_PACKET_END, &stream->cbinfo, &pkt);
 	}
 	stream->readinfo.alength = 0;
+	if (accumulate) {
+		stream->readinfo.accumulate = 1;
+	}
 
 	return (ret < 0) ? -1 : (ret) ? 1 : 0;
 }
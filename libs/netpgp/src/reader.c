@@ -1671,19 +1671,16 @@ se_ip_data_reader(pgp_stream_t *stream, void *dest_,
 		if (se_ip->plaintext) {
 			(void) fprintf(stderr,
 				"se_ip_data_reader: bad plaintext\n");
+			free(buf);
 			return 0;
 		}
-		if ((se_ip->plaintext = calloc(1, sz_plaintext)) == NULL) {
-			(void) fprintf(stderr,
-				"se_ip_data_reader: bad alloc\n");
-			return 0;
-		}
-		memcpy(se_ip->plaintext, plaintext, sz_plaintext);
+		/* the plaintext is read from the packet buffer, no need
+		 * to copy it; the buffer is freed by the destroyer */
+		se_ip->plaintext = buf;
+		se_ip->plaintext_offset = sz_preamble;
 		se_ip->plaintext_available = sz_plaintext;
 
 		se_ip->passed_checks = 1;
-
-		free(buf);
 	}
 	n = (unsigned)len;
 	if (n > se_ip->plaintext_available) {
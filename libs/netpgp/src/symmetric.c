@@ -61,6 +61,15 @@ __RCSID("$NetBSD$");
 #include "netpgp/packet-show.h"
 
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_CIPHER_CTX_set_num(ctx, n)	((ctx)->num = (n))
+#define EVP_CIPHER_CTX_num(ctx)		((ctx)->num)
+#endif
 
 #ifdef HAVE_OPENSSL_CAST_H
 #include <openssl/cast.h>
@@ -99,18 +108,15 @@ std_set_key(pgp_crypt_t *crypt, const uint8_t *key)
 	(void) memcpy(crypt->key, key, crypt->keysize);
 }
 
+/*
+ * OpenPGP CFB resync (RFC 4880, 13.9): the caller puts the last blocksize
+ * bytes of ciphertext into civ, CFB restarts with them as IV.  set_iv() also
+ * makes the EVP based ciphers re-initialize their context.
+ */
 static void
 std_resync(pgp_crypt_t *decrypt)
 {
-	if ((size_t) decrypt->num == decrypt->blocksize) {
-		return;
-	}
-
-	memmove(decrypt->civ + decrypt->blocksize - decrypt->num, decrypt->civ,
-		(unsigned)decrypt->num);
-	(void) memcpy(decrypt->civ, decrypt->siv + decrypt->num,
-	       decrypt->blocksize - decrypt->num);
-	decrypt->num = 0;
+	decrypt->set_iv(decrypt, decrypt->civ);
 }
 
 static void
@@ -275,65 +281,208 @@ static const pgp_crypt_t idea =
 };
 #endif				/* OPENSSL_NO_IDEA */
 
-/* AES with 128-bit key (AES) */
+/*
+ * AES goes through OpenSSL's EVP interface which uses AES-NI, VAES etc. when
+ * available; the legacy AES_cfb128_encrypt() is a plain C implementation.
+ *
+ * The running CFB state lives in the EVP context; crypt->iv and crypt->num
+ * are only read when the context is (re-)synchronized after set_iv() or
+ * base_init().
+ */
 
-#define KEYBITS_AES128 128
+#define AES_CFB_UNSYNCED	-1
+
+typedef struct {
+	const EVP_CIPHER	*ecb;
+	EVP_CIPHER_CTX		*ecb_encrypt;
+	EVP_CIPHER_CTX		*ecb_decrypt;	/* created on first use */
+	EVP_CIPHER_CTX		*cfb;
+	int			 cfb_enc;	/* 1, 0 or AES_CFB_UNSYNCED */
+} aes_evp_t;
+
+enum {
+	AES_128_ECB,
+	AES_128_CFB,
+	AES_256_ECB,
+	AES_256_CFB,
+	AES_CIPHER_COUNT
+};
 
-static int
-aes128_init(pgp_crypt_t *crypt)
+static const struct {
+	const char		*name;
+	const EVP_CIPHER	*(*get)(void);
+} aes_cipher_table[AES_CIPHER_COUNT] = {
+	{ "AES-128-ECB",	EVP_aes_128_ecb },
+	{ "AES-128-CFB",	EVP_aes_128_cfb128 },
+	{ "AES-256-ECB",	EVP_aes_256_ecb },
+	{ "AES-256-CFB",	EVP_aes_256_cfb128 }
+};
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* see fetch_digests() in openssl_crypto.c */
+static pthread_once_t	 fetch_aes_ciphers_once = PTHREAD_ONCE_INIT;
+static EVP_CIPHER	*fetched_aes_ciphers[AES_CIPHER_COUNT];
+
+static void
+fetch_aes_ciphers(void)
 {
-	if (crypt->encrypt_key) {
-		free(crypt->encrypt_key);
+	int	i;
+
+	for (i = 0; i < AES_CIPHER_COUNT; i++) {
+		fetched_aes_ciphers[i] = EVP_CIPHER_fetch(NULL, aes_cipher_table[i].name, NULL);
 	}
-	if ((crypt->encrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes128_init: alloc failure\n");
-		return 0;
+}
+#endif
+
+static const EVP_CIPHER *
+get_aes_cipher(int cipher)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	pthread_once(&fetch_aes_ciphers_once, fetch_aes_ciphers);
+	if (fetched_aes_ciphers[cipher]) {
+		return fetched_aes_ciphers[cipher];
 	}
-	if (AES_set_encrypt_key(crypt->key, KEYBITS_AES128,
-			crypt->encrypt_key)) {
-		fprintf(stderr, "aes128_init: Error setting encrypt_key\n");
+#endif
+	return aes_cipher_table[cipher].get();
+}
+
+static void
+aes_free(aes_evp_t *aes)
+{
+	if (aes) {
+		EVP_CIPHER_CTX_free(aes->ecb_encrypt);
+		EVP_CIPHER_CTX_free(aes->ecb_decrypt);
+		EVP_CIPHER_CTX_free(aes->cfb);
+		free(aes);
 	}
+}
 
-	if (crypt->decrypt_key) {
-		free(crypt->decrypt_key);
+static EVP_CIPHER_CTX *
+aes_new_ctx(const EVP_CIPHER *cipher, const uint8_t *key, int enc)
+{
+	EVP_CIPHER_CTX	*ctx;
+
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL) {
+		return NULL;
+	}
+	if (!EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, enc)) {
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
 	}
-	if ((crypt->decrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes128_init: alloc failure\n");
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+	return ctx;
+}
+
+static int
+aes_init(pgp_crypt_t *crypt, int ecb, int cfb, const char *caller)
+{
+	aes_evp_t	*aes;
+
+	aes_free(crypt->encrypt_key);
+	crypt->encrypt_key = NULL;
+	if ((aes = calloc(1, sizeof(*aes))) == NULL) {
+		(void) fprintf(stderr, "%s: alloc failure\n", caller);
 		return 0;
 	}
-	if (AES_set_decrypt_key(crypt->key, KEYBITS_AES128,
-				crypt->decrypt_key)) {
-		fprintf(stderr, "aes128_init: Error setting decrypt_key\n");
+	aes->ecb = get_aes_cipher(ecb);
+	aes->cfb_enc = AES_CFB_UNSYNCED;
+	if ((aes->ecb_encrypt = aes_new_ctx(aes->ecb, crypt->key, 1)) == NULL ||
+	    (aes->cfb = aes_new_ctx(get_aes_cipher(cfb), crypt->key, 1)) == NULL) {
+		(void) fprintf(stderr, "%s: Error setting encrypt_key\n", caller);
+		aes_free(aes);
+		return 0;
 	}
+	crypt->encrypt_key = aes;
 	return 1;
 }
 
+static void
+aes_set_iv(pgp_crypt_t *crypt, const uint8_t *iv)
+{
+	aes_evp_t	*aes = crypt->encrypt_key;
+
+	std_set_iv(crypt, iv);
+	if (aes) {
+		aes->cfb_enc = AES_CFB_UNSYNCED;
+	}
+}
+
 static void
 aes_block_encrypt(pgp_crypt_t *crypt, void *out, const void *in)
 {
-	AES_encrypt(in, out, crypt->encrypt_key);
+	aes_evp_t	*aes = crypt->encrypt_key;
+	int		 outl;
+
+	EVP_EncryptUpdate(aes->ecb_encrypt, out, &outl, in, AES_BLOCK_SIZE);
 }
 
 static void
 aes_block_decrypt(pgp_crypt_t *crypt, void *out, const void *in)
 {
-	AES_decrypt(in, out, crypt->decrypt_key);
+	aes_evp_t	*aes = crypt->encrypt_key;
+	int		 outl;
+
+	if (aes->ecb_decrypt == NULL &&
+	    (aes->ecb_decrypt = aes_new_ctx(aes->ecb, crypt->key, 0)) == NULL) {
+		(void) fprintf(stderr, "aes_block_decrypt: Error setting decrypt_key\n");
+		return;
+	}
+	EVP_DecryptUpdate(aes->ecb_decrypt, out, &outl, in, AES_BLOCK_SIZE);
+}
+
+static void
+aes_cfb(pgp_crypt_t *crypt, void *outvoid, const void *invoid, size_t count, int enc)
+{
+	aes_evp_t	*aes = crypt->encrypt_key;
+	const uint8_t	*in = invoid;
+	uint8_t		*out = outvoid;
+	int		 chunk;
+	int		 outl;
+
+	if (aes->cfb_enc != enc) {
+		/* the key schedule is kept, only the IV and the offset are set */
+		EVP_CipherInit_ex(aes->cfb, NULL, NULL, NULL, crypt->iv, enc);
+		EVP_CIPHER_CTX_set_num(aes->cfb, crypt->num);
+		aes->cfb_enc = enc;
+	}
+	while (count > 0) {
+		chunk = (count > INT_MAX) ? INT_MAX : (int)count;
+		EVP_CipherUpdate(aes->cfb, out, &outl, in, chunk);
+		in += chunk;
+		out += chunk;
+		count -= (size_t)chunk;
+	}
+	crypt->num = EVP_CIPHER_CTX_num(aes->cfb);
 }
 
 static void
 aes_cfb_encrypt(pgp_crypt_t *crypt, void *out, const void *in, size_t count)
 {
-	AES_cfb128_encrypt(in, out, (unsigned)count,
-			   crypt->encrypt_key, crypt->iv, &crypt->num,
-			   AES_ENCRYPT);
+	aes_cfb(crypt, out, in, count, 1);
 }
 
 static void
 aes_cfb_decrypt(pgp_crypt_t *crypt, void *out, const void *in, size_t count)
 {
-	AES_cfb128_encrypt(in, out, (unsigned)count,
-			   crypt->encrypt_key, crypt->iv, &crypt->num,
-			   AES_DECRYPT);
+	aes_cfb(crypt, out, in, count, 0);
+}
+
+static void
+aes_finish(pgp_crypt_t *crypt)
+{
+	aes_free(crypt->encrypt_key);
+	crypt->encrypt_key = NULL;
+	std_finish(crypt);
+}
+
+/* AES with 128-bit key (AES) */
+
+#define KEYBITS_AES128 128
+
+static int
+aes128_init(pgp_crypt_t *crypt)
+{
+	return aes_init(crypt, AES_128_ECB, AES_128_CFB, "aes128_init");
 }
 
 static const pgp_crypt_t aes128 =
@@ -341,7 +490,7 @@ static const pgp_crypt_t aes128 =
 	PGP_SA_AES_128,
 	AES_BLOCK_SIZE,
 	KEYBITS_AES128 / 8,
-	std_set_iv,
+	aes_set_iv,
 	std_set_key,
 	aes128_init,
 	std_resync,
@@ -349,7 +498,7 @@ static const pgp_crypt_t aes128 =
 	aes_block_decrypt,
 	aes_cfb_encrypt,
 	aes_cfb_decrypt,
-	std_finish,
+	aes_finish,
 	TRAILER
 };
 
@@ -360,39 +509,7 @@ static const pgp_crypt_t aes128 =
 static int
 aes256_init(pgp_crypt_t *crypt)
 {
-	if (crypt->encrypt_key) {
-		free(crypt->encrypt_key);
-	}
-	if ((crypt->encrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes256_init: alloc failure\n");
-		return 0;
-	}
-	if (AES_set_encrypt_key(crypt->key, KEYBITS_AES256,
-			crypt->encrypt_key)) {
-		fprintf(stderr, "aes256_init: Error setting encrypt_key\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		return 0;
-	}
-	if (crypt->decrypt_key) {
-		free(crypt->decrypt_key);
-	}
-	if ((crypt->decrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes256_init: alloc failure\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		return 0;
-	}
-	if (AES_set_decrypt_key(crypt->key, KEYBITS_AES256,
-			crypt->decrypt_key)) {
-		fprintf(stderr, "aes256_init: Error setting decrypt_key\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		free(crypt->decrypt_key);
-		crypt->decrypt_key = NULL;
-		return 0;
-	}
-	return 1;
+	return aes_init(crypt, AES_256_ECB, AES_256_CFB, "aes256_init");
 }
 
 static const pgp_crypt_t aes256 =
@@ -400,7 +517,7 @@ static const pgp_crypt_t aes256 =
 	PGP_SA_AES_256,
 	AES_BLOCK_SIZE,
 	KEYBITS_AES256 / 8,
-	std_set_iv,
+	aes_set_iv,
 	std_set_key,
 	aes256_init,
 	std_resync,
@@ -408,7 +525,7 @@ static const pgp_crypt_t aes256 =
 	aes_block_decrypt,
 	aes_cfb_encrypt,
 	aes_cfb_decrypt,
-	std_finish,
+	aes_finish,
 	TRAILER
 };
 
@@ -172,25 +172,22 @@ The hash value is calculated by the following method:
 to give the final hash value that is checked against the one in the signature
 */
 
-/* Does the signed hash match the given hash? */
+/* Does the signed hash match the hash of the data already added to hashp?
+ * The hash is finished in any case. */
 static unsigned
-check_binary_sig(const uint8_t *data,
-		const unsigned len,
+check_hashed_binary_sig(pgp_hash_t *hashp,
 		const pgp_sig_t *sig,
 		const pgp_pubkey_t *signer)
 {
 	unsigned    hashedlen;
-	pgp_hash_t	hash;
+	pgp_hash_t	hash = *hashp;
 	unsigned	n;
 	uint8_t		hashout[PGP_MAX_HASH_SIZE];
 	uint8_t		trailer[6];
 
-	pgp_hash_any(&hash, sig->info.hash_alg);
-	if (!hash.init(&hash)) {
-		(void) fprintf(stderr, "check_binary_sig: bad hash init\n");
-		return 0;
-	}
-	hash.add(&hash, data, len);
+	/* the caller's copy must not be used again */
+	hashp->data = NULL;
+
 	switch (sig->info.version) {
 	case PGP_V3:
 		trailer[0] = sig->info.type;
@@ -220,6 +217,7 @@ check_binary_sig(const uint8_t *data,
 	default:
 		(void) fprintf(stderr, "Invalid signature version %d\n",
 				sig->info.version);
+		hash.finish(&hash, hashout);
 		return 0;
 	}
 
@@ -230,6 +228,24 @@ check_binary_sig(const uint8_t *data,
 	return pgp_check_sig(hashout, n, sig, signer);
 }
 
+/* Does the signed hash match the given hash? */
+static unsigned
+check_binary_sig(const uint8_t *data,
+		const unsigned len,
+		const pgp_sig_t *sig,
+		const pgp_pubkey_t *signer)
+{
+	pgp_hash_t	hash;
+
+	pgp_hash_any(&hash, sig->info.hash_alg);
+	if (!hash.init(&hash)) {
+		(void) fprintf(stderr, "check_binary_sig: bad hash init\n");
+		return 0;
+	}
+	hash.add(&hash, data, len);
+	return check_hashed_binary_sig(&hash, sig, signer);
+}
+
 static void validate_key_cb_free (validate_key_cb_t *vdata){
 
     /* Free according to previous allocated type */
@@ -569,9 +585,23 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 		/* ignore */
 		break;
 
+	case PGP_PTAG_CT_1_PASS_SIG:
+		/* the parser hashes the following literal data for binary
+		 * signatures, see parse_one_pass() */
+		if (content->one_pass_sig.sig_type == PGP_SIG_BINARY) {
+			data->onepass_hashed++;
+		} else {
+			data->onepass_other++;
+		}
+		break;
+
 	case PGP_PTAG_CT_LITDATA_BODY:
 		data->data.litdata_body = content->litdata_body;
 		data->type = LITDATA;
+		if (data->onepass_hashed && !data->onepass_other) {
+			/* no need to keep a copy of the data */
+			break;
+		}
 		pgp_memory_add(data->mem, data->data.litdata_body.data,
 				       data->data.litdata_body.length);
 		return PGP_KEEP_MEMORY;
@@ -635,10 +665,18 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 				hexdump(stderr, "sig dump", (const uint8_t *)(const void *)&content->sig,
 					sizeof(content->sig));
 			}
-			valid = check_binary_sig(pgp_mem_data(data->mem),
-					(const unsigned)pgp_mem_len(data->mem),
-					&content->sig,
-					sigkey);
+			if (content->sig.hash != NULL &&
+			    content->sig.info.type == PGP_SIG_BINARY &&
+			    content->sig.hash->alg == content->sig.info.hash_alg) {
+				valid = check_hashed_binary_sig(content->sig.hash,
+						&content->sig,
+						sigkey);
+			} else {
+				valid = check_binary_sig(pgp_mem_data(data->mem),
+						(const unsigned)pgp_mem_len(data->mem),
+						&content->sig,
+						sigkey);
+			}
 			break;
 
 		default:
@@ -673,7 +711,6 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 	case PGP_PTAG_CT_SIGNATURE_HEADER:
 	case PGP_PTAG_CT_ARMOUR_HEADER:
 	case PGP_PTAG_CT_ARMOUR_TRAILER:
-	case PGP_PTAG_CT_1_PASS_SIG:
 		break;
 
 	case PGP_PARSER_PACKET_END:
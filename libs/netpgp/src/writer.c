@@ -74,6 +74,10 @@ __RCSID("$NetBSD$");
 #include <openssl/cast.h>
 #endif
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #include "netpgp/create.h"
 #include "netpgp/writer.h"
 #include "netpgp/keyring.h"
@@ -1492,447 +1496,500 @@ pgp_pop_sum16_writer(pgp_output_t *output)
 
 /**************************************************************************/
 
-#if 0 //////
-#define MAX_PARTIAL_DATA_LENGTH 1073741824
+/*
+ * Streaming writers.  The writers above need the whole message in memory as
+ * packet lengths are written before the data; the following writers use
+ * Partial Body Lengths (RFC 4880, 4.2.2.4) instead, so messages of any size
+ * can be signed, compressed and encrypted with constant memory.
+ */
+
+#define PARTIAL_BODY_BITS	13	/* 8 KB chunks, the first chunk MUST be at least 512 bytes */
+#define PARTIAL_BODY_LEN	(1U << PARTIAL_BODY_BITS)
 
 typedef struct {
-	pgp_crypt_t	*crypt;
-	pgp_memory_t	*mem_data;
-	pgp_memory_t	*litmem;
-	pgp_output_t	*litoutput;
-	pgp_memory_t	*se_ip_mem;
-	pgp_output_t	*se_ip_out;
-	pgp_hash_t	 hash;
-} str_enc_se_ip_t;
-#endif //////
+	uint8_t		 ptag;
+	unsigned	 ptag_written;
+	unsigned	 c;
+	uint8_t		 buf[PARTIAL_BODY_LEN];
+} partial_body_t;
 
-#if 0 //////
-static unsigned
-str_enc_se_ip_writer(const uint8_t *src,
-			    unsigned len,
-			    pgp_error_t **errors,
-			    pgp_writer_t *writer);
+static void
+partial_body_init(partial_body_t *body, pgp_content_enum tag)
+{
+	body->ptag = tag | PGP_PTAG_ALWAYS_SET | PGP_PTAG_NEW_FORMAT;
+	body->ptag_written = 0;
+	body->c = 0;
+}
 
 static unsigned
-str_enc_se_ip_finaliser(pgp_error_t **errors,
-			       pgp_writer_t * writer);
-
-static void     str_enc_se_ip_destroyer(pgp_writer_t *writer);
-#endif //////
-
-/* */
-
-/**
-\ingroup Core_WritersNext
-\param output
-\param pubkey
-*/
-#if 0 //////
-void
-pgp_push_stream_enc_se_ip(pgp_output_t *output, pgp_key_t *pubkey, const char *cipher)
+partial_body_flush(partial_body_t *body, const uint8_t *src,
+		pgp_error_t **errors, pgp_writer_t *writer)
 {
-	pgp_pk_sesskey_t	*encrypted_pk_sesskey;
-	str_enc_se_ip_t		*se_ip;
-	const unsigned	 	 bufsz = 1024;
-	pgp_crypt_t		*encrypted;
-	uint8_t			*iv;
+	uint8_t	len = 224 + PARTIAL_BODY_BITS;
 
-	if ((se_ip = calloc(1, sizeof(*se_ip))) == NULL) {
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
-	}
-	encrypted_pk_sesskey = pgp_create_pk_sesskey(pubkey, cipher, NULL);
-	pgp_write_pk_sesskey(output, encrypted_pk_sesskey);
-
-	/* Setup the se_ip */
-	if ((encrypted = calloc(1, sizeof(*encrypted))) == NULL) {
-		free(se_ip);
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
-	}
-	if( !pgp_crypt_any(encrypted, encrypted_pk_sesskey->symm_alg) ) {
-		return; // EDIT BY MR
-	}
-	if ((iv = calloc(1, encrypted->blocksize)) == NULL) {
-		free(encrypted);
-		free(se_ip);
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
+	if (!body->ptag_written) {
+		if (!stacked_write(writer, &body->ptag, 1, errors)) {
+			return 0;
+		}
+		body->ptag_written = 1;
 	}
-	encrypted->set_iv(encrypted, iv);
-	encrypted->set_crypt_key(encrypted, &encrypted_pk_sesskey->key[0]);
-	pgp_encrypt_init(encrypted);
-
-	se_ip->crypt = encrypted;
-
-	se_ip->mem_data = pgp_memory_new();
-	pgp_memory_init(se_ip->mem_data, bufsz);
-
-	se_ip->litmem = NULL;
-	se_ip->litoutput = NULL;
-
-	pgp_setup_memory_write(&se_ip->se_ip_out, &se_ip->se_ip_mem, bufsz);
-
-	/* And push writer on stack */
-	pgp_writer_push(output,
-			str_enc_se_ip_writer,
-			str_enc_se_ip_finaliser,
-			str_enc_se_ip_destroyer, se_ip);
-	/* tidy up */
-	free(encrypted_pk_sesskey);
-	free(iv);
+	return stacked_write(writer, &len, 1, errors) &&
+		stacked_write(writer, src, PARTIAL_BODY_LEN, errors);
 }
-#endif //////
-
 
-/* calculate the partial data length */
-#if 0 //////
+/* add data to the packet body, full chunks are written to the next writer */
 static unsigned
-partial_data_len(unsigned len)
+partial_body_write(partial_body_t *body, const uint8_t *src, unsigned len,
+		pgp_error_t **errors, pgp_writer_t *writer)
 {
-	unsigned	mask;
-	int		i;
+	unsigned	n;
 
-	if (len == 0) {
-		(void) fprintf(stderr, "partial_data_len: 0 len\n");
-		return 0;
-	}
-	if (len > MAX_PARTIAL_DATA_LENGTH) {
-		return MAX_PARTIAL_DATA_LENGTH;
-	}
-	mask = MAX_PARTIAL_DATA_LENGTH;
-	for (i = 0; i <= 30; i++) {
-		if (mask & len) {
-			break;
+	while (len > 0) {
+		if (body->c == 0 && len >= PARTIAL_BODY_LEN) {
+			/* no need to copy full chunks */
+			if (!partial_body_flush(body, src, errors, writer)) {
+				return 0;
+			}
+			src += PARTIAL_BODY_LEN;
+			len -= PARTIAL_BODY_LEN;
+			continue;
+		}
+		n = MIN(len, PARTIAL_BODY_LEN - body->c);
+		(void) memcpy(&body->buf[body->c], src, n);
+		body->c += n;
+		src += n;
+		len -= n;
+		if (body->c == PARTIAL_BODY_LEN) {
+			if (!partial_body_flush(body, body->buf, errors, writer)) {
+				return 0;
+			}
+			body->c = 0;
 		}
-		mask >>= 1;
 	}
-	return mask;
+	return 1;
 }
-#endif //////
 
-#if 0 //////
+/* the remaining data are written as the last chunk, using a normal length */
 static unsigned
-write_partial_len(pgp_output_t *output, unsigned len)
+partial_body_finish(partial_body_t *body, pgp_error_t **errors,
+		pgp_writer_t *writer)
 {
-	/* len must be a power of 2 from 0 to 30 */
-	uint8_t	c;
-	int	i;
+	uint8_t		hdr[3];
+	unsigned	hdrc = 0;
 
-	for (i = 0; i <= 30; i++) {
-		if ((len >> i) & 1) {
-			break;
-		}
+	if (!body->ptag_written) {
+		hdr[hdrc++] = body->ptag;
+		body->ptag_written = 1;
+	}
+	/* body->c is always less than PARTIAL_BODY_LEN, so at most two octets */
+	if (body->c < 192) {
+		hdr[hdrc++] = body->c;
+	} else {
+		hdr[hdrc++] = ((body->c - 192) >> 8) + 192;
+		hdr[hdrc++] = (body->c - 192) % 256;
+	}
+	if (!stacked_write(writer, hdr, hdrc, errors)) {
+		return 0;
 	}
-	c = 224 + i;
-	return pgp_write(output, &c, 1);
+	if (body->c && !stacked_write(writer, body->buf, body->c, errors)) {
+		return 0;
+	}
+	body->c = 0;
+	return 1;
 }
-#endif //////
 
-#if 0 //////
+static void
+partial_body_add_litdata_header(partial_body_t *body, pgp_litdata_enum type)
+{
+	/* see pgp_write_litdata(): type, no filename, no date */
+	body->buf[body->c++] = type;
+	(void) memset(&body->buf[body->c], 0x0, 1 + 4);
+	body->c += 1 + 4;
+}
+
+/* Literal Data packet */
+
 static unsigned
-stream_write_litdata(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len)
+stream_litdata_writer(const uint8_t *src, unsigned len, pgp_error_t **errors,
+		pgp_writer_t *writer)
 {
-	size_t          pdlen;
+	partial_body_t	*body = pgp_writer_get_arg(writer);
 
-	while (len > 0) {
-		pdlen = partial_data_len(len);
-		write_partial_len(output, (unsigned)pdlen);
-		pgp_write(output, data, (unsigned)pdlen);
-		data += pdlen;
-		len -= (unsigned)pdlen;
-	}
-	return 1;
+	return partial_body_write(body, src, len, errors, writer);
 }
-#endif //////
 
-#if 0 //////
 static unsigned
-stream_write_litdata_first(pgp_output_t *output,
-				const uint8_t *data,
-				unsigned len,
-				const pgp_litdata_enum type)
+stream_litdata_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
 {
-	/* \todo add filename  */
-	/* \todo add date */
-	/* \todo do we need to check text data for <cr><lf> line endings ? */
+	partial_body_t	*body = pgp_writer_get_arg(writer);
 
-	unsigned	sz_towrite;
-	size_t		sz_pd;
+	return partial_body_finish(body, errors, writer);
+}
 
-	sz_towrite = 1 + 1 + 4 + len;
-	sz_pd = (size_t)partial_data_len(sz_towrite);
-	if (sz_pd < 512) {
-		(void) fprintf(stderr,
-			"stream_write_litdata_first: bad sz_pd\n");
+static int
+push_stream_litdata(pgp_output_t *output, pgp_litdata_enum type)
+{
+	partial_body_t	*body;
+
+	if ((body = calloc(1, sizeof(*body))) == NULL) {
+		(void) fprintf(stderr, "push_stream_litdata: bad alloc\n");
 		return 0;
 	}
-	pgp_write_ptag(output, PGP_PTAG_CT_LITDATA);
-	write_partial_len(output, (unsigned)sz_pd);
-	pgp_write_scalar(output, (unsigned)type, 1);
-	pgp_write_scalar(output, 0, 1);
-	pgp_write_scalar(output, 0, 4);
-	pgp_write(output, data, (unsigned)(sz_pd - 6));
+	partial_body_init(body, PGP_PTAG_CT_LITDATA);
+	partial_body_add_litdata_header(body, type);
+	pgp_writer_push(output, stream_litdata_writer, stream_litdata_finaliser,
+			generic_destroyer, body);
+	return 1;
+}
 
-	data += (sz_pd - 6);
-	sz_towrite -= (unsigned)sz_pd;
+/* Compressed Data packet */
 
-	return stream_write_litdata(output, data, (unsigned)sz_towrite);
-}
-#endif //////
+typedef struct {
+	partial_body_t	 body;
+	z_stream	 zstream;
+	uint8_t		 out[PARTIAL_BODY_LEN];
+} stream_compress_t;
 
-#if 0 //////
 static unsigned
-stream_write_litdata_last(pgp_output_t *output,
-				const uint8_t *data,
-				unsigned len)
+stream_deflate(stream_compress_t *z, const uint8_t *src, unsigned len,
+		int flush, pgp_error_t **errors, pgp_writer_t *writer)
 {
-	pgp_write_length(output, len);
-	return pgp_write(output, data, len);
+	z->zstream.next_in = __UNCONST(src);
+	z->zstream.avail_in = len;
+	do {
+		z->zstream.next_out = z->out;
+		z->zstream.avail_out = sizeof(z->out);
+		if (deflate(&z->zstream, flush) == Z_STREAM_ERROR) {
+			PGP_ERROR_1(errors, PGP_E_W, "%s", "deflate failed");
+			return 0;
+		}
+		if (!partial_body_write(&z->body, z->out,
+				(unsigned)(sizeof(z->out) - z->zstream.avail_out),
+				errors, writer)) {
+			return 0;
+		}
+	} while (z->zstream.avail_out == 0);
+	return 1;
 }
-#endif //////
 
-#if 0 //////
 static unsigned
-stream_write_se_ip(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
+stream_compress_writer(const uint8_t *src, unsigned len, pgp_error_t **errors,
+		pgp_writer_t *writer)
 {
-	size_t          pdlen;
+	stream_compress_t	*z = pgp_writer_get_arg(writer);
 
-	while (len > 0) {
-		pdlen = partial_data_len(len);
-		write_partial_len(output, (unsigned)pdlen);
+	return stream_deflate(z, src, len, Z_NO_FLUSH, errors, writer);
+}
 
-		pgp_push_enc_crypt(output, se_ip->crypt);
-		pgp_write(output, data, (unsigned)pdlen);
-		pgp_writer_pop(output);
+static unsigned
+stream_compress_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+{
+	stream_compress_t	*z = pgp_writer_get_arg(writer);
 
-		se_ip->hash.add(&se_ip->hash, data, (unsigned)pdlen);
+	return stream_deflate(z, NULL, 0, Z_FINISH, errors, writer) &&
+		partial_body_finish(&z->body, errors, writer);
+}
 
-		data += pdlen;
-		len -= (unsigned)pdlen;
-	}
-	return 1;
+static void
+stream_compress_destroyer(pgp_writer_t *writer)
+{
+	stream_compress_t	*z = pgp_writer_get_arg(writer);
+
+	deflateEnd(&z->zstream);
+	free(z);
 }
-#endif //////
 
-#if 0 //////
-static unsigned
-stream_write_se_ip_first(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
-{
-	uint8_t	*preamble;
-	size_t	blocksize;
-	size_t 	preamblesize;
-	size_t 	sz_towrite;
-	size_t 	sz_pd;
-
-	blocksize = se_ip->crypt->blocksize;
-	preamblesize = blocksize + 2;
-	sz_towrite = preamblesize + 1 + len;
-	if ((preamble = calloc(1, preamblesize)) == NULL) {
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad alloc\n");
+static int
+push_stream_compress(pgp_output_t *output)
+{
+	stream_compress_t	*z;
+
+	if ((z = calloc(1, sizeof(*z))) == NULL) {
+		(void) fprintf(stderr, "push_stream_compress: bad alloc\n");
 		return 0;
 	}
-	sz_pd = (size_t)partial_data_len((unsigned)sz_towrite);
-	if (sz_pd < 512) {
-		free(preamble);
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad sz_pd\n");
+	/* same as pgp_writez() */
+	if (deflateInit(&z->zstream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		(void) fprintf(stderr, "push_stream_compress: can't initialise\n");
+		free(z);
 		return 0;
 	}
-	pgp_write_ptag(output, PGP_PTAG_CT_SE_IP_DATA);
-	write_partial_len(output, (unsigned)sz_pd);
-	pgp_write_scalar(output, PGP_SE_IP_DATA_VERSION, 1);
-	pgp_push_enc_crypt(output, se_ip->crypt);
-
-	pgp_random(preamble, blocksize);
-	preamble[blocksize] = preamble[blocksize - 2];
-	preamble[blocksize + 1] = preamble[blocksize - 1];
-	pgp_hash_any(&se_ip->hash, PGP_HASH_SHA1);
-	if (!se_ip->hash.init(&se_ip->hash)) {
-		free(preamble);
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad hash init\n");
-		return 0;
-	}
-	pgp_write(output, preamble, (unsigned)preamblesize);
-	se_ip->hash.add(&se_ip->hash, preamble, (unsigned)preamblesize);
-	pgp_write(output, data, (unsigned)(sz_pd - preamblesize - 1));
-	se_ip->hash.add(&se_ip->hash, data, (unsigned)(sz_pd - preamblesize - 1));
-	data += (sz_pd - preamblesize - 1);
-	sz_towrite -= sz_pd;
-	pgp_writer_pop(output);
-	stream_write_se_ip(output, data, (unsigned)sz_towrite, se_ip);
-	free(preamble);
+	partial_body_init(&z->body, PGP_PTAG_CT_COMPRESSED);
+	z->body.buf[z->body.c++] = PGP_C_ZLIB;
+	pgp_writer_push(output, stream_compress_writer, stream_compress_finaliser,
+			stream_compress_destroyer, z);
 	return 1;
 }
-#endif //////
 
-#if 0 //////
+/* Symmetrically Encrypted Integrity Protected Data packet */
+
+typedef struct {
+	partial_body_t	 body;
+	pgp_crypt_t	 crypt;
+	pgp_hash_t	 mdc;		/* SHA1 of the plaintext, see pgp_calc_mdc_hash() */
+	unsigned	 mdc_active;
+	uint8_t		 buf[PARTIAL_BODY_LEN];
+} stream_se_ip_t;
+
 static unsigned
-stream_write_se_ip_last(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
+stream_se_ip_encrypt(stream_se_ip_t *se_ip, const uint8_t *src, unsigned len,
+		pgp_error_t **errors, pgp_writer_t *writer)
 {
-	pgp_output_t	*mdcoutput;
-	pgp_memory_t	*mdcmem;
-	const size_t	 mdcsize = 1 + 1 + PGP_SHA1_HASH_SIZE;
-	uint8_t		 c;
-	uint8_t		 hashed[PGP_SHA1_HASH_SIZE];
-	size_t		 bufsize = len + mdcsize;
+	unsigned	n;
 
-	se_ip->hash.add(&se_ip->hash, data, len);
+	while (len > 0) {
+		n = MIN(len, sizeof(se_ip->buf));
+		se_ip->crypt.cfb_encrypt(&se_ip->crypt, se_ip->buf, src, n);
+		if (!partial_body_write(&se_ip->body, se_ip->buf, n, errors, writer)) {
+			return 0;
+		}
+		src += n;
+		len -= n;
+	}
+	return 1;
+}
 
-	/* MDC packet tag */
-	c = MDC_PKT_TAG;
-	se_ip->hash.add(&se_ip->hash, &c, 1);
+static unsigned
+stream_se_ip_writer(const uint8_t *src, unsigned len, pgp_error_t **errors,
+		pgp_writer_t *writer)
+{
+	stream_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
 
-	/* MDC packet len */
-	c = PGP_SHA1_HASH_SIZE;
-	se_ip->hash.add(&se_ip->hash, &c, 1);
+	se_ip->mdc.add(&se_ip->mdc, src, len);
+	return stream_se_ip_encrypt(se_ip, src, len, errors, writer);
+}
 
-	/* finish */
-	se_ip->hash.finish(&se_ip->hash, hashed);
+static unsigned
+stream_se_ip_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+{
+	stream_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
+	uint8_t		 mdc[1 + 1 + PGP_SHA1_HASH_SIZE];
+
+	/* the MDC packet header is part of the hash, see pgp_write_mdc() */
+	mdc[0] = MDC_PKT_TAG;
+	mdc[1] = PGP_SHA1_HASH_SIZE;
+	se_ip->mdc.add(&se_ip->mdc, mdc, 2);
+	se_ip->mdc.finish(&se_ip->mdc, &mdc[2]);
+	se_ip->mdc_active = 0;
+
+	return stream_se_ip_encrypt(se_ip, mdc, sizeof(mdc), errors, writer) &&
+		partial_body_finish(&se_ip->body, errors, writer);
+}
 
-	pgp_setup_memory_write(&mdcoutput, &mdcmem, mdcsize);
-	pgp_write_mdc(mdcoutput, hashed);
+static void
+stream_se_ip_destroyer(pgp_writer_t *writer)
+{
+	stream_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
+	uint8_t		 unused[PGP_SHA1_HASH_SIZE];
 
-	/* write length of last se_ip chunk */
-	pgp_write_length(output, (unsigned)bufsize);
+	if (se_ip->mdc_active) {
+		se_ip->mdc.finish(&se_ip->mdc, unused);
+	}
+	se_ip->crypt.decrypt_finish(&se_ip->crypt);
+	free(se_ip);
+}
 
-	/* encode everting */
-	pgp_push_enc_crypt(output, se_ip->crypt);
+/**
+\ingroup Core_WritersNext
+\brief Push streaming Encrypted SE IP Writer onto stack
 
-	pgp_write(output, data, len);
-	pgp_write(output, pgp_mem_data(mdcmem), (unsigned)pgp_mem_len(mdcmem));
+Same as pgp_push_enc_se_ip() but data may be written in any number of chunks;
+the packets are completed by pgp_writer_close().
+*/
+int
+pgp_push_stream_enc_se_ip(pgp_output_t *output, const pgp_keyring_t *pubkeys, const char *cipher, unsigned raw)
+{
+	pgp_pk_sesskey_t *initial_sesskey = NULL;
+	pgp_pk_sesskey_t *encrypted_pk_sesskey;
+	stream_se_ip_t	*se_ip;
+	uint8_t		 iv[PGP_MAX_BLOCK_SIZE];
+	uint8_t		 preamble[PGP_MAX_BLOCK_SIZE + 2];
+	size_t		 blocksize;
+	unsigned	 n;
 
-	pgp_writer_pop(output);
+	for (n = 0; n < pubkeys->keyc; ++n) {
+		if ((encrypted_pk_sesskey =
+				pgp_create_pk_sesskey(&pubkeys->keys[n],
+					cipher, initial_sesskey)) == NULL) {
+			(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: null pk sesskey\n");
+			break;
+		}
+		if (initial_sesskey == NULL) {
+			initial_sesskey = encrypted_pk_sesskey;
+		}
+		pgp_write_pk_sesskey(output, encrypted_pk_sesskey);
+		if (encrypted_pk_sesskey != initial_sesskey) {
+			pgp_pk_sesskey_free(encrypted_pk_sesskey);
+			free(encrypted_pk_sesskey);
+		}
+	}
+	if (initial_sesskey == NULL || n < pubkeys->keyc) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: no sesskey\n");
+		goto fail;
+	}
 
-	pgp_teardown_memory_write(mdcoutput, mdcmem);
+	if ((se_ip = calloc(1, sizeof(*se_ip))) == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad alloc\n");
+		goto fail;
+	}
+	if (!pgp_crypt_any(&se_ip->crypt, initial_sesskey->symm_alg)) {
+		free(se_ip);
+		goto fail;
+	}
+	pgp_hash_any(&se_ip->mdc, PGP_HASH_SHA1);
+	if (!se_ip->mdc.init(&se_ip->mdc)) {
+		free(se_ip);
+		goto fail;
+	}
+	se_ip->mdc_active = 1;
+	(void) memset(iv, 0x0, sizeof(iv));
+	se_ip->crypt.set_iv(&se_ip->crypt, iv);
+	se_ip->crypt.set_crypt_key(&se_ip->crypt, &initial_sesskey->key[0]);
+	pgp_encrypt_init(&se_ip->crypt);
 
-	return 1;
-}
-#endif //////
+	partial_body_init(&se_ip->body, PGP_PTAG_CT_SE_IP_DATA);
+	se_ip->body.buf[se_ip->body.c++] = PGP_SE_IP_DATA_VERSION;
+	pgp_writer_push(output, stream_se_ip_writer, stream_se_ip_finaliser,
+			stream_se_ip_destroyer, se_ip);
 
-#if 0 //////
-static unsigned
-str_enc_se_ip_writer(const uint8_t *src,
-			    unsigned len,
-			    pgp_error_t **errors,
-			    pgp_writer_t *writer)
-{
-	str_enc_se_ip_t	*se_ip;
-	unsigned	 ret;
-	size_t           datalength;
+	/* the preamble goes through the new writer to be hashed and encrypted */
+	blocksize = se_ip->crypt.blocksize;
+	pgp_random(preamble, blocksize);
+	preamble[blocksize] = preamble[blocksize - 2];
+	preamble[blocksize + 1] = preamble[blocksize - 1];
+	if (!pgp_write(output, preamble, (unsigned)(blocksize + 2))) {
+		goto fail;
+	}
 
-	se_ip = pgp_writer_get_arg(writer);
-	if (se_ip->litoutput == NULL) {
-		/* first literal data chunk is not yet written */
+	/* compress, and create the Literal Data packet if the caller does not
+	 * write packets on its own (raw) */
+	if (!push_stream_compress(output) ||
+	    (!raw && !push_stream_litdata(output, PGP_LDT_BINARY))) {
+		goto fail;
+	}
 
-		pgp_memory_add(se_ip->mem_data, src, len);
-		datalength = pgp_mem_len(se_ip->mem_data);
+	pgp_pk_sesskey_free(initial_sesskey);
+	free(initial_sesskey);
+	return 1;
 
-		/* 4.2.2.4. Partial Body Lengths */
-		/* The first partial length MUST be at least 512 octets long. */
-		if (datalength < 512) {
-			return 1;	/* will wait for more data or
-						 * end of stream             */
-		}
-		pgp_setup_memory_write(&se_ip->litoutput,
-				&se_ip->litmem, datalength + 32);
-		stream_write_litdata_first(se_ip->litoutput,
-				pgp_mem_data(se_ip->mem_data),
-				(unsigned)datalength,
-				PGP_LDT_BINARY);
-
-		stream_write_se_ip_first(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
-	} else {
-		stream_write_litdata(se_ip->litoutput, src, len);
-		stream_write_se_ip(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
+fail:
+	if (initial_sesskey) {
+		pgp_pk_sesskey_free(initial_sesskey);
+		free(initial_sesskey);
 	}
+	return 0;
+}
 
-	/* now write memory to next writer */
-	ret = stacked_write(writer, pgp_mem_data(se_ip->se_ip_mem),
-				(unsigned)pgp_mem_len(se_ip->se_ip_mem), errors);
-
-	pgp_memory_clear(se_ip->litmem);
-	pgp_memory_clear(se_ip->se_ip_mem);
+/* One-Pass Signature, Literal Data and Signature packets */
 
-	return ret;
-}
-#endif //////
+typedef struct {
+	partial_body_t		 body;	/* the Literal Data packet */
+	pgp_create_sig_t	*sig;
+	const pgp_seckey_t	*seckey;
+	pgp_hash_alg_t		 hash_alg;
+	time_t			 from;
+	time_t			 duration;
+	unsigned		 signed_;
+} stream_signed_t;
 
-/* write last chunk of data */
-#if 0 //////
 static unsigned
-str_enc_se_ip_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+stream_signed_writer(const uint8_t *src, unsigned len, pgp_error_t **errors,
+		pgp_writer_t *writer)
 {
-	str_enc_se_ip_t	*se_ip;
+	stream_signed_t	*ssig = pgp_writer_get_arg(writer);
+	pgp_hash_t	*hash = pgp_sig_get_hash(ssig->sig);
 
-	se_ip = pgp_writer_get_arg(writer);
-	if (se_ip->litoutput == NULL) {
-		/* first literal data chunk was not written */
-		/* so we know the total length of data, write a simple packet */
+	hash->add(hash, src, len);
+	return partial_body_write(&ssig->body, src, len, errors, writer);
+}
 
-		/* create literal data packet from buffered data */
-		pgp_setup_memory_write(&se_ip->litoutput, &se_ip->litmem,
-				 pgp_mem_len(se_ip->mem_data) + 32);
+static unsigned
+stream_signed_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+{
+	stream_signed_t	*ssig = pgp_writer_get_arg(writer);
+	pgp_output_t	*sigoutput;
+	pgp_memory_t	*sigmem;
+	uint8_t		 keyid[PGP_KEY_ID_SIZE];
+	unsigned	 ret;
 
-		pgp_write_litdata(se_ip->litoutput,
-			pgp_mem_data(se_ip->mem_data),
-			(const int)pgp_mem_len(se_ip->mem_data),
-			PGP_LDT_BINARY);
+	if (!partial_body_finish(&ssig->body, errors, writer)) {
+		return 0;
+	}
 
-		/* create SE IP packet set from this literal data */
-		pgp_write_se_ip_pktset(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem),
-				se_ip->crypt);
+	/* same as pgp_sign_buf() */
+	pgp_add_creation_time(ssig->sig, ssig->from);
+	pgp_add_sig_expiration_time(ssig->sig, ssig->duration);
+	pgp_keyid(keyid, PGP_KEY_ID_SIZE, &ssig->seckey->pubkey, ssig->hash_alg);
+	pgp_add_issuer_keyid(ssig->sig, keyid);
+	pgp_end_hashed_subpkts(ssig->sig);
 
-	} else {
-		/* finish writing */
-		stream_write_litdata_last(se_ip->litoutput, NULL, 0);
-		stream_write_se_ip_last(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
+	/* the signature is small, render it to memory */
+	pgp_setup_memory_write(&sigoutput, &sigmem, 128);
+	ret = pgp_write_sig(sigoutput, ssig->sig, &ssig->seckey->pubkey, ssig->seckey);
+	ssig->signed_ = 1;
+	if (ret) {
+		ret = stacked_write(writer, pgp_mem_data(sigmem),
+				(unsigned)pgp_mem_len(sigmem), errors);
 	}
-
-	/* now write memory to next writer */
-	return stacked_write(writer, pgp_mem_data(se_ip->se_ip_mem),
-				 (unsigned)pgp_mem_len(se_ip->se_ip_mem), errors);
+	pgp_teardown_memory_write(sigoutput, sigmem);
+	return ret;
 }
-#endif //////
 
-#if 0 //////
 static void
-str_enc_se_ip_destroyer(pgp_writer_t *writer)
+stream_signed_destroyer(pgp_writer_t *writer)
 {
-	str_enc_se_ip_t *se_ip;
+	stream_signed_t	*ssig = pgp_writer_get_arg(writer);
+	pgp_hash_t	*hash;
+	uint8_t		 unused[PGP_MAX_HASH_SIZE];
 
-	se_ip = pgp_writer_get_arg(writer);
-	pgp_memory_free(se_ip->mem_data);
-	pgp_teardown_memory_write(se_ip->litoutput, se_ip->litmem);
-	pgp_teardown_memory_write(se_ip->se_ip_out, se_ip->se_ip_mem);
+	if (!ssig->signed_) {
+		/* pgp_write_sig() was not called and did not finish the hash */
+		hash = pgp_sig_get_hash(ssig->sig);
+		hash->finish(hash, unused);
+	}
+	pgp_create_sig_delete(ssig->sig);
+	free(ssig);
+}
 
-	se_ip->crypt->decrypt_finish(se_ip->crypt);
+/**
+\ingroup Core_WritersNext
+\brief Push streaming Signing Writer onto stack
 
-	free(se_ip->crypt);
-	free(se_ip);
+Writes a One-Pass Signature packet; the data written to the pushed writer
+go to a Literal Data packet and the Signature packet is written by
+pgp_writer_close().  This is the same as pgp_sign_buf() for unarmored,
+binary data.
+*/
+unsigned
+pgp_writer_push_stream_signed(pgp_output_t *output, const pgp_seckey_t *seckey,
+		pgp_hash_alg_t hash_alg, const time_t from, const time_t duration)
+{
+	stream_signed_t	*ssig;
+
+	if ((ssig = calloc(1, sizeof(*ssig))) == NULL ||
+	    (ssig->sig = pgp_create_sig_new()) == NULL) {
+		(void) fprintf(stderr, "pgp_writer_push_stream_signed: bad alloc\n");
+		free(ssig);
+		return 0;
+	}
+	pgp_start_sig(ssig->sig, seckey, hash_alg, PGP_SIG_BINARY);
+	ssig->seckey = seckey;
+	ssig->hash_alg = hash_alg;
+	ssig->from = from;
+	ssig->duration = duration;
+	partial_body_init(&ssig->body, PGP_PTAG_CT_LITDATA);
+	partial_body_add_litdata_header(&ssig->body, PGP_LDT_BINARY);
+
+	if (!pgp_write_one_pass_sig(output, seckey, hash_alg, PGP_SIG_BINARY)) {
+		uint8_t	unused[PGP_MAX_HASH_SIZE];
+		pgp_hash_t *hash = pgp_sig_get_hash(ssig->sig);
+
+		hash->finish(hash, unused);
+		pgp_create_sig_delete(ssig->sig);
+		free(ssig);
+		return 0;
+	}
+	pgp_writer_push(output, stream_signed_writer, stream_signed_finaliser,
+			stream_signed_destroyer, ssig);
+	return 1;
 }
-#endif //////
\ No newline at end of file
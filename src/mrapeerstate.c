@@ -30,6 +30,16 @@
  ******************************************************************************/
 
 
+static void forget_gossip_header(mrapeerstate_t* ths)
+{
+	free(ths->m_gossip_header);
+	ths->m_gossip_header = NULL;
+
+	free(ths->m_gossip_header_fingerprint);
+	ths->m_gossip_header_fingerprint = NULL;
+}
+
+
 static void mrapeerstate_empty(mrapeerstate_t* ths)
 {
 	if( ths == NULL ) {
@@ -47,6 +57,7 @@ static void mrapeerstate_empty(mrapeerstate_t* ths)
 	free(ths->m_fingerprint);
 	ths->m_fingerprint = NULL;
 	ths->m_verified    = 0;
+	ths->m_key_changed = 0;
 
 	if( ths->m_public_key ) {
 		mrkey_unref(ths->m_public_key);
@@ -60,13 +71,15 @@ static void mrapeerstate_empty(mrapeerstate_t* ths)
 		ths->m_gossip_key = NULL;
 	}
 
+	forget_gossip_header(ths);
+
 	ths->m_degrade_event = 0;
 }
 
 
 static void mrapeerstate_set_from_stmt__(mrapeerstate_t* peerstate, sqlite3_stmt* stmt)
 {
-	#define PEERSTATE_FIELDS "addr, last_seen, last_seen_autocrypt, prefer_encrypted, public_key, gossip_timestamp, gossip_key, fingerprint, verified"
+	#define PEERSTATE_FIELDS "addr, last_seen, last_seen_autocrypt, prefer_encrypted, public_key, gossip_timestamp, gossip_key, fingerprint, verified, key_changed"
 	peerstate->m_addr                = safe_strdup((char*)sqlite3_column_text  (stmt, 0));
 	peerstate->m_last_seen           =                    sqlite3_column_int64 (stmt, 1);
 	peerstate->m_last_seen_autocrypt =                    sqlite3_column_int64 (stmt, 2);
@@ -76,6 +89,7 @@ static void mrapeerstate_set_from_stmt__(mrapeerstate_t* peerstate, sqlite3_stmt
 	#define GOSSIP_KEY_COL                                                      6
 	peerstate->m_fingerprint         = safe_strdup((char*)sqlite3_column_text  (stmt, 7));
 	peerstate->m_verified            =                    sqlite3_column_int   (stmt, 8);
+	peerstate->m_key_changed         =                    sqlite3_column_int64 (stmt, 9);
 
 	if( sqlite3_column_type(stmt, PUBLIC_KEY_COL)!=SQLITE_NULL ) {
 		peerstate->m_public_key = mrkey_new();
@@ -89,6 +103,152 @@ static void mrapeerstate_set_from_stmt__(mrapeerstate_t* peerstate, sqlite3_stmt
 }
 
 
+/*******************************************************************************
+ * Cache
+ ******************************************************************************/
+
+
+/* Peerstates are loaded for each recipient on sending and for each sender and
+gossiped address on receiving.  To avoid reading the same rows and keys again
+and again, the recently used peerstates are cached per mailbox; entries without
+peerstate remember that there is no peerstate for the address.
+
+The cache is protected by mrsqlite3_lock() and is used only for the database
+of the mailbox, not for eg. databases opened for backups. */
+typedef struct mrapeerstatecache_t
+{
+	char*                       m_addr;      /* the key in mrmailbox_t::m_peerstate_cache */
+	mrapeerstate_t*             m_peerstate; /* NULL if there is no peerstate for m_addr */
+	struct mrapeerstatecache_t* m_prev;      /* more recently used entry */
+	struct mrapeerstatecache_t* m_next;      /* less recently used entry */
+} mrapeerstatecache_t;
+
+
+static int uses_cache(mrsqlite3_t* sql)
+{
+	return (sql && sql->m_mailbox && sql->m_mailbox->m_sql == sql);
+}
+
+
+static void copy_peerstate(mrapeerstate_t* dst, const mrapeerstate_t* src)
+{
+	/* keys are copied, not ref'd, as the keys are modified by the mrapeerstate_apply_*() functions and are used outside the lock */
+	mrapeerstate_empty(dst);
+
+	dst->m_addr                = safe_strdup(src->m_addr);
+	dst->m_last_seen           = src->m_last_seen;
+	dst->m_last_seen_autocrypt = src->m_last_seen_autocrypt;
+	dst->m_prefer_encrypt      = src->m_prefer_encrypt;
+	dst->m_gossip_timestamp    = src->m_gossip_timestamp;
+	dst->m_fingerprint         = strdup_keep_null(src->m_fingerprint);
+	dst->m_verified            = src->m_verified;
+	dst->m_key_changed         = src->m_key_changed;
+
+	if( src->m_public_key ) {
+		dst->m_public_key = mrkey_new();
+		mrkey_set_from_key(dst->m_public_key, src->m_public_key);
+	}
+
+	if( src->m_gossip_key ) {
+		dst->m_gossip_key = mrkey_new();
+		mrkey_set_from_key(dst->m_gossip_key, src->m_gossip_key);
+	}
+
+	if( src->m_gossip_header && src->m_gossip_header_fingerprint ) {
+		dst->m_gossip_header             = safe_strdup(src->m_gossip_header);
+		dst->m_gossip_header_fingerprint = safe_strdup(src->m_gossip_header_fingerprint);
+	}
+}
+
+
+static void lru_unlink(mrmailbox_t* mailbox, mrapeerstatecache_t* entry)
+{
+	if( entry->m_prev ) { entry->m_prev->m_next = entry->m_next; } else { mailbox->m_peerstate_lru_first = entry->m_next; }
+	if( entry->m_next ) { entry->m_next->m_prev = entry->m_prev; } else { mailbox->m_peerstate_lru_last  = entry->m_prev; }
+	entry->m_prev = NULL;
+	entry->m_next = NULL;
+}
+
+
+static void lru_push_front(mrmailbox_t* mailbox, mrapeerstatecache_t* entry)
+{
+	entry->m_prev = NULL;
+	entry->m_next = mailbox->m_peerstate_lru_first;
+	if( entry->m_next ) { entry->m_next->m_prev = entry; } else { mailbox->m_peerstate_lru_last = entry; }
+	mailbox->m_peerstate_lru_first = entry;
+}
+
+
+static void cache_remove(mrmailbox_t* mailbox, mrapeerstatecache_t* entry)
+{
+	lru_unlink(mailbox, entry);
+	mrhash_insert(&mailbox->m_peerstate_cache, entry->m_addr, strlen(entry->m_addr), NULL);
+	mrapeerstate_unref(entry->m_peerstate);
+	free(entry->m_addr);
+	free(entry);
+}
+
+
+static mrapeerstatecache_t* cache_find(mrmailbox_t* mailbox, const char* addr)
+{
+	mrapeerstatecache_t* entry = (mrapeerstatecache_t*)mrhash_find(&mailbox->m_peerstate_cache, addr, strlen(addr));
+	if( entry && entry != mailbox->m_peerstate_lru_first ) {
+		lru_unlink(mailbox, entry);
+		lru_push_front(mailbox, entry);
+	}
+	return entry;
+}
+
+
+static void cache_put(mrmailbox_t* mailbox, const char* addr, const mrapeerstate_t* peerstate /*NULL=there is no peerstate for addr*/)
+{
+	mrapeerstatecache_t* entry;
+
+	if( addr == NULL ) {
+		return;
+	}
+
+	if( (entry=cache_find(mailbox, addr)) == NULL )
+	{
+		if( mrhash_count(&mailbox->m_peerstate_cache) >= MR_PEERSTATE_CACHE_MAX ) {
+			cache_remove(mailbox, mailbox->m_peerstate_lru_last);
+		}
+
+		if( (entry=calloc(1, sizeof(mrapeerstatecache_t)))==NULL ) {
+			return;
+		}
+		entry->m_addr = safe_strdup(addr);
+		mrhash_insert(&mailbox->m_peerstate_cache, entry->m_addr, strlen(entry->m_addr), entry);
+		lru_push_front(mailbox, entry);
+	}
+
+	if( peerstate ) {
+		if( entry->m_peerstate == NULL ) {
+			entry->m_peerstate = mrapeerstate_new(mailbox);
+		}
+		copy_peerstate(entry->m_peerstate, peerstate);
+	}
+	else {
+		mrapeerstate_unref(entry->m_peerstate);
+		entry->m_peerstate = NULL;
+	}
+}
+
+
+void mrapeerstate_clear_cache__(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL ) {
+		return;
+	}
+
+	while( mailbox->m_peerstate_lru_first ) {
+		cache_remove(mailbox, mailbox->m_peerstate_lru_first);
+	}
+
+	mrhash_clear(&mailbox->m_peerstate_cache);
+}
+
+
 int mrapeerstate_load_by_addr__(mrapeerstate_t* peerstate, mrsqlite3_t* sql, const char* addr)
 {
 	int           success = 0;
@@ -100,16 +260,36 @@ int mrapeerstate_load_by_addr__(mrapeerstate_t* peerstate, mrsqlite3_t* sql, con
 
 	mrapeerstate_empty(peerstate);
 
+	if( uses_cache(sql) )
+	{
+		mrapeerstatecache_t* entry = cache_find(sql->m_mailbox, addr);
+		if( entry ) {
+			if( entry->m_peerstate == NULL ) {
+				goto cleanup;
+			}
+			copy_peerstate(peerstate, entry->m_peerstate);
+			success = 1;
+			goto cleanup;
+		}
+	}
+
 	stmt = mrsqlite3_predefine__(sql, SELECT_fields_FROM_acpeerstates_WHERE_addr,
 		"SELECT " PEERSTATE_FIELDS
 		 " FROM acpeerstates "
 		 " WHERE addr=? COLLATE NOCASE;");
 	sqlite3_bind_text(stmt, 1, addr, -1, SQLITE_STATIC);
 	if( sqlite3_step(stmt) != SQLITE_ROW ) {
+		if( uses_cache(sql) ) {
+			cache_put(sql->m_mailbox, addr, NULL);
+		}
 		goto cleanup;
 	}
 	mrapeerstate_set_from_stmt__(peerstate, stmt);
 
+	if( uses_cache(sql) ) {
+		cache_put(sql->m_mailbox, addr, peerstate);
+	}
+
 	success = 1;
 
 cleanup:
@@ -138,6 +318,10 @@ int mrapeerstate_load_by_fingerprint__(mrapeerstate_t* peerstate, mrsqlite3_t* s
 	}
 	mrapeerstate_set_from_stmt__(peerstate, stmt);
 
+	if( uses_cache(sql) ) {
+		cache_put(sql->m_mailbox, peerstate->m_addr, peerstate);
+	}
+
 	success = 1;
 
 cleanup:
@@ -165,7 +349,7 @@ int mrapeerstate_save_to_db__(const mrapeerstate_t* ths, mrsqlite3_t* sql, int c
 		stmt = mrsqlite3_predefine__(sql, UPDATE_acpeerstates_SET_lcpp_WHERE_a,
 			"UPDATE acpeerstates "
 			"   SET last_seen=?, last_seen_autocrypt=?, prefer_encrypted=?, "
-			"       public_key=?, gossip_timestamp=?, gossip_key=?, fingerprint=?, verified=? "
+			"       public_key=?, gossip_timestamp=?, gossip_key=?, fingerprint=?, verified=?, key_changed=? "
 			" WHERE addr=?;");
 		sqlite3_bind_int64(stmt, 1, ths->m_last_seen);
 		sqlite3_bind_int64(stmt, 2, ths->m_last_seen_autocrypt);
@@ -175,7 +359,25 @@ int mrapeerstate_save_to_db__(const mrapeerstate_t* ths, mrsqlite3_t* sql, int c
 		sqlite3_bind_blob (stmt, 6, ths->m_gossip_key? ths->m_gossip_key->m_binary : NULL/*results in sqlite3_bind_null()*/, ths->m_gossip_key? ths->m_gossip_key->m_bytes : 0, SQLITE_STATIC);
 		sqlite3_bind_text (stmt, 7, ths->m_fingerprint, -1, SQLITE_STATIC);
 		sqlite3_bind_int  (stmt, 8, ths->m_verified);
-		sqlite3_bind_text (stmt, 9, ths->m_addr, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 9, ths->m_key_changed);
+		sqlite3_bind_text (stmt,10, ths->m_addr, -1, SQLITE_STATIC);
+		if( sqlite3_step(stmt) != SQLITE_DONE ) {
+			goto cleanup;
+		}
+	}
+	else if( ths->m_to_save&MRA_SAVE_STATE )
+	{
+		/* as MRA_SAVE_ALL, but without rewriting the key blobs and the fingerprint */
+		stmt = mrsqlite3_predefine__(sql, UPDATE_acpeerstates_SET_lcgpv_WHERE_a,
+			"UPDATE acpeerstates "
+			"   SET last_seen=?, last_seen_autocrypt=?, gossip_timestamp=?, prefer_encrypted=?, verified=? "
+			" WHERE addr=?;");
+		sqlite3_bind_int64(stmt, 1, ths->m_last_seen);
+		sqlite3_bind_int64(stmt, 2, ths->m_last_seen_autocrypt);
+		sqlite3_bind_int64(stmt, 3, ths->m_gossip_timestamp);
+		sqlite3_bind_int64(stmt, 4, ths->m_prefer_encrypt);
+		sqlite3_bind_int  (stmt, 5, ths->m_verified);
+		sqlite3_bind_text (stmt, 6, ths->m_addr, -1, SQLITE_STATIC);
 		if( sqlite3_step(stmt) != SQLITE_DONE ) {
 			goto cleanup;
 		}
@@ -196,6 +398,17 @@ int mrapeerstate_save_to_db__(const mrapeerstate_t* ths, mrsqlite3_t* sql, int c
 	success = 1;
 
 cleanup:
+	if( uses_cache(sql) && (ths->m_to_save || create) ) {
+		if( success ) {
+			cache_put(sql->m_mailbox, ths->m_addr, ths);
+		}
+		else {
+			mrapeerstatecache_t* entry = cache_find(sql->m_mailbox, ths->m_addr);
+			if( entry ) {
+				cache_remove(sql->m_mailbox, entry); /* we do not know the state in the database */
+			}
+		}
+	}
 	return success;
 }
 
@@ -226,8 +439,11 @@ void mrapeerstate_unref(mrapeerstate_t* ths)
 	}
 
 	free(ths->m_addr);
+	free(ths->m_fingerprint);
 	mrkey_unref(ths->m_public_key);
 	mrkey_unref(ths->m_gossip_key);
+	free(ths->m_gossip_header);
+	free(ths->m_gossip_header_fingerprint);
 	free(ths);
 }
 
@@ -265,6 +481,60 @@ cleanup:
 }
 
 
+/**
+ * Get an Autocrypt-Gossip header value as mrapeerstate_render_gossip_header()
+ * does, but re-use the value rendered before for the same fingerprint.
+ *
+ * Rendering base64-encodes the whole key; for groups, this is done for every
+ * member on every message sent.  Therefore the rendered value is memoized in
+ * the peerstate and in the peerstate cache; it is forgotten when the key
+ * changes.
+ *
+ * @memberof mrapeerstate_t
+ *
+ * @param peerstate The peerstate object.
+ *
+ * @param sql The database the peerstate was loaded from; if this database
+ *     uses the peerstate cache, the rendered value is stored there, too.
+ *
+ * @return See mrapeerstate_render_gossip_header().
+ */
+char* mrapeerstate_get_gossip_header__(mrapeerstate_t* peerstate, mrsqlite3_t* sql)
+{
+	char*                ret = NULL;
+	mrapeerstatecache_t* entry = NULL;
+
+	if( peerstate == NULL || peerstate->m_fingerprint == NULL ) {
+		return mrapeerstate_render_gossip_header(peerstate);
+	}
+
+	if( peerstate->m_gossip_header && peerstate->m_gossip_header_fingerprint
+	 && strcasecmp(peerstate->m_gossip_header_fingerprint, peerstate->m_fingerprint)==0 ) {
+		return safe_strdup(peerstate->m_gossip_header);
+	}
+
+	forget_gossip_header(peerstate);
+	if( (ret=mrapeerstate_render_gossip_header(peerstate)) == NULL ) {
+		return NULL;
+	}
+	peerstate->m_gossip_header             = safe_strdup(ret);
+	peerstate->m_gossip_header_fingerprint = safe_strdup(peerstate->m_fingerprint);
+
+	/* store the value also in the cache, however, only if the cached peerstate has the same key */
+	if( uses_cache(sql) && peerstate->m_addr
+	 && (entry=cache_find(sql->m_mailbox, peerstate->m_addr))!=NULL
+	 && entry->m_peerstate && entry->m_peerstate->m_fingerprint
+	 && strcasecmp(entry->m_peerstate->m_fingerprint, peerstate->m_fingerprint)==0
+	 && mrkey_equals(mrapeerstate_peek_key(entry->m_peerstate), mrapeerstate_peek_key(peerstate)) ) {
+		forget_gossip_header(entry->m_peerstate);
+		entry->m_peerstate->m_gossip_header             = safe_strdup(ret);
+		entry->m_peerstate->m_gossip_header_fingerprint = safe_strdup(peerstate->m_fingerprint);
+	}
+
+	return ret;
+}
+
+
 /**
  * Return either m_public_key or m_gossip_key if m_public_key is null.
  * The function does not check if the keys are valid but the caller can assume
@@ -325,6 +595,7 @@ int mrapeerstate_init_from_header(mrapeerstate_t* ths, const mraheader_t* header
 	ths->m_public_key = mrkey_new();
 	mrkey_set_from_key(ths->m_public_key, header->m_public_key);
 	mrapeerstate_recalc_fingerprint(ths);
+	ths->m_key_changed = message_time;
 
 	return 1;
 }
@@ -344,6 +615,7 @@ int mrapeerstate_init_from_gossip(mrapeerstate_t* peerstate, const mraheader_t*
 	peerstate->m_gossip_key = mrkey_new();
 	mrkey_set_from_key(peerstate->m_gossip_key, gossip_header->m_public_key);
 	mrapeerstate_recalc_fingerprint(peerstate);
+	peerstate->m_key_changed = message_time;
 
 	return 1;
 }
@@ -361,7 +633,7 @@ int mrapeerstate_degrade_encryption(mrapeerstate_t* ths, time_t message_time)
 
 	ths->m_prefer_encrypt = MRA_PE_RESET;
 	ths->m_last_seen      = message_time; /*last_seen_autocrypt is not updated as there was not Autocrypt:-header seen*/
-	ths->m_to_save        = MRA_SAVE_ALL;
+	ths->m_to_save        |= MRA_SAVE_STATE;
 
 	return 1;
 }
@@ -390,7 +662,7 @@ void mrapeerstate_apply_header(mrapeerstate_t* ths, const mraheader_t* header, t
 			}
 
 			ths->m_prefer_encrypt = header->m_prefer_encrypt;
-			ths->m_to_save |= MRA_SAVE_ALL;
+			ths->m_to_save |= MRA_SAVE_STATE;
 		}
 
 		if( ths->m_public_key == NULL ) {
@@ -401,6 +673,8 @@ void mrapeerstate_apply_header(mrapeerstate_t* ths, const mraheader_t* header, t
 		{
 			mrkey_set_from_key(ths->m_public_key, header->m_public_key);
 			mrapeerstate_recalc_fingerprint(ths);
+			forget_gossip_header(ths);
+			ths->m_key_changed = message_time;
 			ths->m_to_save |= MRA_SAVE_ALL;
 		}
 	}
@@ -429,6 +703,10 @@ void mrapeerstate_apply_gossip(mrapeerstate_t* peerstate, const mraheader_t* gos
 		{
 			mrkey_set_from_key(peerstate->m_gossip_key, gossip_header->m_public_key);
 			mrapeerstate_recalc_fingerprint(peerstate);
+			forget_gossip_header(peerstate);
+			if( peerstate->m_public_key == NULL ) {
+				peerstate->m_key_changed = message_time; /* the gossip key is used only if there is no public key */
+			}
 			peerstate->m_to_save |= MRA_SAVE_ALL;
 		}
 	}
@@ -520,7 +798,7 @@ int mrapeerstate_set_verified(mrapeerstate_t* peerstate, const char* fingerprint
 		goto cleanup;
 	}
 
-	peerstate->m_to_save        |= MRA_SAVE_ALL;
+	peerstate->m_to_save        |= MRA_SAVE_STATE;
 	peerstate->m_prefer_encrypt =  MRA_PE_MUTUAL;
 	peerstate->m_verified       = verified;
 	success                     = 1;
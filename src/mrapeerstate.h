@@ -58,9 +58,14 @@ typedef struct mrapeerstate_t
 
 	char*          m_fingerprint; /* fingerprint belonging to public_key (if set) or m_gossip_key (otherwise), may be NULL */
 	int            m_verified;    // fingerprint verified?
+	time_t         m_key_changed; /* time of the message that brought the key belonging to m_fingerprint, 0 if unknown */
 
-	#define        MRA_SAVE_TIMESTAMPS 0x01
-	#define        MRA_SAVE_ALL        0x02
+	char*          m_gossip_header;             /* memoized result of mrapeerstate_render_gossip_header(), may be NULL */
+	char*          m_gossip_header_fingerprint; /* fingerprint m_gossip_header was rendered for */
+
+	#define        MRA_SAVE_TIMESTAMPS 0x01 /* only the timestamps have changed */
+	#define        MRA_SAVE_ALL        0x02 /* the keys or the fingerprint have changed */
+	#define        MRA_SAVE_STATE      0x04 /* prefer-encrypt or the verified-state have changed, but not the keys */
 	int            m_to_save;
 
 	#define        MRA_DE_ENCRYPTION_PAUSED   0x01 // recoverable by an incoming encrypted mail
@@ -82,6 +87,7 @@ void            mrapeerstate_apply_header         (mrapeerstate_t*, const mrahea
 void            mrapeerstate_apply_gossip         (mrapeerstate_t*, const mraheader_t*, time_t message_time);
 
 char*           mrapeerstate_render_gossip_header (const mrapeerstate_t*);
+char*           mrapeerstate_get_gossip_header__  (mrapeerstate_t*, mrsqlite3_t*);
 
 mrkey_t*        mrapeerstate_peek_key             (const mrapeerstate_t*);
 
@@ -93,6 +99,8 @@ int             mrapeerstate_load_by_addr__       (mrapeerstate_t*, mrsqlite3_t*
 int             mrapeerstate_load_by_fingerprint__(mrapeerstate_t*, mrsqlite3_t*, const char* fingerprint);
 int             mrapeerstate_save_to_db__         (const mrapeerstate_t*, mrsqlite3_t*, int create);
 
+void            mrapeerstate_clear_cache__        (mrmailbox_t*);
+
 
 #ifdef __cplusplus
 } /* /extern "C" */
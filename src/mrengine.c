@@ -0,0 +1,651 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+/* Event loop engine for running many mailboxes in one process.
+
+Without an engine, each mailbox has a job thread, an IMAP watch thread
+waiting in IDLE and a heartbeat thread.  With an engine, these are replaced by
+tasks run by a fixed pool of worker threads:
+
+- A reactor thread waits using epoll() for IMAP connections in IDLE getting
+  readable and for the next timer to expire; it submits the tasks then.
+
+- Each worker has its own deque of tasks.  Tasks submitted by a worker are
+  added to its own deque and taken from the back, tasks submitted by other
+  threads are distributed round-robin; idle workers steal from the front of the
+  other deques.
+
+Network operations are still blocking, so the number of threads limits the
+number of concurrent fetches and sends, not the number of mailboxes. */
+
+
+#include "mrmailbox_internal.h"
+#include "mrengine.h"
+#include "mrosnative.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+
+#define MR_ENGINE_THREADS_MAX 64
+
+
+typedef struct mrenginetask_t
+{
+	mrengine_func_t  m_func;
+	void*            m_arg;
+	mrengineowner_t* m_owner;
+} mrenginetask_t;
+
+
+typedef struct mrenginedeque_t
+{
+	pthread_mutex_t  m_mutex;
+	mrenginetask_t*  m_tasks;       /* ring buffer */
+	int              m_alloc;
+	int              m_first;
+	int              m_cnt;
+} mrenginedeque_t;
+
+
+struct mrengine_t
+{
+	pthread_mutex_t  m_mutex;       /* protects all members except the deques */
+	pthread_cond_t   m_work_cond;   /* signalled when tasks are added or on exit */
+	pthread_cond_t   m_drain_cond;  /* signalled when an owner has no more pending tasks */
+	int              m_queued;      /* tasks in all deques */
+	int              m_do_exit;
+	int              m_next_deque;
+
+	int              m_threads_cnt;
+	pthread_t        m_threads[MR_ENGINE_THREADS_MAX];
+	mrenginedeque_t  m_deques[MR_ENGINE_THREADS_MAX];
+
+	mrenginetimer_t** m_heap;       /* armed timers, the next one first */
+	int              m_heap_cnt;
+	int              m_heap_alloc;
+
+	pthread_t        m_reactor_thread;
+	int              m_reactor_running;
+	int              m_epoll_fd;
+	int              m_wakeup_fd;
+};
+
+
+static __thread mrengine_t* s_current_engine = NULL;
+static __thread int         s_current_worker = -1;
+
+
+static uint64_t now_ms()
+{
+	return mrmetrics_now_us() / 1000;
+}
+
+
+/*******************************************************************************
+ * Worker pool
+ ******************************************************************************/
+
+
+static void deque_push(mrenginedeque_t* deque, const mrenginetask_t* task)
+{
+	pthread_mutex_lock(&deque->m_mutex);
+		if( deque->m_cnt == deque->m_alloc ) {
+			int             new_alloc = deque->m_alloc? deque->m_alloc*2 : 64, i;
+			mrenginetask_t* new_tasks = malloc(sizeof(mrenginetask_t)*new_alloc);
+			if( new_tasks == NULL ) {
+				exit(58); /* cannot allocate little memory, unrecoverable error */
+			}
+			for( i = 0; i < deque->m_cnt; i++ ) {
+				new_tasks[i] = deque->m_tasks[(deque->m_first+i)%deque->m_alloc];
+			}
+			free(deque->m_tasks);
+			deque->m_tasks = new_tasks;
+			deque->m_alloc = new_alloc;
+			deque->m_first = 0;
+		}
+		deque->m_tasks[(deque->m_first+deque->m_cnt)%deque->m_alloc] = *task;
+		deque->m_cnt++;
+	pthread_mutex_unlock(&deque->m_mutex);
+}
+
+
+/* take from the back (own deque) or from the front (stealing); returns 0 if the deque is empty */
+static int deque_pop(mrenginedeque_t* deque, int from_back, mrenginetask_t* ret)
+{
+	int success = 0;
+
+	pthread_mutex_lock(&deque->m_mutex);
+		if( deque->m_cnt > 0 ) {
+			if( from_back ) {
+				*ret = deque->m_tasks[(deque->m_first+deque->m_cnt-1)%deque->m_alloc];
+			}
+			else {
+				*ret = deque->m_tasks[deque->m_first];
+				deque->m_first = (deque->m_first+1)%deque->m_alloc;
+			}
+			deque->m_cnt--;
+			success = 1;
+		}
+	pthread_mutex_unlock(&deque->m_mutex);
+
+	return success;
+}
+
+
+static void* worker_thread_entry_point(void* entry_arg)
+{
+	mrengine_t*     engine = (mrengine_t*)entry_arg;
+	mrenginetask_t  task;
+	int             me, i, got;
+
+	mrosnative_setup_thread(NULL); /* the workers are not bound to a mailbox */
+
+	pthread_mutex_lock(&engine->m_mutex);
+		for( me = 0; me < engine->m_threads_cnt && !pthread_equal(engine->m_threads[me], pthread_self()); me++ ) {
+			;
+		}
+	pthread_mutex_unlock(&engine->m_mutex);
+
+	s_current_engine = engine;
+	s_current_worker = me;
+
+	while( 1 )
+	{
+		got = deque_pop(&engine->m_deques[me], 1, &task);
+		for( i = 1; !got && i < engine->m_threads_cnt; i++ ) {
+			got = deque_pop(&engine->m_deques[(me+i)%engine->m_threads_cnt], 0, &task);
+		}
+
+		if( got )
+		{
+			__atomic_sub_fetch(&engine->m_queued, 1, __ATOMIC_SEQ_CST);
+
+			task.m_func(task.m_arg);
+
+			pthread_mutex_lock(&engine->m_mutex);
+				if( task.m_owner && --task.m_owner->m_pending == 0 ) {
+					pthread_cond_broadcast(&engine->m_drain_cond);
+				}
+			pthread_mutex_unlock(&engine->m_mutex);
+			continue;
+		}
+
+		pthread_mutex_lock(&engine->m_mutex);
+			if( engine->m_do_exit ) {
+				pthread_mutex_unlock(&engine->m_mutex);
+				break;
+			}
+			if( __atomic_load_n(&engine->m_queued, __ATOMIC_SEQ_CST) == 0 ) {
+				pthread_cond_wait(&engine->m_work_cond, &engine->m_mutex);
+			}
+		pthread_mutex_unlock(&engine->m_mutex);
+	}
+
+	mrosnative_unsetup_thread(NULL);
+	return NULL;
+}
+
+
+/* must be called with m_mutex locked */
+static void submit__(mrengine_t* engine, mrengineowner_t* owner, mrengine_func_t func, void* arg)
+{
+	mrenginetask_t task;
+	int            deque;
+
+	task.m_func  = func;
+	task.m_arg   = arg;
+	task.m_owner = owner;
+
+	if( owner ) {
+		owner->m_pending++;
+	}
+
+	if( s_current_engine == engine && s_current_worker >= 0 ) {
+		deque = s_current_worker;
+	}
+	else {
+		deque = engine->m_next_deque;
+		engine->m_next_deque = (engine->m_next_deque+1) % engine->m_threads_cnt;
+	}
+
+	deque_push(&engine->m_deques[deque], &task);
+	__atomic_add_fetch(&engine->m_queued, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&engine->m_work_cond);
+}
+
+
+void mrengine_submit(mrengine_t* engine, mrengineowner_t* owner, mrengine_func_t func, void* arg)
+{
+	if( engine == NULL || func == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+		submit__(engine, owner, func, arg);
+	pthread_mutex_unlock(&engine->m_mutex);
+}
+
+
+void mrengine_drain(mrengine_t* engine, mrengineowner_t* owner)
+{
+	if( engine == NULL || owner == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+		while( owner->m_pending > 0 ) {
+			pthread_cond_wait(&engine->m_drain_cond, &engine->m_mutex);
+		}
+	pthread_mutex_unlock(&engine->m_mutex);
+}
+
+
+int mrengine_get_threads(mrengine_t* engine)
+{
+	return engine? engine->m_threads_cnt : 0;
+}
+
+
+/*******************************************************************************
+ * Timers, kept in a binary min-heap
+ ******************************************************************************/
+
+
+static void heap_swap__(mrengine_t* engine, int a, int b)
+{
+	mrenginetimer_t* temp = engine->m_heap[a];
+	engine->m_heap[a] = engine->m_heap[b];
+	engine->m_heap[b] = temp;
+	engine->m_heap[a]->m_heap_index = a;
+	engine->m_heap[b]->m_heap_index = b;
+}
+
+
+static void heap_fix__(mrengine_t* engine, int i)
+{
+	while( i > 0 && engine->m_heap[(i-1)/2]->m_due_ms > engine->m_heap[i]->m_due_ms ) {
+		heap_swap__(engine, i, (i-1)/2);
+		i = (i-1)/2;
+	}
+
+	while( 1 ) {
+		int smallest = i, l = 2*i+1, r = 2*i+2;
+		if( l < engine->m_heap_cnt && engine->m_heap[l]->m_due_ms < engine->m_heap[smallest]->m_due_ms ) { smallest = l; }
+		if( r < engine->m_heap_cnt && engine->m_heap[r]->m_due_ms < engine->m_heap[smallest]->m_due_ms ) { smallest = r; }
+		if( smallest == i ) {
+			break;
+		}
+		heap_swap__(engine, i, smallest);
+		i = smallest;
+	}
+}
+
+
+static void heap_remove__(mrengine_t* engine, mrenginetimer_t* timer)
+{
+	int i = timer->m_heap_index;
+
+	engine->m_heap_cnt--;
+	if( i != engine->m_heap_cnt ) {
+		engine->m_heap[i] = engine->m_heap[engine->m_heap_cnt];
+		engine->m_heap[i]->m_heap_index = i;
+		heap_fix__(engine, i);
+	}
+	timer->m_heap_index = -1;
+}
+
+
+static void wakeup_reactor(mrengine_t* engine)
+{
+	#ifdef __linux__
+		uint64_t one = 1;
+		if( write(engine->m_wakeup_fd, &one, sizeof(one)) != sizeof(one) ) {
+			; /* the counter is already set */
+		}
+	#endif
+}
+
+
+void mrengine_init_timer(mrenginetimer_t* timer, mrengineowner_t* owner, mrengine_func_t func, void* arg)
+{
+	memset(timer, 0, sizeof(mrenginetimer_t));
+	timer->m_owner      = owner;
+	timer->m_func       = func;
+	timer->m_arg        = arg;
+	timer->m_heap_index = -1;
+}
+
+
+void mrengine_set_timer(mrengine_t* engine, mrenginetimer_t* timer, int delay_ms)
+{
+	int is_first;
+
+	if( engine == NULL || timer == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+
+		timer->m_due_ms = now_ms() + (delay_ms>0? delay_ms : 0);
+
+		if( timer->m_heap_index < 0 ) {
+			if( engine->m_heap_cnt == engine->m_heap_alloc ) {
+				engine->m_heap_alloc = engine->m_heap_alloc? engine->m_heap_alloc*2 : 64;
+				if( (engine->m_heap=realloc(engine->m_heap, sizeof(mrenginetimer_t*)*engine->m_heap_alloc))==NULL ) {
+					exit(59); /* cannot allocate little memory, unrecoverable error */
+				}
+			}
+			timer->m_heap_index = engine->m_heap_cnt;
+			engine->m_heap[engine->m_heap_cnt++] = timer;
+		}
+		heap_fix__(engine, timer->m_heap_index);
+
+		is_first = (timer->m_heap_index == 0);
+
+	pthread_mutex_unlock(&engine->m_mutex);
+
+	if( is_first ) {
+		wakeup_reactor(engine);
+	}
+}
+
+
+void mrengine_cancel_timer(mrengine_t* engine, mrenginetimer_t* timer)
+{
+	if( engine == NULL || timer == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+		if( timer->m_heap_index >= 0 ) {
+			heap_remove__(engine, timer);
+		}
+	pthread_mutex_unlock(&engine->m_mutex);
+}
+
+
+/*******************************************************************************
+ * File descriptor watches and the reactor
+ ******************************************************************************/
+
+
+void mrengine_init_watch(mrenginewatch_t* watch, mrengineowner_t* owner, mrengine_func_t func, void* arg)
+{
+	memset(watch, 0, sizeof(mrenginewatch_t));
+	watch->m_owner = owner;
+	watch->m_func  = func;
+	watch->m_arg   = arg;
+	watch->m_fd    = -1;
+}
+
+
+int mrengine_watch_fd(mrengine_t* engine, mrenginewatch_t* watch, int fd)
+{
+	int success = 0;
+
+	if( engine == NULL || watch == NULL || fd < 0 ) {
+		return 0;
+	}
+
+	#ifdef __linux__
+	pthread_mutex_lock(&engine->m_mutex);
+		if( !watch->m_armed ) {
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events   = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+			ev.data.ptr = watch;
+			if( epoll_ctl(engine->m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0 ) {
+				watch->m_fd    = fd;
+				watch->m_armed = 1;
+				success = 1;
+			}
+		}
+	pthread_mutex_unlock(&engine->m_mutex);
+	#endif
+
+	return success;
+}
+
+
+/* must be called with m_mutex locked */
+static void unwatch__(mrengine_t* engine, mrenginewatch_t* watch)
+{
+	#ifdef __linux__
+	if( watch->m_armed ) {
+		epoll_ctl(engine->m_epoll_fd, EPOLL_CTL_DEL, watch->m_fd, NULL);
+		watch->m_armed = 0;
+		watch->m_fd    = -1;
+	}
+	#endif
+}
+
+
+void mrengine_unwatch_fd(mrengine_t* engine, mrenginewatch_t* watch)
+{
+	if( engine == NULL || watch == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+		unwatch__(engine, watch);
+	pthread_mutex_unlock(&engine->m_mutex);
+}
+
+
+#ifdef __linux__
+
+
+static void* reactor_thread_entry_point(void* entry_arg)
+{
+	#define          MR_ENGINE_EVENTS 64
+	mrengine_t*        engine = (mrengine_t*)entry_arg;
+	struct epoll_event events[MR_ENGINE_EVENTS];
+	int                timeout_ms, cnt, i;
+	uint64_t           now;
+
+	while( 1 )
+	{
+		pthread_mutex_lock(&engine->m_mutex);
+
+			if( engine->m_do_exit ) {
+				pthread_mutex_unlock(&engine->m_mutex);
+				break;
+			}
+
+			/* submit expired timers */
+			now = now_ms();
+			while( engine->m_heap_cnt > 0 && engine->m_heap[0]->m_due_ms <= now ) {
+				mrenginetimer_t* timer = engine->m_heap[0];
+				heap_remove__(engine, timer);
+				submit__(engine, timer->m_owner, timer->m_func, timer->m_arg);
+			}
+
+			timeout_ms = -1;
+			if( engine->m_heap_cnt > 0 ) {
+				timeout_ms = (int)(engine->m_heap[0]->m_due_ms - now);
+			}
+
+		pthread_mutex_unlock(&engine->m_mutex);
+
+		cnt = epoll_wait(engine->m_epoll_fd, events, MR_ENGINE_EVENTS, timeout_ms);
+
+		pthread_mutex_lock(&engine->m_mutex);
+			for( i = 0; i < cnt; i++ ) {
+				if( events[i].data.ptr == NULL ) {
+					uint64_t value;
+					if( read(engine->m_wakeup_fd, &value, sizeof(value)) != sizeof(value) ) {
+						; /* nothing to read, another thread was faster */
+					}
+				}
+				else {
+					mrenginewatch_t* watch = (mrenginewatch_t*)events[i].data.ptr;
+					if( watch->m_armed ) { /* the watch may be removed after epoll_wait() returned */
+						unwatch__(engine, watch);
+						submit__(engine, watch->m_owner, watch->m_func, watch->m_arg);
+					}
+				}
+			}
+		pthread_mutex_unlock(&engine->m_mutex);
+	}
+
+	return NULL;
+}
+
+
+#endif
+
+
+/*******************************************************************************
+ * Main interface
+ ******************************************************************************/
+
+
+/**
+ * Create an engine that drives several mailbox objects from a fixed number
+ * of threads.  Mailboxes using the engine are created by
+ * mrmailbox_new_with_engine(); they do not create their own job, IMAP-watch and
+ * heartbeat threads and parse fetched messages using the threads of the engine.
+ *
+ * The engine is meant for servers handling many accounts in one process.  It
+ * is available on Linux only, as it uses epoll() to wait for the IMAP IDLE
+ * connections.
+ *
+ * @memberof mrengine_t
+ *
+ * @param threads The number of worker threads.  As network operations are
+ *     blocking, this is the maximum number of concurrent fetch and send
+ *     operations.  If 0, the number of CPUs is used, but at least 4.
+ *
+ * @return The engine object, must be freed using mrengine_unref() after all
+ *     mailbox objects using the engine are freed.  NULL on errors or if the
+ *     engine is not supported on this system.
+ */
+mrengine_t* mrengine_new(int threads)
+{
+	#ifdef __linux__
+		mrengine_t*        engine = NULL;
+		struct epoll_event ev;
+		int                i;
+
+		if( threads <= 0 ) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			threads = cpus > 4? (int)cpus : 4;
+		}
+		if( threads > MR_ENGINE_THREADS_MAX ) {
+			threads = MR_ENGINE_THREADS_MAX;
+		}
+
+		if( (engine=calloc(1, sizeof(mrengine_t)))==NULL ) {
+			exit(60); /* cannot allocate little memory, unrecoverable error */
+		}
+
+		pthread_mutex_init(&engine->m_mutex, NULL);
+		pthread_cond_init(&engine->m_work_cond, NULL);
+		pthread_cond_init(&engine->m_drain_cond, NULL);
+		for( i = 0; i < MR_ENGINE_THREADS_MAX; i++ ) {
+			pthread_mutex_init(&engine->m_deques[i].m_mutex, NULL);
+		}
+
+		engine->m_epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+		engine->m_wakeup_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if( engine->m_epoll_fd < 0 || engine->m_wakeup_fd < 0
+		 || epoll_ctl(engine->m_epoll_fd, EPOLL_CTL_ADD, engine->m_wakeup_fd, &ev) != 0 ) {
+			mrengine_unref(engine);
+			return NULL;
+		}
+
+		pthread_mutex_lock(&engine->m_mutex); /* the workers wait until m_threads[] is complete */
+			for( i = 0; i < threads; i++ ) {
+				if( pthread_create(&engine->m_threads[engine->m_threads_cnt], NULL, worker_thread_entry_point, engine) == 0 ) {
+					engine->m_threads_cnt++;
+				}
+			}
+		pthread_mutex_unlock(&engine->m_mutex);
+
+		if( engine->m_threads_cnt == 0
+		 || pthread_create(&engine->m_reactor_thread, NULL, reactor_thread_entry_point, engine) != 0 ) {
+			mrengine_unref(engine);
+			return NULL;
+		}
+		engine->m_reactor_running = 1;
+
+		return engine;
+	#else
+		return NULL;
+	#endif
+}
+
+
+/**
+ * Free an engine object created by mrengine_new().  All mailbox objects using
+ * the engine must be freed before.
+ *
+ * @memberof mrengine_t
+ *
+ * @param engine The engine object as created by mrengine_new().
+ *
+ * @return None.
+ */
+void mrengine_unref(mrengine_t* engine)
+{
+	int i;
+
+	if( engine == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&engine->m_mutex);
+		engine->m_do_exit = 1;
+		pthread_cond_broadcast(&engine->m_work_cond);
+	pthread_mutex_unlock(&engine->m_mutex);
+
+	wakeup_reactor(engine);
+
+	for( i = 0; i < engine->m_threads_cnt; i++ ) {
+		pthread_join(engine->m_threads[i], NULL);
+	}
+
+	#ifdef __linux__
+	if( engine->m_reactor_running ) {
+		pthread_join(engine->m_reactor_thread, NULL);
+	}
+	if( engine->m_epoll_fd >= 0 ) { close(engine->m_epoll_fd); }
+	if( engine->m_wakeup_fd >= 0 ) { close(engine->m_wakeup_fd); }
+	#endif
+
+	for( i = 0; i < MR_ENGINE_THREADS_MAX; i++ ) {
+		pthread_mutex_destroy(&engine->m_deques[i].m_mutex);
+		free(engine->m_deques[i].m_tasks);
+	}
+	pthread_cond_destroy(&engine->m_drain_cond);
+	pthread_cond_destroy(&engine->m_work_cond);
+	pthread_mutex_destroy(&engine->m_mutex);
+	free(engine->m_heap);
+	free(engine);
+}
@@ -0,0 +1,83 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+#ifndef __MRENGINE_H__
+#define __MRENGINE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+/* The engine drives many mailboxes from a fixed number of threads, see
+mrengine_new().  Work is done by tasks; tasks are submitted directly, by timers
+or by file descriptors getting readable.  Every task belongs to an owner, so
+that an object can wait for its tasks before it is freed. */
+
+
+typedef void (*mrengine_func_t) (void* arg);
+
+
+typedef struct mrengineowner_t
+{
+	int              m_pending;     /* submitted and running tasks, protected by the engine */
+} mrengineowner_t;
+
+
+typedef struct mrenginetimer_t
+{
+	mrengineowner_t* m_owner;
+	mrengine_func_t  m_func;
+	void*            m_arg;
+	uint64_t         m_due_ms;
+	int              m_heap_index;  /* -1 if the timer is not armed */
+} mrenginetimer_t;
+
+
+typedef struct mrenginewatch_t
+{
+	mrengineowner_t* m_owner;
+	mrengine_func_t  m_func;
+	void*            m_arg;
+	int              m_fd;
+	int              m_armed;
+} mrenginewatch_t;
+
+
+void mrengine_submit         (mrengine_t*, mrengineowner_t*, mrengine_func_t, void* arg);
+void mrengine_drain          (mrengine_t*, mrengineowner_t*); /* wait until all tasks of the owner are done; timers and watches must be cancelled before */
+int  mrengine_get_threads    (mrengine_t*);
+
+void mrengine_init_timer     (mrenginetimer_t*, mrengineowner_t*, mrengine_func_t, void* arg);
+void mrengine_set_timer      (mrengine_t*, mrenginetimer_t*, int delay_ms); /* (re-)arms the timer, on expiry, the function is submitted once */
+void mrengine_cancel_timer   (mrengine_t*, mrenginetimer_t*);
+
+void mrengine_init_watch     (mrenginewatch_t*, mrengineowner_t*, mrengine_func_t, void* arg);
+int  mrengine_watch_fd       (mrengine_t*, mrenginewatch_t*, int fd); /* the function is submitted once when the fd gets readable */
+void mrengine_unwatch_fd     (mrengine_t*, mrenginewatch_t*);
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRENGINE_H__ */
@@ -32,6 +32,10 @@ extern "C" {
  * The following constants are used as events reported to the callback given to mrmailbox_new().
  *
  * If you do not want to handle an event, it is always safe to return 0, so there is no need to add a "case" for every event.
+ *
+ * Events that only inform (eg. #MR_EVENT_MSGS_CHANGED) may also be queued and
+ * delivered by a dispatcher thread or fetched using mrmailbox_get_next_event(),
+ * see mrmailbox_set_event_mode().
  */
 
 
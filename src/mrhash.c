@@ -30,376 +30,411 @@
 
 
 /*
-** Based upon hash.c from sqlite which author disclaims copyright to this source code. In place of
+** The API is based upon hash.c from sqlite which author disclaims copyright to this source code. In place of
 ** a legal notice, here is a blessing:
 **
 ** May you do good and not evil.
 ** May you find forgiveness for yourself and forgive others.
 ** May you share freely, never taking more than you give.
+**
+** The table itself uses open addressing with linear probing over groups of
+** 8 control bytes, see mrhash_t.  The control bytes of a group are loaded as
+** one 64-bit word and compared using bit operations, so no SIMD instructions
+** are needed and the code is the same on all platforms.
 */
-#define Addr(X)  ((uintptr_t)X)
-
-static void*    sjhashMalloc(long bytes) { void* p=malloc(bytes); if( p) memset(p, 0, bytes); return p; }
-#define         sjhashMallocRaw(a) malloc((a))
-#define         sjhashFree(a) free((a))
-
+#define MRHASH_GROUP       8
+#define MRHASH_EMPTY       0x80
+#define MRHASH_DELETED     0xFE
+#define MRHASH_LSB         0x0101010101010101ULL
+#define MRHASH_MSB         0x8080808080808080ULL
+#define MRHASH_ARENA_FIRST 8     /* elements in the first arena block, each next block is twice as large */
+#define MRHASH_ARENA_MAX   1024
 
 
-/* An array to map all upper-case characters into their corresponding
- * lower-case character.
- */
-static const unsigned char sjhashUpperToLower[] = {
-	0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17,
-	18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
-	36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53,
-	54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 97, 98, 99,100,101,102,103,
-	104,105,106,107,108,109,110,111,112,113,114,115,116,117,118,119,120,121,
-	122, 91, 92, 93, 94, 95, 96, 97, 98, 99,100,101,102,103,104,105,106,107,
-	108,109,110,111,112,113,114,115,116,117,118,119,120,121,122,123,124,125,
-	126,127,128,129,130,131,132,133,134,135,136,137,138,139,140,141,142,143,
-	144,145,146,147,148,149,150,151,152,153,154,155,156,157,158,159,160,161,
-	162,163,164,165,166,167,168,169,170,171,172,173,174,175,176,177,178,179,
-	180,181,182,183,184,185,186,187,188,189,190,191,192,193,194,195,196,197,
-	198,199,200,201,202,203,204,205,206,207,208,209,210,211,212,213,214,215,
-	216,217,218,219,220,221,222,223,224,225,226,227,228,229,230,231,232,233,
-	234,235,236,237,238,239,240,241,242,243,244,245,246,247,248,249,250,251,
-	252,253,254,255
+struct mrhasharena_t
+{
+	mrhasharena_t* next;
+	int            used;
+	int            size;
+	mrhashelem_t   elems[1];
 };
 
 
+/*******************************************************************************
+ * Hashing and comparing keys
+ ******************************************************************************/
+
 
-/* Some systems have stricmp().  Others have strcasecmp().  Because
- * there is no consistency, we will define our own.
- */
-static int sjhashStrNICmp(const char *zLeft, const char *zRight, int N)
+static uint64_t load64(const void* p)
 {
-	register unsigned char *a, *b;
-	a = (unsigned char *)zLeft;
-	b = (unsigned char *)zRight;
-	while( N-- > 0 && *a!=0 && sjhashUpperToLower[*a]==sjhashUpperToLower[*b]) { a++; b++; }
-	return N<0 ? 0 : sjhashUpperToLower[*a] - sjhashUpperToLower[*b];
+	uint64_t w;
+	memcpy(&w, p, 8);
+	return w;
 }
 
 
+static uint32_t load32(const void* p)
+{
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return w;
+}
 
-/* This function computes a hash on the name of a keyword.
- * Case is not significant.
- */
-static int sjhashNoCase(const char *z, int n)
+
+static uint64_t load_tail(const unsigned char* p, int n)
 {
-	int h = 0;
-	if( n<=0 ) n = strlen(z);
-	while( n > 0  ) {
-		h = (h<<3) ^ h ^ sjhashUpperToLower[(unsigned char)*z++];
-		n--;
+	/* load the last 1..7 bytes of a key without reading beyond it; for 4-7 bytes, two overlapping 4-byte words are used.
+	the result is only used for hashing and for comparing keys of the same length, so every byte must be included, but not in order */
+	if( n >= 4 ) {
+		return load32(p) | ((uint64_t)load32(p+n-4) << 32);
 	}
-	return h & 0x7fffffff;
+	return p[0] | ((uint64_t)p[n>>1] << 8) | ((uint64_t)p[n-1] << 16);
 }
 
 
-
-/* Turn bulk memory into a hash table object by initializing the
- * fields of the Hash structure.
- *
- * "pNew" is a pointer to the hash table that is to be initialized.
- * keyClass is one of the constants SJHASH_INT, SJHASH_POINTER,
- * SJHASH_BINARY, or SJHASH_STRING.  The value of keyClass
- * determines what kind of key the hash table will use.  "copyKey" is
- * true if the hash table should make its own private copy of keys and
- * false if it should just use the supplied pointer.  CopyKey only makes
- * sense for SJHASH_STRING and SJHASH_BINARY and is ignored
- * for other key classes.
- */
-void mrhash_init(mrhash_t *pNew, int keyClass, int copyKey)
+static uint64_t fold_ascii(uint64_t w)
 {
-	assert( pNew!=0 );
-	assert( keyClass>=MRHASH_INT && keyClass<=MRHASH_BINARY );
-	pNew->keyClass = keyClass;
+	/* convert the ASCII characters A-Z in all 8 bytes to lower case; other bytes are not changed,
+	this is the same as sjhashUpperToLower[] did byte by byte before */
+	uint64_t heptets  = w & ~MRHASH_MSB;
+	uint64_t is_gt_Z  = heptets + (0x7F-'Z')*MRHASH_LSB;
+	uint64_t is_ge_A  = heptets + (0x80-'A')*MRHASH_LSB;
+	uint64_t is_upper = ~w & (is_ge_A ^ is_gt_Z) & MRHASH_MSB;
+	return w | (is_upper >> 2);
+}
 
-	if( keyClass==MRHASH_POINTER || keyClass==MRHASH_INT ) copyKey = 0;
 
-	pNew->copyKey = copyKey;
-	pNew->first = 0;
-	pNew->count = 0;
-	pNew->htsize = 0;
-	pNew->ht = 0;
+static uint32_t mix64(uint64_t h)
+{
+	/* finalizer of MurmurHash3, every input bit affects every output bit */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (uint32_t)h;
 }
 
 
-
-/* Remove all entries from a hash table.  Reclaim all memory.
- * Call this routine to delete a hash table or to reset a hash table
- * to the empty state.
- */
-void mrhash_clear(mrhash_t *pH)
+static uint32_t hash_bytes(const unsigned char* z, int n, int fold)
 {
-	mrhashelem_t *elem;         /* For looping over all elements of the table */
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)n, w;
 
-	if( pH == NULL ) {
-		return;
+	for( ; n >= 8; n -= 8, z += 8 ) {
+		w = load64(z);
+		h = (h ^ (fold? fold_ascii(w) : w)) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
 	}
 
-	elem = pH->first;
-	pH->first = 0;
-	if( pH->ht ) sjhashFree(pH->ht);
-	pH->ht = 0;
-	pH->htsize = 0;
-	while( elem )
-	{
-		mrhashelem_t *next_elem = elem->next;
-		if( pH->copyKey && elem->pKey )
-		{
-			sjhashFree(elem->pKey);
-		}
-		sjhashFree(elem);
-		elem = next_elem;
+	if( n > 0 ) {
+		w = load_tail(z, n);
+		h = (h ^ (fold? fold_ascii(w) : w)) * 0x9E3779B97F4A7C15ULL;
 	}
-	pH->count = 0;
-}
 
+	return (uint32_t)(h >> 32); /* the upper half of a product depends on all bits of the factors */
+}
 
 
-/* Hash and comparison functions when the mode is SJHASH_INT
- */
-static int intHash(const void *pKey, int nKey)
+static uint32_t hash_key(int keyClass, const void* pKey, int nKey)
 {
-	return nKey ^ (nKey<<8) ^ (nKey>>8);
+	switch( keyClass )
+	{
+		case MRHASH_INT:     return mix64((uint32_t)nKey);
+		case MRHASH_POINTER: return mix64((uintptr_t)pKey);
+		case MRHASH_STRING:  return hash_bytes((const unsigned char*)pKey, nKey>0? nKey : 0, 1);
+		default:             return hash_bytes((const unsigned char*)pKey, nKey>0? nKey : 0, 0);
+	}
 }
 
-static int intCompare(const void *pKey1, int n1, const void *pKey2, int n2)
+
+static int keys_equal(int keyClass, const mrhashelem_t* elem, const void* pKey, int nKey)
 {
-	return n2 - n1;
+	const unsigned char *a, *b;
+	int                  n;
+
+	switch( keyClass )
+	{
+		case MRHASH_INT:
+			return elem->nKey==nKey;
+
+		case MRHASH_POINTER:
+			return elem->pKey==pKey;
+
+		case MRHASH_STRING:
+			/* case is ignored for A-Z only */
+			if( elem->nKey!=nKey ) {
+				return 0;
+			}
+			for( a = elem->pKey, b = pKey, n = nKey; n >= 8; n -= 8, a += 8, b += 8 ) {
+				uint64_t wa = load64(a), wb = load64(b);
+				if( wa!=wb && fold_ascii(wa)!=fold_ascii(wb) ) {
+					return 0;
+				}
+			}
+			if( n > 0 ) {
+				uint64_t wa = load_tail(a, n), wb = load_tail(b, n);
+				return wa==wb || fold_ascii(wa)==fold_ascii(wb);
+			}
+			return 1;
+
+		default:
+			return elem->nKey==nKey && memcmp(elem->pKey, pKey, nKey)==0;
+	}
 }
 
 
+/*******************************************************************************
+ * Control bytes
+ ******************************************************************************/
+
 
-/* Hash and comparison functions when the mode is SJHASH_POINTER
- */
-static int ptrHash(const void *pKey, int nKey)
+static unsigned char hash_tag(uint32_t hash)
 {
-	uintptr_t x = Addr(pKey);
-	return x ^ (x<<8) ^ (x>>8);
+	return (unsigned char)(hash >> 25); /* the upper 7 bits, the lower ones select the slot */
 }
 
-static int ptrCompare(const void *pKey1, int n1, const void *pKey2, int n2)
+
+static uint64_t group_match(uint64_t group, unsigned char tag)
 {
-	if( pKey1==pKey2 ) return 0;
-	if( pKey1<pKey2 ) return -1;
-	return 1;
+	/* returns 0x80 for each byte equal to the tag; there may be false positives, but never false negatives */
+	uint64_t x = group ^ (MRHASH_LSB * tag);
+	return (x - MRHASH_LSB) & ~x & MRHASH_MSB;
 }
 
 
-
-/* Hash and comparison functions when the mode is SJHASH_STRING
- */
-static int strHash(const void *pKey, int nKey)
+static uint64_t group_match_empty(uint64_t group)
 {
-	return sjhashNoCase((const char*)pKey, nKey);
+	return group & (~group << 6) & MRHASH_MSB; /* MRHASH_EMPTY is the only control byte with bit 7 set and bit 1 unset */
 }
 
-static int strCompare(const void *pKey1, int n1, const void *pKey2, int n2)
+
+static uint64_t group_match_free(uint64_t group)
 {
-	if( n1!=n2 ) return 1;
-	return sjhashStrNICmp((const char*)pKey1,(const char*)pKey2,n1);
+	return group & MRHASH_MSB; /* empty or deleted */
 }
 
 
-
-/* Hash and comparison functions when the mode is SJHASH_BINARY
- */
-static int binHash(const void *pKey, int nKey)
+static int group_next(uint64_t* mask)
 {
-	int h = 0;
-	const char *z = (const char *)pKey;
-	while( nKey-- > 0 )
-	{
-		h = (h<<3) ^ h ^ *(z++);
-	}
-	return h & 0x7fffffff;
+	/* returns the index of the first byte set in the mask and removes it from the mask */
+	int i;
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+		i = __builtin_clzll(*mask) / 8;
+		*mask &= ~(0x80ULL << (56-i*8));
+	#else
+		i = __builtin_ctzll(*mask) / 8;
+		*mask &= *mask - 1;
+	#endif
+	return i;
 }
 
-static int binCompare(const void *pKey1, int n1, const void *pKey2, int n2)
+
+static int empty_distance(uint64_t group, int from_end)
 {
-	if( n1!=n2 ) return 1;
-	return memcmp(pKey1,pKey2,n1);
+	/* number of bytes before the first empty byte, counted from the start or from the end of the group */
+	uint64_t match = group_match_empty(group);
+	if( match==0 ) {
+		return MRHASH_GROUP;
+	}
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+		return (from_end? __builtin_ctzll(match) : __builtin_clzll(match)) / 8;
+	#else
+		return (from_end? __builtin_clzll(match) : __builtin_ctzll(match)) / 8;
+	#endif
 }
 
 
-
-/* Return a pointer to the appropriate hash function given the key class.
- *
- * About the syntax:
- * The name of the function is "hashFunction".  The function takes a
- * single parameter "keyClass".  The return value of hashFunction()
- * is a pointer to another function.  Specifically, the return value
- * of hashFunction() is a pointer to a function that takes two parameters
- * with types "const void*" and "int" and returns an "int".
- */
-static int (*hashFunction(int keyClass))(const void*,int)
+static void set_ctrl(mrhash_t* pH, int i, unsigned char value)
 {
-	switch( keyClass )
-	{
-		case MRHASH_INT:    return &intHash;
-		case MRHASH_POINTER:return &ptrHash;
-		case MRHASH_STRING: return &strHash;
-		case MRHASH_BINARY: return &binHash;;
-		default:            break;
+	pH->ctrl[i] = value;
+	if( i < MRHASH_GROUP ) {
+		pH->ctrl[pH->htsize + i] = value; /* the copy allows loading a group that wraps around */
 	}
-	return 0;
 }
 
 
-
-/* Return a pointer to the appropriate hash function given the key class.
- */
-static int (*compareFunction(int keyClass))(const void*,int,const void*,int)
+static int find_slot(const mrhash_t* pH, uint32_t hash, const void* pKey, int nKey)
 {
-	switch( keyClass )
-	{
-		case MRHASH_INT:     return &intCompare;
-		case MRHASH_POINTER: return &ptrCompare;
-		case MRHASH_STRING:  return &strCompare;
-		case MRHASH_BINARY:  return &binCompare;
-		default: break;
+	/* returns the slot of the element with the given key or -1 */
+	int           mask = pH->htsize-1, pos = hash & mask, probed, i;
+	unsigned char tag = hash_tag(hash);
+	uint64_t      group, match;
+
+	for( probed = 0; probed < pH->htsize; probed += MRHASH_GROUP ) {
+		group = load64(&pH->ctrl[pos]);
+		for( match = group_match(group, tag); match; ) {
+			i = (pos + group_next(&match)) & mask;
+			if( pH->ctrl[i]==tag && pH->slots[i]->hash==hash && keys_equal(pH->keyClass, pH->slots[i], pKey, nKey) ) {
+				return i;
+			}
+		}
+
+		if( group_match_empty(group) ) {
+			return -1;
+		}
+
+		pos = (pos + MRHASH_GROUP) & mask;
 	}
-	return 0;
-}
 
+	return -1;
+}
 
 
-/* Link an element into the hash table
- */
-static void insertElement(mrhash_t *pH,           /* The complete hash table */
-                          struct _ht *pEntry,   /* The entry into which pNew is inserted */
-                          mrhashelem_t *pNew)     /* The element to be inserted */
+static int find_free_slot(const mrhash_t* pH, uint32_t hash)
 {
-	mrhashelem_t *pHead; /* First element already in pEntry */
-	pHead = pEntry->chain;
-	if( pHead )
-	{
-		pNew->next = pHead;
-		pNew->prev = pHead->prev;
-		if( pHead->prev ) { pHead->prev->next = pNew; }
-		else             { pH->first = pNew; }
-		pHead->prev = pNew;
-	}
-	else
-	{
-		pNew->next = pH->first;
-		if( pH->first ) { pH->first->prev = pNew; }
-		pNew->prev = 0;
-		pH->first = pNew;
+	/* there is always a free slot as the table is never full */
+	int      mask = pH->htsize-1, pos = hash & mask;
+	uint64_t match;
+
+	while( (match=group_match_free(load64(&pH->ctrl[pos]))) == 0 ) {
+		pos = (pos + MRHASH_GROUP) & mask;
 	}
-	pEntry->count++;
-	pEntry->chain = pNew;
-}
 
+	return (pos + group_next(&match)) & mask;
+}
 
 
-/* Resize the hash table so that it cantains "new_size" buckets.
- * "new_size" must be a power of 2.  The hash table might fail
- * to resize if sjhashMalloc() fails.
- */
-static void rehash(mrhash_t *pH, int new_size)
+static int resize(mrhash_t* pH, int new_size)
 {
-	struct _ht *new_ht;            /* The new hash table */
-	mrhashelem_t *elem, *next_elem;    /* For looping over existing elements */
-	int (*xHash)(const void*,int); /* The hash function */
-
-	assert( (new_size & (new_size-1))==0 );
-	new_ht = (struct _ht *)sjhashMalloc( new_size*sizeof(struct _ht) );
-	if( new_ht==0 ) return;
-	if( pH->ht ) sjhashFree(pH->ht);
-	pH->ht = new_ht;
-	pH->htsize = new_size;
-	xHash = hashFunction(pH->keyClass);
-	for(elem=pH->first, pH->first=0; elem; elem = next_elem)
-	{
-		int h = (*xHash)(elem->pKey, elem->nKey) & (new_size-1);
-		next_elem = elem->next;
-		insertElement(pH, &new_ht[h], elem);
+	/* rebuilds the slots, this also removes all deleted slots; the slots and the control bytes share one block of memory,
+	the slots are not initialized as they are only read if the control byte is in use */
+	mrhashelem_t** new_slots = malloc(new_size*sizeof(mrhashelem_t*) + new_size + MRHASH_GROUP);
+	mrhashelem_t*  elem;
+	int            i;
+
+	assert( (new_size & (new_size-1))==0 && new_size >= MRHASH_GROUP );
+	if( new_slots==NULL ) {
+		return 0;
+	}
+
+	free(pH->slots);
+	pH->slots      = new_slots;
+	pH->ctrl       = (unsigned char*)(new_slots + new_size);
+	pH->htsize     = new_size;
+	pH->tombstones = 0;
+	memset(pH->ctrl, MRHASH_EMPTY, new_size + MRHASH_GROUP);
+
+	for( elem = pH->first; elem; elem = elem->next ) {
+		i = find_free_slot(pH, elem->hash);
+		set_ctrl(pH, i, hash_tag(elem->hash));
+		pH->slots[i] = elem;
 	}
+
+	return 1;
 }
 
 
+/*******************************************************************************
+ * Elements
+ ******************************************************************************/
+
 
-/* This function (for internal use only) locates an element in an
- * hash table that matches the given key.  The hash for this key has
- * already been computed and is passed as the 4th parameter.
- */
-static mrhashelem_t *findElementGivenHash(const mrhash_t *pH,   /* The pH to be searched */
-                                        const void *pKey,   /* The key we are searching for */
-                                        int nKey,
-                                        int h)              /* The hash for this key. */
+static mrhashelem_t* alloc_elem(mrhash_t* pH)
 {
-	mrhashelem_t *elem; /* Used to loop thru the element list */
-	int count; /* Number of elements left to test */
-	int (*xCompare)(const void*,int,const void*,int);  /* comparison function */
+	mrhashelem_t* elem;
 
-	if( pH->ht )
-	{
-		struct _ht *pEntry = &pH->ht[h];
-		elem = pEntry->chain;
-		count = pEntry->count;
-		xCompare = compareFunction(pH->keyClass);
-		while( count-- && elem )
-		{
-			if( (*xCompare)(elem->pKey,elem->nKey,pKey,nKey)==0 )
-			{
-				return elem;
+	if( pH->freelist ) {
+		elem = pH->freelist;
+		pH->freelist = elem->next;
+	}
+	else {
+		if( pH->arena==NULL || pH->arena->used >= pH->arena->size ) {
+			int            size = pH->arena? pH->arena->size*2 : MRHASH_ARENA_FIRST;
+			mrhasharena_t* block;
+			if( size > MRHASH_ARENA_MAX ) {
+				size = MRHASH_ARENA_MAX;
 			}
-			elem = elem->next;
+			if( (block=malloc(sizeof(mrhasharena_t) + (size-1)*sizeof(mrhashelem_t)))==NULL ) {
+				return NULL;
+			}
+			block->next = pH->arena;
+			block->used = 0;
+			block->size = size;
+			pH->arena = block;
 		}
+		elem = &pH->arena->elems[pH->arena->used++];
 	}
-	return 0;
+
+	memset(elem, 0, sizeof(mrhashelem_t));
+	return elem;
 }
 
 
+static void free_elem(mrhash_t* pH, mrhashelem_t* elem)
+{
+	if( pH->copyKey && elem->pKey && elem->pKey!=elem->inlineKey ) {
+		free(elem->pKey);
+	}
+	elem->next = pH->freelist;
+	pH->freelist = elem;
+}
+
+
+/*******************************************************************************
+ * Public API
+ ******************************************************************************/
+
 
-/* Remove a single entry from the hash table given a pointer to that
- * element and a hash on the element's key.
+/* Turn bulk memory into a hash table object by initializing the
+ * fields of the Hash structure.
+ *
+ * "pNew" is a pointer to the hash table that is to be initialized.
+ * keyClass is one of the constants SJHASH_INT, SJHASH_POINTER,
+ * SJHASH_BINARY, or SJHASH_STRING.  The value of keyClass
+ * determines what kind of key the hash table will use.  "copyKey" is
+ * true if the hash table should make its own private copy of keys and
+ * false if it should just use the supplied pointer.  CopyKey only makes
+ * sense for SJHASH_STRING and SJHASH_BINARY and is ignored
+ * for other key classes.
  */
-static void removeElementGivenHash(mrhash_t *pH,         /* The pH containing "elem" */
-                                   mrhashelem_t* elem,   /* The element to be removed from the pH */
-                                   int h)              /* Hash value for the element */
+void mrhash_init(mrhash_t *pNew, int keyClass, int copyKey)
 {
-	struct _ht *pEntry;
+	assert( pNew!=0 );
+	assert( keyClass>=MRHASH_INT && keyClass<=MRHASH_BINARY );
+	memset(pNew, 0, sizeof(mrhash_t));
+	pNew->keyClass = keyClass;
 
-	if( elem->prev )
-	{
-		elem->prev->next = elem->next;
-	}
-	else
-	{
-		pH->first = elem->next;
-	}
+	if( keyClass==MRHASH_POINTER || keyClass==MRHASH_INT ) copyKey = 0;
 
-	if( elem->next )
-	{
-		elem->next->prev = elem->prev;
-	}
+	pNew->copyKey = copyKey;
+}
 
-	pEntry = &pH->ht[h];
 
-	if( pEntry->chain==elem )
-	{
-		pEntry->chain = elem->next;
-	}
 
-	pEntry->count--;
+/* Remove all entries from a hash table.  Reclaim all memory.
+ * Call this routine to delete a hash table or to reset a hash table
+ * to the empty state.
+ */
+void mrhash_clear(mrhash_t *pH)
+{
+	mrhashelem_t*  elem;
+	mrhasharena_t* block;
 
-	if( pEntry->count<=0 )
-	{
-		pEntry->chain = 0;
+	if( pH == NULL ) {
+		return;
 	}
 
-	if( pH->copyKey && elem->pKey )
-	{
-		sjhashFree(elem->pKey);
+	if( pH->copyKey ) {
+		for( elem = pH->first; elem; elem = elem->next ) {
+			if( elem->pKey && elem->pKey!=elem->inlineKey ) {
+				free(elem->pKey);
+			}
+		}
 	}
 
-	sjhashFree( elem );
-	pH->count--;
+	while( (block=pH->arena) != NULL ) {
+		pH->arena = block->next;
+		free(block);
+	}
+
+	free(pH->slots);
+	pH->ctrl       = NULL;
+	pH->slots      = NULL;
+	pH->htsize     = 0;
+	pH->tombstones = 0;
+	pH->first      = NULL;
+	pH->freelist   = NULL;
+	pH->count      = 0;
 }
 
 
@@ -410,17 +445,11 @@ static void removeElementGivenHash(mrhash_t *pH,         /* The pH containing "e
  */
 void* mrhash_find(const mrhash_t *pH, const void *pKey, int nKey)
 {
-	int h;             /* A hash on key */
-	mrhashelem_t *elem;    /* The element that matches key */
-	int (*xHash)(const void*,int);  /* The hash function */
-
-	if( pH==0 || pH->ht==0 ) return 0;
-	xHash = hashFunction(pH->keyClass);
-	assert( xHash!=0 );
-	h = (*xHash)(pKey,nKey);
-	assert( (pH->htsize & (pH->htsize-1))==0 );
-	elem = findElementGivenHash(pH,pKey,nKey, h & (pH->htsize-1));
-	return elem ? elem->data : 0;
+	int i;
+
+	if( pH==0 || pH->count==0 ) return 0;
+	i = find_slot(pH, hash_key(pH->keyClass, pKey, nKey), pKey, nKey);
+	return i>=0 ? pH->slots[i]->data : 0;
 }
 
 
@@ -442,26 +471,35 @@ void* mrhash_find(const mrhash_t *pH, const void *pKey, int nKey)
  */
 void* mrhash_insert(mrhash_t *pH, const void *pKey, int nKey, void *data)
 {
-	int hraw;                       /* Raw hash value of the key */
-	int h;                          /* the hash of the key modulo hash table size */
-	mrhashelem_t *elem;               /* Used to loop thru the element list */
-	mrhashelem_t *new_elem;           /* New element added to the pH */
-	int (*xHash)(const void*,int);  /* The hash function */
+	uint32_t      hash;
+	int           i;
+	mrhashelem_t* elem;
 
 	assert( pH!=0 );
-	xHash = hashFunction(pH->keyClass);
-	assert( xHash!=0 );
-	hraw = (*xHash)(pKey, nKey);
-	assert( (pH->htsize & (pH->htsize-1))==0 );
-	h = hraw & (pH->htsize-1);
-	elem = findElementGivenHash(pH,pKey,nKey,h);
-
-	if( elem )
+	hash = hash_key(pH->keyClass, pKey, nKey);
+	i = pH->htsize? find_slot(pH, hash, pKey, nKey) : -1;
+
+	if( i>=0 )
 	{
+		elem = pH->slots[i];
 		void *old_data = elem->data;
 		if( data==0 )
 		{
-			removeElementGivenHash(pH,elem,h);
+			/* the slot can be marked as empty if each group containing it has another empty slot;
+			otherwise, a lookup may have continued over the slot, so it must be marked as deleted */
+			uint64_t before = load64(&pH->ctrl[(i-MRHASH_GROUP) & (pH->htsize-1)]), after = load64(&pH->ctrl[i]);
+			if( empty_distance(before, 1) + empty_distance(after, 0) < MRHASH_GROUP ) {
+				set_ctrl(pH, i, MRHASH_EMPTY);
+			}
+			else {
+				set_ctrl(pH, i, MRHASH_DELETED);
+				pH->tombstones++;
+			}
+
+			if( elem->prev ) { elem->prev->next = elem->next; } else { pH->first = elem->next; }
+			if( elem->next ) { elem->next->prev = elem->prev; }
+			free_elem(pH, elem);
+			pH->count--;
 		}
 		else
 		{
@@ -472,49 +510,52 @@ void* mrhash_insert(mrhash_t *pH, const void *pKey, int nKey, void *data)
 
 	if( data==0 ) return 0;
 
-	new_elem = (mrhashelem_t*)sjhashMalloc( sizeof(mrhashelem_t) );
+	/* keep the load factor, including deleted slots, below 7/8; if there are many deleted slots, the size is not changed */
+	if( (pH->count + 1 + pH->tombstones)*8 > pH->htsize*7 ) {
+		int new_size = pH->htsize? pH->htsize : MRHASH_GROUP;
+		while( (pH->count + 1)*16 > new_size*7 ) {
+			new_size *= 2;
+		}
+		if( !resize(pH, new_size) ) {
+			return data;
+		}
+	}
 
-	if( new_elem==0 ) return data;
+	if( (elem=alloc_elem(pH))==NULL ) {
+		return data;
+	}
 
 	if( pH->copyKey && pKey!=0 )
 	{
-		new_elem->pKey = sjhashMallocRaw( nKey );
-		if( new_elem->pKey==0 )
-		{
-			sjhashFree(new_elem);
+		if( nKey <= MRHASH_INLINE_KEY ) {
+			elem->pKey = elem->inlineKey;
+		}
+		else if( (elem->pKey=malloc(nKey))==NULL ) {
+			elem->next = pH->freelist;
+			pH->freelist = elem;
 			return data;
 		}
-		memcpy((void*)new_elem->pKey, pKey, nKey);
+		memcpy(elem->pKey, pKey, nKey);
 	}
 	else
 	{
-		new_elem->pKey = (void*)pKey;
+		elem->pKey = (void*)pKey;
 	}
 
-	new_elem->nKey = nKey;
-	pH->count++;
+	elem->nKey = nKey;
+	elem->hash = hash;
+	elem->data = data;
 
-	if( pH->htsize==0 )
-	{
-		rehash(pH,8);
-		if( pH->htsize==0 )
-		{
-			pH->count = 0;
-			sjhashFree(new_elem);
-			return data;
-		}
-	}
+	elem->next = pH->first;
+	if( pH->first ) { pH->first->prev = elem; }
+	pH->first = elem;
 
-	if( pH->count > pH->htsize )
-	{
-		rehash(pH,pH->htsize*2);
+	i = find_free_slot(pH, hash);
+	if( pH->ctrl[i]==MRHASH_DELETED ) {
+		pH->tombstones--;
 	}
-
-	assert( pH->htsize>0 );
-	assert( (pH->htsize & (pH->htsize-1))==0 );
-	h = hraw & (pH->htsize-1);
-	insertElement(pH, &pH->ht[h], new_elem);
-	new_elem->data = data;
+	set_ctrl(pH, i, hash_tag(hash));
+	pH->slots[i] = elem;
+	pH->count++;
 	return 0;
 }
-
@@ -31,6 +31,13 @@ extern "C"
 /* Forward declarations of structures.
  */
 typedef struct mrhashelem_t   mrhashelem_t;
+typedef struct mrhasharena_t  mrhasharena_t;
+
+
+/* Copied keys up to this size are stored in the element itself; this way,
+ * an element of a 64-bit system fills exactly one cache line.
+ */
+#define MRHASH_INLINE_KEY 24
 
 
 /* A complete hash table is an instance of the following structure.
@@ -40,19 +47,25 @@ typedef struct mrhashelem_t   mrhashelem_t;
  * However, many of the "procedures" and "functions" for modifying and
  * accessing this structure are really macros, so we can't really make
  * this structure opaque.
+ *
+ * The table uses open addressing: each slot has a control byte holding 7 bits
+ * of the hash of the element in the slot, or a marker for empty and deleted
+ * slots.  Lookups compare 8 control bytes at once and only look at elements
+ * whose control byte matches.  The elements are allocated from an arena
+ * owned by the table and are never moved, so pointers to them stay valid.
  */
 typedef struct mrhash_t
 {
 	char              keyClass;       /* SJHASH_INT, _POINTER, _STRING, _BINARY */
 	char              copyKey;        /* True if copy of key made on insert */
 	int               count;          /* Number of entries in this table */
-	mrhashelem_t*     first;          /* The first element of the array */
-	int               htsize;         /* Number of buckets in the hash table */
-	struct _ht
-	{	/* the hash table */
-		int           count;          /* Number of entries with this hash */
-		mrhashelem_t* chain;          /* Pointer to first entry with this hash */
-	} *ht;
+	mrhashelem_t*     first;          /* The first element of the list of all elements */
+	int               htsize;         /* Number of slots in the hash table, 0 or a power of two */
+	int               tombstones;     /* Number of slots marked as deleted */
+	mrhashelem_t**    slots;          /* htsize pointers to the elements, only valid for slots in use */
+	unsigned char*    ctrl;           /* htsize control bytes, followed by a copy of the first 8 ones; allocated together with the slots */
+	mrhasharena_t*    arena;          /* Memory for the elements */
+	mrhashelem_t*     freelist;       /* Elements removed from the table, linked using `next` */
 } mrhash_t;
 
 
@@ -68,6 +81,8 @@ typedef struct mrhashelem_t
 	void*             data;           /* Data associated with this element */
 	void*             pKey;           /* Key associated with this element */
 	int               nKey;           /* Key associated with this element */
+	uint32_t          hash;           /* Hash of the key, needed when the table grows */
+	char              inlineKey[MRHASH_INLINE_KEY]; /* pKey points here for small copied keys */
 } mrhashelem_t;
 
 
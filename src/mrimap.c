@@ -25,18 +25,24 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <unistd.h> /* for sleep() */
+#include <sys/mman.h>
 #include "mrmailbox_internal.h"
 #include "mrimap.h"
 #include "mrosnative.h"
 #include "mrloginparam.h"
 
-#define LOCK_HANDLE   pthread_mutex_lock(&ths->m_hEtpanmutex); mrmailbox_wake_lock(ths->m_mailbox); handle_locked = 1;
-#define UNLOCK_HANDLE if( handle_locked ) { mrmailbox_wake_unlock(ths->m_mailbox); pthread_mutex_unlock(&ths->m_hEtpanmutex); handle_locked = 0; }
+#define LOCK_HANDLE   MR_LOCK_MUTEX(ths->m_mailbox, &ths->m_hEtpanmutex, "imap-handle"); mrmailbox_wake_lock(ths->m_mailbox); handle_locked = 1;
+#define UNLOCK_HANDLE if( handle_locked ) { mrmailbox_wake_unlock(ths->m_mailbox); MR_UNLOCK_MUTEX(ths->m_mailbox, &ths->m_hEtpanmutex); handle_locked = 0; }
 
-#define BLOCK_IDLE   pthread_mutex_lock(&ths->m_idlemutex); idle_blocked = 1;
-#define UNBLOCK_IDLE if( idle_blocked ) { pthread_mutex_unlock(&ths->m_idlemutex); idle_blocked = 0; }
+#define TIMED_IMAP_CMD(imap, cmd) { uint64_t cmd_start_us = mrmetrics_now_us(); cmd; mrmetrics_add_time((imap)->m_mailbox, MR_HIST_IMAP_CMD, cmd_start_us); }
+
+#define BLOCK_IDLE   MR_LOCK_MUTEX(ths->m_mailbox, &ths->m_idlemutex, "imap-idle"); idle_blocked = 1;
+#define UNBLOCK_IDLE if( idle_blocked ) { MR_UNLOCK_MUTEX(ths->m_mailbox, &ths->m_idlemutex); idle_blocked = 0; }
 #define INTERRUPT_IDLE  \
-	if( ths && ths->m_can_idle && ths->m_hEtpan && ths->m_hEtpan->imap_stream ) { \
+	if( ths && ths->m_mailbox->m_engine ) { \
+		interrupt_engine_idle__(ths); \
+	} \
+	else if( ths && ths->m_can_idle && ths->m_hEtpan && ths->m_hEtpan->imap_stream ) { \
 		if( pthread_mutex_trylock(&ths->m_inwait_mutex)!=0 ) { \
 			mrmailbox_log_info(ths->m_mailbox, 0, "Interrupting IDLE..."); \
 			mailstream_interrupt_idle(ths->m_hEtpan->imap_stream); \
@@ -47,6 +53,7 @@
 
 static int  setup_handle_if_needed__ (mrimap_t*);
 static void unsetup_handle__         (mrimap_t*);
+static void interrupt_engine_idle__  (mrimap_t*);
 
 
 /*******************************************************************************
@@ -70,6 +77,7 @@ static int is_error(mrimap_t* ths, int code)
 		ths->m_should_reconnect = 1;
 	}
 
+	mrmetrics_count(ths->m_mailbox, MR_CNT_IMAP_ERRORS, 1);
 	return 1;
 }
 
@@ -112,6 +120,51 @@ static void set_config_lastseenuid(mrimap_t* imap, const char* folder, uint32_t
 }
 
 
+/* The folder list and the capabilities are cached in the config-keys `imap.folders` and `imap.capabilities`,
+so that reconnects on flaky networks can go straight to SELECT/IDLE.  Both entries start with the lines
+`<timestamp>\n<user>@<server>:<port>\n`; they're ignored if they're older than MR_IMAP_CACHE_SECONDS or if the
+account has changed. */
+#define MR_IMAP_CACHE_SECONDS (10*60)
+
+
+static char* get_cache(mrimap_t* imap, const char* key)
+{
+	/* returns the cached data behind the header lines, NULL if there's no valid cache */
+	char   *cache = imap->m_get_config(imap, key, NULL), *account = NULL, *ret = NULL, *p1, *p2;
+	time_t timestamp, now = time(NULL);
+
+	if( cache == NULL || (p1=strchr(cache, '\n'))==NULL || (p2=strchr(p1+1, '\n'))==NULL ) {
+		goto cleanup;
+	}
+	*p1 = 0;
+	*p2 = 0;
+
+	timestamp = (time_t)atol(cache);
+	account   = mr_mprintf("%s@%s:%i", imap->m_imap_user, imap->m_imap_server, (int)imap->m_imap_port);
+	if( timestamp > now || now-timestamp > MR_IMAP_CACHE_SECONDS || strcmp(p1+1, account)!=0 ) {
+		goto cleanup;
+	}
+
+	ret = safe_strdup(p2+1);
+
+cleanup:
+	free(account);
+	free(cache);
+	return ret;
+}
+
+
+static void set_cache(mrimap_t* imap, const char* key, const char* data /*NULL=forget the cache*/)
+{
+	char* val = NULL;
+	if( data ) {
+		val = mr_mprintf("%lu\n%s@%s:%i\n%s", (unsigned long)time(NULL), imap->m_imap_user, imap->m_imap_server, (int)imap->m_imap_port, data);
+	}
+	imap->m_set_config(imap, key, val);
+	free(val);
+}
+
+
 /*******************************************************************************
  * Handle folders
  ******************************************************************************/
@@ -208,6 +261,59 @@ typedef struct mrimapfolder_t
 } mrimapfolder_t;
 
 
+static clist* load_folder_cache(mrimap_t* ths)
+{
+	/* the cached folder list has one line `<meaning> <name to select>` per folder */
+	clist* ret_list = NULL;
+	char   *cache = get_cache(ths, "imap.folders"), *line, *next, *name;
+
+	if( cache == NULL ) {
+		return NULL;
+	}
+
+	ret_list = clist_new();
+	for( line = cache; line && *line; line = next )
+	{
+		if( (next=strchr(line, '\n')) != NULL ) {
+			*next = 0;
+			next++;
+		}
+
+		if( (name=strchr(line, ' ')) != NULL && name[1] ) {
+			mrimapfolder_t* ret_folder = calloc(1, sizeof(mrimapfolder_t));
+			ret_folder->m_meaning        = atoi(line);
+			ret_folder->m_name_to_select = safe_strdup(name+1);
+			ret_folder->m_name_utf8      = imap_modified_utf7_to_utf8(name+1, 0);
+			clist_append(ret_list, (void*)ret_folder);
+		}
+	}
+
+	free(cache);
+	return ret_list;
+}
+
+
+static void save_folder_cache(mrimap_t* ths, clist* folders)
+{
+	mrstrbuilder_t cache;
+	clistiter*     iter1;
+	char           temp[32];
+
+	mrstrbuilder_init(&cache, 0);
+	for( iter1 = clist_begin(folders); iter1 != NULL ; iter1 = clist_next(iter1) ) {
+		mrimapfolder_t* folder = (struct mrimapfolder_t*)clist_content(iter1);
+		if( strchr(folder->m_name_to_select, '\n')==NULL ) {
+			snprintf(temp, sizeof(temp), "%i ", folder->m_meaning);
+			mrstrbuilder_cat(&cache, temp);
+			mrstrbuilder_cat(&cache, folder->m_name_to_select);
+			mrstrbuilder_cat(&cache, "\n");
+		}
+	}
+	set_cache(ths, "imap.folders", cache.m_buf);
+	free(cache.m_buf);
+}
+
+
 static clist* list_folders__(mrimap_t* ths)
 {
 	clist*     imap_list = NULL;
@@ -219,14 +325,22 @@ static clist* list_folders__(mrimap_t* ths)
 		goto cleanup;
 	}
 
+	{
+		clist* cached_list = load_folder_cache(ths);
+		if( cached_list ) {
+			clist_free(ret_list);
+			return cached_list;
+		}
+	}
+
 	/* the "*" not only gives us the folders from the main directory, but also all subdirectories; so the resulting foldernames may contain
 	delimiters as "folder/subdir/subsubdir" etc.  However, as we do not really use folders, this is just fine (otherwise we'd implement this
 	functinon recursively. */
 	if( ths->m_has_xlist )  {
-		r = mailimap_xlist(ths->m_hEtpan, "", "*", &imap_list);
+		TIMED_IMAP_CMD(ths, r = mailimap_xlist(ths->m_hEtpan, "", "*", &imap_list));
 	}
 	else {
-		r = mailimap_list(ths->m_hEtpan, "", "*", &imap_list);
+		TIMED_IMAP_CMD(ths, r = mailimap_list(ths->m_hEtpan, "", "*", &imap_list));
 	}
 	if( is_error(ths, r) || imap_list==NULL ) {
 		imap_list = NULL;
@@ -268,6 +382,8 @@ static clist* list_folders__(mrimap_t* ths)
 		}
 	}
 
+	save_folder_cache(ths, ret_list);
+
 cleanup:
 	if( imap_list ) {
 		mailimap_list_result_free(imap_list);
@@ -337,6 +453,7 @@ static int init_chat_folders__(mrimap_t* ths)
 		}
 		else {
 			chats_folder = safe_strdup(MR_CHATS_FOLDER);
+			set_cache(ths, "imap.folders", NULL); /* the cached folder list lacks the new folder */
 			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-folder created.");
 		}
 	}
@@ -400,7 +517,8 @@ static int select_folder__(mrimap_t* ths, const char* folder /*may be NULL*/)
 
 	/* select new folder */
 	if( folder ) {
-		int r = mailimap_select(ths->m_hEtpan, folder);
+		int r;
+		TIMED_IMAP_CMD(ths, r = mailimap_select(ths->m_hEtpan, folder));
 		if( is_error(ths, r) || ths->m_hEtpan->imap_selection_info == NULL ) {
 			ths->m_selected_folder[0] = 0;
 			return 0;
@@ -433,7 +551,8 @@ static uint32_t search_uid__(mrimap_t* imap, const char* message_id)
 		mrimapfolder_t* folder = (mrimapfolder_t*)clist_content(cur);
 		if( select_folder__(imap, folder->m_name_to_select) )
 		{
-			int r = mailimap_uid_search(imap->m_hEtpan, "utf-8", key, &search_result);
+			int r;
+			TIMED_IMAP_CMD(imap, r = mailimap_uid_search(imap->m_hEtpan, "utf-8", key, &search_result));
 			if( !is_error(imap, r) && search_result ) {
 				if( (cur2=clist_begin(search_result)) != NULL ) {
 					uint32_t* ptr_uid = (uint32_t *)clist_content(cur2);
@@ -486,6 +605,29 @@ static uint32_t peek_uid(struct mailimap_msg_att* msg_att)
 }
 
 
+static uint32_t peek_size(struct mailimap_msg_att* msg_att)
+{
+	/* search the RFC822.SIZE in a list of attributes returned by a FETCH command, returns 0 if unknown */
+	clistiter* iter1;
+	for( iter1=clist_begin(msg_att->att_list); iter1!=NULL; iter1=clist_next(iter1) )
+	{
+		struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(iter1);
+		if( item )
+		{
+			if( item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC )
+			{
+				if( item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_RFC822_SIZE )
+				{
+					return item->att_data.att_static->att_data.att_rfc822_size;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
 static char* unquote_rfc724_mid(const char* in)
 {
 	/* remove < and > from the given message id */
@@ -618,7 +760,180 @@ static void peek_body(struct mailimap_msg_att* msg_att, char** p_msg, size_t* p_
 }
 
 
-static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_uid, int block_idle)
+/* Large messages are fetched in chunks using `UID FETCH <uid> (FLAGS BODY.PEEK[]<offset.length>)` and
+appended to a spool file in the blob directory.  After each chunk, the number of bytes spooled is saved to the
+config-key `imap.spool` in the format `<uidvalidity>:<uid>:<bytes>:<folder>`.  If the connection gets lost, the
+message is tried again on the next fetch and the download resumes where it stopped.  Finally, the spool file is
+mapped to memory and given to mr_receive_imf_t with the flag MR_IMAP_LARGE. */
+
+
+static uint32_t get_config_spool(mrimap_t* ths, const char* folder, uint32_t uidvalidity, uint32_t server_uid)
+{
+	uint32_t ret = 0;
+	char*    val = ths->m_get_config(ths, "imap.spool", NULL);
+	char*    test = mr_mprintf("%lu:%lu:", (unsigned long)uidvalidity, (unsigned long)server_uid);
+	if( val && strncmp(val, test, strlen(test))==0 ) {
+		char* bytes = val + strlen(test), *spool_folder = strchr(bytes, ':');
+		if( spool_folder && strcmp(spool_folder+1, folder)==0 ) {
+			ret = atol(bytes);
+		}
+	}
+	free(test);
+	free(val);
+	return ret;
+}
+
+
+static void set_config_spool(mrimap_t* ths, const char* folder, uint32_t uidvalidity, uint32_t server_uid, uint32_t bytes)
+{
+	char* val = mr_mprintf("%lu:%lu:%lu:%s", (unsigned long)uidvalidity, (unsigned long)server_uid, (unsigned long)bytes, folder);
+	ths->m_set_config(ths, "imap.spool", val);
+	free(val);
+}
+
+
+static int fetch_chunked_msg(mrimap_t* ths, const char* folder, uint32_t server_uid)
+{
+	/* the function returns the same values as fetch_single_msg() */
+	char*       spool_filename = NULL;
+	FILE*       spool = NULL;
+	char*       mapped = MAP_FAILED;
+	uint32_t    uidvalidity = 0, offset = 0;
+	int         r = 0, retry_later = 0, deleted = 0, handle_locked = 0, complete = 0;
+	uint32_t    flags = 0;
+	clist*      fetch_result = NULL;
+	clistiter*  cur;
+	struct stat st;
+
+	MR_TRACE_BEGIN(ths->m_mailbox, "fetch_chunked_msg", "\"uid\":%lu", (unsigned long)server_uid);
+
+	LOCK_HANDLE
+		if( ths->m_hEtpan==NULL || ths->m_hEtpan->imap_selection_info==NULL ) {
+			retry_later = 1;
+			goto cleanup;
+		}
+		uidvalidity = ths->m_hEtpan->imap_selection_info->sel_uidvalidity;
+	UNLOCK_HANDLE
+
+	/* open the spool file; continue a download or start over */
+	spool_filename = mr_mprintf("%s/" MR_IMAP_SPOOL_FILE, ths->m_mailbox->m_blobdir);
+	if( (spool=fopen(spool_filename, "a+b"))==NULL ) {
+		mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot open spool file \"%s\".", spool_filename);
+		retry_later = 1;
+		goto cleanup;
+	}
+
+	offset = get_config_spool(ths, folder, uidvalidity, server_uid);
+	if( fstat(fileno(spool), &st) != 0 || st.st_size < (off_t)offset ) {
+		offset = 0; /* the spool file was truncated or replaced, ftruncate() would pad it with null-bytes */
+	}
+	if( ftruncate(fileno(spool), offset) != 0 ) { /* drop data written after the last saved state */
+		offset = 0;
+		if( ftruncate(fileno(spool), 0) != 0 ) {
+			retry_later = 1;
+			goto cleanup;
+		}
+	}
+	if( offset ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Resuming download of message #%i from folder \"%s\" at %i bytes.", (int)server_uid, folder, (int)offset);
+	}
+
+	while( !complete )
+	{
+		char*  chunk = NULL;
+		size_t chunk_bytes = 0;
+
+		LOCK_HANDLE
+
+			if( ths->m_hEtpan==NULL ) {
+				retry_later = 1;
+				goto cleanup;
+			}
+
+			{
+				struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+				mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
+				mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_body_peek_section_partial(mailimap_section_new(NULL), offset, MR_IMAP_CHUNK_BYTES));
+				struct mailimap_set* set = mailimap_set_new_single(server_uid);
+					TIMED_IMAP_CMD(ths, r = mailimap_uid_fetch(ths->m_hEtpan, set, fetch_type, &fetch_result));
+				mailimap_set_free(set);
+				mailimap_fetch_type_free(fetch_type);
+			}
+
+		UNLOCK_HANDLE
+
+		if( is_error(ths, r) || fetch_result == NULL ) {
+			fetch_result = NULL;
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Error #%i on fetching message #%i from folder \"%s\" at %i bytes; retry=%i.", (int)r, (int)server_uid, folder, (int)offset, (int)ths->m_should_reconnect);
+			if( ths->m_should_reconnect ) {
+				retry_later = 1; /* the spooled part is kept, the next try continues at offset */
+			}
+			goto cleanup;
+		}
+
+		if( (cur=clist_begin(fetch_result)) == NULL ) {
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Message #%i does not exist in folder \"%s\".", (int)server_uid, folder);
+			goto cleanup;
+		}
+
+		flags = 0;
+		peek_body((struct mailimap_msg_att*)clist_content(cur), &chunk, &chunk_bytes, &flags, &deleted);
+		if( deleted ) {
+			goto cleanup;
+		}
+
+		if( chunk && chunk_bytes > 0 ) {
+			if( fwrite(chunk, 1, chunk_bytes, spool) != chunk_bytes || fflush(spool) != 0 || fsync(fileno(spool)) != 0 ) {
+				mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot write to spool file \"%s\".", spool_filename);
+				retry_later = 1;
+				goto cleanup;
+			}
+			offset += chunk_bytes;
+			set_config_spool(ths, folder, uidvalidity, server_uid, offset);
+		}
+
+		complete = (chunk_bytes < MR_IMAP_CHUNK_BYTES);
+
+		mailimap_fetch_list_free(fetch_result);
+		fetch_result = NULL;
+	}
+
+	if( offset == 0 ) {
+		goto cleanup; /* empty message */
+	}
+
+	/* map the message and a terminating null-byte, the parser expects null-terminated data */
+	if( fwrite("", 1, 1, spool) != 1 || fflush(spool) != 0
+	 || (mapped=mmap(NULL, offset+1, PROT_READ, MAP_PRIVATE, fileno(spool), 0))==MAP_FAILED ) {
+		mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot map spool file \"%s\".", spool_filename);
+		goto cleanup; /* the message is treated as received, otherwise we may try over forever */
+	}
+
+	ths->m_receive_imf(ths, mapped, offset, folder, server_uid, flags|MR_IMAP_LARGE);
+
+cleanup:
+	UNLOCK_HANDLE
+
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
+	if( mapped != MAP_FAILED ) {
+		munmap(mapped, offset+1);
+	}
+	if( spool ) {
+		fclose(spool);
+	}
+	if( !retry_later && spool_filename ) {
+		ths->m_set_config(ths, "imap.spool", NULL);
+		unlink(spool_filename);
+	}
+	free(spool_filename);
+	MR_TRACE_END(ths->m_mailbox, "fetch_chunked_msg", "\"bytes\":%lu", (unsigned long)offset);
+	return retry_later? 0 : 1;
+}
+
+
+static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_uid, uint32_t size_hint, int block_idle)
 {
 	/* the function returns:
 	    0  the caller should try over again later
@@ -631,9 +946,15 @@ static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_u
 	clistiter*  cur;
 
 	if( ths==NULL ) {
-		goto cleanup;
+		return 1; /* nothing to retry; returning before MR_TRACE_BEGIN() keeps the trace balanced */
 	}
 
+	if( size_hint >= MR_IMAP_CHUNKED_MIN && !block_idle ) {
+		return fetch_chunked_msg(ths, folder, server_uid); /* size_hint is the RFC822.SIZE from the UID listing, 0 if unknown */
+	}
+
+	MR_TRACE_BEGIN(ths->m_mailbox, "fetch_single_msg", "\"uid\":%lu", (unsigned long)server_uid);
+
 	LOCK_HANDLE
 
 		if( ths->m_hEtpan==NULL ) {
@@ -650,7 +971,7 @@ static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_u
 
 		{
 			struct mailimap_set* set = mailimap_set_new_single(server_uid);
-				r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_body, &fetch_result);
+				TIMED_IMAP_CMD(ths, r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_body, &fetch_result));
 			mailimap_set_free(set);
 		}
 
@@ -692,17 +1013,18 @@ cleanup:
 	if( fetch_result ) {
 		mailimap_fetch_list_free(fetch_result);
 	}
+	MR_TRACE_END(ths->m_mailbox, "fetch_single_msg", "\"bytes\":%lu", (unsigned long)msg_bytes);
 	return retry_later? 0 : 1;
 }
 
 
 static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 {
-	int                  r, handle_locked = 0;
+	int                  r, handle_locked = 0, chat_only = 0;
 	uint32_t             uidvalidity = 0;
 	uint32_t             lastseenuid = 0, new_lastseenuid = 0;
 	clist*               fetch_result = NULL;
-	size_t               read_cnt = 0, read_errors = 0;
+	size_t               read_cnt = 0, read_errors = 0, skipped_cnt = 0;
 	clistiter*           cur;
 	struct mailimap_set* set;
 
@@ -710,6 +1032,12 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 		goto cleanup;
 	}
 
+	if( ths->m_precheck_imf ) {
+		char* temp = ths->m_get_config(ths, "chat_only", "0");
+			chat_only = atoi(temp);
+		free(temp);
+	}
+
 	LOCK_HANDLE
 
 		if( ths->m_hEtpan==NULL ) {
@@ -747,7 +1075,7 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
                 mrmailbox_log_info(ths->m_mailbox, 0, "EXISTS is missing for folder \"%s\", using fallback.", folder);
 				set = mailimap_set_new_single(0);
 			}
-			r = mailimap_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid, &fetch_result);
+			TIMED_IMAP_CMD(ths, r = mailimap_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid, &fetch_result));
 			mailimap_set_free(set);
 
 			if( is_error(ths, r) || fetch_result==NULL || (cur=clist_begin(fetch_result))==NULL ) {
@@ -774,9 +1102,10 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 			set_config_lastseenuid(ths, folder, uidvalidity, lastseenuid);
 		}
 
-		/* fetch messages with larger UID than the last one seen (`UID FETCH lastseenuid+1:*)`, see RFC 4549 */
+		/* fetch messages with larger UID than the last one seen (`UID FETCH lastseenuid+1:*)`, see RFC 4549;
+		in chat-only mode, we fetch some headers together with the UIDs to check which messages are needed at all */
 		set = mailimap_set_new_interval(lastseenuid+1, 0);
-			r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid, &fetch_result);
+			TIMED_IMAP_CMD(ths, r = mailimap_uid_fetch(ths->m_hEtpan, set, chat_only? ths->m_fetch_type_header : ths->m_fetch_type_uid, &fetch_result));
 		mailimap_set_free(set);
 
 	UNLOCK_HANDLE
@@ -800,9 +1129,25 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 		if( cur_uid > 0
 		 && cur_uid!=lastseenuid /* `UID FETCH <lastseenuid+1>:*` may include lastseenuid if "*" == lastseenuid */ )
 		{
+			if( chat_only ) {
+				char*    header = NULL;
+				size_t   header_bytes = 0;
+				uint32_t dummy_flags = 0;
+				int      dummy_deleted = 0;
+				peek_body(msg_att, &header, &header_bytes, &dummy_flags, &dummy_deleted);
+				if( header && header_bytes > 0 && ths->m_precheck_imf(ths, header, header_bytes)==0 ) {
+					skipped_cnt++; /* the message is treated as being read, it is not downloaded later */
+					if( cur_uid > new_lastseenuid ) {
+						new_lastseenuid = cur_uid;
+					}
+					continue;
+				}
+			}
+
 			read_cnt++;
-			if( fetch_single_msg(ths, folder, cur_uid, 0) == 0/* 0=try again later*/ ) {
+			if( fetch_single_msg(ths, folder, cur_uid, peek_size(msg_att), 0) == 0/* 0=try again later*/ ) {
 				read_errors++;
+				break; /* the connection is lost; moreover, fetching another large message would overwrite the spool file of this one */
 			}
 			else if( cur_uid > new_lastseenuid ) {
 				new_lastseenuid = cur_uid;
@@ -811,6 +1156,11 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 		}
 	}
 
+	/* the messages may be parsed in the background, make sure, they're stored before we update lastseenuid */
+	if( read_cnt > 0 && ths->m_flush_imf ) {
+		ths->m_flush_imf(ths);
+	}
+
 	if( !read_errors && new_lastseenuid > 0 ) {
 		set_config_lastseenuid(ths, folder, uidvalidity, new_lastseenuid);
 	}
@@ -819,6 +1169,11 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder)
 cleanup:
 	UNLOCK_HANDLE
 
+	if( skipped_cnt ) {
+		mrmetrics_count(ths->m_mailbox, MR_CNT_MSGS_SKIPPED, skipped_cnt);
+		mrmailbox_log_info(ths->m_mailbox, 0, "%i mails in \"%s\" skipped in chat-only mode.", (int)skipped_cnt, folder);
+	}
+
 	{
 		char* temp = mr_mprintf("%i mails read from \"%s\" with %i errors.", (int)read_cnt, folder, (int)read_errors);
 		if( read_errors ) {
@@ -864,7 +1219,10 @@ static int fetch_from_all_folders(mrimap_t* ths)
 	for( cur = clist_begin(folder_list); cur != NULL ; cur = clist_next(cur) )
 	{
 		mrimapfolder_t* folder = (mrimapfolder_t*)clist_content(cur);
-		if( folder->m_meaning == MEANING_IGNORE ) {
+		if( ths->m_should_reconnect ) {
+			break; /* a message is to be fetched again, the other folders are read after reconnecting */
+		}
+		else if( folder->m_meaning == MEANING_IGNORE ) {
 			mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" ignored.", folder->m_name_utf8);
 		}
 		else if( folder->m_meaning != MEANING_INBOX ) {
@@ -1109,10 +1467,12 @@ static void* heartbeat_thread_entry_point(void* entry_arg)
 	while( 1 )
 	{
 		pthread_mutex_lock(&ths->m_heartbeat_condmutex);
-			struct timespec timeToWait;
-			timeToWait.tv_sec  = time(NULL) + 50;
-			timeToWait.tv_nsec = 0;
-			pthread_cond_timedwait(&ths->m_heartbeat_cond, &ths->m_heartbeat_condmutex, &timeToWait);
+			if( !ths->m_watch_do_exit ) { /* the signal is lost if mrimap_disconnect() is called before we wait, eg. if the configuration fails just after connecting */
+				struct timespec timeToWait;
+				timeToWait.tv_sec  = time(NULL) + 50;
+				timeToWait.tv_nsec = 0;
+				pthread_cond_timedwait(&ths->m_heartbeat_cond, &ths->m_heartbeat_condmutex, &timeToWait);
+			}
 		pthread_mutex_unlock(&ths->m_heartbeat_condmutex);
 		if( ths->m_watch_do_exit ) {
 			break;
@@ -1161,6 +1521,12 @@ void mrimap_heartbeat(mrimap_t* ths)
 					INTERRUPT_IDLE
 				UNBLOCK_IDLE
 			}
+			else if( ths->m_mailbox->m_engine )
+			{
+				UNLOCK_HANDLE
+
+				mrengine_set_timer(ths->m_mailbox->m_engine, &ths->m_step_timer, 0);
+			}
 			else
 			{
 				UNLOCK_HANDLE
@@ -1177,6 +1543,177 @@ cleanup:
 }
 
 
+/*******************************************************************************
+ * Watch and heartbeat tasks, used instead of the threads if the mailbox uses an
+ * engine, see mrengine_new()
+ ******************************************************************************/
+
+
+static void engine_idle_done(void* arg)
+{
+	/* called when the server sends data while we're in IDLE or when the IDLE delay is reached */
+	mrimap_t*   ths = (mrimap_t*)arg;
+	mrengine_t* engine = ths->m_mailbox->m_engine;
+	int         handle_locked = 0, do_fetch = 0;
+
+	LOCK_HANDLE
+		if( !ths->m_idling ) {
+			UNLOCK_HANDLE /* IDLE was interrupted meanwhile */
+			return;
+		}
+		mrengine_unwatch_fd(engine, &ths->m_idle_watch);
+		mrengine_cancel_timer(engine, &ths->m_idle_timer);
+		ths->m_idling = 0;
+		ths->m_enter_watch_wait_time = 0;
+		do_fetch = !is_error(ths, mailimap_idle_done(ths->m_hEtpan));
+	UNLOCK_HANDLE
+
+	if( ths->m_watch_do_exit ) {
+		return;
+	}
+
+	if( do_fetch ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "IDLE has data or timeout.");
+		fetch_from_single_folder(ths, "INBOX");
+	}
+
+	if( !ths->m_watch_do_exit ) {
+		mrengine_set_timer(engine, &ths->m_step_timer, do_fetch? 0 : SLEEP_ON_ERROR_SECONDS*1000);
+	}
+}
+
+
+static void interrupt_engine_idle__(mrimap_t* ths)
+{
+	/* the caller must lock the handle */
+	mrengine_t* engine = ths->m_mailbox->m_engine;
+
+	if( ths->m_idling ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Interrupting IDLE...");
+		mrengine_unwatch_fd(engine, &ths->m_idle_watch);
+		mrengine_cancel_timer(engine, &ths->m_idle_timer);
+		ths->m_idling = 0;
+		ths->m_enter_watch_wait_time = 0;
+		is_error(ths, mailimap_idle_done(ths->m_hEtpan));
+		if( !ths->m_watch_do_exit ) {
+			mrengine_set_timer(engine, &ths->m_step_timer, SLEEP_ON_INTERRUPT_SECONDS*1000);
+		}
+	}
+}
+
+
+static void engine_step(void* arg)
+{
+	/* one round of the watch thread's loop; instead of waiting, the function arms a timer or a watch and returns */
+	mrimap_t*   ths = (mrimap_t*)arg;
+	mrengine_t* engine = ths->m_mailbox->m_engine;
+	int         handle_locked = 0, has_data = 0, delay_ms = SLEEP_ON_ERROR_SECONDS*1000;
+	time_t      now = time(NULL);
+
+	if( ths->m_watch_do_exit ) {
+		return;
+	}
+
+	if( ths->m_can_idle )
+	{
+		if( ths->m_last_fullread_time == 0 || now-ths->m_last_fullread_time > FULL_FETCH_EVERY_SECONDS ) {
+			fetch_from_all_folders(ths); /* the initial fetch from all folders is needed as this will init the folder UIDs */
+			ths->m_last_fullread_time = time(NULL);
+		}
+
+		LOCK_HANDLE
+			if( ths->m_idling ) {
+				delay_ms = -1; /* another step is already waiting */
+			}
+			else if( pthread_mutex_trylock(&ths->m_idlemutex) != 0 ) {
+				delay_ms = SLEEP_ON_INTERRUPT_SECONDS*1000; /* IDLE is blocked by another thread, do not wait for it on a worker thread */
+			}
+			else {
+				setup_handle_if_needed__(ths);
+				if( ths->m_hEtpan && ths->m_hEtpan->imap_stream && select_folder__(ths, "INBOX") )
+				{
+					if( !is_error(ths, mailimap_idle(ths->m_hEtpan)) )
+					{
+						mrmailbox_log_info(ths->m_mailbox, 0, "IDLE start...");
+						ths->m_idling = 1;
+						ths->m_enter_watch_wait_time = time(NULL);
+						delay_ms = -1;
+						if( ths->m_hEtpan->imap_stream->read_buffer_len > 0 ) {
+							has_data = 1; /* the server has sent data together with the IDLE continuation */
+						}
+						else {
+							mrengine_set_timer(engine, &ths->m_idle_timer, IDLE_DELAY_SECONDS*1000);
+							if( !mrengine_watch_fd(engine, &ths->m_idle_watch, mailimap_idle_get_fd(ths->m_hEtpan)) ) {
+								has_data = 1; /* cannot watch, finish IDLE and try over */
+							}
+						}
+					}
+				}
+				pthread_mutex_unlock(&ths->m_idlemutex);
+			}
+		UNLOCK_HANDLE
+
+		if( has_data ) {
+			engine_idle_done(ths);
+		}
+		else if( delay_ms >= 0 && !ths->m_watch_do_exit ) {
+			mrengine_set_timer(engine, &ths->m_step_timer, delay_ms);
+		}
+	}
+	else
+	{
+		time_t seconds_to_wait;
+
+		LOCK_HANDLE
+			ths->m_enter_watch_wait_time = 0;
+			setup_handle_if_needed__(ths);
+			forget_folder_selection__(ths);
+		UNLOCK_HANDLE
+
+		if( now-ths->m_last_fullread_time > FULL_FETCH_EVERY_SECONDS ) {
+			if( fetch_from_all_folders(ths) > 0 ) {
+				ths->m_last_message_time = now;
+			}
+			ths->m_last_fullread_time = now;
+		}
+		else if( fetch_from_single_folder(ths, "INBOX") > 0 ) {
+			ths->m_last_message_time = now;
+		}
+
+		/* the same wait times as used by the watch thread */
+		if( now-ths->m_last_message_time < 2*60 ) {
+			seconds_to_wait = 10;
+		}
+		else {
+			seconds_to_wait = (now-ths->m_last_message_time)/6;
+			if( seconds_to_wait > 5*60 ) {
+				seconds_to_wait = 5*60;
+			}
+		}
+
+		LOCK_HANDLE
+			ths->m_enter_watch_wait_time = time(NULL);
+		UNLOCK_HANDLE
+
+		if( !ths->m_watch_do_exit ) {
+			mrengine_set_timer(engine, &ths->m_step_timer, seconds_to_wait*1000);
+		}
+	}
+}
+
+
+static void engine_heartbeat(void* arg)
+{
+	mrimap_t* ths = (mrimap_t*)arg;
+
+	mrimap_heartbeat(ths);
+
+	if( !ths->m_watch_do_exit ) {
+		mrengine_set_timer(ths->m_mailbox->m_engine, &ths->m_heartbeat_timer, 50*1000);
+	}
+}
+
+
 /*******************************************************************************
  * Setup handle
  ******************************************************************************/
@@ -1208,6 +1745,8 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 
 	mailimap_set_timeout(ths->m_hEtpan, 30); /* 30 seconds until actions are aborted, this is also used in mailcore2 */
 
+	mr_tls_session_check(&ths->m_tls_session, ths->m_imap_server, ths->m_imap_port);
+
 	if( ths->m_server_flags&(MR_IMAP_SOCKET_STARTTLS|MR_IMAP_SOCKET_PLAIN) )
 	{
 		mrmailbox_log_info(ths->m_mailbox, 0, "Connecting to IMAP-server \"%s:%i\"...", ths->m_imap_server, (int)ths->m_imap_port);
@@ -1220,7 +1759,7 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 		if( ths->m_server_flags&MR_IMAP_SOCKET_STARTTLS )
 		{
 			mrmailbox_log_info(ths->m_mailbox, 0, "Switching to IMAP-STARTTLS.", ths->m_imap_server, (int)ths->m_imap_port);
-			r = mailimap_socket_starttls(ths->m_hEtpan);
+			r = mailimap_socket_starttls_with_callback(ths->m_hEtpan, mr_tls_session_cb, &ths->m_tls_session);
 			if( is_error(ths, r) ) {
 				mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "Could not connect to IMAP-server \"%s:%i\" using STARTTLS. (Error #%i)", ths->m_imap_server, (int)ths->m_imap_port, (int)r);
 				goto cleanup;
@@ -1230,7 +1769,7 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 	else
 	{
 		mrmailbox_log_info(ths->m_mailbox, 0, "Connecting to IMAP-server \"%s:%i\" via SSL...", ths->m_imap_server, (int)ths->m_imap_port);
-		r = mailimap_ssl_connect(ths->m_hEtpan, ths->m_imap_server, ths->m_imap_port);
+		r = mailimap_ssl_connect_with_callback(ths->m_hEtpan, ths->m_imap_server, ths->m_imap_port, mr_tls_session_cb, &ths->m_tls_session);
 		if( is_error(ths, r) ) {
 			mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "Could not connect to IMAP-server \"%s:%i\" using SSL. (Error #%i)", ths->m_imap_server, (int)ths->m_imap_port, (int)r);
 			goto cleanup;
@@ -1255,7 +1794,7 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 		else*/
 		{
 			/* MR_AUTH_NORMAL or no auth flag set */
-			r = mailimap_login(ths->m_hEtpan, ths->m_imap_user, ths->m_imap_pw);
+			TIMED_IMAP_CMD(ths, r = mailimap_login(ths->m_hEtpan, ths->m_imap_user, ths->m_imap_pw));
 		}
 
 		if( is_error(ths, r) ) {
@@ -1265,6 +1804,10 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 
 	mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-Login ok.");
 
+	if( mr_tls_session_save(&ths->m_tls_session, ths->m_hEtpan->imap_stream, ths->m_imap_server, ths->m_imap_port) ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-TLS-session resumed.");
+	}
+
 	success = 1;
 
 cleanup:
@@ -1287,6 +1830,12 @@ static void unsetup_handle__(mrimap_t* ths)
 	{
 		mrmailbox_log_info(ths->m_mailbox, 0, "Disconnecting...");
 
+			if( ths->m_idling ) {
+				mrengine_unwatch_fd(ths->m_mailbox->m_engine, &ths->m_idle_watch);
+				mrengine_cancel_timer(ths->m_mailbox->m_engine, &ths->m_idle_timer);
+				ths->m_idling = 0;
+			}
+
 			if( ths->m_idle_set_up ) {
 				mailstream_unsetup_idle(ths->m_hEtpan->imap_stream);
 				ths->m_idle_set_up = 0;
@@ -1314,6 +1863,63 @@ static void unsetup_handle__(mrimap_t* ths)
  ******************************************************************************/
 
 
+static char* get_capabilities__(mrimap_t* ths)
+{
+	/* returns the capability names, each with a leading space; the capabilities are taken from the greeting or the
+	login response, if the server sends them there, from the cache or from a CAPABILITY command */
+	mrstrbuilder_t caps;
+	char*          cached = NULL;
+	clistiter*     cur;
+
+	if( ths->m_hEtpan->imap_connection_info==NULL || ths->m_hEtpan->imap_connection_info->imap_capability==NULL )
+	{
+		if( (cached=get_cache(ths, "imap.capabilities")) != NULL ) {
+			return cached;
+		}
+
+		struct mailimap_capability_data* cap_data = NULL;
+		int r;
+		TIMED_IMAP_CMD(ths, r = mailimap_capability(ths->m_hEtpan, &cap_data)); /* also stored in imap_connection_info */
+		if( is_error(ths, r) ) {
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot get IMAP-capabilities.");
+		}
+		if( cap_data ) {
+			mailimap_capability_data_free(cap_data);
+		}
+	}
+
+	mrstrbuilder_init(&caps, 0);
+	if( ths->m_hEtpan->imap_connection_info && ths->m_hEtpan->imap_connection_info->imap_capability
+	 && ths->m_hEtpan->imap_connection_info->imap_capability->cap_list )
+	{
+		for( cur = clist_begin(ths->m_hEtpan->imap_connection_info->imap_capability->cap_list); cur != NULL ; cur = clist_next(cur) ) {
+			struct mailimap_capability* cap = clist_content(cur);
+			if( cap && cap->cap_type == MAILIMAP_CAPABILITY_NAME ) {
+				mrstrbuilder_cat(&caps, " ");
+				mrstrbuilder_cat(&caps, cap->cap_data.cap_name);
+			}
+		}
+		set_cache(ths, "imap.capabilities", caps.m_buf);
+	}
+	return caps.m_buf;
+}
+
+
+static int has_capability(const char* caps, const char* name)
+{
+	size_t name_len = strlen(name);
+	const char* p = caps;
+	while( p && (p=strchr(p, ' ')) != NULL ) {
+		p++;
+		if( strncasecmp(p, name, name_len)==0 && (p[name_len]==' ' || p[name_len]==0) ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+
 int mrimap_connect(mrimap_t* ths, const mrloginparam_t* lp)
 {
 	int success = 0, handle_locked = 0;
@@ -1342,40 +1948,33 @@ int mrimap_connect(mrimap_t* ths, const mrloginparam_t* lp)
 		ths->m_connected = 1;
 
 		/* we set the following flags here and not in setup_handle_if_needed__() as they must not change during connection */
-		ths->m_can_idle = mailimap_has_idle(ths->m_hEtpan);
-		ths->m_has_xlist = mailimap_has_xlist(ths->m_hEtpan);
+		{
+			char* caps = get_capabilities__(ths);
+			ths->m_can_idle  = has_capability(caps, "IDLE");
+			ths->m_has_xlist = has_capability(caps, "XLIST");
+			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-Capabilities:%s", caps); /* log the whole capabilities list, this is a good overview on problems */
+			free(caps);
+		}
 
 		#ifdef __APPLE__
 		ths->m_can_idle = 0; // HACK to force iOS not to work IMAP-IDLE which does not work for now, see also (*)
 		#endif
 
-
-		if( ths->m_hEtpan->imap_connection_info && ths->m_hEtpan->imap_connection_info->imap_capability ) {
-			/* just log the whole capabilities list (the mailimap_has_*() function also use this list, so this is a good overview on problems) */
-			mrstrbuilder_t capinfostr;
-			mrstrbuilder_init(&capinfostr, 0);
-			clist* list = ths->m_hEtpan->imap_connection_info->imap_capability->cap_list;
-			if( list ) {
-				clistiter* cur;
-				for(cur = clist_begin(list) ; cur != NULL ; cur = clist_next(cur)) {
-					struct mailimap_capability * cap = clist_content(cur);
-					if( cap && cap->cap_type == MAILIMAP_CAPABILITY_NAME ) {
-						mrstrbuilder_cat(&capinfostr, " ");
-						mrstrbuilder_cat(&capinfostr, cap->cap_data.cap_name);
-					}
-				}
-			}
-			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-Capabilities:%s", capinfostr.m_buf);
-			free(capinfostr.m_buf);
-		}
-
 		mrmailbox_log_info(ths->m_mailbox, 0, "Starting IMAP-watch-thread...");
 		ths->m_watch_do_exit = 0;
 
 	UNLOCK_HANDLE
 
-	pthread_create(&ths->m_watch_thread, NULL, watch_thread_entry_point, ths);
-	pthread_create(&ths->m_heartbeat_thread, NULL, heartbeat_thread_entry_point, ths);
+	if( ths->m_mailbox->m_engine ) {
+		ths->m_last_fullread_time = 0;
+		ths->m_last_message_time  = time(NULL);
+		mrengine_set_timer(ths->m_mailbox->m_engine, &ths->m_step_timer, 0);
+		mrengine_set_timer(ths->m_mailbox->m_engine, &ths->m_heartbeat_timer, 50*1000);
+	}
+	else {
+		pthread_create(&ths->m_watch_thread, NULL, watch_thread_entry_point, ths);
+		pthread_create(&ths->m_heartbeat_thread, NULL, heartbeat_thread_entry_point, ths);
+	}
 
 	success = 1;
 
@@ -1405,7 +2004,24 @@ void mrimap_disconnect(mrimap_t* ths)
 		mrmailbox_log_info(ths->m_mailbox, 0, "Stopping IMAP-watch-thread...");
 
 			/* prepare for exit */
-			if( ths->m_can_idle && ths->m_hEtpan->imap_stream )
+			if( ths->m_mailbox->m_engine )
+			{
+				mrengine_t* engine = ths->m_mailbox->m_engine;
+
+				LOCK_HANDLE
+					ths->m_watch_do_exit = 1;
+					interrupt_engine_idle__(ths);
+				UNLOCK_HANDLE
+
+				/* tasks running meanwhile check m_watch_do_exit before they re-arm a timer, so cancelling twice is sufficient */
+				mrengine_cancel_timer(engine, &ths->m_step_timer);
+				mrengine_cancel_timer(engine, &ths->m_heartbeat_timer);
+				mrengine_drain(engine, &ths->m_engine_owner);
+				mrengine_cancel_timer(engine, &ths->m_step_timer);
+				mrengine_cancel_timer(engine, &ths->m_heartbeat_timer);
+				mrengine_drain(engine, &ths->m_engine_owner);
+			}
+			else if( ths->m_can_idle && ths->m_hEtpan->imap_stream )
 			{
 				ths->m_watch_do_exit = 1;
 
@@ -1428,8 +2044,10 @@ void mrimap_disconnect(mrimap_t* ths)
 			pthread_mutex_unlock(&ths->m_heartbeat_condmutex);
 
 			/* wait for the threads to terminate */
-			pthread_join(ths->m_watch_thread, NULL);
-			pthread_join(ths->m_heartbeat_thread, NULL);
+			if( ths->m_mailbox->m_engine == NULL ) {
+				pthread_join(ths->m_watch_thread, NULL);
+				pthread_join(ths->m_heartbeat_thread, NULL);
+			}
 
 		mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-watch-thread stopped.");
 
@@ -1454,7 +2072,7 @@ int mrimap_is_connected(mrimap_t* ths)
  ******************************************************************************/
 
 
-mrimap_t* mrimap_new(mr_get_config_t get_config, mr_set_config_t set_config, mr_receive_imf_t receive_imf, void* userData, mrmailbox_t* mailbox)
+mrimap_t* mrimap_new(mr_get_config_t get_config, mr_set_config_t set_config, mr_receive_imf_t receive_imf, mr_flush_imf_t flush_imf, mr_precheck_imf_t precheck_imf, void* userData, mrmailbox_t* mailbox)
 {
 	mrimap_t* ths = NULL;
 
@@ -1468,6 +2086,8 @@ mrimap_t* mrimap_new(mr_get_config_t get_config, mr_set_config_t set_config, mr_
 	ths->m_get_config     = get_config;
 	ths->m_set_config     = set_config;
 	ths->m_receive_imf    = receive_imf;
+	ths->m_flush_imf      = flush_imf;
+	ths->m_precheck_imf   = precheck_imf;
 	ths->m_userData       = userData;
 
 	pthread_mutex_init(&ths->m_hEtpanmutex, NULL);
@@ -1481,13 +2101,19 @@ mrimap_t* mrimap_new(mr_get_config_t get_config, mr_set_config_t set_config, mr_
 	pthread_mutex_init(&ths->m_heartbeat_condmutex, NULL);
 	pthread_cond_init (&ths->m_heartbeat_cond, NULL);
 
+	mrengine_init_timer(&ths->m_step_timer,      &ths->m_engine_owner, engine_step,      ths);
+	mrengine_init_timer(&ths->m_idle_timer,      &ths->m_engine_owner, engine_idle_done, ths);
+	mrengine_init_watch(&ths->m_idle_watch,      &ths->m_engine_owner, engine_idle_done, ths);
+	mrengine_init_timer(&ths->m_heartbeat_timer, &ths->m_engine_owner, engine_heartbeat, ths);
+
 	ths->m_selected_folder = calloc(1, 1);
 	ths->m_moveto_folder   = NULL;
 	ths->m_sent_folder     = NULL;
 
 	/* create some useful objects */
-	ths->m_fetch_type_uid = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch the ID */
+	ths->m_fetch_type_uid = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch the ID and the size */
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_uid, mailimap_fetch_att_new_uid());
+	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_uid, mailimap_fetch_att_new_rfc822_size());
 
 
 	ths->m_fetch_type_message_id = mailimap_fetch_type_new_fetch_att_list_empty();
@@ -1507,6 +2133,21 @@ mrimap_t* mrimap_new(mr_get_config_t get_config, mr_set_config_t set_config, mr_
 	ths->m_fetch_type_flags = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch flags only */
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_flags, mailimap_fetch_att_new_flags());
 
+	{
+		/* object to fetch the UID and the headers needed to decide if a message is downloaded in chat-only mode,
+		`UID FETCH <set> (UID BODY.PEEK[HEADER.FIELDS (...)])`; this is typically a few hundred bytes per message */
+		static const char* precheck_headers[] = { "From", "In-Reply-To", "References", "Content-Type", "Chat-Version", "X-MrMsg", "Autocrypt-Setup-Message", NULL };
+		int    i;
+		clist* hdrlist = clist_new();
+		for( i = 0; precheck_headers[i]; i++ ) {
+			clist_append(hdrlist, strdup(precheck_headers[i]));
+		}
+		ths->m_fetch_type_header = mailimap_fetch_type_new_fetch_att_list_empty();
+		mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_header, mailimap_fetch_att_new_uid());
+		mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_header, mailimap_fetch_att_new_rfc822_size());
+		mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_header, mailimap_fetch_att_new_body_peek_section(mailimap_section_new_header_fields(mailimap_header_list_new(hdrlist))));
+	}
+
     return ths;
 }
 
@@ -1534,10 +2175,12 @@ void mrimap_unref(mrimap_t* ths)
 	free(ths->m_selected_folder);
 	free(ths->m_moveto_folder);
 	free(ths->m_sent_folder);
+	mr_tls_session_clear(&ths->m_tls_session);
 
 	if( ths->m_fetch_type_uid )  { mailimap_fetch_type_free(ths->m_fetch_type_uid);  }
 	if( ths->m_fetch_type_body ) { mailimap_fetch_type_free(ths->m_fetch_type_body); }
 	if( ths->m_fetch_type_flags ){ mailimap_fetch_type_free(ths->m_fetch_type_flags);}
+	if( ths->m_fetch_type_header){ mailimap_fetch_type_free(ths->m_fetch_type_header);}
 
 	free(ths);
 }
@@ -1549,6 +2192,13 @@ int mrimap_fetch(mrimap_t* ths)
 		return 0;
 	}
 
+	if( ths->m_mailbox->m_engine ) {
+		if( !ths->m_can_idle ) {
+			mrengine_set_timer(ths->m_mailbox->m_engine, &ths->m_step_timer, 0);
+		}
+		return 1;
+	}
+
 	/* the following code has no effect in IDLE mode, however, it also does not disturb */
 	pthread_mutex_lock(&ths->m_watch_condmutex);
 		ths->m_watch_condflag = 1;
@@ -1591,6 +2241,7 @@ int mrimap_append_msg(mrimap_t* ths, time_t timestamp, const char* data_not_term
 		if( !select_folder__(ths, ths->m_sent_folder) ) {
 			mrmailbox_log_error(ths->m_mailbox, 0, "Cannot select IMAP-folder \"%s\".", ths->m_sent_folder);
 			ths->m_sent_folder[0] = 0; /* force re-init */
+			set_cache(ths, "imap.folders", NULL); /* the folder may be deleted, do not use the cached folder list for re-init */
 			goto cleanup;
 		}
 
@@ -1603,7 +2254,7 @@ int mrimap_append_msg(mrimap_t* ths, time_t timestamp, const char* data_not_term
 			goto cleanup;
 		}
 
-		r = mailimap_uidplus_append(ths->m_hEtpan, ths->m_sent_folder, flag_list, imap_date, data_not_terminated, data_bytes, &ret_uidvalidity, ret_server_uid);
+		TIMED_IMAP_CMD(ths, r = mailimap_uidplus_append(ths->m_hEtpan, ths->m_sent_folder, flag_list, imap_date, data_not_terminated, data_bytes, &ret_uidvalidity, ret_server_uid));
 		if( is_error(ths, r) ) {
 			mrmailbox_log_error(ths->m_mailbox, 0, "Cannot append message to \"%s\", error #%i.", ths->m_sent_folder, (int)r);
 			goto cleanup;
@@ -1647,7 +2298,7 @@ static int add_flag__(mrimap_t* ths, uint32_t server_uid, struct mailimap_flag*
 
 	store_att_flags = mailimap_store_att_flags_new_add_flags(flag_list); /* FLAGS.SILENT does not return the new value */
 
-	r = mailimap_uid_store(ths->m_hEtpan, set, store_att_flags);
+	TIMED_IMAP_CMD(ths, r = mailimap_uid_store(ths->m_hEtpan, set, store_att_flags));
 	if( is_error(ths, r) ) {
 		goto cleanup;
 	}
@@ -1732,7 +2383,7 @@ int mrimap_markseen_msg(mrimap_t* ths, const char* folder, uint32_t server_uid,
 			if( can_create_flag )
 			{
 				clist* fetch_result = NULL;
-				r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_flags, &fetch_result);
+				TIMED_IMAP_CMD(ths, r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_flags, &fetch_result));
 				if( !is_error(ths, r) && fetch_result ) {
 					clistiter* cur=clist_begin(fetch_result);
 					if( cur ) {
@@ -1770,7 +2421,7 @@ int mrimap_markseen_msg(mrimap_t* ths, const char* folder, uint32_t server_uid,
 				uint32_t             res_uid = 0;
 				struct mailimap_set* res_setsrc = NULL;
 				struct mailimap_set* res_setdest = NULL;
-				r = mailimap_uidplus_uid_move(ths->m_hEtpan, set, ths->m_moveto_folder, &res_uid, &res_setsrc, &res_setdest); /* the correct folder is already selected in add_flag__() above */
+				TIMED_IMAP_CMD(ths, r = mailimap_uidplus_uid_move(ths->m_hEtpan, set, ths->m_moveto_folder, &res_uid, &res_setsrc, &res_setdest)); /* the correct folder is already selected in add_flag__() above */
 				if( is_error(ths, r) ) {
 					mrmailbox_log_info(ths->m_mailbox, 0, "Cannot move message.");
 					goto cleanup;
@@ -1841,7 +2492,7 @@ int mrimap_delete_msg(mrimap_t* ths, const char* rfc724_mid, const char* folder,
 			clistiter* cur = NULL;
 			const char* is_quoted_rfc724_mid = NULL;
 			struct mailimap_set* set = mailimap_set_new_single(server_uid);
-				r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_message_id, &fetch_result);
+				TIMED_IMAP_CMD(ths, r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_message_id, &fetch_result));
 			mailimap_set_free(set);
 			if( is_error(ths, r) || fetch_result == NULL
 			 || (cur=clist_begin(fetch_result)) == NULL
@@ -35,11 +35,18 @@ extern "C" {
 typedef struct mrloginparam_t mrloginparam_t;
 typedef struct mrimap_t mrimap_t;
 
-#define MR_IMAP_SEEN 0x0001L
+#define MR_IMAP_SEEN  0x0001L
+#define MR_IMAP_LARGE 0x0002L /* the message is mapped from a spool file and should not be copied, it is parsed before mr_receive_imf_t returns */
+
+#define MR_IMAP_SPOOL_FILE  ".imap-spool"    /* in the blob directory, messages larger than MR_IMAP_CHUNKED_MIN are downloaded to this file */
+#define MR_IMAP_CHUNKED_MIN (2*1024*1024)
+#define MR_IMAP_CHUNK_BYTES (512*1024)
 
 typedef char*    (*mr_get_config_t)    (mrimap_t*, const char*, const char*);
 typedef void     (*mr_set_config_t)    (mrimap_t*, const char*, const char*);
 typedef void     (*mr_receive_imf_t)   (mrimap_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+typedef void     (*mr_flush_imf_t)     (mrimap_t*); /* called after a bunch of messages is passed to mr_receive_imf_t; on return, all messages must be stored */
+typedef int      (*mr_precheck_imf_t)  (mrimap_t*, const char* imf_header_not_terminated, size_t imf_header_bytes); /* only called in chat-only mode; return 0 if the message need not to be downloaded */
 
 
 /**
@@ -82,22 +89,35 @@ typedef struct mrimap_t
 	pthread_cond_t        m_heartbeat_cond;
 	pthread_mutex_t       m_heartbeat_condmutex;
 
+	mrengineowner_t       m_engine_owner; /* if the mailbox uses an engine, the watch and heartbeat threads are replaced by the following tasks */
+	mrenginetimer_t       m_step_timer;
+	mrenginetimer_t       m_idle_timer;
+	mrenginewatch_t       m_idle_watch;
+	mrenginetimer_t       m_heartbeat_timer;
+	int                   m_idling;       /* IDLE is sent and m_idle_watch waits for the server; protected by m_hEtpanmutex */
+	time_t                m_last_fullread_time;
+	time_t                m_last_message_time;
+
 	struct mailimap_fetch_type* m_fetch_type_uid;
 	struct mailimap_fetch_type* m_fetch_type_message_id;
 	struct mailimap_fetch_type* m_fetch_type_body;
 	struct mailimap_fetch_type* m_fetch_type_flags;
+	struct mailimap_fetch_type* m_fetch_type_header; /* UID and the headers needed by mr_precheck_imf_t */
 
 	mr_get_config_t       m_get_config;
 	mr_set_config_t       m_set_config;
 	mr_receive_imf_t      m_receive_imf;
+	mr_flush_imf_t        m_flush_imf;
+	mr_precheck_imf_t     m_precheck_imf;
 	void*                 m_userData;
 	mrmailbox_t*          m_mailbox;
 
 	int                   m_log_connect_errors;
+	mrtlssession_t        m_tls_session;  /* resumed on reconnects */
 } mrimap_t;
 
 
-mrimap_t* mrimap_new               (mr_get_config_t, mr_set_config_t, mr_receive_imf_t, void* userData, mrmailbox_t*);
+mrimap_t* mrimap_new               (mr_get_config_t, mr_set_config_t, mr_receive_imf_t, mr_flush_imf_t, mr_precheck_imf_t, void* userData, mrmailbox_t*);
 void      mrimap_unref             (mrimap_t*);
 
 int       mrimap_connect           (mrimap_t*, const mrloginparam_t*);
@@ -57,12 +57,82 @@ static int get_wait_seconds(mrmailbox_t* mailbox) // >0: wait seconds, =0: do no
 }
 
 
+/* do all waiting jobs, returns 0 if the job thread or task should exit */
+static int perform_jobs(mrmailbox_t* mailbox, mrjob_t* job)
+{
+	sqlite3_stmt* stmt;
+
+	while( 1 )
+	{
+		pthread_mutex_lock(&mailbox->m_job_condmutex);
+			if( mailbox->m_job_do_exit ) {
+				pthread_mutex_unlock(&mailbox->m_job_condmutex);
+				return 0;
+			}
+		pthread_mutex_unlock(&mailbox->m_job_condmutex);
+
+		/* get next waiting job */
+		job->m_job_id = 0;
+		mrsqlite3_lock(mailbox->m_sql);
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_iafp_FROM_jobs,
+				"SELECT id, action, foreign_id, param FROM jobs WHERE desired_timestamp<=? ORDER BY action DESC, id LIMIT 1;");
+			sqlite3_bind_int64(stmt, 1, time(NULL));
+			if( sqlite3_step(stmt) == SQLITE_ROW ) {
+				job->m_job_id                        = sqlite3_column_int (stmt, 0);
+				job->m_action                        = sqlite3_column_int (stmt, 1);
+				job->m_foreign_id                    = sqlite3_column_int (stmt, 2);
+				mrparam_set_packed(job->m_param, (char*)sqlite3_column_text(stmt, 3));
+			}
+		mrsqlite3_unlock(mailbox->m_sql);
+
+		if( job->m_job_id == 0 ) {
+			return 1;
+		}
+
+		/* execute job */
+		mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job->m_job_id, (int)job->m_action);
+		job->m_start_again_at = 0;
+		switch( job->m_action ) {
+			case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap      (mailbox, job); break;
+			case MRJ_CONNECT_TO_SMTP:      mrmailbox_connect_to_smtp      (mailbox, job); break;
+			case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msg_to_smtp     (mailbox, job); break;
+			case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap     (mailbox, job); break;
+			case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msg_on_imap   (mailbox, job); break;
+			case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msg_on_imap (mailbox, job); break;
+			case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdn_on_imap (mailbox, job); break;
+			case MRJ_SEND_MDN:             mrmailbox_send_mdn             (mailbox, job); break;
+		}
+
+		/* delete job or execute job later again */
+		if( job->m_start_again_at ) {
+			mrsqlite3_lock(mailbox->m_sql);
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
+					"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
+				sqlite3_bind_int64(stmt, 1, job->m_start_again_at);
+				sqlite3_bind_text (stmt, 2, job->m_param->m_packed, -1, SQLITE_STATIC);
+				sqlite3_bind_int  (stmt, 3, job->m_job_id);
+				sqlite3_step(stmt);
+			mrsqlite3_unlock(mailbox->m_sql);
+			mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job->m_job_id, (int)(job->m_start_again_at-time(NULL)));
+		}
+		else {
+			mrsqlite3_lock(mailbox->m_sql);
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
+					"DELETE FROM jobs WHERE id=?;");
+				sqlite3_bind_int(stmt, 1, job->m_job_id);
+				sqlite3_step(stmt);
+			mrsqlite3_unlock(mailbox->m_sql);
+			mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted from database", (int)job->m_job_id);
+		}
+	}
+}
+
+
 static void* job_thread_entry_point(void* entry_arg)
 {
 	mrmailbox_t*  mailbox = (mrmailbox_t*)entry_arg;
 	mrosnative_setup_thread(mailbox); /* must be very first */
 
-	sqlite3_stmt* stmt;
 	mrjob_t       job;
 	int           seconds_to_wait;
 
@@ -97,77 +167,65 @@ static void* job_thread_entry_point(void* entry_arg)
 
 		/* do all waiting jobs */
 		mrmailbox_log_info(mailbox, 0, "Job thread checks for pending jobs...");
-		while( 1 )
-		{
-			pthread_mutex_lock(&mailbox->m_job_condmutex);
-				if( mailbox->m_job_do_exit ) {
-					pthread_mutex_unlock(&mailbox->m_job_condmutex);
-					goto exit_;
-				}
-			pthread_mutex_unlock(&mailbox->m_job_condmutex);
+		if( !perform_jobs(mailbox, &job) ) {
+			break;
+		}
+	}
 
-			/* get next waiting job */
-			job.m_job_id = 0;
-			mrsqlite3_lock(mailbox->m_sql);
-				stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_iafp_FROM_jobs,
-					"SELECT id, action, foreign_id, param FROM jobs WHERE desired_timestamp<=? ORDER BY action DESC, id LIMIT 1;");
-				sqlite3_bind_int64(stmt, 1, time(NULL));
-				if( sqlite3_step(stmt) == SQLITE_ROW ) {
-					job.m_job_id                         = sqlite3_column_int (stmt, 0);
-					job.m_action                         = sqlite3_column_int (stmt, 1);
-					job.m_foreign_id                     = sqlite3_column_int (stmt, 2);
-					mrparam_set_packed(job.m_param, (char*)sqlite3_column_text(stmt, 3));
-				}
-			mrsqlite3_unlock(mailbox->m_sql);
+	/* exit thread */
+	mrparam_unref(job.m_param);
+	mrmailbox_log_info(mailbox, 0, "Exit job thread.");
+	mrosnative_unsetup_thread(mailbox); /* must be very last */
+	return NULL;
+}
 
-			if( job.m_job_id == 0 ) {
-				break;
-			}
 
-			/* execute job */
-			mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job.m_job_id, (int)job.m_action);
-			job.m_start_again_at = 0;
-			switch( job.m_action ) {
-				case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap      (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msg_to_smtp     (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap     (mailbox, &job); break;
-                case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msg_on_imap   (mailbox, &job); break;
-                case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msg_on_imap (mailbox, &job); break;
-                case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdn_on_imap (mailbox, &job); break;
-                case MRJ_SEND_MDN:             mrmailbox_send_mdn             (mailbox, &job); break;
-			}
+static void job_task(void* arg)
+{
+	/* used instead of the job thread if the mailbox uses an engine; the task is started by m_job_timer */
+	mrmailbox_t*  mailbox = (mrmailbox_t*)arg;
+	mrjob_t       job;
+	int           seconds_to_wait = -1, go_on = 1;
 
-			/* delete job or execute job later again */
-			if( job.m_start_again_at ) {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
-						"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
-					sqlite3_bind_int64(stmt, 1, job.m_start_again_at);
-					sqlite3_bind_text (stmt, 2, job.m_param->m_packed, -1, SQLITE_STATIC);
-					sqlite3_bind_int  (stmt, 3, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job.m_job_id, (int)(job.m_start_again_at-time(NULL)));
-			}
-			else {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
-						"DELETE FROM jobs WHERE id=?;");
-					sqlite3_bind_int(stmt, 1, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted from database", (int)job.m_job_id);
-			}
+	pthread_mutex_lock(&mailbox->m_job_condmutex);
+		if( mailbox->m_job_running ) {
+			mailbox->m_job_rerun = 1; /* the running task checks for jobs again before it returns */
+			go_on = 0;
 		}
+		mailbox->m_job_running = go_on;
+	pthread_mutex_unlock(&mailbox->m_job_condmutex);
 
+	if( !go_on ) {
+		return;
+	}
+
+	memset(&job, 0, sizeof(mrjob_t));
+	job.m_param = mrparam_new();
+
+	while( 1 )
+	{
+		mrmailbox_log_info(mailbox, 0, "Job task checks for pending jobs...");
+		go_on = perform_jobs(mailbox, &job);
+		if( go_on ) {
+			seconds_to_wait = get_wait_seconds(mailbox);
+		}
+
+		pthread_mutex_lock(&mailbox->m_job_condmutex);
+			if( go_on && mailbox->m_job_rerun && !mailbox->m_job_do_exit ) {
+				mailbox->m_job_rerun = 0;
+				pthread_mutex_unlock(&mailbox->m_job_condmutex);
+				continue;
+			}
+			mailbox->m_job_running = 0;
+			mailbox->m_job_rerun   = 0;
+			if( go_on && seconds_to_wait >= 0 && !mailbox->m_job_do_exit ) {
+				mrengine_set_timer(mailbox->m_engine, &mailbox->m_job_timer, seconds_to_wait*1000);
+			}
+		pthread_mutex_unlock(&mailbox->m_job_condmutex);
+		break;
 	}
 
-	/* exit thread */
-exit_:
 	mrparam_unref(job.m_param);
-	mrmailbox_log_info(mailbox, 0, "Exit job thread.");
-	mrosnative_unsetup_thread(mailbox); /* must be very last */
-	return NULL;
 }
 
 
@@ -180,6 +238,11 @@ void mrjob_init_thread(mrmailbox_t* mailbox)
 {
 	pthread_mutex_init(&mailbox->m_job_condmutex, NULL);
     pthread_cond_init(&mailbox->m_job_cond, NULL);
+	if( mailbox->m_engine ) {
+		mrengine_init_timer(&mailbox->m_job_timer, &mailbox->m_job_owner, job_task, mailbox);
+		mrengine_set_timer(mailbox->m_engine, &mailbox->m_job_timer, 0);
+		return;
+	}
     pthread_create(&mailbox->m_job_thread, NULL, job_thread_entry_point, mailbox);
 }
 
@@ -192,7 +255,13 @@ void mrjob_exit_thread(mrmailbox_t* mailbox)
 		pthread_cond_signal(&mailbox->m_job_cond);
 	pthread_mutex_unlock(&mailbox->m_job_condmutex);
 
-	pthread_join(mailbox->m_job_thread, NULL);
+	if( mailbox->m_engine ) {
+		mrengine_cancel_timer(mailbox->m_engine, &mailbox->m_job_timer); /* the task does not re-arm the timer after m_job_do_exit is set */
+		mrengine_drain(mailbox->m_engine, &mailbox->m_job_owner);
+	}
+	else {
+		pthread_join(mailbox->m_job_thread, NULL);
+	}
 	pthread_cond_destroy(&mailbox->m_job_cond);
 	pthread_mutex_destroy(&mailbox->m_job_condmutex);
 }
@@ -219,9 +288,19 @@ uint32_t mrjob_add__(mrmailbox_t* mailbox, int action, int foreign_id, const cha
 
 	pthread_mutex_lock(&mailbox->m_job_condmutex);
 		if( !mailbox->m_job_do_exit ) {
-			mrmailbox_log_info(mailbox, 0, "Signal job thread to wake up...");
-			mailbox->m_job_condflag = 1;
-			pthread_cond_signal(&mailbox->m_job_cond);
+			if( mailbox->m_engine ) {
+				if( mailbox->m_job_running ) {
+					mailbox->m_job_rerun = 1;
+				}
+				else {
+					mrengine_set_timer(mailbox->m_engine, &mailbox->m_job_timer, 0);
+				}
+			}
+			else {
+				mrmailbox_log_info(mailbox, 0, "Signal job thread to wake up...");
+				mailbox->m_job_condflag = 1;
+				pthread_cond_signal(&mailbox->m_job_cond);
+			}
 		}
 	pthread_mutex_unlock(&mailbox->m_job_condmutex);
 
@@ -32,6 +32,7 @@ extern "C" {
 #define MRJ_MARKSEEN_MSG_ON_IMAP   110
 #define MRJ_SEND_MSG_TO_IMAP       700
 #define MRJ_SEND_MSG_TO_SMTP       800
+#define MRJ_CONNECT_TO_SMTP        850
 #define MRJ_CONNECT_TO_IMAP        900    /* ... high priority*/
 
 /**
@@ -22,6 +22,11 @@
 
 #include <ctype.h>
 #include <memory.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MR_BASE64_SSSE3 1
+#include <immintrin.h>
+#endif
 #include "mrmailbox_internal.h"
 #include "mrkey.h"
 #include "mrpgp.h"
@@ -299,21 +304,113 @@ int mrkey_load_self_private__(mrkey_t* ths, const char* self_addr, mrsqlite3_t*
  ******************************************************************************/
 
 
-static long crc_octets(const unsigned char *octets, size_t len)
+/* CRC24 as used by the ASCII armor (RFC 4880, 6.1), calculated bytewise using
+a table; the table is the bitwise algorithm applied to each possible byte. */
+#define CRC24_POLY 0x1864CFBL
+
+static uint32_t       s_crc24_table[256];
+static pthread_once_t s_crc24_table_once = PTHREAD_ONCE_INIT;
+
+static void crc24_init_table(void)
 {
-	#define CRC24_INIT 0xB704CEL
-	#define CRC24_POLY 0x1864CFBL
-	long crc = CRC24_INIT;
-	int i;
-	while (len--) {
-		crc ^= (*octets++) << 16;
-		for (i = 0; i < 8; i++) {
+	int i, j;
+	for( i = 0; i < 256; i++ ) {
+		long crc = (long)i << 16;
+		for( j = 0; j < 8; j++ ) {
 			crc <<= 1;
-			if (crc & 0x1000000)
-			crc ^= CRC24_POLY;
+			if( crc & 0x1000000 ) {
+				crc ^= CRC24_POLY;
+			}
 		}
+		s_crc24_table[i] = (uint32_t)(crc & 0xFFFFFFL);
+	}
+}
+
+
+long mr_crc24(long crc, const void* buf, size_t bytes)
+{
+	const uint8_t* p = (const uint8_t*)buf;
+
+	pthread_once(&s_crc24_table_once, crc24_init_table);
+
+	while( bytes-- ) {
+		crc = ((crc << 8) ^ s_crc24_table[((crc >> 16) ^ *p++) & 0xFF]) & 0xFFFFFFL;
+	}
+	return crc;
+}
+
+
+/* Encode base64 as defined in RFC 4648; if the CPU supports SSSE3, 12 bytes
+are encoded at once (see http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html ) */
+static const char s_base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+#ifdef MR_BASE64_SSSE3
+static inline __attribute__((target("ssse3"))) __m128i encode_base64_12_bytes(__m128i in)
+{
+	/* split each group of 3 bytes into 4 6-bit values, one per byte */
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	__m128i values = _mm_or_si128(t1, t3);
+
+	/* translate the 6-bit values to the alphabet by adding an offset depending on the range */
+	__m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m128i indices = _mm_subs_epu8(values, _mm_set1_epi8(51));
+	indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+	return _mm_add_epi8(values, _mm_shuffle_epi8(lut, indices));
+}
+
+
+static __attribute__((target("ssse3"))) size_t encode_base64_ssse3(const uint8_t* in, size_t in_bytes, char* out)
+{
+	size_t done = 0;
+	while( in_bytes-done >= 16 ) { /* 16 bytes are loaded, 12 are used */
+		_mm_storeu_si128((__m128i*)out, encode_base64_12_bytes(_mm_loadu_si128((const __m128i*)(in+done))));
+		done += 12;
+		out  += 16;
 	}
-	return crc & 0xFFFFFFL;
+	return done;
+}
+#endif
+
+
+size_t mr_encode_base64_to(const uint8_t* in, size_t in_bytes, char* out /*must have space for 4*ceil(in_bytes/3) characters*/)
+{
+	char* start = out;
+
+	#ifdef MR_BASE64_SSSE3
+	if( __builtin_cpu_supports("ssse3") ) {
+		size_t done = encode_base64_ssse3(in, in_bytes, out);
+		in       += done;
+		in_bytes -= done;
+		out      += done/3*4;
+	}
+	#endif
+
+	while( in_bytes >= 3 ) {
+		uint32_t v = (in[0]<<16) | (in[1]<<8) | in[2];
+		out[0] = s_base64_chars[(v>>18)&0x3F];
+		out[1] = s_base64_chars[(v>>12)&0x3F];
+		out[2] = s_base64_chars[(v>> 6)&0x3F];
+		out[3] = s_base64_chars[ v     &0x3F];
+		in       += 3;
+		in_bytes -= 3;
+		out      += 4;
+	}
+
+	if( in_bytes > 0 ) {
+		uint32_t v = (in[0]<<16) | (in_bytes>1? (in[1]<<8) : 0);
+		out[0] = s_base64_chars[(v>>18)&0x3F];
+		out[1] = s_base64_chars[(v>>12)&0x3F];
+		out[2] = in_bytes>1? s_base64_chars[(v>>6)&0x3F] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+
+	return out - start;
 }
 
 
@@ -326,13 +423,38 @@ char* mr_render_base64(const void* buf, size_t buf_bytes, int break_every, const
 		goto cleanup;
 	}
 
-	if( (ret = encode_base64((const char*)buf, buf_bytes))==NULL ) {
-		goto cleanup;
+	if( break_every>0 && break_chars && break_chars[0] ) {
+		/* encode to a temporary buffer and copy line by line; this is the same as mr_insert_breaks() but without touching every character */
+		size_t enc_bytes, break_chars_len = strlen(break_chars), pos, line_bytes;
+		char*  enc = NULL, *p;
+		if( (enc=malloc((buf_bytes+2)/3*4))==NULL
+		 || (ret=malloc((buf_bytes+2)/3*4 + ((buf_bytes+2)/3*4/break_every+1)*break_chars_len + 1))==NULL ) {
+			free(enc);
+			goto cleanup;
+		}
+		enc_bytes = mr_encode_base64_to((const uint8_t*)buf, buf_bytes, enc);
+		for( pos = 0, p = ret; pos < enc_bytes; pos += line_bytes ) {
+			line_bytes = enc_bytes-pos > (size_t)break_every? (size_t)break_every : enc_bytes-pos;
+			memcpy(p, enc+pos, line_bytes);
+			p += line_bytes;
+			if( pos+line_bytes < enc_bytes ) {
+				memcpy(p, break_chars, break_chars_len);
+				p += break_chars_len;
+			}
+		}
+		*p = 0;
+		free(enc);
+	}
+	else {
+		if( (ret=malloc((buf_bytes+2)/3*4 + 1))==NULL ) {
+			goto cleanup;
+		}
+		ret[mr_encode_base64_to((const uint8_t*)buf, buf_bytes, ret)] = 0;
 	}
 
 	#if 0
 	if( add_checksum == 1/*appended checksum*/ ) {
-		long checksum = crc_octets(buf, buf_bytes);
+		long checksum = mr_crc24(MR_CRC24_INIT, buf, buf_bytes);
 		uint8_t c[3];
 		c[0] = (uint8_t)((checksum >> 16)&0xFF);
 		c[1] = (uint8_t)((checksum >> 8)&0xFF);
@@ -345,14 +467,8 @@ char* mr_render_base64(const void* buf, size_t buf_bytes, int break_every, const
 	}
 	#endif
 
-	if( break_every>0 ) {
-		char* temp = ret;
-			ret = mr_insert_breaks(temp, break_every, break_chars);
-		free(temp);
-	}
-
 	if( add_checksum == 2/*checksum with break character*/ ) {
-		long checksum = crc_octets(buf, buf_bytes);
+		long checksum = mr_crc24(MR_CRC24_INIT, buf, buf_bytes);
 		uint8_t c[3];
 		c[0] = (uint8_t)((checksum >> 16)&0xFF);
 		c[1] = (uint8_t)((checksum >> 8)&0xFF);
@@ -65,6 +65,9 @@ int   mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* privat
 int   mrkey_load_self_public__ (mrkey_t*, const char* self_addr, mrsqlite3_t* sql);
 int   mrkey_load_self_private__(mrkey_t*, const char* self_addr, mrsqlite3_t* sql);
 
+#define MR_CRC24_INIT 0xB704CEL
+long   mr_crc24           (long crc, const void* buf, size_t bytes); /* start with MR_CRC24_INIT, the checksum is updated incrementally */
+size_t mr_encode_base64_to(const uint8_t* in, size_t in_bytes, char* out); /* out must have space for 4*ceil(in_bytes/3) characters, no terminating null is added */
 char* mr_render_base64   (const void* buf, size_t buf_bytes, int break_every, const char* break_chars, int add_checksum); /* the result must be freed */
 char* mrkey_render_base64(const mrkey_t* ths, int break_every, const char* break_chars, int add_checksum); /* the result must be freed */
 char* mrkey_render_asc   (const mrkey_t*, const char* add_header_lines); /* each header line must be terminated by \r\n, the result must be freed */
@@ -0,0 +1,469 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+/* Lock profiler, see mrlockprof.h.
+
+For every profiled lock currently held, a holder slot remembers the call site
+and the acquisition time; on unlocking, wait and hold times are added to the
+statistics of the call site and the longest holds are kept in a sorted list.
+All this is protected by a mutex of the profiler, so the profiler is meant for
+diagnostic builds only. */
+
+
+#include <sys/time.h>
+#include "mrmailbox_internal.h"
+#include "mrosnative.h"
+
+
+#ifdef MR_LOCK_PROFILER
+
+
+#define MR_LOCKPROF_HOLDERS  16   /* locks held at the same time */
+#define MR_LOCKPROF_SITES    256  /* distinct call sites, must be a power of 2 */
+#define MR_LOCKPROF_TOP      32   /* longest holds remembered */
+
+
+typedef struct mrlockholder_t
+{
+	pthread_mutex_t* m_mutex;       /* NULL for unused slots */
+	const char*      m_name;
+	const char*      m_label;
+	uint64_t         m_acquired_us;
+	int              m_thread;
+	int              m_reported;    /* set if the watchdog has logged the hold */
+} mrlockholder_t;
+
+
+typedef struct mrlocksite_t
+{
+	const char*      m_label;       /* string literal created by MR_LOCK_LABEL; label and name are compared by pointer */
+	const char*      m_name;
+	uint64_t         m_count;
+	uint64_t         m_wait_us;
+	uint64_t         m_max_wait_us;
+	uint64_t         m_hold_us;
+	uint64_t         m_max_hold_us;
+} mrlocksite_t;
+
+
+typedef struct mrlockhold_t
+{
+	const char*      m_label;
+	const char*      m_name;
+	uint64_t         m_hold_us;
+	int              m_thread;
+} mrlockhold_t;
+
+
+typedef struct mrlockprof_t
+{
+	pthread_mutex_t  m_mutex;       /* protects all members */
+	mrlockholder_t   m_holders[MR_LOCKPROF_HOLDERS];
+	mrlocksite_t     m_sites[MR_LOCKPROF_SITES];
+	int              m_sites_full;
+	mrlockhold_t     m_top[MR_LOCKPROF_TOP]; /* sorted, longest hold first */
+	int              m_top_cnt;
+
+	pthread_t        m_watchdog_thread;
+	pthread_cond_t   m_watchdog_cond;
+	int              m_watchdog_exit;
+} mrlockprof_t;
+
+
+static const char* basename_of(const char* label)
+{
+	const char* p = strrchr(label, '/');
+	return p? p+1 : label;
+}
+
+
+static mrlocksite_t* get_site__(mrlockprof_t* prof, const char* name, const char* label)
+{
+	uintptr_t i = (((uintptr_t)label ^ (uintptr_t)name) >> 3) & (MR_LOCKPROF_SITES-1), probe;
+
+	for( probe = 0; probe < MR_LOCKPROF_SITES; probe++, i = (i+1) & (MR_LOCKPROF_SITES-1) ) {
+		mrlocksite_t* site = &prof->m_sites[i];
+		if( site->m_label == label && site->m_name == name ) {
+			return site;
+		}
+		if( site->m_label == NULL ) {
+			site->m_label = label;
+			site->m_name  = name;
+			return site;
+		}
+	}
+
+	prof->m_sites_full = 1;
+	return NULL;
+}
+
+
+static void add_top_hold__(mrlockprof_t* prof, mrlockholder_t* holder, uint64_t hold_us)
+{
+	int i;
+
+	if( prof->m_top_cnt == MR_LOCKPROF_TOP && hold_us <= prof->m_top[MR_LOCKPROF_TOP-1].m_hold_us ) {
+		return;
+	}
+
+	i = prof->m_top_cnt < MR_LOCKPROF_TOP? prof->m_top_cnt++ : MR_LOCKPROF_TOP-1;
+	for( ; i > 0 && prof->m_top[i-1].m_hold_us < hold_us; i-- ) {
+		prof->m_top[i] = prof->m_top[i-1];
+	}
+
+	prof->m_top[i].m_label   = holder->m_label;
+	prof->m_top[i].m_name    = holder->m_name;
+	prof->m_top[i].m_hold_us = hold_us;
+	prof->m_top[i].m_thread  = holder->m_thread;
+}
+
+
+/* the other profiled locks held by the given thread, as " (also holding x at y, ...)" */
+static void cat_thread_locks__(mrlockprof_t* prof, mrstrbuilder_t* ret, mrlockholder_t* holder)
+{
+	int i, cnt = 0;
+
+	for( i = 0; i < MR_LOCKPROF_HOLDERS; i++ ) {
+		mrlockholder_t* other = &prof->m_holders[i];
+		if( other != holder && other->m_mutex && other->m_thread == holder->m_thread ) {
+			mrstrbuilder_catf(ret, "%s%s at %s", cnt++? ", " : " (also holding ", other->m_name, basename_of(other->m_label));
+		}
+	}
+
+	if( cnt ) {
+		mrstrbuilder_cat(ret, ")");
+	}
+}
+
+
+void mrlockprof_lock(mrmailbox_t* mailbox, pthread_mutex_t* mutex, const char* name, const char* label)
+{
+	mrlockprof_t*   prof = mailbox? mailbox->m_lockprof : NULL;
+	uint64_t        start_us, acquired_us;
+	mrlocksite_t*   site;
+	int             i;
+
+	if( prof == NULL ) {
+		pthread_mutex_lock(mutex);
+		return;
+	}
+
+	start_us = mrmetrics_now_us();
+	pthread_mutex_lock(mutex);
+	acquired_us = mrmetrics_now_us();
+
+	pthread_mutex_lock(&prof->m_mutex);
+
+		for( i = 0; i < MR_LOCKPROF_HOLDERS; i++ ) {
+			mrlockholder_t* holder = &prof->m_holders[i];
+			if( holder->m_mutex == NULL ) {
+				holder->m_mutex       = mutex;
+				holder->m_name        = name;
+				holder->m_label       = label;
+				holder->m_acquired_us = acquired_us;
+				holder->m_thread      = mrmailbox_get_thread_index();
+				holder->m_reported    = 0;
+				break;
+			}
+		}
+
+		if( (site=get_site__(prof, name, label)) != NULL ) {
+			site->m_count++;
+			site->m_wait_us += acquired_us-start_us;
+			if( acquired_us-start_us > site->m_max_wait_us ) {
+				site->m_max_wait_us = acquired_us-start_us;
+			}
+		}
+
+	pthread_mutex_unlock(&prof->m_mutex);
+}
+
+
+void mrlockprof_unlock(mrmailbox_t* mailbox, pthread_mutex_t* mutex)
+{
+	mrlockprof_t*   prof = mailbox? mailbox->m_lockprof : NULL;
+	uint64_t        hold_us = 0;
+	const char*     name = NULL;
+	const char*     label = NULL;
+	int             i, reported = 0;
+
+	if( prof == NULL ) {
+		pthread_mutex_unlock(mutex);
+		return;
+	}
+
+	pthread_mutex_lock(&prof->m_mutex);
+
+		for( i = 0; i < MR_LOCKPROF_HOLDERS; i++ ) {
+			mrlockholder_t* holder = &prof->m_holders[i];
+			if( holder->m_mutex == mutex ) {
+				mrlocksite_t* site;
+				hold_us  = mrmetrics_now_us() - holder->m_acquired_us;
+				name     = holder->m_name;
+				label    = holder->m_label;
+				reported = holder->m_reported;
+				if( (site=get_site__(prof, holder->m_name, holder->m_label)) != NULL ) {
+					site->m_hold_us += hold_us;
+					if( hold_us > site->m_max_hold_us ) {
+						site->m_max_hold_us = hold_us;
+					}
+				}
+				add_top_hold__(prof, holder, hold_us);
+				holder->m_mutex = NULL;
+				break;
+			}
+		}
+
+	pthread_mutex_unlock(&prof->m_mutex);
+
+	pthread_mutex_unlock(mutex);
+
+	if( reported ) { /* log only after unlocking, the logging may use the profiled locks */
+		mrmailbox_log_info(mailbox, 0, "Lock %s released after %i ms at %s.", name, (int)(hold_us/1000), basename_of(label));
+	}
+}
+
+
+static void* watchdog_thread_entry_point(void* entry_arg)
+{
+	mrmailbox_t*    mailbox = (mrmailbox_t*)entry_arg;
+	mrlockprof_t*   prof = mailbox->m_lockprof;
+	int             interval_ms = MR_LOCK_WATCHDOG_MS/4 > 10? MR_LOCK_WATCHDOG_MS/4 : 10;
+	carray*         msgs = carray_new(4);
+	int             i;
+
+	mrosnative_setup_thread(mailbox);
+
+	pthread_mutex_lock(&prof->m_mutex);
+
+		while( !prof->m_watchdog_exit )
+		{
+			struct timespec timeToWait;
+			uint64_t        now = mrmetrics_now_us(), due;
+			struct timeval  tv;
+
+			for( i = 0; i < MR_LOCKPROF_HOLDERS; i++ ) {
+				mrlockholder_t* holder = &prof->m_holders[i];
+				if( holder->m_mutex && !holder->m_reported && now - holder->m_acquired_us > MR_LOCK_WATCHDOG_MS*1000ULL ) {
+					mrstrbuilder_t msg;
+					mrstrbuilder_init(&msg, 0);
+					mrstrbuilder_catf(&msg, "Lock %s held for %i ms at %s by thread #%i", holder->m_name,
+						(int)((now - holder->m_acquired_us)/1000), basename_of(holder->m_label), holder->m_thread);
+					cat_thread_locks__(prof, &msg, holder);
+					mrstrbuilder_cat(&msg, ".");
+					carray_add(msgs, msg.m_buf, NULL);
+					holder->m_reported = 1;
+				}
+			}
+
+			if( carray_count(msgs) ) {
+				pthread_mutex_unlock(&prof->m_mutex); /* log without holding our mutex, the logging may use profiled locks */
+					for( i = 0; i < (int)carray_count(msgs); i++ ) {
+						mrmailbox_log_warning(mailbox, 0, "%s", (char*)carray_get(msgs, i));
+						free(carray_get(msgs, i));
+					}
+					carray_set_size(msgs, 0);
+				pthread_mutex_lock(&prof->m_mutex);
+				continue;
+			}
+
+			gettimeofday(&tv, NULL);
+			due = (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000 + interval_ms;
+			timeToWait.tv_sec  = due/1000;
+			timeToWait.tv_nsec = (due%1000)*1000000;
+			pthread_cond_timedwait(&prof->m_watchdog_cond, &prof->m_mutex, &timeToWait);
+		}
+
+	pthread_mutex_unlock(&prof->m_mutex);
+
+	carray_free(msgs);
+	mrosnative_unsetup_thread(mailbox);
+	return NULL;
+}
+
+
+void mrmailbox_init_lockprof(mrmailbox_t* mailbox)
+{
+	mrlockprof_t* prof = NULL;
+
+	if( mailbox == NULL || mailbox->m_lockprof ) {
+		return;
+	}
+
+	if( (prof=calloc(1, sizeof(mrlockprof_t)))==NULL ) {
+		exit(55); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	pthread_mutex_init(&prof->m_mutex, NULL);
+	pthread_cond_init(&prof->m_watchdog_cond, NULL);
+
+	mailbox->m_lockprof = prof;
+
+	pthread_create(&prof->m_watchdog_thread, NULL, watchdog_thread_entry_point, mailbox);
+}
+
+
+void mrmailbox_exit_lockprof(mrmailbox_t* mailbox)
+{
+	mrlockprof_t* prof = NULL;
+
+	if( mailbox == NULL || (prof=mailbox->m_lockprof)==NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&prof->m_mutex);
+		prof->m_watchdog_exit = 1;
+		pthread_cond_signal(&prof->m_watchdog_cond);
+	pthread_mutex_unlock(&prof->m_mutex);
+
+	pthread_join(prof->m_watchdog_thread, NULL);
+
+	mailbox->m_lockprof = NULL;
+
+	pthread_cond_destroy(&prof->m_watchdog_cond);
+	pthread_mutex_destroy(&prof->m_mutex);
+	free(prof);
+}
+
+
+static int compare_sites(const void* a, const void* b)
+{
+	const mrlocksite_t* s1 = (const mrlocksite_t*)a;
+	const mrlocksite_t* s2 = (const mrlocksite_t*)b;
+	if( s1->m_hold_us == s2->m_hold_us ) { return 0; }
+	return s1->m_hold_us > s2->m_hold_us? -1 : 1;
+}
+
+
+#else /* MR_LOCK_PROFILER */
+
+
+void mrmailbox_init_lockprof(mrmailbox_t* mailbox)
+{
+}
+
+
+void mrmailbox_exit_lockprof(mrmailbox_t* mailbox)
+{
+}
+
+
+#endif /* MR_LOCK_PROFILER */
+
+
+/**
+ * Get a report of the lock profiler.  The report lists the longest holds of
+ * the database lock and the IMAP locks together with their call sites, followed
+ * by the call sites sorted by the total hold time.
+ *
+ * The lock profiler is available only if the library is compiled with
+ * `MR_LOCK_PROFILER` defined (meson option `lock_profiler`); otherwise, the
+ * report just says so.
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @param top_n The maximum number of holds and call sites to list; if 0, a
+ *     default is used.
+ *
+ * @return Multi-line text, must be free()'d after usage.  Returns NULL on errors.
+ */
+char* mrmailbox_get_lock_report(mrmailbox_t* mailbox, int top_n)
+{
+	mrstrbuilder_t  ret;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+		return NULL;
+	}
+
+	mrstrbuilder_init(&ret, 0);
+
+	#ifdef MR_LOCK_PROFILER
+	{
+		mrlockprof_t*   prof = mailbox->m_lockprof;
+		mrlocksite_t*   sites = NULL;
+		int             i, sites_cnt = 0;
+		uint64_t        now = mrmetrics_now_us();
+
+		if( prof == NULL ) {
+			goto cleanup;
+		}
+
+		if( top_n <= 0 ) {
+			top_n = 10;
+		}
+
+		if( (sites=malloc(sizeof(mrlocksite_t)*MR_LOCKPROF_SITES))==NULL ) {
+			goto cleanup;
+		}
+
+		pthread_mutex_lock(&prof->m_mutex);
+
+			mrstrbuilder_cat(&ret, "Held locks:\n");
+			for( i = 0; i < MR_LOCKPROF_HOLDERS; i++ ) {
+				mrlockholder_t* holder = &prof->m_holders[i];
+				if( holder->m_mutex ) {
+					mrstrbuilder_catf(&ret, "%12.3f ms  %-12s %s, thread #%i\n", (double)(now-holder->m_acquired_us)/1000.0,
+						holder->m_name, basename_of(holder->m_label), holder->m_thread);
+				}
+			}
+
+			mrstrbuilder_cat(&ret, "\nLongest holds:\n");
+			for( i = 0; i < prof->m_top_cnt && i < top_n; i++ ) {
+				mrstrbuilder_catf(&ret, "%12.3f ms  %-12s %s, thread #%i\n", (double)prof->m_top[i].m_hold_us/1000.0,
+					prof->m_top[i].m_name, basename_of(prof->m_top[i].m_label), prof->m_top[i].m_thread);
+			}
+
+			for( i = 0; i < MR_LOCKPROF_SITES; i++ ) {
+				if( prof->m_sites[i].m_label ) {
+					sites[sites_cnt++] = prof->m_sites[i];
+				}
+			}
+
+			if( prof->m_sites_full ) {
+				mrstrbuilder_cat(&ret, "\nToo many call sites, some are not recorded.\n");
+			}
+
+		pthread_mutex_unlock(&prof->m_mutex);
+
+		qsort(sites, sites_cnt, sizeof(mrlocksite_t), compare_sites);
+
+		mrstrbuilder_cat(&ret, "\nCall sites by total hold time:\n");
+		mrstrbuilder_cat(&ret, "       count    hold total ms   hold max ms   wait total ms   wait max ms  lock         site\n");
+		for( i = 0; i < sites_cnt && i < top_n; i++ ) {
+			mrstrbuilder_catf(&ret, "%12lu %16.3f %13.3f %15.3f %13.3f  %-12s %s\n", (unsigned long)sites[i].m_count,
+				(double)sites[i].m_hold_us/1000.0, (double)sites[i].m_max_hold_us/1000.0,
+				(double)sites[i].m_wait_us/1000.0, (double)sites[i].m_max_wait_us/1000.0,
+				sites[i].m_name, basename_of(sites[i].m_label));
+		}
+
+	cleanup:
+		free(sites);
+	}
+	#else
+		mrstrbuilder_cat(&ret, "The lock profiler is not compiled in, build with MR_LOCK_PROFILER defined, eg. using `meson configure -Dlock_profiler=true`.\n");
+	#endif
+
+	return ret.m_buf;
+}
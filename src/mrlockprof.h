@@ -0,0 +1,73 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+#ifndef __MRLOCKPROF_H__
+#define __MRLOCKPROF_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+/* Lock profiler, only compiled in if MR_LOCK_PROFILER is defined (meson option
+`lock_profiler`).  The profiled locks are locked and unlocked using
+MR_LOCK_MUTEX() and MR_UNLOCK_MUTEX(); in normal builds, these macros are
+plain pthread calls.  In profiling builds, the call site, the wait time and the
+hold time is recorded and a watchdog thread logs locks held for longer than
+MR_LOCK_WATCHDOG_MS milliseconds.  The report is returned by
+mrmailbox_get_lock_report(). */
+
+
+#define MR_LOCK_STR_(a)   #a
+#define MR_LOCK_STR(a)    MR_LOCK_STR_(a)
+#define MR_LOCK_LABEL     __FILE__ ":" MR_LOCK_STR(__LINE__)
+
+#ifndef MR_LOCK_WATCHDOG_MS
+#define MR_LOCK_WATCHDOG_MS 500
+#endif
+
+
+#ifdef MR_LOCK_PROFILER
+
+#define MR_LOCK_MUTEX(mailbox, mutex, name) mrlockprof_lock((mailbox), (mutex), (name), MR_LOCK_LABEL)
+#define MR_UNLOCK_MUTEX(mailbox, mutex)     mrlockprof_unlock((mailbox), (mutex))
+
+void    mrlockprof_lock         (mrmailbox_t*, pthread_mutex_t*, const char* name, const char* label);
+void    mrlockprof_unlock       (mrmailbox_t*, pthread_mutex_t*);
+
+#else
+
+#define MR_LOCK_MUTEX(mailbox, mutex, name) pthread_mutex_lock((mutex))
+#define MR_UNLOCK_MUTEX(mailbox, mutex)     pthread_mutex_unlock((mutex))
+
+#endif
+
+void    mrmailbox_init_lockprof (mrmailbox_t*);
+void    mrmailbox_exit_lockprof (mrmailbox_t*);
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRLOCKPROF_H__ */
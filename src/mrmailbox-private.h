@@ -55,6 +55,12 @@ struct _mrmailbox
 	pthread_mutex_t  m_job_condmutex;         /**< Internal */
 	int              m_job_condflag;          /**< Internal */
 	int              m_job_do_exit;           /**< Internal */
+	int              m_job_running;           /**< Internal. Engine mode: set while the job task runs, protected by m_job_condmutex */
+	int              m_job_rerun;             /**< Internal. Engine mode: jobs were added while the job task runs */
+	mrenginetimer_t  m_job_timer;             /**< Internal. Engine mode: runs the job task instead of signalling m_job_cond */
+	mrengineowner_t  m_job_owner;             /**< Internal */
+
+	struct mrengine_t* m_engine;              /**< Internal. The engine given to mrmailbox_new_with_engine() or NULL if the mailbox uses its own threads */
 
 	mrmailboxcb_t    m_cb;                    /**< Internal */
 
@@ -67,13 +73,35 @@ struct _mrmailbox
 
 	int              m_e2ee_enabled;          /**< Internal */
 
-	#define          MR_LOG_RINGBUF_SIZE 200
-	pthread_mutex_t  m_log_ringbuf_critical;  /**< Internal */
-	char*            m_log_ringbuf[MR_LOG_RINGBUF_SIZE];
-	                                          /**< Internal */
-	time_t           m_log_ringbuf_times[MR_LOG_RINGBUF_SIZE];
-	                                          /**< Internal */
-	int              m_log_ringbuf_pos;       /**< Internal. The oldest position resp. the position that is overwritten next */
+	pthread_t        m_keygen_thread;         /**< Internal */
+	pthread_cond_t   m_keygen_cond;           /**< Internal, signalled when m_keygen_running is reset */
+	pthread_mutex_t  m_keygen_condmutex;      /**< Internal */
+	int              m_keygen_running;        /**< Internal, 1 while m_keygen_thread generates the keypair */
+	int              m_keygen_joinable;       /**< Internal */
+	char*            m_keygen_addr;           /**< Internal, the address the keypair is generated for */
+
+	int              m_log_level;             /**< Internal. Log events below this event are dropped before formatting, see mrmailbox_set_log_level() */
+	int              m_log_id;                /**< Internal. Identifies the log lines of this mailbox in the per-thread rings, see mrmailbox_log.c */
+
+	#define          MR_CONTACT_CACHE_MAX     2000
+	mrhash_t         m_contact_cache_by_addr; /**< Internal. Known contacts by address, case-insensitive; protected by mrsqlite3_lock() */
+	mrhash_t         m_contact_cache_by_id;   /**< Internal. The same entries as in m_contact_cache_by_addr, by contact ID */
+
+	#define          MR_PEERSTATE_CACHE_MAX   500
+	mrhash_t         m_peerstate_cache;       /**< Internal. Recently used peerstates by address, see mrapeerstate.c; protected by mrsqlite3_lock() */
+	struct mrapeerstatecache_t* m_peerstate_lru_first; /**< Internal. The most recently used entry of m_peerstate_cache */
+	struct mrapeerstatecache_t* m_peerstate_lru_last;  /**< Internal. The least recently used entry of m_peerstate_cache */
+
+	struct mrparsepool_t* m_parsepool;       /**< Internal. Worker threads parsing fetched messages, see mrmailbox_queue_imf() */
+
+	struct mreventqueue_t* m_eventqueue;     /**< Internal. Events queued for the frontend, see mrmailbox_send_event() */
+
+	struct mrmetrics_t* m_metrics;           /**< Internal. Counters and histograms, see mrmailbox_get_metrics() */
+
+	struct mrlockprof_t* m_lockprof;         /**< Internal. Lock profiler, only used if compiled with MR_LOCK_PROFILER, see mrmailbox_get_lock_report() */
+
+	int                 m_tracing;           /**< Internal. Set if a trace is written, see MR_TRACE_BEGIN() */
+	struct mrtrace_t*   m_trace;             /**< Internal. The trace file, see mrmailbox_start_trace() */
 
 };
 
@@ -83,12 +111,39 @@ void            mrmailbox_log_error         (mrmailbox_t*, int code, const char*
 void            mrmailbox_log_error_if      (int* condition, mrmailbox_t*, int code, const char* msg, ...);
 void            mrmailbox_log_warning       (mrmailbox_t*, int code, const char* msg, ...);
 void            mrmailbox_log_info          (mrmailbox_t*, int code, const char* msg, ...);
+void            mrmailbox_init_log          (mrmailbox_t*);
+char*           mrmailbox_get_log_excerpt   (mrmailbox_t*, int max_lines);
+
+/* the level is checked before the arguments are evaluated and formatted; define MR_NO_INFO_LOG to compile out info logs */
+#define         MR_LOG_ENABLED(mailbox, event) ((mailbox)!=NULL && (event) >= (mailbox)->m_log_level)
+#define         mrmailbox_log_warning(mailbox, ...) (MR_LOG_ENABLED((mailbox), MR_EVENT_WARNING)? mrmailbox_log_warning((mailbox), __VA_ARGS__) : (void)0)
+#ifdef MR_NO_INFO_LOG
+#define         mrmailbox_log_info(mailbox, ...)    (0? mrmailbox_log_info((mailbox), __VA_ARGS__) : (void)0)
+#else
+#define         mrmailbox_log_info(mailbox, ...)    (MR_LOG_ENABLED((mailbox), MR_EVENT_INFO)? mrmailbox_log_info((mailbox), __VA_ARGS__) : (void)0)
+#endif
+
+
+/* events */
+void            mrmailbox_send_event        (mrmailbox_t*, int event, uintptr_t data1, uintptr_t data2);
+void            mrmailbox_init_event_queue  (mrmailbox_t*);
+void            mrmailbox_exit_event_queue  (mrmailbox_t*);
+int             mrmailbox_get_event_queue_cnt(mrmailbox_t*);
 
 
 /* misc.*/
 void            mrmailbox_receive_imf                             (mrmailbox_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+void            mrmailbox_queue_imf                               (mrmailbox_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+void            mrmailbox_flush_imf_queue                         (mrmailbox_t*);
+int             mrmailbox_precheck_imf                            (mrmailbox_t*, const char* imf_header_not_terminated, size_t imf_header_bytes);
+void            mrmailbox_init_imf_queue                          (mrmailbox_t*);
+void            mrmailbox_exit_imf_queue                          (mrmailbox_t*);
+struct mrparsepool_t* mrmailbox_new_bulk_imf_queue                (mrmailbox_t*);
+void            mrmailbox_queue_bulk_imf                          (struct mrparsepool_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+void            mrmailbox_unref_bulk_imf_queue                    (struct mrparsepool_t*);
 uint32_t        mrmailbox_send_msg_object                         (mrmailbox_t*, uint32_t chat_id, mrmsg_t*);
 void            mrmailbox_connect_to_imap                         (mrmailbox_t*, mrjob_t*);
+void            mrmailbox_connect_to_smtp                         (mrmailbox_t*, mrjob_t*);
 void            mrmailbox_wake_lock                               (mrmailbox_t*);
 void            mrmailbox_wake_unlock                             (mrmailbox_t*);
 int             mrmailbox_get_archived_count__                    (mrmailbox_t*);
@@ -99,6 +154,7 @@ int             mrmailbox_is_contact_blocked__                    (mrmailbox_t*,
 int             mrmailbox_real_contact_exists__                   (mrmailbox_t*, uint32_t id);
 int             mrmailbox_contact_addr_equals__                   (mrmailbox_t*, uint32_t contact_id, const char* other_addr);
 void            mrmailbox_scaleup_contact_origin__                (mrmailbox_t*, uint32_t contact_id, int origin);
+void            mrmailbox_clear_contact_cache__                   (mrmailbox_t*);
 void            mrmailbox_unarchive_chat__                        (mrmailbox_t*, uint32_t chat_id);
 size_t          mrmailbox_get_chat_cnt__                          (mrmailbox_t*);
 void            mrmailbox_block_chat__                            (mrmailbox_t*, uint32_t chat_id, int new_blocking);
@@ -144,7 +200,9 @@ typedef struct mrmailbox_e2ee_helper_t {
 void            mrmailbox_e2ee_encrypt      (mrmailbox_t*, const clist* recipients_addr, int force_unencrypted, int e2ee_guaranteed, struct mailmime* in_out_message, mrmailbox_e2ee_helper_t*);
 int             mrmailbox_e2ee_decrypt      (mrmailbox_t*, struct mailmime* in_out_message, int* ret_validation_errors, int* ret_degrade_event); /* returns 1 if sth. was decrypted, 0 in other cases */
 void            mrmailbox_e2ee_thanks       (mrmailbox_e2ee_helper_t*); /* frees data referenced by "mailmime" but not freed by mailmime_free(). After calling mre2ee_unhelp(), in_out_message cannot be used any longer! */
-int             mrmailbox_ensure_secret_key_exists (mrmailbox_t*); /* makes sure, the private key exists, needed only for exporting keys and the case no message was sent before */
+void            mrmailbox_start_keygen_thread(mrmailbox_t*); /* generates the keypair in the background, if needed; must not be called from lock */
+void            mrmailbox_wait_for_keygen_thread(mrmailbox_t*); /* must not be called from lock */
+int             mrmailbox_ensure_secret_key_exists (mrmailbox_t*); /* makes sure, the private key exists, waits for mrmailbox_start_keygen_thread() if needed */
 char*           mrmailbox_create_setup_code (mrmailbox_t*);
 char*           mrmailbox_normalize_setup_code(mrmailbox_t*, const char* passphrase);
 char*           mrmailbox_render_setup_file (mrmailbox_t*, const char* passphrase);
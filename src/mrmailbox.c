@@ -64,7 +64,17 @@ static void cb_set_config(mrimap_t* imap, const char* key, const char* value)
 static void cb_receive_imf(mrimap_t* imap, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags)
 {
 	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
-	mrmailbox_receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+	mrmailbox_queue_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+}
+static void cb_flush_imf(mrimap_t* imap)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	mrmailbox_flush_imf_queue(mailbox);
+}
+static int cb_precheck_imf(mrimap_t* imap, const char* imf_header_not_terminated, size_t imf_header_bytes)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	return mrmailbox_precheck_imf(mailbox, imf_header_not_terminated, imf_header_bytes);
 }
 
 
@@ -98,6 +108,34 @@ static void cb_receive_imf(mrimap_t* imap, const char* imf_raw_not_terminated, s
  *     and the object must be freed using mrmailbox_unref() after usage.
  */
 mrmailbox_t* mrmailbox_new(mrmailboxcb_t cb, void* userdata, const char* os_name)
+{
+	return mrmailbox_new_with_engine(cb, userdata, os_name, NULL);
+}
+
+
+/**
+ * Create a new mailbox object that uses the threads of an engine.  Such a
+ * mailbox does not create its own job, IMAP-watch and heartbeat threads; the
+ * jobs, IMAP-IDLE and the parsing of fetched messages are done by the worker
+ * threads of the engine instead.  This allows running many mailboxes in one
+ * process, eg. on a server.  Apart from this, the object is the same as
+ * created by mrmailbox_new().
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param cb The callback function, see mrmailbox_new().
+ *
+ * @param userdata See mrmailbox_new().
+ *
+ * @param os_name See mrmailbox_new().
+ *
+ * @param engine The engine as created by mrengine_new().  The engine must not be
+ *     freed before all mailbox objects using it are freed.  If NULL, the
+ *     function behaves as mrmailbox_new().
+ *
+ * @return A mailbox object, must be freed using mrmailbox_unref() after usage.
+ */
+mrmailbox_t* mrmailbox_new_with_engine(mrmailboxcb_t cb, void* userdata, const char* os_name, mrengine_t* engine)
 {
 	mrmailbox_get_thread_index(); /* make sure, the main thread has the index #1, only for a nicer look of the logs */
 
@@ -107,15 +145,30 @@ mrmailbox_t* mrmailbox_new(mrmailboxcb_t cb, void* userdata, const char* os_name
 		exit(23); /* cannot allocate little memory, unrecoverable error */
 	}
 
-	pthread_mutex_init(&ths->m_log_ringbuf_critical, NULL);
+	mrmailbox_init_log(ths);
+
+	ths->m_metrics = mrmetrics_new();
+	mrmailbox_init_lockprof(ths);
+	mrmailbox_init_trace(ths);
 
 	pthread_mutex_init(&ths->m_wake_lock_critical, NULL);
 
+	pthread_mutex_init(&ths->m_keygen_condmutex, NULL);
+	pthread_cond_init(&ths->m_keygen_cond, NULL);
+
+	mrhash_init(&ths->m_contact_cache_by_addr, MRHASH_STRING, 1/*copy key*/);
+	mrhash_init(&ths->m_contact_cache_by_id, MRHASH_INT, 0);
+	mrhash_init(&ths->m_peerstate_cache, MRHASH_STRING, 1/*copy key*/);
+
+	mrmailbox_init_imf_queue(ths);
+	mrmailbox_init_event_queue(ths);
+
 	ths->m_magic    = MR_MAILBOX_MAGIC;
+	ths->m_engine   = engine;
 	ths->m_sql      = mrsqlite3_new(ths);
 	ths->m_cb       = cb? cb : cb_dummy;
 	ths->m_userdata = userdata;
-	ths->m_imap     = mrimap_new(cb_get_config, cb_set_config, cb_receive_imf, (void*)ths, ths);
+	ths->m_imap     = mrimap_new(cb_get_config, cb_set_config, cb_receive_imf, cb_flush_imf, cb_precheck_imf, (void*)ths, ths);
 	ths->m_smtp     = mrsmtp_new(ths);
 	ths->m_os_name  = strdup_keep_null(os_name);
 
@@ -161,6 +214,8 @@ void mrmailbox_unref(mrmailbox_t* mailbox)
 		return;
 	}
 
+	mrmailbox_wait_for_keygen_thread(mailbox);
+
 	mrpgp_exit(mailbox);
 
 	mrjob_exit_thread(mailbox);
@@ -169,17 +224,25 @@ void mrmailbox_unref(mrmailbox_t* mailbox)
 		mrmailbox_close(mailbox);
 	}
 
+	mrmailbox_exit_event_queue(mailbox); /* deliver pending events while the objects still exist */
+
 	mrimap_unref(mailbox->m_imap);
+	mrmailbox_exit_imf_queue(mailbox);
 	mrsmtp_unref(mailbox->m_smtp);
 	mrsqlite3_unref(mailbox->m_sql);
 	pthread_mutex_destroy(&mailbox->m_wake_lock_critical);
 
-	pthread_mutex_destroy(&mailbox->m_log_ringbuf_critical);
-	for( int i = 0; i < MR_LOG_RINGBUF_SIZE; i++ ) {
-		free(mailbox->m_log_ringbuf[i]);
-	}
+	pthread_cond_destroy(&mailbox->m_keygen_cond);
+	pthread_mutex_destroy(&mailbox->m_keygen_condmutex);
+	free(mailbox->m_keygen_addr);
+
+	mrmailbox_clear_contact_cache__(mailbox);
+	mrapeerstate_clear_cache__(mailbox);
 
 	free(mailbox->m_os_name);
+	mrmailbox_exit_trace(mailbox);
+	mrmailbox_exit_lockprof(mailbox);
+	mrmetrics_unref(mailbox->m_metrics);
 	mailbox->m_magic = 0;
 	free(mailbox);
 
@@ -282,6 +345,10 @@ cleanup:
 
 	if( db_locked ) { mrsqlite3_unlock(mailbox->m_sql); }
 
+	if( success ) {
+		mrmailbox_start_keygen_thread(mailbox); /* does nothing if not configured or if there is already a keypair */
+	}
+
 	return success;
 }
 
@@ -304,12 +371,18 @@ void mrmailbox_close(mrmailbox_t* mailbox)
 	mrimap_disconnect(mailbox->m_imap);
 	mrsmtp_disconnect(mailbox->m_smtp);
 
+	mrmailbox_flush_imf_queue(mailbox); /* the workers use m_blobdir, so the queue must be empty before m_blobdir is freed */
+	mrmailbox_wait_for_keygen_thread(mailbox);
+
 	mrsqlite3_lock(mailbox->m_sql);
 
 		if( mrsqlite3_is_open(mailbox->m_sql) ) {
 			mrsqlite3_close__(mailbox->m_sql);
 		}
 
+		mrmailbox_clear_contact_cache__(mailbox);
+		mrapeerstate_clear_cache__(mailbox);
+
 		free(mailbox->m_dbfile);
 		mailbox->m_dbfile = NULL;
 
@@ -379,6 +452,14 @@ char* mrmailbox_get_blobdir(mrmailbox_t* mailbox)
  * - displayname  = Own name to use when sending messages.  MUAs are allowed to spread this way eg. using CC, defaults to empty
  * - selfstatus   = Own status to display eg. in email footers, defaults to a standard text
  * - e2ee_enabled = 0=no e2ee, 1=prefer encryption (default)
+ * - smtp_preconnect = 1=connect to the SMTP-server when a draft is saved, so that sending is faster (default), 0=connect only when sending
+ * - chat_only    = 0=download all messages (default),
+ *                  1=check the headers of new messages first and download only messages that are sent by a messenger,
+ *                  that reply to known messages or that are sent by known contacts; other messages are left untouched on the server
+ *                  and will not be downloaded later.  Useful for mailboxes shared with classic email.
+ * - gossip_recent_days = 0=gossip the keys of all members in encrypted group messages (default),
+ *                  >0=gossip only keys of members whose key has changed in the given number of days
+ *                  and gossip all keys only when members are added
  *
  * @memberof mrmailbox_t
  *
@@ -608,19 +689,9 @@ char* mrmailbox_get_info(mrmailbox_t* mailbox)
 	free(temp);
 
 	/* add log excerpt */
-	pthread_mutex_lock(&mailbox->m_log_ringbuf_critical); /*take care not to log here! */
-		for( int i = 0; i < MR_LOG_RINGBUF_SIZE; i++ ) {
-			int j = (mailbox->m_log_ringbuf_pos+i) % MR_LOG_RINGBUF_SIZE;
-			if( mailbox->m_log_ringbuf[j] ) {
-				struct tm wanted_struct;
-				memcpy(&wanted_struct, localtime(&mailbox->m_log_ringbuf_times[j]), sizeof(struct tm));
-				temp = mr_mprintf("\n%02i:%02i:%02i ", (int)wanted_struct.tm_hour, (int)wanted_struct.tm_min, (int)wanted_struct.tm_sec);
-					mrstrbuilder_cat(&ret, temp);
-					mrstrbuilder_cat(&ret, mailbox->m_log_ringbuf[j]);
-				free(temp);
-			}
-		}
-	pthread_mutex_unlock(&mailbox->m_log_ringbuf_critical);
+	temp = mrmailbox_get_log_excerpt(mailbox, 200);
+	mrstrbuilder_cat(&ret, temp);
+	free(temp);
 
 	/* free data */
 	mrloginparam_unref(l);
@@ -736,6 +807,31 @@ cleanup:
 }
 
 
+void mrmailbox_connect_to_smtp(mrmailbox_t* ths, mrjob_t* job)
+{
+	/* connect to SMTP in advance, eg. if the user starts typing a message; this is only a warm-up,
+	so we do not try over on errors, sending the message will connect again */
+	mrloginparam_t* param = NULL;
+	int             configured;
+
+	if( ths == NULL || ths->m_magic != MR_MAILBOX_MAGIC || mrsmtp_is_connected(ths->m_smtp) ) {
+		return;
+	}
+
+	param = mrloginparam_new();
+	mrsqlite3_lock(ths->m_sql);
+		configured = mrsqlite3_get_config_int__(ths->m_sql, "configured", 0);
+		mrloginparam_read__(param, ths->m_sql, "configured_" /*the trailing underscore is correct*/);
+	mrsqlite3_unlock(ths->m_sql);
+
+	if( configured ) {
+		mrsmtp_connect(ths->m_smtp, param);
+	}
+
+	mrloginparam_unref(param);
+}
+
+
 /**
  * Connect to the mailbox using the configured settings.  We connect using IMAP-IDLE or, if this is not possible,
  * a using pull algorithm.
@@ -1041,7 +1137,7 @@ cleanup:
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
 
 	if( send_event ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 	}
 
 	return chat_id;
@@ -1111,12 +1207,29 @@ cleanup:
 	mrmsg_unref(msg);
 	mrchat_unref(chat);
 	if( send_event ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 	}
 	return chat_id;
 }
 
 
+static int mrmailbox_get_media_cursor__(mrmailbox_t* mailbox, uint32_t msg_id, uint32_t* ret_chat_id, int* ret_type, int64_t* ret_timestamp)
+{
+	/* get the position of a message in msgs_index6; we do not use mrmsg_load_from_db__() as we do not need all the other fields */
+	sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_ctt_FROM_msgs_WHERE_id,
+		"SELECT chat_id, type, timestamp FROM msgs WHERE id=?;");
+	sqlite3_bind_int(stmt, 1, msg_id);
+	if( sqlite3_step(stmt) != SQLITE_ROW ) {
+		return 0;
+	}
+
+	if( ret_chat_id )   { *ret_chat_id   = sqlite3_column_int  (stmt, 0); }
+	if( ret_type )      { *ret_type      = sqlite3_column_int  (stmt, 1); }
+	if( ret_timestamp ) { *ret_timestamp = sqlite3_column_int64(stmt, 2); }
+	return 1;
+}
+
+
 static mrarray_t* mrmailbox_get_chat_media__(mrmailbox_t* mailbox, uint32_t chat_id, int msg_type, int or_msg_type)
 {
 	mrarray_t* ret = mrarray_new(mailbox, 100);
@@ -1169,11 +1282,116 @@ mrarray_t* mrmailbox_get_chat_media(mrmailbox_t* mailbox, uint32_t chat_id, int
 }
 
 
+/**
+ * Returns a page of message IDs of the given types in a chat.  Typically used
+ * to show a gallery that is loaded while scrolling; in contrast to
+ * mrmailbox_get_chat_media() only the requested part of the list is loaded
+ * from the database.  The result must be mrarray_unref()'d
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as returned from mrmailbox_new().
+ *
+ * @param chat_id The chat ID to get the messages with media from.
+ *
+ * @param msg_type Specify a message type to query here, one of the MR_MSG_* constats.
+ *
+ * @param or_msg_type Another message type to return, one of the MR_MSG_* constats.
+ *     The function will return both types then.  0 if you need only one.
+ *
+ * @param start_msg_id The page starts directly after (or before, see `dir`) this message,
+ *     the message itself is not returned.  Typically, this is the first or the
+ *     last message of the page shown before.  0 to start at the oldest
+ *     (dir=1) or at the newest (dir=-1) message.
+ *
+ * @param dir 1=get the messages following start_msg_id, -1=get the messages before start_msg_id.
+ *
+ * @param max_cnt The maximal number of message IDs to return.
+ *
+ * @return An array with up to max_cnt message IDs, always sorted from the oldest
+ *     to the newest message as mrmailbox_get_chat_media() does.
+ *     If there are no more messages in the given direction, the array is empty.
+ */
+mrarray_t* mrmailbox_get_chat_media_page(mrmailbox_t* mailbox, uint32_t chat_id, int msg_type, int or_msg_type, uint32_t start_msg_id, int dir, int max_cnt)
+{
+	mrarray_t*    ret = NULL;
+	int           locked = 0;
+	sqlite3_stmt* stmt;
+	int64_t       start_timestamp = dir>0? 0 : INT64_MAX;
+	int64_t       start_id = dir>0? 0 : INT64_MAX;
+	size_t        i, cnt;
+	uintptr_t     temp;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || dir == 0 || max_cnt <= 0 ) {
+		goto cleanup;
+	}
+
+	ret = mrarray_new(mailbox, max_cnt);
+
+	mrsqlite3_lock(mailbox->m_sql);
+	locked = 1;
+
+		if( start_msg_id )
+		{
+			if( !mrmailbox_get_media_cursor__(mailbox, start_msg_id, NULL, NULL, &start_timestamp) ) {
+				goto cleanup;
+			}
+			start_id = start_msg_id;
+		}
+
+		/* each part of the UNION is a range scan on msgs_index6 limited to max_cnt rows, so we never touch more than 2*max_cnt index entries;
+		if only one type is wanted, both parts are equal and UNION removes the duplicates */
+		if( dir > 0 ) {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_cttti_next,
+				"SELECT id, timestamp FROM (SELECT id, timestamp FROM msgs WHERE chat_id=?1 AND type=?2 AND timestamp>=?4 AND (timestamp>?4 OR id>?5) ORDER BY timestamp, id LIMIT ?6)"
+				" UNION "
+				"SELECT id, timestamp FROM (SELECT id, timestamp FROM msgs WHERE chat_id=?1 AND type=?3 AND timestamp>=?4 AND (timestamp>?4 OR id>?5) ORDER BY timestamp, id LIMIT ?6)"
+				" ORDER BY 2, 1 LIMIT ?6;");
+		}
+		else {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_cttti_prev,
+				"SELECT id, timestamp FROM (SELECT id, timestamp FROM msgs WHERE chat_id=?1 AND type=?2 AND timestamp<=?4 AND (timestamp<?4 OR id<?5) ORDER BY timestamp DESC, id DESC LIMIT ?6)"
+				" UNION "
+				"SELECT id, timestamp FROM (SELECT id, timestamp FROM msgs WHERE chat_id=?1 AND type=?3 AND timestamp<=?4 AND (timestamp<?4 OR id<?5) ORDER BY timestamp DESC, id DESC LIMIT ?6)"
+				" ORDER BY 2 DESC, 1 DESC LIMIT ?6;");
+		}
+		sqlite3_bind_int  (stmt, 1, chat_id);
+		sqlite3_bind_int  (stmt, 2, msg_type);
+		sqlite3_bind_int  (stmt, 3, or_msg_type>0? or_msg_type : msg_type);
+		sqlite3_bind_int64(stmt, 4, start_timestamp);
+		sqlite3_bind_int64(stmt, 5, start_id);
+		sqlite3_bind_int  (stmt, 6, max_cnt);
+		while( sqlite3_step(stmt) == SQLITE_ROW ) {
+			mrarray_add_id(ret, sqlite3_column_int(stmt, 0));
+		}
+
+	mrsqlite3_unlock(mailbox->m_sql);
+	locked = 0;
+
+	if( dir < 0 ) {
+		/* we've read backwards, however, the caller always gets the messages from the oldest to the newest */
+		cnt = mrarray_get_cnt(ret);
+		for( i = 0; i < cnt/2; i++ ) {
+			temp = ret->m_array[i];
+			ret->m_array[i] = ret->m_array[cnt-1-i];
+			ret->m_array[cnt-1-i] = temp;
+		}
+	}
+
+cleanup:
+	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
+	return ret;
+}
+
+
 /**
  * Get next/previous message of the same type.
  * Typically used to implement the "next" and "previous" buttons on a media
  * player playing eg. voice messages.
  *
+ * The neighbour is found by a single index lookup, so there is no need to
+ * worry about performance even in chats with lots of media.
+ *
  * @memberof mrmailbox_t
  *
  * @param mailbox The mailbox object as returned from mrmailbox_new().
@@ -1189,55 +1407,42 @@ mrarray_t* mrmailbox_get_chat_media(mrmailbox_t* mailbox, uint32_t chat_id, int
  */
 uint32_t mrmailbox_get_next_media(mrmailbox_t* mailbox, uint32_t curr_msg_id, int dir)
 {
-	uint32_t ret_msg_id = 0;
-	mrmsg_t* msg = mrmsg_new();
-	int      locked = 0;
-	mrarray_t* list = NULL;
-	int      i, cnt;
+	uint32_t      ret_msg_id = 0;
+	int           locked = 0;
+	uint32_t      chat_id = 0;
+	int           msg_type = 0;
+	int64_t       timestamp = 0;
+	sqlite3_stmt* stmt;
 
-	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || dir == 0 ) {
 		goto cleanup;
 	}
 
 	mrsqlite3_lock(mailbox->m_sql);
 	locked = 1;
 
-		if( !mrmsg_load_from_db__(msg, mailbox, curr_msg_id) ) {
+		if( !mrmailbox_get_media_cursor__(mailbox, curr_msg_id, &chat_id, &msg_type, &timestamp) ) {
 			goto cleanup;
 		}
 
-		if( (list=mrmailbox_get_chat_media__(mailbox, msg->m_chat_id, msg->m_type, 0))==NULL ) {
-			goto cleanup;
+		if( dir > 0 ) {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_ctt_next,
+				"SELECT id FROM msgs WHERE chat_id=?1 AND type=?2 AND timestamp>=?3 AND (timestamp>?3 OR id>?4) ORDER BY timestamp, id LIMIT 1;");
 		}
-
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
-
-	cnt = mrarray_get_cnt(list);
-	for( i = 0; i < cnt; i++ ) {
-		if( curr_msg_id == mrarray_get_id(list, i) )
-		{
-			if( dir > 0 ) {
-				/* get the next message from the current position */
-				if( i+1 < cnt ) {
-					ret_msg_id = mrarray_get_id(list, i+1);
-				}
-			}
-			else if( dir < 0 ) {
-				/* get the previous message from the current position */
-				if( i-1 >= 0 ) {
-					ret_msg_id = mrarray_get_id(list, i-1);
-				}
-			}
-			break;
+		else {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_ctt_prev,
+				"SELECT id FROM msgs WHERE chat_id=?1 AND type=?2 AND timestamp<=?3 AND (timestamp<?3 OR id<?4) ORDER BY timestamp DESC, id DESC LIMIT 1;");
+		}
+		sqlite3_bind_int  (stmt, 1, chat_id);
+		sqlite3_bind_int  (stmt, 2, msg_type);
+		sqlite3_bind_int64(stmt, 3, timestamp);
+		sqlite3_bind_int  (stmt, 4, curr_msg_id);
+		if( sqlite3_step(stmt) == SQLITE_ROW ) {
+			ret_msg_id = sqlite3_column_int(stmt, 0);
 		}
-	}
-
 
 cleanup:
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
-	mrarray_unref(list);
-	mrmsg_unref(msg);
 	return ret_msg_id;
 }
 
@@ -1632,9 +1837,16 @@ static void set_draft_int(mrmailbox_t* mailbox, mrchat_t* chat, uint32_t chat_id
 
 		sqlite3_step(stmt);
 
+		/* the user is typing a message; connect to SMTP in the background, so that sending does not wait for the connection */
+		if( msg && !mrsmtp_is_connected(mailbox->m_smtp)
+		 && mrsqlite3_get_config_int__(mailbox->m_sql, "smtp_preconnect", 1) ) {
+			mrjob_kill_action__(mailbox, MRJ_CONNECT_TO_SMTP);
+			mrjob_add__(mailbox, MRJ_CONNECT_TO_SMTP, 0, NULL, MR_AT_ONCE);
+		}
+
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 
 cleanup:
 	mrchat_unref(chat_to_delete);
@@ -1949,7 +2161,7 @@ void mrmailbox_archive_chat(mrmailbox_t* mailbox, uint32_t chat_id, int archive)
 		sqlite3_finalize(stmt);
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 }
 
 
@@ -2037,7 +2249,7 @@ void mrmailbox_delete_chat(mrmailbox_t* mailbox, uint32_t chat_id)
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 
 cleanup:
 	if( pending_transaction ) { mrsqlite3_rollback__(mailbox->m_sql); }
@@ -2104,7 +2316,7 @@ static void mark_as_error(mrmailbox_t* mailbox, mrmsg_t* msg)
 	mrsqlite3_lock(mailbox->m_sql);
 		mrmailbox_update_msg_state__(mailbox, msg->m_id, MR_STATE_OUT_ERROR);
 	mrsqlite3_unlock(mailbox->m_sql);
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, msg->m_chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, msg->m_chat_id, 0);
 }
 
 
@@ -2170,15 +2382,10 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 
 		/* debug print? */
 		if( mrsqlite3_get_config_int__(mailbox->m_sql, "save_eml", 0) ) {
-			char* emlname = mr_mprintf("%s/to-smtp-%i.eml", mailbox->m_blobdir, (int)mimefactory.m_msg->m_id);
-			FILE* emlfileob = fopen(emlname, "w");
-			if( emlfileob ) {
-				if( mimefactory.m_out ) {
-					fwrite(mimefactory.m_out->str, 1, mimefactory.m_out->len, emlfileob);
-				}
-				fclose(emlfileob);
-			}
-			free(emlname);
+			char* desired_name = mr_mprintf("to-smtp-%i.eml", (int)mimefactory.m_msg->m_id);
+			free(mr_create_fine_file(mailbox->m_blobdir, desired_name,
+				mimefactory.m_out? mimefactory.m_out->str : NULL, mimefactory.m_out? mimefactory.m_out->len : 0, mailbox));
+			free(desired_name);
 		}
 
 		mrmailbox_update_msg_state__(mailbox, mimefactory.m_msg->m_id, MR_STATE_OUT_DELIVERED);
@@ -2199,7 +2406,7 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 	mrsqlite3_commit__(mailbox->m_sql);
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSG_DELIVERED, mimefactory.m_msg->m_chat_id, mimefactory.m_msg->m_id);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSG_DELIVERED, mimefactory.m_msg->m_chat_id, mimefactory.m_msg->m_id);
 
 cleanup:
 	mrmimefactory_empty(&mimefactory);
@@ -2495,7 +2702,7 @@ uint32_t mrmailbox_send_msg_object(mrmailbox_t* mailbox, uint32_t chat_id, mrmsg
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
 
 cleanup:
 	if( transaction_pending ) { mrsqlite3_rollback__(mailbox->m_sql); }
@@ -2865,7 +3072,7 @@ uint32_t mrmailbox_add_device_msg(mrmailbox_t* mailbox, uint32_t chat_id, const
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg_id);
+	mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg_id);
 
 cleanup:
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
@@ -3003,7 +3210,7 @@ cleanup:
 	free(grpid);
 
 	if( chat_id ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 	}
 
 	return chat_id;
@@ -3073,9 +3280,9 @@ int mrmailbox_set_chat_name(mrmailbox_t* mailbox, uint32_t chat_id, const char*
 		msg->m_text = mrstock_str_repl_string2(MR_STR_MSGGRPNAME, chat->m_name, new_name);
 		mrparam_set_int(msg->m_param, MRP_CMD, MR_CMD_GROUPNAME_CHANGED);
 		msg->m_id = mrmailbox_send_msg_object(mailbox, chat_id, msg);
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
 	}
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 	success = 1;
 
@@ -3148,9 +3355,9 @@ int mrmailbox_set_chat_profile_image(mrmailbox_t* mailbox, uint32_t chat_id, con
 		msg->m_type = MR_MSG_TEXT;
 		msg->m_text = mrstock_str(new_image? MR_STR_MSGGRPIMGCHANGED : MR_STR_MSGGRPIMGDELETED);
 		msg->m_id = mrmailbox_send_msg_object(mailbox, chat_id, msg);
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
 	}
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 	success = 1;
 
@@ -3287,9 +3494,9 @@ int mrmailbox_add_contact_to_chat(mrmailbox_t* mailbox, uint32_t chat_id, uint32
 		mrparam_set_int(msg->m_param, MRP_CMD,       MR_CMD_MEMBER_ADDED_TO_GROUP);
 		mrparam_set    (msg->m_param, MRP_CMD_PARAM, contact->m_addr);
 		msg->m_id = mrmailbox_send_msg_object(mailbox, chat_id, msg);
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
 	}
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 	success = 1;
 
@@ -3366,7 +3573,7 @@ int mrmailbox_remove_contact_from_chat(mrmailbox_t* mailbox, uint32_t chat_id, u
 			mrparam_set_int(msg->m_param, MRP_CMD,       MR_CMD_MEMBER_REMOVED_FROM_GROUP);
 			mrparam_set    (msg->m_param, MRP_CMD_PARAM, contact->m_addr);
 			msg->m_id = mrmailbox_send_msg_object(mailbox, chat_id, msg);
-			mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
+			mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, msg->m_id);
 		}
 	}
 
@@ -3381,7 +3588,7 @@ int mrmailbox_remove_contact_from_chat(mrmailbox_t* mailbox, uint32_t chat_id, u
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 	success = 1;
 
@@ -3441,16 +3648,106 @@ size_t mrmailbox_get_real_contact_cnt__(mrmailbox_t* mailbox)
 }
 
 
+/* The contact cache holds the fields of contacts recently seen by
+mrmailbox_add_or_lookup_contact__(), so that receiving messages from known
+contacts does not require any database access.  The cache is protected by
+mrsqlite3_lock() and must be updated by all functions modifying the fields
+below in the contacts table. */
+typedef struct mrcontactcache_t
+{
+	uint32_t m_id;
+	char*    m_name;
+	char*    m_addr;
+	char*    m_authname;
+	int      m_origin;
+	int      m_blocked;
+} mrcontactcache_t;
+
+
+static void mrcontactcache_free(mrcontactcache_t* entry)
+{
+	if( entry == NULL ) {
+		return;
+	}
+
+	free(entry->m_name);
+	free(entry->m_addr);
+	free(entry->m_authname);
+	free(entry);
+}
+
+
+void mrmailbox_clear_contact_cache__(mrmailbox_t* mailbox)
+{
+	mrhashelem_t* elem;
+
+	if( mailbox == NULL ) {
+		return;
+	}
+
+	for( elem = mrhash_first(&mailbox->m_contact_cache_by_id); elem; elem = mrhash_next(elem) ) {
+		mrcontactcache_free((mrcontactcache_t*)mrhash_data(elem));
+	}
+
+	mrhash_clear(&mailbox->m_contact_cache_by_id);
+	mrhash_clear(&mailbox->m_contact_cache_by_addr);
+}
+
+
+static mrcontactcache_t* mrmailbox_lookup_contact_cache__(mrmailbox_t* mailbox, uint32_t contact_id)
+{
+	return (mrcontactcache_t*)mrhash_find(&mailbox->m_contact_cache_by_id, NULL, contact_id);
+}
+
+
+static void mrmailbox_uncache_contact__(mrmailbox_t* mailbox, uint32_t contact_id)
+{
+	mrcontactcache_t* entry = mrmailbox_lookup_contact_cache__(mailbox, contact_id);
+	if( entry ) {
+		mrhash_insert(&mailbox->m_contact_cache_by_addr, entry->m_addr, strlen(entry->m_addr), NULL);
+		mrhash_insert(&mailbox->m_contact_cache_by_id, NULL, contact_id, NULL);
+		mrcontactcache_free(entry);
+	}
+}
+
+
+static void mrmailbox_cache_contact__(mrmailbox_t* mailbox, uint32_t contact_id, const char* name, const char* addr, const char* authname, int origin, int blocked)
+{
+	mrcontactcache_t* entry;
+
+	mrmailbox_uncache_contact__(mailbox, contact_id);
+
+	if( mrhash_count(&mailbox->m_contact_cache_by_id) >= MR_CONTACT_CACHE_MAX ) {
+		mrmailbox_clear_contact_cache__(mailbox); /* simple, but sufficient: the cache is re-filled by the next messages */
+	}
+
+	if( (entry=calloc(1, sizeof(mrcontactcache_t)))==NULL ) {
+		return;
+	}
+
+	entry->m_id       = contact_id;
+	entry->m_name     = safe_strdup(name);
+	entry->m_addr     = safe_strdup(addr);
+	entry->m_authname = safe_strdup(authname);
+	entry->m_origin   = origin;
+	entry->m_blocked  = blocked;
+
+	mrhash_insert(&mailbox->m_contact_cache_by_addr, entry->m_addr, strlen(entry->m_addr), entry);
+	mrhash_insert(&mailbox->m_contact_cache_by_id, NULL, contact_id, entry);
+}
+
+
 uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
                                            const char*  name /*can be NULL, the caller may use mr_normalize_name() before*/,
                                            const char*  addr__,
                                            int          origin,
                                            int*         sth_modified )
 {
-	sqlite3_stmt* stmt;
-	uint32_t      row_id = 0;
-	int           dummy;
-	char*         addr = NULL;
+	sqlite3_stmt*     stmt;
+	uint32_t          row_id = 0;
+	int               dummy;
+	char*             addr = NULL;
+	mrcontactcache_t* cached = NULL;
 
 	if( sth_modified == NULL ) {
 		sth_modified = &dummy;
@@ -3473,20 +3770,40 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 	}
 
 	/* insert email-address to database or modify the record with the given email-address.
-	we treat all email-addresses case-insensitive. */
-	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_inao_FROM_contacts_a,
-		"SELECT id, name, addr, origin, authname FROM contacts WHERE addr=? COLLATE NOCASE;");
-	sqlite3_bind_text(stmt, 1, (const char*)addr, -1, SQLITE_STATIC);
-	if( sqlite3_step(stmt) == SQLITE_ROW )
+	we treat all email-addresses case-insensitive.
+	for known contacts, the fields are typically taken from the cache, which avoids any database access if nothing changes. */
+	stmt = NULL;
+	if( (cached=(mrcontactcache_t*)mrhash_find(&mailbox->m_contact_cache_by_addr, addr, strlen(addr))) == NULL )
 	{
-		const char  *row_name, *row_addr, *row_authname;
-		int         row_origin, update_addr = 0, update_name = 0, update_authname = 0;
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_inao_FROM_contacts_a,
+			"SELECT id, name, addr, origin, authname, blocked FROM contacts WHERE addr=? COLLATE NOCASE;");
+		sqlite3_bind_text(stmt, 1, (const char*)addr, -1, SQLITE_STATIC);
+		if( sqlite3_step(stmt) != SQLITE_ROW ) {
+			stmt = NULL;
+		}
+	}
 
-		row_id       = sqlite3_column_int(stmt, 0);
-		row_name     = (const char*)sqlite3_column_text(stmt, 1); if( row_name == NULL ) { row_name = ""; }
-		row_addr     = (const char*)sqlite3_column_text(stmt, 2); if( row_addr == NULL ) { row_addr = addr; }
-		row_origin   = sqlite3_column_int(stmt, 3);
-		row_authname = (const char*)sqlite3_column_text(stmt, 4); if( row_authname == NULL ) { row_authname = ""; }
+	if( cached || stmt )
+	{
+		const char  *row_name, *row_addr, *row_authname;
+		int         row_origin, row_blocked, update_addr = 0, update_name = 0, update_authname = 0;
+
+		if( cached ) {
+			row_id       = cached->m_id;
+			row_name     = cached->m_name;
+			row_addr     = cached->m_addr;
+			row_origin   = cached->m_origin;
+			row_authname = cached->m_authname;
+			row_blocked  = cached->m_blocked;
+		}
+		else {
+			row_id       = sqlite3_column_int(stmt, 0);
+			row_name     = (const char*)sqlite3_column_text(stmt, 1); if( row_name == NULL ) { row_name = ""; }
+			row_addr     = (const char*)sqlite3_column_text(stmt, 2); if( row_addr == NULL ) { row_addr = addr; }
+			row_origin   = sqlite3_column_int(stmt, 3);
+			row_authname = (const char*)sqlite3_column_text(stmt, 4); if( row_authname == NULL ) { row_authname = ""; }
+			row_blocked  = sqlite3_column_int(stmt, 5);
+		}
 
 		if( name && name[0] ) {
 			if( row_name && row_name[0] ) {
@@ -3509,14 +3826,25 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 
 		if( update_name || update_authname || update_addr || origin>row_origin )
 		{
+			/* the row_* pointers may point to the cache or to the statement; both are reused below, so make copies */
+			char* new_name     = safe_strdup(update_name?     name : row_name);
+			char* new_addr     = safe_strdup(update_addr?     addr : row_addr);
+			char* new_authname = safe_strdup(update_authname? name : row_authname);
+			int   new_origin   = origin>row_origin? origin : row_origin;
+
 			stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_contacts_nao_WHERE_i,
 				"UPDATE contacts SET name=?, addr=?, origin=?, authname=? WHERE id=?;");
-			sqlite3_bind_text(stmt, 1, update_name?       name   : row_name, -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 2, update_addr?       addr   : row_addr, -1, SQLITE_STATIC);
-			sqlite3_bind_int (stmt, 3, origin>row_origin? origin : row_origin);
-			sqlite3_bind_text(stmt, 4, update_authname?   name   : row_authname, -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 1, new_name,     -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2, new_addr,     -1, SQLITE_STATIC);
+			sqlite3_bind_int (stmt, 3, new_origin);
+			sqlite3_bind_text(stmt, 4, new_authname, -1, SQLITE_STATIC);
 			sqlite3_bind_int (stmt, 5, row_id);
-			sqlite3_step     (stmt);
+			if( sqlite3_step(stmt) == SQLITE_DONE ) {
+				mrmailbox_cache_contact__(mailbox, row_id, new_name, new_addr, new_authname, new_origin, row_blocked);
+			}
+			else {
+				mrmailbox_uncache_contact__(mailbox, row_id);
+			}
 
 			if( update_name )
 			{
@@ -3530,8 +3858,15 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 				sqlite3_step     (stmt);
 			}
 
+			free(new_name);
+			free(new_addr);
+			free(new_authname);
 			*sth_modified = 1;
 		}
+		else if( cached == NULL )
+		{
+			mrmailbox_cache_contact__(mailbox, row_id, row_name, row_addr, row_authname, row_origin, row_blocked);
+		}
 	}
 	else
 	{
@@ -3543,6 +3878,7 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 		if( sqlite3_step(stmt) == SQLITE_DONE )
 		{
 			row_id = sqlite3_last_insert_rowid(mailbox->m_sql->m_cobj);
+			mrmailbox_cache_contact__(mailbox, row_id, name, addr, "", origin, 0);
 			*sth_modified = 1;
 		}
 		else
@@ -3569,13 +3905,25 @@ void mrmailbox_scaleup_contact_origin__(mrmailbox_t* mailbox, uint32_t contact_i
 	sqlite3_bind_int(stmt, 2, contact_id);
 	sqlite3_bind_int(stmt, 3, origin);
 	sqlite3_step(stmt);
+
+	mrcontactcache_t* cached = mrmailbox_lookup_contact_cache__(mailbox, contact_id);
+	if( cached && cached->m_origin < origin ) {
+		cached->m_origin = origin;
+	}
 }
 
 
 int mrmailbox_is_contact_blocked__(mrmailbox_t* mailbox, uint32_t contact_id)
 {
 	int          is_blocked = 0;
-	mrcontact_t* contact = mrcontact_new(mailbox);
+	mrcontact_t* contact = NULL;
+
+	mrcontactcache_t* cached = mrmailbox_lookup_contact_cache__(mailbox, contact_id);
+	if( cached ) {
+		return cached->m_blocked? 1 : 0;
+	}
+
+	contact = mrcontact_new(mailbox);
 
 	if( mrcontact_load_from_db__(contact, mailbox->m_sql, contact_id) ) { /* we could optimize this by loading only the needed fields */
 		if( contact->m_blocked ) {
@@ -3592,10 +3940,21 @@ int mrmailbox_get_contact_origin__(mrmailbox_t* mailbox, uint32_t contact_id, in
 {
 	int          ret = 0;
 	int          dummy; if( ret_blocked==NULL ) { ret_blocked = &dummy; }
-	mrcontact_t* contact = mrcontact_new(mailbox);
+	mrcontact_t* contact = NULL;
 
 	*ret_blocked = 0;
 
+	mrcontactcache_t* cached = mrmailbox_lookup_contact_cache__(mailbox, contact_id);
+	if( cached ) {
+		if( cached->m_blocked ) {
+			*ret_blocked = 1;
+			return 0;
+		}
+		return cached->m_origin;
+	}
+
+	contact = mrcontact_new(mailbox);
+
 	if( !mrcontact_load_from_db__(contact, mailbox->m_sql, contact_id) ) { /* we could optimize this by loading only the needed fields */
 		goto cleanup;
 	}
@@ -3651,7 +4010,7 @@ uint32_t mrmailbox_create_contact(mrmailbox_t* mailbox, const char* name, const
 
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	mailbox->m_cb(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
 
 cleanup:
 	return contact_id;
@@ -4021,6 +4380,8 @@ void mrmailbox_block_contact(mrmailbox_t* mailbox, uint32_t contact_id, int new_
 					goto cleanup;
 				}
 
+				mrmailbox_uncache_contact__(mailbox, contact_id);
+
 				/* also (un)block all chats with _only_ this contact - we do not delete them to allow a non-destructive blocking->unblocking.
 				(Maybe, beside normal chats (type=100) we should also block group chats with only this user.
 				However, I'm not sure about this point; it may be confusing if the user wants to add other people;
@@ -4047,7 +4408,7 @@ void mrmailbox_block_contact(mrmailbox_t* mailbox, uint32_t contact_id, int new_
 	locked = 0;
 
 	if( send_event ) {
-		mailbox->m_cb(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
 	}
 
 cleanup:
@@ -4249,10 +4610,12 @@ int mrmailbox_delete_contact(mrmailbox_t* mailbox, uint32_t contact_id)
 			goto cleanup;
 		}
 
+		mrmailbox_uncache_contact__(mailbox, contact_id);
+
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	mailbox->m_cb(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CONTACTS_CHANGED, 0, 0);
 
 	success = 1;
 
@@ -4702,7 +5065,7 @@ cleanup:
 	if( created_db_entries ) {
 		size_t i, icnt = carray_count(created_db_entries);
 		for( i = 0; i < icnt; i += 2 ) {
-			mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
+			mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
 		}
 		carray_free(created_db_entries);
 	}
@@ -5066,7 +5429,7 @@ void mrmailbox_markseen_msgs(mrmailbox_t* mailbox, const uint32_t* msg_ids, int
 
 	/* the event is needed eg. to remove the deaddrop from the chatlist */
 	if( send_event ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0);
 	}
 
 cleanup:
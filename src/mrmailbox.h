@@ -172,6 +172,15 @@ extern "C" {
 typedef struct _mrmailbox mrmailbox_t;
 
 
+/**
+ * @class mrengine_t
+ *
+ * Worker threads and an event loop shared by several mailbox objects,
+ * see mrengine_new() and mrmailbox_new_with_engine().
+ */
+typedef struct mrengine_t mrengine_t;
+
+
 /**
  * Callback function that should be given to mrmailbox_new().
  *
@@ -194,9 +203,13 @@ typedef uintptr_t (*mrmailboxcb_t) (mrmailbox_t*, int event, uintptr_t data1, ui
 
 /* create/open/connect */
 mrmailbox_t*    mrmailbox_new               (mrmailboxcb_t, void* userdata, const char* os_name);
+mrmailbox_t*    mrmailbox_new_with_engine   (mrmailboxcb_t, void* userdata, const char* os_name, mrengine_t*);
 void            mrmailbox_unref             (mrmailbox_t*);
 void*           mrmailbox_get_userdata      (mrmailbox_t*);
 
+mrengine_t*     mrengine_new                (int threads);
+void            mrengine_unref              (mrengine_t*);
+
 int             mrmailbox_open              (mrmailbox_t*, const char* dbfile, const char* blobdir);
 void            mrmailbox_close             (mrmailbox_t*);
 int             mrmailbox_is_open           (const mrmailbox_t*);
@@ -216,6 +229,17 @@ void            mrmailbox_connect           (mrmailbox_t*);
 void            mrmailbox_disconnect        (mrmailbox_t*);
 
 char*           mrmailbox_get_info          (mrmailbox_t*);
+char*           mrmailbox_get_metrics       (mrmailbox_t*);
+char*           mrmailbox_get_lock_report   (mrmailbox_t*, int top_n);
+int             mrmailbox_start_trace       (mrmailbox_t*, const char* filename);
+void            mrmailbox_stop_trace        (mrmailbox_t*);
+
+#define         MR_EVENTS_SYNC              0
+#define         MR_EVENTS_DISPATCH          1
+#define         MR_EVENTS_PULL              2
+int             mrmailbox_set_event_mode    (mrmailbox_t*, int mode, int coalesce_ms);
+int             mrmailbox_get_next_event    (mrmailbox_t*, int timeout_ms, int* ret_event, uintptr_t* ret_data1, uintptr_t* ret_data2);
+void            mrmailbox_set_log_level     (mrmailbox_t*, int min_event);
 
 
 /* Handle chatlists */
@@ -245,6 +269,7 @@ int             mrmailbox_get_fresh_msg_count (mrmailbox_t*, uint32_t chat_id);
 mrarray_t*      mrmailbox_get_fresh_msgs    (mrmailbox_t*);
 void            mrmailbox_marknoticed_chat  (mrmailbox_t*, uint32_t chat_id);
 mrarray_t*      mrmailbox_get_chat_media    (mrmailbox_t*, uint32_t chat_id, int msg_type, int or_msg_type);
+mrarray_t*      mrmailbox_get_chat_media_page (mrmailbox_t*, uint32_t chat_id, int msg_type, int or_msg_type, uint32_t start_msg_id, int dir, int max_cnt);
 uint32_t        mrmailbox_get_next_media    (mrmailbox_t*, uint32_t curr_msg_id, int dir);
 
 void            mrmailbox_archive_chat      (mrmailbox_t*, uint32_t chat_id, int archive);
@@ -295,6 +320,7 @@ mrcontact_t*    mrmailbox_get_contact       (mrmailbox_t*, uint32_t contact_id);
 #define         MR_IMEX_IMPORT_SELF_KEYS      2 /* param1 is a directory where the keys are searched in and read from */
 #define         MR_IMEX_EXPORT_BACKUP        11 /* param1 is a directory where the backup is written to */
 #define         MR_IMEX_IMPORT_BACKUP        12 /* param1 is the file with the backup to import */
+#define         MR_IMEX_IMPORT_MAILS         21 /* param1 is an .eml file, a directory with .eml files, a maildir or an mbox file */
 #define         MR_BAK_PREFIX                "delta-chat"
 #define         MR_BAK_SUFFIX                "bak"
 int             mrmailbox_imex              (mrmailbox_t*, int what, const char* param1, const char* param2);
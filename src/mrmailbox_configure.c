@@ -356,6 +356,222 @@ cleanup:
 }
 
 
+/*******************************************************************************
+ * Parallel autoconfig and probing
+ ******************************************************************************/
+
+
+/* The autoconfig URLs are fetched at the same time, each in its own thread.
+The result is taken in the order the URLs were added, so a faster but less
+specific source does not win over a slower but more specific one; fetches still
+running when a result is taken are joined by autoconf_exit(). */
+
+
+#define AUTOCONF_MOZ    1
+#define AUTOCONF_OUTLK  2
+#define AUTOCONF_MAX    8
+
+
+typedef struct autoconf_task_t
+{
+	struct autoconf_t* m_ac;
+	int                m_type;
+	char*              m_url;
+	int                m_done;
+	mrloginparam_t*    m_result;
+	pthread_t          m_thread;
+	int                m_thread_running;
+} autoconf_task_t;
+
+
+typedef struct autoconf_t
+{
+	mrmailbox_t*       m_mailbox;
+	mrloginparam_t*    m_in;    /* an own copy with only m_addr set, the caller's parameters change while the fetches may still run */
+	pthread_mutex_t    m_mutex;
+	pthread_cond_t     m_cond;
+	int                m_task_cnt;
+	int                m_taken_cnt; /* tasks already examined by autoconf_get_result() */
+	autoconf_task_t    m_tasks[AUTOCONF_MAX];
+} autoconf_t;
+
+
+static void autoconf_init(autoconf_t* ac, mrmailbox_t* mailbox, const char* addr)
+{
+	memset(ac, 0, sizeof(autoconf_t));
+	ac->m_mailbox = mailbox;
+	ac->m_in = mrloginparam_new();
+	ac->m_in->m_addr = safe_strdup(addr);
+	pthread_mutex_init(&ac->m_mutex, NULL);
+	pthread_cond_init(&ac->m_cond, NULL);
+}
+
+
+static void autoconf_exit(autoconf_t* ac)
+{
+	int i;
+
+	for( i = 0; i < ac->m_task_cnt; i++ ) {
+		if( ac->m_tasks[i].m_thread_running ) {
+			pthread_join(ac->m_tasks[i].m_thread, NULL);
+		}
+		free(ac->m_tasks[i].m_url);
+		mrloginparam_unref(ac->m_tasks[i].m_result);
+	}
+
+	mrloginparam_unref(ac->m_in);
+	pthread_cond_destroy(&ac->m_cond);
+	pthread_mutex_destroy(&ac->m_mutex);
+}
+
+
+static void* autoconf_thread_entry_point(void* entry_arg)
+{
+	autoconf_task_t* task = (autoconf_task_t*)entry_arg;
+	autoconf_t*      ac = task->m_ac;
+	mrloginparam_t*  result = NULL;
+
+	if( !mr_shall_stop_ongoing ) {
+		result = task->m_type==AUTOCONF_OUTLK? outlk_autodiscover(ac->m_mailbox, task->m_url, ac->m_in)
+		                                     : moz_autoconfigure(ac->m_mailbox, task->m_url, ac->m_in);
+	}
+
+	pthread_mutex_lock(&ac->m_mutex);
+		task->m_result = result;
+		task->m_done   = 1;
+		pthread_cond_broadcast(&ac->m_cond);
+	pthread_mutex_unlock(&ac->m_mutex);
+
+	return NULL;
+}
+
+
+static void autoconf_add(autoconf_t* ac, int type, char* url /*will be free()'d*/)
+{
+	autoconf_task_t* task;
+
+	if( ac->m_task_cnt >= AUTOCONF_MAX ) {
+		free(url);
+		return;
+	}
+
+	task = &ac->m_tasks[ac->m_task_cnt++];
+	task->m_ac   = ac;
+	task->m_type = type;
+	task->m_url  = url;
+
+	if( pthread_create(&task->m_thread, NULL, autoconf_thread_entry_point, task) == 0 ) {
+		task->m_thread_running = 1;
+	}
+	else {
+		autoconf_thread_entry_point(task); /* cannot create a thread, fetch in this thread */
+	}
+}
+
+
+static mrloginparam_t* autoconf_get_result(autoconf_t* ac, int progress_start, int progress_end)
+{
+	mrloginparam_t* ret = NULL;
+	int             i, done_cnt, last_done_cnt = -1;
+	struct timespec abstime;
+
+	pthread_mutex_lock(&ac->m_mutex);
+
+		while( ac->m_taken_cnt < ac->m_task_cnt && !mr_shall_stop_ongoing )
+		{
+			autoconf_task_t* task = &ac->m_tasks[ac->m_taken_cnt];
+
+			if( task->m_done ) {
+				ac->m_taken_cnt++;
+				if( task->m_result ) {
+					ret = task->m_result;
+					task->m_result = NULL;
+					break;
+				}
+				continue;
+			}
+
+			for( i = 0, done_cnt = 0; i < ac->m_task_cnt; i++ ) {
+				done_cnt += ac->m_tasks[i].m_done;
+			}
+
+			if( done_cnt != last_done_cnt ) {
+				last_done_cnt = done_cnt;
+				pthread_mutex_unlock(&ac->m_mutex);
+					mrmailbox_send_event(ac->m_mailbox, MR_EVENT_CONFIGURE_PROGRESS, progress_start + (progress_end-progress_start)*done_cnt/ac->m_task_cnt, 0);
+				pthread_mutex_lock(&ac->m_mutex);
+				continue;
+			}
+
+			/* wake up at least every second to check mr_shall_stop_ongoing */
+			clock_gettime(CLOCK_REALTIME, &abstime);
+			abstime.tv_sec += 1;
+			pthread_cond_timedwait(&ac->m_cond, &ac->m_mutex, &abstime);
+		}
+
+	pthread_mutex_unlock(&ac->m_mutex);
+
+	return ret; /* may be NULL */
+}
+
+
+typedef struct smtp_probe_t
+{
+	mrsmtp_t*          m_smtp;
+	mrloginparam_t*    m_param;
+	int                m_connected;
+	pthread_t          m_thread;
+	int                m_thread_running;
+} smtp_probe_t;
+
+
+static void* smtp_probe_thread_entry_point(void* entry_arg)
+{
+	smtp_probe_t* probe = (smtp_probe_t*)entry_arg;
+	probe->m_connected = mrsmtp_connect(probe->m_smtp, probe->m_param);
+	return NULL;
+}
+
+
+static void smtp_probe_start(smtp_probe_t* probe)
+{
+	{ char* r = mrloginparam_get_readable(probe->m_param); mrmailbox_log_info(probe->m_smtp->m_mailbox, 0, "Trying: %s", r); free(r); }
+
+	if( pthread_create(&probe->m_thread, NULL, smtp_probe_thread_entry_point, probe) == 0 ) {
+		probe->m_thread_running = 1;
+	}
+	else {
+		smtp_probe_thread_entry_point(probe);
+	}
+}
+
+
+static void smtp_probe_join(smtp_probe_t* probe)
+{
+	if( probe->m_thread_running ) {
+		pthread_join(probe->m_thread, NULL);
+		probe->m_thread_running = 0;
+	}
+}
+
+
+static mrloginparam_t* copy_loginparam(const mrloginparam_t* src)
+{
+	mrloginparam_t* dst = mrloginparam_new();
+	dst->m_addr         = strdup_keep_null(src->m_addr);
+	dst->m_mail_server  = strdup_keep_null(src->m_mail_server);
+	dst->m_mail_user    = strdup_keep_null(src->m_mail_user);
+	dst->m_mail_pw      = strdup_keep_null(src->m_mail_pw);
+	dst->m_mail_port    =                  src->m_mail_port;
+	dst->m_send_server  = strdup_keep_null(src->m_send_server);
+	dst->m_send_user    = strdup_keep_null(src->m_send_user);
+	dst->m_send_pw      = strdup_keep_null(src->m_send_pw);
+	dst->m_send_port    =                  src->m_send_port;
+	dst->m_server_flags =                  src->m_server_flags;
+	return dst;
+}
+
+
 /*******************************************************************************
  * Main interface
  ******************************************************************************/
@@ -403,6 +619,13 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 	char*           param_addr_urlencoded = NULL;
 	mrloginparam_t* param_autoconfig = NULL;
 
+	autoconf_t      ac;
+	int             ac_initialized = 0;
+	smtp_probe_t    probe[2];
+	int             probe_cnt = 0;
+
+	memset(probe, 0, sizeof(probe));
+
 	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
 		return 0;
 	}
@@ -413,7 +636,7 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 
 	#define PROGRESS(p) \
 				if( mr_shall_stop_ongoing ) { goto cleanup; } \
-				mailbox->m_cb(mailbox, MR_EVENT_CONFIGURE_PROGRESS, (p), 0);
+				mrmailbox_send_event(mailbox, MR_EVENT_CONFIGURE_PROGRESS, (p), 0);
 
 	if( !mrsqlite3_is_open(mailbox->m_sql) ) {
 		mrmailbox_log_error(mailbox, 0, "Cannot configure, database not opened.");
@@ -494,40 +717,30 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 	/*&&param->m_send_pw      == NULL -- the password cannot be auto-configured and is no criterion for autoconfig or not */
 	 && param->m_server_flags == 0 )
 	{
-		/* A.  Search configurations from the domain used in the email-address */
+		/* A.  Search configurations from the domain used in the email-address; all URLs are fetched in parallel, the first URL with a result wins */
+		autoconf_init(&ac, mailbox, param->m_addr);
+		ac_initialized = 1;
+
 		for( i = 0; i <= 1; i++ ) {
-			if( param_autoconfig==NULL ) {
-				char* url = mr_mprintf("%s://autoconfig.%s/mail/config-v1.1.xml?emailaddress=%s", i==0?"https":"http", param_domain, param_addr_urlencoded); /* Thunderbird may or may not use SSL */
-				param_autoconfig = moz_autoconfigure(mailbox, url, param);
-				free(url);
-				PROGRESS(300+i*20)
-			}
+			autoconf_add(&ac, AUTOCONF_MOZ, mr_mprintf("%s://autoconfig.%s/mail/config-v1.1.xml?emailaddress=%s", i==0?"https":"http", param_domain, param_addr_urlencoded)); /* Thunderbird may or may not use SSL */
 		}
 
 		for( i = 0; i <= 1; i++ ) {
-			if( param_autoconfig==NULL ) {
-				char* url = mr_mprintf("%s://%s/.well-known/autoconfig/mail/config-v1.1.xml?emailaddress=%s", i==0?"https":"http", param_domain, param_addr_urlencoded); // the doc does not mention `emailaddress=`, however, Thunderbird adds it, see https://releases.mozilla.org/pub/thunderbird/ ,  which makes some sense
-				param_autoconfig = moz_autoconfigure(mailbox, url, param);
-				free(url);
-				PROGRESS(340+i*30)
-			}
+			autoconf_add(&ac, AUTOCONF_MOZ, mr_mprintf("%s://%s/.well-known/autoconfig/mail/config-v1.1.xml?emailaddress=%s", i==0?"https":"http", param_domain, param_addr_urlencoded)); // the doc does not mention `emailaddress=`, however, Thunderbird adds it, see https://releases.mozilla.org/pub/thunderbird/ ,  which makes some sense
 		}
 
 		for( i = 0; i <= 1; i++ ) {
-			if( param_autoconfig==NULL ) {
-				char* url = mr_mprintf("https://%s%s/autodiscover/autodiscover.xml", i==0?"":"autodiscover.", param_domain); /* Outlook uses always SSL but different domains */
-				param_autoconfig = outlk_autodiscover(mailbox, url, param);
-				free(url);
-				PROGRESS(400+i*50)
-			}
+			autoconf_add(&ac, AUTOCONF_OUTLK, mr_mprintf("https://%s%s/autodiscover/autodiscover.xml", i==0?"":"autodiscover.", param_domain)); /* Outlook uses always SSL but different domains */
 		}
 
-		/* B.  If we have no configuration yet, search configuration in Thunderbird's centeral database */
+		param_autoconfig = autoconf_get_result(&ac, 200, 450);
+		PROGRESS(450)
+
+		/* B.  If we have no configuration yet, search configuration in Thunderbird's centeral database (not in parallel to A. as this tells a third party about the domain) */
 		if( param_autoconfig==NULL )
 		{
-			char* url = mr_mprintf("https://autoconfig.thunderbird.net/v1.1/%s", param_domain); /* always SSL for Thunderbird's database */
-			param_autoconfig = moz_autoconfigure(mailbox, url, param);
-			free(url);
+			autoconf_add(&ac, AUTOCONF_MOZ, mr_mprintf("https://autoconfig.thunderbird.net/v1.1/%s", param_domain)); /* always SSL for Thunderbird's database */
+			param_autoconfig = autoconf_get_result(&ac, 450, 500);
 			PROGRESS(500)
 		}
 
@@ -644,7 +857,25 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 
 	PROGRESS(600)
 
-	/* try to connect to IMAP */
+	/* connect to SMTP in the background while connecting to IMAP - if we did not got an autoconfig, we try SSL-465
+	and STARTTLS-587 at the same time; the STARTTLS-probe uses a temporary SMTP object and is only used if SSL fails */
+	probe[0].m_smtp  = mailbox->m_smtp;
+	probe[0].m_param = copy_loginparam(param);
+	smtp_probe_start(&probe[0]);
+	probe_cnt = 1;
+
+	if( param_autoconfig==NULL && param->m_send_port!=TYPICAL_SMTP_STARTTLS_PORT )
+	{
+		probe[1].m_smtp  = mrsmtp_new(mailbox);
+		probe[1].m_smtp->m_log_connect_errors = 0; /* errors are reported by the first probe */
+		probe[1].m_param = copy_loginparam(param);
+		probe[1].m_param->m_server_flags &= ~MR_SMTP_SOCKET_FLAGS;
+		probe[1].m_param->m_server_flags |=  MR_SMTP_SOCKET_STARTTLS;
+		probe[1].m_param->m_send_port    =   TYPICAL_SMTP_STARTTLS_PORT;
+		smtp_probe_start(&probe[1]);
+		probe_cnt = 2;
+	}
+
 	{ char* r = mrloginparam_get_readable(param); mrmailbox_log_info(mailbox, 0, "Trying: %s", r); free(r); }
 
 	if( !mrimap_connect(mailbox->m_imap, param) ) {
@@ -654,22 +885,21 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 
 	PROGRESS(800)
 
-	/* try to connect to SMTP - if we did not got an autoconfig, the first try was SSL-465 and we do a second try with STARTTLS-587 */
-	if( !mrsmtp_connect(mailbox->m_smtp, param) )  {
-		if( param_autoconfig ) {
-			goto cleanup;
-		}
+	for( i = 0; i < probe_cnt; i++ ) {
+		smtp_probe_join(&probe[i]);
+	}
 
-		PROGRESS(850)
+	if( !probe[0].m_connected && probe_cnt > 1 && probe[1].m_connected ) {
+		param->m_server_flags = probe[1].m_param->m_server_flags;
+		param->m_send_port    = probe[1].m_param->m_send_port;
 
-		param->m_server_flags &= ~MR_SMTP_SOCKET_FLAGS;
-		param->m_server_flags |=  MR_SMTP_SOCKET_STARTTLS;
-		param->m_send_port    =   TYPICAL_SMTP_STARTTLS_PORT;
-		{ char* r = mrloginparam_get_readable(param); mrmailbox_log_info(mailbox, 0, "Trying: %s", r); free(r); }
-
-		if( !mrsmtp_connect(mailbox->m_smtp, param) ) {
-			goto cleanup;
-		}
+		/* hand over the TLS session, so that the next connect of the mailbox's SMTP object is a resumption */
+		mr_tls_session_clear(&mailbox->m_smtp->m_tls_session);
+		mailbox->m_smtp->m_tls_session = probe[1].m_smtp->m_tls_session;
+		memset(&probe[1].m_smtp->m_tls_session, 0, sizeof(mrtlssession_t));
+	}
+	else if( !probe[0].m_connected ) {
+		goto cleanup;
 	}
 
 	PROGRESS(900)
@@ -687,11 +917,26 @@ int mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 	success = 1;
 	mrmailbox_log_info(mailbox, 0, "Configure completed successfully.");
 
+	mrmailbox_start_keygen_thread(mailbox); /* the keypair is needed on the first send, generate it now, in the background */
+
 cleanup:
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
+	for( i = 0; i < probe_cnt; i++ ) {
+		smtp_probe_join(&probe[i]);
+		mrloginparam_unref(probe[i].m_param);
+	}
+	if( probe_cnt > 1 ) {
+		mrsmtp_unref(probe[1].m_smtp); /* disconnects */
+	}
 	if( !success && imap_connected_here ) {
 		mrimap_disconnect(mailbox->m_imap);
 	}
+	if( !success && probe_cnt > 0 && probe[0].m_connected ) {
+		mrsmtp_disconnect(mailbox->m_smtp);
+	}
+	if( ac_initialized ) {
+		autoconf_exit(&ac);
+	}
 	mrloginparam_unref(param);
 	mrloginparam_unref(param_autoconfig);
 	free(param_addr_urlencoded);
@@ -26,6 +26,7 @@
 #include "mraheader.h"
 #include "mrkeyring.h"
 #include "mrmimeparser.h"
+#include "mrosnative.h"
 
 
 /*******************************************************************************
@@ -191,97 +192,211 @@ static int contains_report(struct mailmime* mime)
  ******************************************************************************/
 
 
-static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* public_key, const char* self_addr,
-                                              struct mailmime* random_data_mime /*for an extra-seed of the random generator. For speed reasons, only give _available_ pointers here, do not create any data - in very most cases, the key is not generated!*/)
+/* The keypair is generated in a separate thread as soon as we know the address,
+that is, after configuration or on opening a configured mailbox.  The key
+generation may take several seconds on slow devices; the thread does not hold
+the database lock during generation and publishes the keypair atomically by
+saving it in a single locked call.  Only functions that really need the key
+(eg. for sending a message) wait for the thread. */
+static void* keygen_thread_entry_point(void* entry_arg)
 {
-	static int s_in_key_creation = 0; /* avoid double creation (we unlock the database during creation) */
-	int        key_created = 0;
-	int        success = 0, key_creation_here = 0;
+	mrmailbox_t* mailbox = (mrmailbox_t*)entry_arg;
+	mrosnative_setup_thread(mailbox); /* must be very first */
 
-	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || public_key == NULL ) {
-		goto cleanup;
+	char*        self_addr = mailbox->m_keygen_addr;
+	mrkey_t*     public_key = mrkey_new();
+	mrkey_t*     private_key = mrkey_new();
+	int          key_created = 0;
+
+	/* seed the random generator */
+	{
+		uintptr_t seed[4];
+		seed[0] = (uintptr_t)time(NULL);     /* time */
+		seed[1] = (uintptr_t)seed;           /* stack */
+		seed[2] = (uintptr_t)public_key;     /* heap */
+		seed[3] = (uintptr_t)pthread_self(); /* thread ID */
+		mrpgp_rand_seed(mailbox, seed, sizeof(seed));
 	}
 
-	if( !mrkey_load_self_public__(public_key, self_addr, mailbox->m_sql) )
+	mrmailbox_log_info(mailbox, 0, "Generating keypair for \"%s\" ...", self_addr);
+
+	/* The public key must contain the following:
+	- a signing-capable primary key Kp
+	- a user id
+	- a self signature
+	- an encryption-capable subkey Ke
+	- a binding signature over Ke by Kp
+	(see https://autocrypt.readthedocs.io/en/latest/level0.html#type-p-openpgp-based-key-data )*/
+	key_created = mrpgp_create_keypair(mailbox, self_addr, public_key, private_key);
+
+	if( !key_created ) {
+		mrmailbox_log_warning(mailbox, 0, "Cannot create keypair.");
+	}
+	else if( !mrpgp_is_valid_key(mailbox, public_key)
+	      || !mrpgp_is_valid_key(mailbox, private_key) ) {
+		mrmailbox_log_warning(mailbox, 0, "Generated keys are not valid.");
+	}
+	else
 	{
-		/* create the keypair - this may take a moment, however, as this is in a thread, this is no big deal */
-		if( s_in_key_creation ) { goto cleanup; }
-		key_creation_here = 1;
-		s_in_key_creation = 1;
+		mrsqlite3_lock(mailbox->m_sql);
 
-		/* seed the random generator */
-		{
-			uintptr_t seed[4];
-			seed[0] = (uintptr_t)time(NULL);     /* time */
-			seed[1] = (uintptr_t)seed;           /* stack */
-			seed[2] = (uintptr_t)public_key;     /* heap */
-			seed[3] = (uintptr_t)pthread_self(); /* thread ID */
-			mrpgp_rand_seed(mailbox, seed, sizeof(seed));
-
-			if( random_data_mime ) {
-				MMAPString* random_data_mmap = NULL;
-				int col = 0;
-				if( (random_data_mmap=mmap_string_new(""))==NULL ) {
-					goto cleanup;
-				}
-				mailmime_write_mem(random_data_mmap, &col, random_data_mime);
-				mrpgp_rand_seed(mailbox, random_data_mmap->str, random_data_mmap->len);
-				mmap_string_free(random_data_mmap);
+			mrkey_t* existing_key = mrkey_new();
+			if( !mrsqlite3_is_open(mailbox->m_sql) ) {
+				mrmailbox_log_warning(mailbox, 0, "Database closed during key generation.");
 			}
-		}
+			else if( mrkey_load_self_public__(existing_key, self_addr, mailbox->m_sql) ) {
+				mrmailbox_log_info(mailbox, 0, "Keypair imported during key generation, generated keypair dropped."); /* eg. by an Autocrypt Setup Message */
+			}
+			else if( !mrkey_save_self_keypair__(public_key, private_key, self_addr, 1/*set default*/, mailbox->m_sql) ) {
+				mrmailbox_log_warning(mailbox, 0, "Cannot save keypair.");
+			}
+			else {
+				mrmailbox_log_info(mailbox, 0, "Keypair generated.");
+			}
+			mrkey_unref(existing_key);
 
-		{
-			mrkey_t* private_key = mrkey_new();
+		mrsqlite3_unlock(mailbox->m_sql);
+	}
 
-			mrmailbox_log_info(mailbox, 0, "Generating keypair ...");
+	mrkey_unref(public_key);
+	mrkey_unref(private_key);
 
-			mrsqlite3_unlock(mailbox->m_sql); /* SIC! unlock database during creation - otherwise the GUI may hang */
+	pthread_mutex_lock(&mailbox->m_keygen_condmutex);
+		mailbox->m_keygen_running = 0;
+		pthread_cond_broadcast(&mailbox->m_keygen_cond);
+	pthread_mutex_unlock(&mailbox->m_keygen_condmutex);
 
-				/* The public key must contain the following:
-				- a signing-capable primary key Kp
-				- a user id
-				- a self signature
-				- an encryption-capable subkey Ke
-				- a binding signature over Ke by Kp
-				(see https://autocrypt.readthedocs.io/en/latest/level0.html#type-p-openpgp-based-key-data )*/
-				key_created = mrpgp_create_keypair(mailbox, self_addr, public_key, private_key);
+	mrosnative_unsetup_thread(mailbox); /* must be very last */
+	return NULL;
+}
 
-			mrsqlite3_lock(mailbox->m_sql);
 
-			if( !key_created ) {
-				mrmailbox_log_warning(mailbox, 0, "Cannot create keypair.");
-				goto cleanup;
-			}
+/**
+ * Start generating the keypair in the background, if there is none yet.
+ * The function returns at once.
+ *
+ * Must be called without holding the database lock.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_start_keygen_thread(mrmailbox_t* mailbox)
+{
+	char*    self_addr = NULL;
+	mrkey_t* public_key = mrkey_new();
 
-			if( !mrpgp_is_valid_key(mailbox, public_key)
-			 || !mrpgp_is_valid_key(mailbox, private_key) ) {
-				mrmailbox_log_warning(mailbox, 0, "Generated keys are not valid.");
-				goto cleanup;
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+		goto cleanup;
+	}
+
+	mrsqlite3_lock(mailbox->m_sql);
+		self_addr = mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL);
+		if( self_addr && mrkey_load_self_public__(public_key, self_addr, mailbox->m_sql) ) {
+			free(self_addr);
+			self_addr = NULL; /* the keypair already exists */
+		}
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	if( self_addr == NULL ) {
+		goto cleanup;
+	}
+
+	pthread_mutex_lock(&mailbox->m_keygen_condmutex);
+		if( !mailbox->m_keygen_running )
+		{
+			if( mailbox->m_keygen_joinable ) {
+				pthread_join(mailbox->m_keygen_thread, NULL); /* the previous thread has already finished */
+				mailbox->m_keygen_joinable = 0;
 			}
 
-			if( !mrkey_save_self_keypair__(public_key, private_key, self_addr, 1/*set default*/, mailbox->m_sql) ) {
-				mrmailbox_log_warning(mailbox, 0, "Cannot save keypair.");
-				goto cleanup;
+			free(mailbox->m_keygen_addr);
+			mailbox->m_keygen_addr = self_addr;
+			self_addr = NULL;
+
+			mailbox->m_keygen_running = 1;
+			if( pthread_create(&mailbox->m_keygen_thread, NULL, keygen_thread_entry_point, mailbox) == 0 ) {
+				mailbox->m_keygen_joinable = 1;
+			}
+			else {
+				mrmailbox_log_error(mailbox, 0, "Cannot start key generation thread.");
+				mailbox->m_keygen_running = 0;
 			}
+		}
+	pthread_mutex_unlock(&mailbox->m_keygen_condmutex);
 
-			mrmailbox_log_info(mailbox, 0, "Keypair generated.");
+cleanup:
+	free(self_addr);
+	mrkey_unref(public_key);
+}
 
-			mrkey_unref(private_key);
+
+/**
+ * Wait until a running key generation is finished.  Called before the
+ * database is closed and to clean up the mailbox object.
+ *
+ * Must be called without holding the database lock.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_wait_for_keygen_thread(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+		return;
+	}
+
+	pthread_mutex_lock(&mailbox->m_keygen_condmutex);
+		while( mailbox->m_keygen_running ) {
+			pthread_cond_wait(&mailbox->m_keygen_cond, &mailbox->m_keygen_condmutex);
+		}
+
+		if( mailbox->m_keygen_joinable ) {
+			pthread_join(mailbox->m_keygen_thread, NULL);
+			mailbox->m_keygen_joinable = 0;
+		}
+	pthread_mutex_unlock(&mailbox->m_keygen_condmutex);
+}
+
+
+static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* public_key, const char* self_addr)
+{
+	int success = 0;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || public_key == NULL ) {
+		goto cleanup;
+	}
+
+	if( !mrkey_load_self_public__(public_key, self_addr, mailbox->m_sql) )
+	{
+		/* the keypair is not yet ready; make sure, it is generated and wait for it.
+		we unlock the database while waiting, the key generation thread needs it and the GUI should not hang. */
+		mrsqlite3_unlock(mailbox->m_sql); /* SIC! */
+
+			mrmailbox_start_keygen_thread(mailbox);
+
+			pthread_mutex_lock(&mailbox->m_keygen_condmutex);
+				while( mailbox->m_keygen_running ) {
+					pthread_cond_wait(&mailbox->m_keygen_cond, &mailbox->m_keygen_condmutex);
+				}
+			pthread_mutex_unlock(&mailbox->m_keygen_condmutex);
+
+		mrsqlite3_lock(mailbox->m_sql);
+
+		if( !mrkey_load_self_public__(public_key, self_addr, mailbox->m_sql) ) {
+			mrmailbox_log_warning(mailbox, 0, "Keypair not available.");
+			goto cleanup;
 		}
 	}
 
 	success = 1;
 
 cleanup:
-	if( key_creation_here ) { s_in_key_creation = 0; }
 	return success;
 }
 
 
 int mrmailbox_ensure_secret_key_exists(mrmailbox_t* mailbox)
 {
-	/* normally, the key is generated as soon as the first mail is send
-	(this is to gain some extra-random-seed by the message content and the timespan between program start and message sending) */
+	/* normally, the key is generated in the background after configuration, see mrmailbox_start_keygen_thread();
+	this function waits for the key generation if it is not yet finished */
 	int      success = 0, locked = 0;
 	mrkey_t* public_key = mrkey_new();
 	char*    self_addr = NULL;
@@ -298,7 +413,7 @@ int mrmailbox_ensure_secret_key_exists(mrmailbox_t* mailbox)
 			goto cleanup;
 		}
 
-		if( !load_or_generate_self_public_key__(mailbox, public_key, self_addr, NULL/*no random text data for seeding available*/) ) {
+		if( !load_or_generate_self_public_key__(mailbox, public_key, self_addr) ) {
 			goto cleanup;
 		}
 
@@ -317,6 +432,14 @@ cleanup:
  ******************************************************************************/
 
 
+/* mailmime_write_driver() passes the rendered MIME structure in small pieces
+directly to the encryption, so no plaintext copy of the message is built */
+static int write_to_encrypt(void* encrypt, const char* str, size_t bytes)
+{
+	return mrpgp_pk_encrypt_write((mrpgp_encrypt_t*)encrypt, str, bytes)? (int)bytes : 0;
+}
+
+
 void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
                     int force_unencrypted,
                     int e2ee_guaranteed, /*set if e2ee was possible on sending time; we should not degrade to transport*/
@@ -327,16 +450,20 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 	struct mailimf_fields* imffields_unprotected = NULL; /*just a pointer into mailmime structure, must not be freed*/
 	mrkeyring_t*           keyring = mrkeyring_new();
 	mrkey_t*               sign_key = mrkey_new();
-	MMAPString*            plain = mmap_string_new("");
-	char*                  ctext = NULL;
+	void*                  ctext = NULL;
 	size_t                 ctext_bytes = 0;
 	mrarray_t*             peerstates = mrarray_new(NULL, 10);
+	mrarray_t*             gossip_headers = mrarray_new(NULL, 10);
 
 	if( helper ) { memset(helper, 0, sizeof(mrmailbox_e2ee_helper_t)); }
 
 	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || recipients_addr == NULL || in_out_message == NULL
 	 || in_out_message->mm_parent /* libEtPan's pgp_encrypt_mime() takes the parent as the new root. We just expect the root as being given to this function. */
-	 || autocryptheader == NULL || keyring==NULL || sign_key==NULL || plain == NULL || helper == NULL ) {
+	 || autocryptheader == NULL || keyring==NULL || sign_key==NULL || helper == NULL ) {
+		goto cleanup;
+	}
+
+	if( (imffields_unprotected=mailmime_find_mailimf_fields(in_out_message))==NULL ) {
 		goto cleanup;
 	}
 
@@ -354,7 +481,7 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 			goto cleanup;
 		}
 
-		if( !load_or_generate_self_public_key__(mailbox, autocryptheader->m_public_key, autocryptheader->m_addr, in_out_message/*only for random-seed*/) ) {
+		if( !load_or_generate_self_public_key__(mailbox, autocryptheader->m_public_key, autocryptheader->m_addr) ) {
 			goto cleanup;
 		}
 
@@ -392,13 +519,30 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 			do_encrypt = 0;
 		}
 
+		/* render gossip headers; the rendered headers are cached in the peerstates.
+		if `gossip_recent_days` is set, only peers whose key has changed recently are gossiped,
+		the other members probably know the keys already; when members are added, all peers are gossiped as usual */
+		if( do_encrypt && mrarray_get_cnt(peerstates) > 1 ) {
+			int    recent_days = mrsqlite3_get_config_int__(mailbox->m_sql, "gossip_recent_days", 0);
+			time_t recent_since = 0;
+			if( recent_days > 0 && mailimf_find_optional_field(imffields_unprotected, "Chat-Group-Member-Added")==NULL ) {
+				recent_since = time(NULL) - recent_days*24*60*60;
+			}
+
+			for( int i = 0; i < mrarray_get_cnt(peerstates); i++ ) {
+				mrapeerstate_t* peerstate = (mrapeerstate_t*)mrarray_get_ptr(peerstates, i);
+				if( peerstate->m_key_changed >= recent_since ) {
+					char* p = mrapeerstate_get_gossip_header__(peerstate, mailbox->m_sql);
+					if( p ) {
+						mrarray_add_ptr(gossip_headers, p);
+					}
+				}
+			}
+		}
+
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
-	if( (imffields_unprotected=mailmime_find_mailimf_fields(in_out_message))==NULL ) {
-		goto cleanup;
-	}
-
 	/* encrypt message, if possible */
 	if( do_encrypt )
 	{
@@ -412,15 +556,10 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 			mailmime_get_content_message(), NULL, NULL, NULL, NULL, imffields_encrypted, part_to_encrypt);
 
 		/* gossip keys */
-		int iCnt = mrarray_get_cnt(peerstates);
-		if( iCnt > 1 ) {
-			for( int i = 0; i < iCnt; i++ ) {
-				char* p = mrapeerstate_render_gossip_header((mrapeerstate_t*)mrarray_get_ptr(peerstates, i));
-				if( p ) {
-					mailimf_fields_add(imffields_encrypted, mailimf_field_new_custom(strdup("Autocrypt-Gossip"), p/*takes ownership*/));
-				}
-			}
+		for( int i = 0; i < mrarray_get_cnt(gossip_headers); i++ ) {
+			mailimf_fields_add(imffields_encrypted, mailimf_field_new_custom(strdup("Autocrypt-Gossip"), (char*)mrarray_get_ptr(gossip_headers, i)/*takes ownership*/));
 		}
+		mrarray_empty(gossip_headers);
 
 		/* memoryhole headers */
 		clistiter* cur = clist_begin(imffields_unprotected->fld_list);
@@ -459,18 +598,23 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 
 		clist_append(part_to_encrypt->mm_content_type->ct_parameters, mailmime_param_new_with_data("protected-headers", "v1"));
 
-		/* convert part to encrypt to plain text */
-		mailmime_write_mem(plain, &col, message_to_encrypt);
-		if( plain->str == NULL || plain->len<=0 ) {
-			goto cleanup;
-		}
-		//char* t1=mr_null_terminate(plain->str,plain->len);printf("PLAIN:\n%s\n",t1);free(t1); // DEBUG OUTPUT
-
-		if( !mrpgp_pk_encrypt(mailbox, plain->str, plain->len, keyring, sign_key, 1/*use_armor*/, (void**)&ctext, &ctext_bytes) ) {
-			goto cleanup;
+		/* render the part to encrypt and encrypt it on the fly */
+		{
+			mrpgp_encrypt_t* encrypt = mrpgp_pk_encrypt_open(mailbox, keyring, sign_key, 1/*use_armor*/);
+			if( encrypt == NULL ) {
+				goto cleanup;
+			}
+			if( mailmime_write_driver(write_to_encrypt, encrypt, &col, message_to_encrypt)!=MAILIMF_NO_ERROR ) {
+				mrpgp_pk_encrypt_close(encrypt, NULL, NULL);
+				goto cleanup;
+			}
+			if( !mrpgp_pk_encrypt_close(encrypt, &ctext, &ctext_bytes) ) {
+				goto cleanup;
+			}
 		}
 		helper->m_cdata_to_free = ctext;
-		//char* t2=mr_null_terminate(ctext,ctext_bytes);printf("ENCRYPTED:\n%s\n",t2);free(t2); // DEBUG OUTPUT
+		ctext = NULL;
+		//char* t2=mr_null_terminate(helper->m_cdata_to_free,ctext_bytes);printf("ENCRYPTED:\n%s\n",t2);free(t2); // DEBUG OUTPUT
 
 		/* create MIME-structure that will contain the encrypted text */
 		struct mailmime* encrypted_part = new_data_part(NULL, 0, "multipart/encrypted", -1);
@@ -482,7 +626,7 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 		struct mailmime* version_mime = new_data_part(version_content, strlen(version_content), "application/pgp-encrypted", MAILMIME_MECHANISM_7BIT);
 		mailmime_smart_add_part(encrypted_part, version_mime);
 
-		struct mailmime* ctext_part = new_data_part(ctext, ctext_bytes, "application/octet-stream", MAILMIME_MECHANISM_7BIT);
+		struct mailmime* ctext_part = new_data_part(helper->m_cdata_to_free, ctext_bytes, "application/octet-stream", MAILMIME_MECHANISM_7BIT);
 		mailmime_smart_add_part(encrypted_part, ctext_part);
 
 		/* replace the original MIME-structure by the encrypted MIME-structure */
@@ -505,10 +649,13 @@ cleanup:
 	mraheader_unref(autocryptheader);
 	mrkeyring_unref(keyring);
 	mrkey_unref(sign_key);
-	if( plain ) { mmap_string_free(plain); }
+	free(ctext);
 
 	for( int i=mrarray_get_cnt(peerstates)-1; i>=0; i-- ) { mrapeerstate_unref((mrapeerstate_t*)mrarray_get_ptr(peerstates, i)); }
 	mrarray_unref(peerstates);
+
+	for( int i=mrarray_get_cnt(gossip_headers)-1; i>=0; i-- ) { free(mrarray_get_ptr(gossip_headers, i)); }
+	mrarray_unref(gossip_headers);
 }
 
 
@@ -718,6 +865,10 @@ static void update_gossip_peerstates(mrmailbox_t* mailbox, time_t message_time,
 	clistiter* cur1;
 	mrhash_t*  recipients = NULL;
 
+	/* all peerstates of a message are written in a single transaction */
+	mrsqlite3_lock(mailbox->m_sql);
+	mrsqlite3_begin_transaction__(mailbox->m_sql);
+
 	for( cur1 = clist_begin(gossip_headers->fld_list); cur1!=NULL ; cur1=clist_next(cur1) )
 	{
 		struct mailimf_field* field = (struct mailimf_field*)clist_content(cur1);
@@ -759,6 +910,9 @@ static void update_gossip_peerstates(mrmailbox_t* mailbox, time_t message_time,
 		}
 	}
 
+	mrsqlite3_commit__(mailbox->m_sql);
+	mrsqlite3_unlock(mailbox->m_sql);
+
 	if( recipients ) {
 		mrhash_clear(recipients);
 		free(recipients);
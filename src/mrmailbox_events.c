@@ -0,0 +1,523 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+/* Events that only inform the frontend (MR_EVENT_MSGS_CHANGED, logging etc.)
+are sent using mrmailbox_send_event().  By default, the callback given to
+mrmailbox_new() is called directly from the thread that sends the event.
+
+With mrmailbox_set_event_mode(), these events can be queued instead; the queue
+is then either processed by a dispatcher thread or the frontend pulls the
+events using mrmailbox_get_next_event().  In both cases, the core threads never
+wait for the frontend.  Pending events of the same kind are coalesced.
+
+Events that ask the frontend for something (MR_EVENT_IS_OFFLINE,
+MR_EVENT_GET_STRING etc.) are always sent directly using mrmailbox_t::m_cb. */
+
+
+#include <sys/time.h>
+#include "mrmailbox_internal.h"
+#include "mrosnative.h"
+
+
+#define MR_EVENT_QUEUE_MAX 1000
+
+
+typedef struct mrqueuedevent_t
+{
+	int                  m_event;
+	uintptr_t            m_data1;
+	uintptr_t            m_data2;
+	char*                m_str;       /* copy of the string given as data1 or data2, owned by the queue */
+	uint64_t             m_queued_ms; /* time the event was added; coalescing does not change this time */
+} mrqueuedevent_t;
+
+
+typedef struct mreventqueue_t
+{
+	pthread_mutex_t      m_mutex;
+	pthread_cond_t       m_cond;      /* signalled when an event is added or the dispatcher should exit */
+
+	int                  m_mode;
+	int                  m_coalesce_ms;
+
+	pthread_t            m_thread;
+	int                  m_thread_running;
+	int                  m_do_exit;
+
+	mrqueuedevent_t      m_events[MR_EVENT_QUEUE_MAX]; /* ring buffer */
+	int                  m_first;
+	int                  m_cnt;
+
+	int                  m_overflow;  /* events were dropped; the number of "reload all" events still to send */
+
+	char*                m_pulled_str; /* string of the event last returned by mrmailbox_get_next_event() */
+} mreventqueue_t;
+
+
+static uint64_t now_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+}
+
+
+static int has_string_data1(int event) { return event==MR_EVENT_IMEX_FILE_WRITTEN; }
+static int has_string_data2(int event) { return event==MR_EVENT_INFO || event==MR_EVENT_WARNING || event==MR_EVENT_ERROR; }
+
+
+/* try to merge the event into a pending one; returns 1 if the event was merged */
+static int coalesce__(mreventqueue_t* queue, int event, uintptr_t data1, uintptr_t data2)
+{
+	int i;
+
+	if( has_string_data1(event) || has_string_data2(event) ) {
+		return 0; /* each log line and each written file is reported */
+	}
+
+	for( i = queue->m_cnt-1; i >= 0; i-- )
+	{
+		mrqueuedevent_t* ev = &queue->m_events[(queue->m_first+i)%MR_EVENT_QUEUE_MAX];
+		if( ev->m_event != event ) {
+			continue;
+		}
+
+		switch( event )
+		{
+			case MR_EVENT_MSGS_CHANGED:
+				if( ev->m_data1 == data1 ) {
+					if( ev->m_data2 != data2 ) {
+						ev->m_data2 = 0; /* several messages in the chat changed */
+					}
+					return 1;
+				}
+				break;
+
+			case MR_EVENT_INCOMING_MSG:
+				if( ev->m_data1 == data1 ) {
+					ev->m_data2 = data2; /* notify about the newest message of the chat */
+					return 1;
+				}
+				break;
+
+			case MR_EVENT_CHAT_MODIFIED:
+			case MR_EVENT_CONTACTS_CHANGED:
+				if( ev->m_data1 == data1 ) {
+					return 1;
+				}
+				break;
+
+			case MR_EVENT_CONFIGURE_PROGRESS:
+			case MR_EVENT_IMEX_PROGRESS:
+				ev->m_data1 = data1; /* only the current progress is of interest */
+				return 1;
+
+			default:
+				if( ev->m_data1 == data1 && ev->m_data2 == data2 ) {
+					return 1;
+				}
+				break;
+		}
+	}
+
+	return 0;
+}
+
+
+/* get the next event that is due; returns 0 if there is none, *ret_wait_ms is set to the time until the next event is due then */
+static int pop_event__(mreventqueue_t* queue, int ignore_window, mrqueuedevent_t* ret, int* ret_wait_ms)
+{
+	*ret_wait_ms = -1;
+
+	if( queue->m_cnt > 0 )
+	{
+		mrqueuedevent_t* ev = &queue->m_events[queue->m_first];
+		uint64_t         due = ev->m_queued_ms + queue->m_coalesce_ms, now = now_ms();
+		if( !ignore_window && due > now ) {
+			*ret_wait_ms = (int)(due-now);
+			return 0;
+		}
+
+		*ret = *ev;
+		memset(ev, 0, sizeof(mrqueuedevent_t));
+		queue->m_first = (queue->m_first+1)%MR_EVENT_QUEUE_MAX;
+		queue->m_cnt--;
+		return 1;
+	}
+
+	if( queue->m_overflow > 0 )
+	{
+		/* events were dropped as the frontend does not process them fast enough; ask the frontend to reload everything */
+		memset(ret, 0, sizeof(mrqueuedevent_t));
+		ret->m_event = queue->m_overflow==2? MR_EVENT_MSGS_CHANGED : MR_EVENT_CONTACTS_CHANGED;
+		queue->m_overflow--;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static void call_cb(mrmailbox_t* mailbox, mrqueuedevent_t* ev)
+{
+	MR_TRACE_BEGIN(mailbox, "event_cb", "\"event\":%i", ev->m_event);
+	mailbox->m_cb(mailbox, ev->m_event,
+		has_string_data1(ev->m_event)? (uintptr_t)ev->m_str : ev->m_data1,
+		has_string_data2(ev->m_event)? (uintptr_t)ev->m_str : ev->m_data2);
+	MR_TRACE_END(mailbox, "event_cb", NULL);
+	free(ev->m_str);
+	ev->m_str = NULL;
+}
+
+
+static void* dispatch_thread_entry_point(void* entry_arg)
+{
+	mrmailbox_t*     mailbox = (mrmailbox_t*)entry_arg;
+	mreventqueue_t*  queue = mailbox->m_eventqueue;
+	mrqueuedevent_t  ev;
+	int              wait_ms;
+
+	mrosnative_setup_thread(mailbox);
+
+	pthread_mutex_lock(&queue->m_mutex);
+
+		while( 1 )
+		{
+			if( pop_event__(queue, queue->m_do_exit, &ev, &wait_ms) ) {
+				pthread_mutex_unlock(&queue->m_mutex);
+					call_cb(mailbox, &ev);
+				pthread_mutex_lock(&queue->m_mutex);
+				continue;
+			}
+
+			if( queue->m_do_exit ) {
+				break; /* all events are delivered */
+			}
+
+			if( wait_ms >= 0 ) {
+				struct timespec timeToWait;
+				uint64_t        due = now_ms() + wait_ms;
+				timeToWait.tv_sec  = due/1000;
+				timeToWait.tv_nsec = (due%1000)*1000000;
+				pthread_cond_timedwait(&queue->m_cond, &queue->m_mutex, &timeToWait);
+			}
+			else {
+				pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+			}
+		}
+
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	mrosnative_unsetup_thread(mailbox);
+	return NULL;
+}
+
+
+/* stop the dispatcher thread, if any, and deliver the pending events from the calling thread; must be called with m_mode already set to MR_EVENTS_SYNC */
+static void stop_queue(mrmailbox_t* mailbox)
+{
+	mreventqueue_t*  queue = mailbox->m_eventqueue;
+	mrqueuedevent_t  ev;
+	int              wait_ms;
+
+	pthread_mutex_lock(&queue->m_mutex);
+		int thread_running = queue->m_thread_running;
+		queue->m_do_exit = 1;
+		pthread_cond_broadcast(&queue->m_cond);
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	if( thread_running ) {
+		pthread_join(queue->m_thread, NULL);
+	}
+
+	pthread_mutex_lock(&queue->m_mutex);
+		queue->m_thread_running = 0;
+		queue->m_do_exit = 0;
+		while( pop_event__(queue, 1, &ev, &wait_ms) ) {
+			pthread_mutex_unlock(&queue->m_mutex);
+				call_cb(mailbox, &ev);
+			pthread_mutex_lock(&queue->m_mutex);
+		}
+	pthread_mutex_unlock(&queue->m_mutex);
+}
+
+
+void mrmailbox_init_event_queue(mrmailbox_t* mailbox)
+{
+	mreventqueue_t* queue = NULL;
+
+	if( mailbox == NULL || mailbox->m_eventqueue ) {
+		return;
+	}
+
+	if( (queue=calloc(1, sizeof(mreventqueue_t)))==NULL ) {
+		exit(51); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	pthread_mutex_init(&queue->m_mutex, NULL);
+	pthread_cond_init(&queue->m_cond, NULL);
+	queue->m_mode = MR_EVENTS_SYNC;
+
+	mailbox->m_eventqueue = queue;
+}
+
+
+void mrmailbox_exit_event_queue(mrmailbox_t* mailbox)
+{
+	mreventqueue_t* queue = NULL;
+
+	if( mailbox == NULL || (queue=mailbox->m_eventqueue)==NULL ) {
+		return;
+	}
+
+	mrmailbox_set_event_mode(mailbox, MR_EVENTS_SYNC, 0);
+
+	pthread_mutex_destroy(&queue->m_mutex);
+	pthread_cond_destroy(&queue->m_cond);
+	free(queue->m_pulled_str);
+	free(queue);
+
+	mailbox->m_eventqueue = NULL;
+}
+
+
+/**
+ * Send an event that informs the frontend.  Depending on the mode set by
+ * mrmailbox_set_event_mode(), the callback is called directly or the event is
+ * queued.  Strings given as data1 or data2 are copied as needed.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_send_event(mrmailbox_t* mailbox, int event, uintptr_t data1, uintptr_t data2)
+{
+	mreventqueue_t*  queue = NULL;
+	mrqueuedevent_t* ev = NULL;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+		return;
+	}
+
+	mrmetrics_count(mailbox, MR_CNT_EVENTS_SENT, 1);
+	if( !has_string_data2(event) ) { /* log lines are not traced */
+		MR_TRACE_INSTANT(mailbox, "event", "\"event\":%i,\"data1\":%lu,\"data2\":%lu", event,
+			has_string_data1(event)? 0UL : (unsigned long)data1, (unsigned long)data2);
+	}
+
+	if( (queue=mailbox->m_eventqueue)==NULL || queue->m_mode == MR_EVENTS_SYNC ) {
+		mailbox->m_cb(mailbox, event, data1, data2);
+		return;
+	}
+
+	pthread_mutex_lock(&queue->m_mutex);
+
+		if( queue->m_mode == MR_EVENTS_SYNC ) {
+			pthread_mutex_unlock(&queue->m_mutex);
+			mailbox->m_cb(mailbox, event, data1, data2); /* the mode was changed in between */
+			return;
+		}
+
+		if( coalesce__(queue, event, data1, data2) )
+		{
+			mrmetrics_count(mailbox, MR_CNT_EVENTS_COALESCED, 1);
+		}
+		else
+		{
+			if( queue->m_cnt >= MR_EVENT_QUEUE_MAX ) {
+				queue->m_overflow = 2;
+				mrmetrics_count(mailbox, MR_CNT_EVENTS_DROPPED, 1);
+			}
+			else {
+				ev = &queue->m_events[(queue->m_first+queue->m_cnt)%MR_EVENT_QUEUE_MAX];
+				ev->m_event     = event;
+				ev->m_data1     = data1;
+				ev->m_data2     = data2;
+				ev->m_str       = has_string_data1(event)? strdup_keep_null((char*)data1) : (has_string_data2(event)? strdup_keep_null((char*)data2) : NULL);
+				ev->m_queued_ms = now_ms();
+				queue->m_cnt++;
+				pthread_cond_broadcast(&queue->m_cond);
+			}
+		}
+
+	pthread_mutex_unlock(&queue->m_mutex);
+}
+
+
+/* the number of events waiting in the queue, used for the metrics */
+int mrmailbox_get_event_queue_cnt(mrmailbox_t* mailbox)
+{
+	mreventqueue_t* queue = NULL;
+	int             cnt = 0;
+
+	if( mailbox == NULL || (queue=mailbox->m_eventqueue)==NULL ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&queue->m_mutex);
+		cnt = queue->m_cnt;
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	return cnt;
+}
+
+
+/**
+ * Set how events informing the frontend are delivered.  Events asking the
+ * frontend for something, eg. #MR_EVENT_IS_OFFLINE or #MR_EVENT_GET_STRING,
+ * are always delivered directly to the callback given to mrmailbox_new().
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @param mode One of
+ *     - MR_EVENTS_SYNC: the callback is called directly from the thread that
+ *       sends the event; this is the default.
+ *     - MR_EVENTS_DISPATCH: the events are queued and the callback is called
+ *       from a dispatcher thread; the core never waits for the callback.
+ *     - MR_EVENTS_PULL: the events are queued and must be fetched using
+ *       mrmailbox_get_next_event().
+ *
+ * @param coalesce_ms Queued events are delayed by this number of
+ *     milliseconds.  Events of the same kind that are sent meanwhile are
+ *     merged, eg. all #MR_EVENT_MSGS_CHANGED for a chat result in a single
+ *     event.  0=deliver queued events as soon as possible; events that are
+ *     still pending are merged anyway.
+ *
+ * @return 1=success, 0=error.
+ *
+ * When the mode is changed, the events still queued are delivered to the
+ * callback before the function returns.  If the queue overflows because
+ * the frontend does not process the events fast enough, events are dropped
+ * and the frontend gets #MR_EVENT_MSGS_CHANGED and #MR_EVENT_CONTACTS_CHANGED
+ * with data1=0 and data2=0 afterwards.
+ *
+ * The function must not be called from the callback.
+ */
+int mrmailbox_set_event_mode(mrmailbox_t* mailbox, int mode, int coalesce_ms)
+{
+	int             success = 1;
+	mreventqueue_t* queue = NULL;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || (queue=mailbox->m_eventqueue)==NULL
+	 || (mode!=MR_EVENTS_SYNC && mode!=MR_EVENTS_DISPATCH && mode!=MR_EVENTS_PULL) ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&queue->m_mutex);
+		queue->m_mode = MR_EVENTS_SYNC; /* new events are delivered directly while the queue is stopped */
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	stop_queue(mailbox);
+
+	pthread_mutex_lock(&queue->m_mutex);
+		queue->m_coalesce_ms = coalesce_ms>0? coalesce_ms : 0;
+		if( mode == MR_EVENTS_DISPATCH ) {
+			queue->m_thread_running = (pthread_create(&queue->m_thread, NULL, dispatch_thread_entry_point, mailbox)==0);
+			if( !queue->m_thread_running ) {
+				mode = MR_EVENTS_SYNC;
+				success = 0;
+			}
+		}
+		queue->m_mode = mode;
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	return success;
+}
+
+
+/**
+ * Get the next queued event.  This function may be used instead of a
+ * callback after switching to MR_EVENTS_PULL using mrmailbox_set_event_mode().
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @param timeout_ms Milliseconds to wait for an event; 0=do not wait, -1=wait
+ *     until an event arrives.
+ *
+ * @param ret_event Set to the event, one of the MR_EVENT_* constants.
+ *
+ * @param ret_data1 Set to data1 of the event, see mrevent.h.
+ *
+ * @param ret_data2 Set to data2 of the event, see mrevent.h.  Strings returned
+ *     in data1 or data2 are valid until the next call to this function and
+ *     must not be free()'d.
+ *
+ * @return 1=an event was returned, 0=there is no event within the timeout or
+ *     the mailbox is not in MR_EVENTS_PULL mode.
+ */
+int mrmailbox_get_next_event(mrmailbox_t* mailbox, int timeout_ms, int* ret_event, uintptr_t* ret_data1, uintptr_t* ret_data2)
+{
+	int              success = 0;
+	mreventqueue_t*  queue = NULL;
+	mrqueuedevent_t  ev;
+	int              wait_ms;
+	uint64_t         timeout_at = now_ms() + (timeout_ms>0? timeout_ms : 0);
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || (queue=mailbox->m_eventqueue)==NULL
+	 || ret_event == NULL || ret_data1 == NULL || ret_data2 == NULL ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&queue->m_mutex);
+
+		free(queue->m_pulled_str);
+		queue->m_pulled_str = NULL;
+
+		while( queue->m_mode == MR_EVENTS_PULL )
+		{
+			if( pop_event__(queue, 0, &ev, &wait_ms) ) {
+				*ret_event = ev.m_event;
+				*ret_data1 = has_string_data1(ev.m_event)? (uintptr_t)ev.m_str : ev.m_data1;
+				*ret_data2 = has_string_data2(ev.m_event)? (uintptr_t)ev.m_str : ev.m_data2;
+				queue->m_pulled_str = ev.m_str;
+				success = 1;
+				break;
+			}
+
+			uint64_t now = now_ms();
+			if( timeout_ms >= 0 ) {
+				if( now >= timeout_at ) {
+					break;
+				}
+				if( wait_ms < 0 || now+wait_ms > timeout_at ) {
+					wait_ms = (int)(timeout_at-now);
+				}
+			}
+
+			if( wait_ms >= 0 ) {
+				struct timespec timeToWait;
+				uint64_t        due = now + wait_ms;
+				timeToWait.tv_sec  = due/1000;
+				timeToWait.tv_nsec = (due%1000)*1000000;
+				pthread_cond_timedwait(&queue->m_cond, &queue->m_mutex, &timeToWait);
+			}
+			else {
+				pthread_cond_wait(&queue->m_cond, &queue->m_mutex);
+			}
+		}
+
+	pthread_mutex_unlock(&queue->m_mutex);
+
+	return success;
+}
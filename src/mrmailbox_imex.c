@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <dirent.h>
 #include <unistd.h> /* for sleep() */
+#include <sys/stat.h>
 #include <openssl/rand.h>
 #include <libetpan/mmapstring.h>
 #include <netpgp-extra.h>
@@ -34,6 +35,7 @@
 #include "mrapeerstate.h"
 #include "mrpgp.h"
 #include "mrmimefactory.h"
+#include "mrimap.h"
 
 
 /*******************************************************************************
@@ -497,8 +499,7 @@ char* mrmailbox_initiate_key_transfer(mrmailbox_t* mailbox)
 
 	CHECK_EXIT
 
-	if( (setup_file_name=mr_get_fine_pathNfilename(mailbox->m_blobdir, "autocrypt-setup-message.html")) == NULL
-	 || !mr_write_file(setup_file_name, setup_file_content, strlen(setup_file_content), mailbox) ) {
+	if( (setup_file_name=mr_create_fine_file(mailbox->m_blobdir, "autocrypt-setup-message.html", setup_file_content, strlen(setup_file_content), mailbox)) == NULL ) {
 		goto cleanup;
 	}
 
@@ -715,7 +716,7 @@ static void export_key_to_asc_file(mrmailbox_t* mailbox, const char* dir, int id
 	mrmailbox_log_info(mailbox, 0, "Exporting key %s", file_name);
 	mr_delete_file(file_name, mailbox);
 	if( mrkey_render_asc_to_file(key, file_name, mailbox) ) {
-		mailbox->m_cb(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)file_name, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)file_name, 0);
 		mrmailbox_log_error(mailbox, 0, "Cannot write key to %s", file_name);
 	}
 	free(file_name);
@@ -858,7 +859,7 @@ The macro avoids weird values of 0% or 100% while still working. */
 	int permille = (processed_files_count*1000)/total_files_count; \
 	if( permille <  10 ) { permille =  10; } \
 	if( permille > 990 ) { permille = 990; } \
-	mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, permille, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_IMEX_PROGRESS, permille, 0);
 
 
 static int export_backup(mrmailbox_t* mailbox, const char* dir)
@@ -885,7 +886,7 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 		char buffer[256];
 		timeinfo = localtime(&now);
 		strftime(buffer, 256, MR_BAK_PREFIX "-%Y-%m-%d." MR_BAK_SUFFIX, timeinfo);
-		if( (dest_pathNfilename=mr_get_fine_pathNfilename(dir, buffer))==NULL ) {
+		if( (dest_pathNfilename=mr_create_fine_file(dir, buffer, NULL, 0, mailbox))==NULL ) { /* reserve the name, the file is overwritten by the copy below */
 			mrmailbox_log_error(mailbox, 0, "Cannot get backup file name.");
 			goto cleanup;
 		}
@@ -900,6 +901,7 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 	/* copy file to backup directory */
 	mrmailbox_log_info(mailbox, 0, "Backup \"%s\" to \"%s\".", mailbox->m_dbfile, dest_pathNfilename);
 	if( !mr_copy_file(mailbox->m_dbfile, dest_pathNfilename, mailbox) ) {
+		delete_dest_file = 1; /* remove the reserved file */
 		goto cleanup; /* error already logged */
 	}
 
@@ -957,6 +959,7 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 			int name_len = strlen(name);
 			if( (name_len==1 && name[0]=='.')
 			 || (name_len==2 && name[0]=='.' && name[1]=='.')
+			 || strcmp(name, MR_IMAP_SPOOL_FILE)==0
 			 || (name_len > prefix_len && strncmp(name, MR_BAK_PREFIX, prefix_len)==0 && name_len > suffix_len && strncmp(&name[name_len-suffix_len-1], "." MR_BAK_SUFFIX, suffix_len)==0) ) {
 				//mrmailbox_log_info(mailbox, 0, "Backup: Skipping \"%s\".", name);
 				continue;
@@ -988,7 +991,7 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 	mrsqlite3_set_config_int__(dest_sql, "backup_time", now);
 	mrsqlite3_set_config__    (dest_sql, "backup_for", mailbox->m_blobdir);
 
-	mailbox->m_cb(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)dest_pathNfilename, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)dest_pathNfilename, 0);
 	success = 1;
 
 cleanup:
@@ -1056,6 +1059,9 @@ static int import_backup(mrmailbox_t* mailbox, const char* backup_to_import)
 		mrsqlite3_close__(mailbox->m_sql);
 	}
 
+	mrmailbox_clear_contact_cache__(mailbox);
+	mrapeerstate_clear_cache__(mailbox);
+
 	mr_delete_file(mailbox->m_dbfile, mailbox);
 
 	if( mr_file_exist(mailbox->m_dbfile) ) {
@@ -1149,6 +1155,196 @@ cleanup:
 }
 
 
+/*******************************************************************************
+ * Import mails
+ ******************************************************************************/
+
+
+/* Mails are imported from .eml files, from the `cur` and `new` directories of a
+maildir or from mbox files.  They're queued to an own queue in bulk mode, see
+mrmailbox_new_bulk_imf_queue(), so they're parsed and decrypted in parallel and
+written in large transactions in the order they were read. */
+
+
+#define IMPORT_FOLDER "import"
+
+
+static void add_dir_files(mrarray_t* files, const char* dir_name, int eml_only)
+{
+	DIR*           dir_handle = NULL;
+	struct dirent* dir_entry = NULL;
+	char*          suffix = NULL;
+	int            is_eml;
+
+	if( (dir_handle=opendir(dir_name))==NULL ) {
+		return;
+	}
+
+	while( (dir_entry=readdir(dir_handle))!=NULL )
+	{
+		if( dir_entry->d_name[0] == '.' ) {
+			continue; /* `.`, `..` and hidden files as `.DS_Store` */
+		}
+
+		if( eml_only ) {
+			suffix = mr_get_filesuffix_lc(dir_entry->d_name);
+			is_eml = (suffix && strcmp(suffix, "eml")==0);
+			free(suffix);
+			if( !is_eml ) {
+				continue;
+			}
+		}
+
+		mrarray_add_ptr(files, mr_mprintf("%s/%s", dir_name, dir_entry->d_name));
+	}
+
+	closedir(dir_handle);
+}
+
+
+static int import_mbox(mrmailbox_t* mailbox, struct mrparsepool_t* queue, const char* filename)
+{
+	/* mbox files are read line by line, so also large files can be imported;
+	lines escaped as `>From ` (mboxrd) are unescaped */
+	int         imported_cnt = 0, prev_line_empty = 1, permille, last_permille = 0;
+	FILE*       file = NULL;
+	char*       line = NULL;
+	size_t      line_alloc = 0;
+	ssize_t     line_bytes;
+	const char* p;
+	uint64_t    total_bytes = mr_get_filebytes(filename), read_bytes = 0;
+	MMAPString* msg = mmap_string_new("");
+
+	if( (file=fopen(filename, "rb"))==NULL ) {
+		mrmailbox_log_error(mailbox, 0, "Import: Cannot open \"%s\".", filename);
+		goto cleanup;
+	}
+
+	while( (line_bytes=getline(&line, &line_alloc, file)) > 0 )
+	{
+		if( mr_shall_stop_ongoing ) {
+			goto cleanup;
+		}
+
+		read_bytes += line_bytes;
+
+		if( prev_line_empty && line_bytes >= 5 && strncmp(line, "From ", 5)==0 )
+		{
+			/* the separator line of the next message */
+			if( msg->len > 0 ) {
+				mrmailbox_queue_bulk_imf(queue, msg->str, msg->len, IMPORT_FOLDER, 0, 0);
+				mmap_string_truncate(msg, 0);
+				imported_cnt++;
+			}
+
+			permille = total_bytes? (int)((read_bytes*1000)/total_bytes) : 0;
+			if( permille < 10 )  { permille = 10; }
+			if( permille > 990 ) { permille = 990; }
+			if( permille >= last_permille+10 ) {
+				mrmailbox_send_event(mailbox, MR_EVENT_IMEX_PROGRESS, permille, 0);
+				last_permille = permille;
+			}
+
+			prev_line_empty = 0;
+			continue;
+		}
+
+		prev_line_empty = (line[0]=='\n' || (line[0]=='\r' && line[1]=='\n'));
+
+		for( p = line; *p == '>'; p++ ) {
+			;
+		}
+		p = (p > line && strncmp(p, "From ", 5)==0)? line+1 : line;
+		mmap_string_append_len(msg, p, line_bytes-(p-line));
+	}
+
+	if( msg->len > 0 ) {
+		mrmailbox_queue_bulk_imf(queue, msg->str, msg->len, IMPORT_FOLDER, 0, 0);
+		imported_cnt++;
+	}
+
+cleanup:
+	if( file ) { fclose(file); }
+	free(line);
+	mmap_string_free(msg);
+	return imported_cnt;
+}
+
+
+static int import_mails(mrmailbox_t* mailbox, const char* path)
+{
+	int        success = 0, imported_cnt = 0, processed_files_count = 0, total_files_count = 0, i;
+	mrarray_t* files = mrarray_new(mailbox, 256);
+	struct mrparsepool_t* queue = NULL;
+	char*      cur_dir = mr_mprintf("%s/cur", path);
+	char*      new_dir = mr_mprintf("%s/new", path);
+	char*      suffix = mr_get_filesuffix_lc(path);
+	struct stat st;
+	char*      buf = NULL;
+	size_t     buf_bytes = 0;
+
+	mrmailbox_log_info(mailbox, 0, "Import mails from \"%s\".", path);
+
+	queue = mrmailbox_new_bulk_imf_queue(mailbox);
+
+	if( mr_file_exist(cur_dir) && mr_file_exist(new_dir) ) {
+		add_dir_files(files, cur_dir, 0);
+		add_dir_files(files, new_dir, 0);
+	}
+	else if( stat(path, &st)==0 && S_ISDIR(st.st_mode) ) {
+		add_dir_files(files, path, 1);
+	}
+	else if( suffix && strcmp(suffix, "eml")==0 ) {
+		mrarray_add_ptr(files, safe_strdup(path));
+	}
+	else if( mr_file_exist(path) ) {
+		imported_cnt = import_mbox(mailbox, queue, path);
+	}
+	else {
+		mrmailbox_log_error(mailbox, 0, "Import: \"%s\" not found.", path);
+		goto cleanup;
+	}
+
+	mrarray_sort_strings(files); /* the names of maildir files start with the time of delivery */
+	total_files_count = mrarray_get_cnt(files);
+	for( i = 0; i < total_files_count; i++ )
+	{
+		if( mr_shall_stop_ongoing ) {
+			goto cleanup;
+		}
+
+		FILE_PROGRESS
+
+		free(buf);
+		buf = NULL;
+		if( !mr_read_file((const char*)mrarray_get_ptr(files, i), (void**)&buf, &buf_bytes, mailbox) ) {
+			continue; /* no abort on single errors, errors are logged in any case */
+		}
+
+		mrmailbox_queue_bulk_imf(queue, buf, buf_bytes, IMPORT_FOLDER, 0, 0);
+		imported_cnt++;
+	}
+
+	success = 1;
+
+cleanup:
+	mrmailbox_unref_bulk_imf_queue(queue); /* writes the pending messages */
+
+	mrmailbox_log_info(mailbox, 0, "Import: %i mails read from \"%s\".", imported_cnt, path);
+	if( imported_cnt > 0 ) {
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, 0, 0); /* no events are sent for the single messages in bulk mode */
+	}
+
+	mrarray_free_ptr(files);
+	mrarray_unref(files);
+	free(cur_dir);
+	free(new_dir);
+	free(suffix);
+	free(buf);
+	return success;
+}
+
+
 /*******************************************************************************
  * Import/Export Thread and Main Interface
  ******************************************************************************/
@@ -1177,6 +1373,11 @@ cleanup:
  * - **MR_IMEX_IMPORT_SELF_KEYS** (2) - Import private keys found in the directory given as `param1`.
  *   The last imported key is made the default keys unless its name contains the string `legacy`.  Public keys are not imported.
  *
+ * - **MR_IMEX_IMPORT_MAILS** (21) - Import mails from `param1`, which may be an `.eml` file, a directory
+ *   with `.eml` files, a maildir or an mbox file.  The mails are parsed and decrypted in parallel and
+ *   added as if they were received.  No events are sent for the single mails, only
+ *   #MR_EVENT_MSGS_CHANGED when done.  Secure-join handshakes found in the mails are ignored.
+ *
  * The function may take a long time until it finishes, so it might be a good idea to start it in a
  * separate thread. During its execution, the function sends out some events:
  *
@@ -1216,7 +1417,7 @@ int mrmailbox_imex(mrmailbox_t* mailbox, int what, const char* param1, const cha
 	}
 
 	mrmailbox_log_info(mailbox, 0, "Import/export process started.");
-	mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, 0, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_IMEX_PROGRESS, 0, 0);
 
 	if( !mrsqlite3_is_open(mailbox->m_sql) ) {
 		mrmailbox_log_error(mailbox, 0, "Import/export: Database not opened.");
@@ -1259,12 +1460,18 @@ int mrmailbox_imex(mrmailbox_t* mailbox, int what, const char* param1, const cha
 			}
 			break;
 
+		case MR_IMEX_IMPORT_MAILS:
+			if( !import_mails(mailbox, param1) ) {
+				goto cleanup;
+			}
+			break;
+
 		default:
 			goto cleanup;
 	}
 
 	success = 1;
-	mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, 1000, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_IMEX_PROGRESS, 1000, 0);
 
 cleanup:
 	mrmailbox_log_info(mailbox, 0, "Import/export process ended.");
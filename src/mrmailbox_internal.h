@@ -34,6 +34,7 @@ extern "C" {
 #include "mrsqlite3.h"
 #include "mrtools.h"
 #include "mrparam.h"
+#include "mrhash.h"
 #include "mrstock.h"
 #include "mrarray-private.h"
 #include "mrchat-private.h"
@@ -41,7 +42,11 @@ extern "C" {
 #include "mrlot-private.h"
 #include "mrmsg-private.h"
 #include "mrcontact-private.h"
+#include "mrengine.h"
 #include "mrmailbox-private.h"
+#include "mrmetrics.h"
+#include "mrlockprof.h"
+#include "mrtrace.h"
 
 
 #ifdef __cplusplus
@@ -33,40 +33,207 @@ are usually logged by mrmailbox_log_warning(). */
 #include <memory.h>
 #include "mrmailbox_internal.h"
 
+#undef mrmailbox_log_info    /* the macros check the log level before formatting, see mrmailbox-private.h */
+#undef mrmailbox_log_warning
+
 
 /*******************************************************************************
- * Get a unique thread ID to recognize log output from different threads
+ * Per-thread log rings
  ******************************************************************************/
 
 
-int mrmailbox_get_thread_index(void)
+/* The last log lines are kept for mrmailbox_get_info().  Each thread writes to
+its own ring, so writing a line needs neither a lock nor an allocation.  The
+lines of all mailboxes go to the same rings; they are told apart by
+mrmailbox_t::m_log_id.
+
+Rings are never freed; when a thread exits, its ring is taken over by the next
+new thread.  Readers may therefore access any ring at any time; a line is
+protected by a sequence counter that is odd while the owner writes the line
+and readers skip lines that changed while they were copied. */
+
+
+#define MR_LOG_RING_LINES  64
+#define MR_LOG_LINE_BYTES  256
+
+
+typedef struct mrlogline_t
+{
+	unsigned            m_seq;      /* odd while the line is written */
+	int                 m_log_id;   /* mrmailbox_t::m_log_id, 0 for unused lines */
+	uint64_t            m_serial;   /* orders the lines of all rings */
+	time_t              m_time;
+	char                m_text[MR_LOG_LINE_BYTES];
+} mrlogline_t;
+
+
+typedef struct mrlogring_t
 {
-	#define          MR_MAX_THREADS 32 /* if more threads are started, the full ID is printed (this may happen eg. on many failed connections so that we try to start a working thread several times) */
-	static pthread_t s_threadIds[MR_MAX_THREADS];
-	static int       s_threadIdsCnt = 0;
+	int                 m_thread_index;
+	int                 m_in_use;   /* 0 when the owning thread has exited */
+	unsigned            m_pos;      /* the line written next */
+	mrlogline_t         m_lines[MR_LOG_RING_LINES];
+	struct mrlogring_t* m_next;
+} mrlogring_t;
+
+
+static mrlogring_t*   s_rings = NULL;
+static int            s_rings_cnt = 0;
+static uint64_t       s_log_serial = 0;
+static int            s_log_ids = 0;
+static pthread_key_t  s_ring_key;
+static pthread_once_t s_ring_key_once = PTHREAD_ONCE_INIT;
+
+
+static void release_ring(void* ring)
+{
+	__atomic_store_n(&((mrlogring_t*)ring)->m_in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+static void create_ring_key(void)
+{
+	pthread_key_create(&s_ring_key, release_ring);
+}
+
+
+static mrlogring_t* get_ring(void)
+{
+	mrlogring_t* ring;
+	int          expected;
+
+	pthread_once(&s_ring_key_once, create_ring_key);
 
-	int       i;
-	pthread_t self = pthread_self();
+	if( (ring=(mrlogring_t*)pthread_getspecific(s_ring_key)) != NULL ) {
+		return ring;
+	}
 
-	if( s_threadIdsCnt==0 ) {
-		for( i = 0; i < MR_MAX_THREADS; i++ ) {
-			s_threadIds[i] = 0;
+	/* take over the ring of an exited thread, if any ... */
+	for( ring = __atomic_load_n(&s_rings, __ATOMIC_ACQUIRE); ring; ring = ring->m_next ) {
+		expected = 0;
+		if( __atomic_compare_exchange_n(&ring->m_in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+			pthread_setspecific(s_ring_key, ring);
+			return ring;
 		}
 	}
 
-	for( i = 0; i < s_threadIdsCnt; i++ ) {
-		if( s_threadIds[i] == self ) {
-			return i+1;
+	/* ... or add a new one */
+	if( (ring=calloc(1, sizeof(mrlogring_t)))==NULL ) {
+		exit(52); /* cannot allocate little memory, unrecoverable error */
+	}
+	ring->m_in_use       = 1;
+	ring->m_thread_index = __atomic_add_fetch(&s_rings_cnt, 1, __ATOMIC_RELAXED);
+	ring->m_next         = __atomic_load_n(&s_rings, __ATOMIC_RELAXED);
+	while( !__atomic_compare_exchange_n(&s_rings, &ring->m_next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) ) {
+		;
+	}
+
+	pthread_setspecific(s_ring_key, ring);
+	return ring;
+}
+
+
+static void ring_add(int log_id, const char* text)
+{
+	mrlogring_t* ring = get_ring();
+	mrlogline_t* line = &ring->m_lines[ring->m_pos % MR_LOG_RING_LINES];
+	unsigned     seq  = line->m_seq;
+	size_t       text_bytes;
+
+	ring->m_pos++;
+
+	__atomic_store_n(&line->m_seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		__atomic_store_n(&line->m_log_id, log_id, __ATOMIC_RELAXED);
+		line->m_serial = __atomic_add_fetch(&s_log_serial, 1, __ATOMIC_RELAXED);
+		line->m_time   = time(NULL);
+		text_bytes     = strnlen(text, MR_LOG_LINE_BYTES-1); /* truncate long lines, copying just the bytes needed */
+		memcpy(line->m_text, text, text_bytes);
+		line->m_text[text_bytes] = 0;
+
+	__atomic_store_n(&line->m_seq, seq+2, __ATOMIC_RELEASE);
+}
+
+
+static int compare_lines(const void* p1, const void* p2)
+{
+	const mrlogline_t* l1 = (const mrlogline_t*)p1;
+	const mrlogline_t* l2 = (const mrlogline_t*)p2;
+	return l1->m_serial < l2->m_serial? -1 : (l1->m_serial > l2->m_serial? 1 : 0);
+}
+
+
+/**
+ * Get the last log lines of the mailbox, one line per log event, prefixed
+ * by the time.
+ *
+ * @private @memberof mrmailbox_t
+ */
+char* mrmailbox_get_log_excerpt(mrmailbox_t* mailbox, int max_lines)
+{
+	mrstrbuilder_t ret;
+	mrlogring_t*   ring;
+	mrlogline_t*   lines = NULL;
+	int            lines_cnt = 0, lines_max = 0, i;
+	unsigned       seq;
+
+	mrstrbuilder_init(&ret, 0);
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
+		return ret.m_buf;
+	}
+
+	/* copy the lines of the mailbox from all rings; take care not to log here! */
+	lines_max = __atomic_load_n(&s_rings_cnt, __ATOMIC_ACQUIRE) * MR_LOG_RING_LINES;
+	if( lines_max > 0 && (lines=malloc(sizeof(mrlogline_t)*lines_max))==NULL ) {
+		exit(53);
+	}
+
+	for( ring = __atomic_load_n(&s_rings, __ATOMIC_ACQUIRE); ring && lines_cnt < lines_max; ring = ring->m_next )
+	{
+		for( i = 0; i < MR_LOG_RING_LINES && lines_cnt < lines_max; i++ )
+		{
+			mrlogline_t* line = &ring->m_lines[i];
+			if( ((seq=__atomic_load_n(&line->m_seq, __ATOMIC_ACQUIRE)) & 1) || __atomic_load_n(&line->m_log_id, __ATOMIC_RELAXED) != mailbox->m_log_id ) {
+				continue;
+			}
+
+			memcpy(&lines[lines_cnt], line, sizeof(mrlogline_t));
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if( __atomic_load_n(&line->m_seq, __ATOMIC_RELAXED) == seq && lines[lines_cnt].m_log_id == mailbox->m_log_id ) {
+				lines[lines_cnt].m_text[MR_LOG_LINE_BYTES-1] = 0;
+				lines_cnt++;
+			}
 		}
 	}
 
-	if( s_threadIdsCnt >= MR_MAX_THREADS ) {
-		return (int)(self); /* Fallback, this may happen, see comment above */
+	qsort(lines, lines_cnt, sizeof(mrlogline_t), compare_lines);
+
+	for( i = lines_cnt>max_lines? lines_cnt-max_lines : 0; i < lines_cnt; i++ )
+	{
+		struct tm wanted_struct;
+		char      temp[32];
+		localtime_r(&lines[i].m_time, &wanted_struct);
+		snprintf(temp, sizeof(temp), "\n%02i:%02i:%02i ", (int)wanted_struct.tm_hour, (int)wanted_struct.tm_min, (int)wanted_struct.tm_sec);
+		mrstrbuilder_cat(&ret, temp);
+		mrstrbuilder_cat(&ret, lines[i].m_text);
 	}
 
-	s_threadIds[s_threadIdsCnt] = self;
-	s_threadIdsCnt++;
-	return s_threadIdsCnt;
+	free(lines);
+	return ret.m_buf;
+}
+
+
+/*******************************************************************************
+ * Get a unique thread ID to recognize log output from different threads
+ ******************************************************************************/
+
+
+int mrmailbox_get_thread_index(void)
+{
+	return get_ring()->m_thread_index;
 }
 
 
@@ -75,55 +242,89 @@ int mrmailbox_get_thread_index(void)
  ******************************************************************************/
 
 
-static void mrmailbox_log_vprintf(mrmailbox_t* mailbox, int event, int code, const char* msg_format, va_list va)
+void mrmailbox_init_log(mrmailbox_t* mailbox)
 {
-	char* msg = NULL;
+	mailbox->m_log_level = MR_EVENT_INFO;
+	mailbox->m_log_id    = __atomic_add_fetch(&s_log_ids, 1, __ATOMIC_RELAXED);
+}
+
 
+/**
+ * Set the minimal level of the events that are logged.  Log events below this
+ * level are dropped before the message is formatted, they are neither sent to
+ * the callback nor shown by mrmailbox_get_info().
+ *
+ * If the library is compiled with MR_NO_INFO_LOG defined, #MR_EVENT_INFO is
+ * never sent.
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @param min_event #MR_EVENT_INFO to log everything (default),
+ *     #MR_EVENT_WARNING to log warnings and errors or #MR_EVENT_ERROR to log
+ *     errors only.
+ *
+ * @return None.
+ */
+void mrmailbox_set_log_level(mrmailbox_t* mailbox, int min_event)
+{
 	if( mailbox==NULL || mailbox->m_magic != MR_MAILBOX_MAGIC ) {
 		return;
 	}
 
+	mailbox->m_log_level = min_event > MR_EVENT_ERROR? MR_EVENT_ERROR : min_event;
+}
+
+
+static void mrmailbox_log_vprintf(mrmailbox_t* mailbox, int event, int code, const char* msg_format, va_list va)
+{
+	#define BUFSIZE 1024
+	char  msg[BUFSIZE];
+	char* stock_str = NULL;
+	int   prefix_len = 0;
+
+	if( mailbox==NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || event < mailbox->m_log_level ) {
+		return;
+	}
+
+	/* prefix the message by the thread-id? we do this for non-errros that are normally only logged (for the few errros, the thread should be clear (enough)) */
+	if( event != MR_EVENT_ERROR ) {
+		prefix_len = snprintf(msg, BUFSIZE, "T%i: ", mrmailbox_get_thread_index());
+	}
+
 	/* format message from variable parameters or translate very comming errors */
 	if( code == MR_ERR_SELF_NOT_IN_GROUP )
 	{
-		msg = mrstock_str(MR_STR_SELFNOTINGRP);
+		stock_str = mrstock_str(MR_STR_SELFNOTINGRP);
 	}
 	else if( code == MR_ERR_NONETWORK )
 	{
-		msg = mrstock_str(MR_STR_NONETWORK);
+		stock_str = mrstock_str(MR_STR_NONETWORK);
 	}
-	else if( msg_format )
+
+	if( stock_str )
 	{
-		#define BUFSIZE 1024
-		char tempbuf[BUFSIZE+1];
-		vsnprintf(tempbuf, BUFSIZE, msg_format, va);
-		msg = safe_strdup(tempbuf);
+		snprintf(msg+prefix_len, BUFSIZE-prefix_len, "%s", stock_str);
+		free(stock_str);
 	}
-
-	/* if we have still no message, create one based upon  the code */
-	if( msg == NULL ) {
-		     if( event == MR_EVENT_INFO )    { msg = mr_mprintf("Info: %i",    (int)code); }
-		else if( event == MR_EVENT_WARNING ) { msg = mr_mprintf("Warning: %i", (int)code); }
-		else                                 { msg = mr_mprintf("Error: %i",   (int)code); }
+	else if( msg_format )
+	{
+		vsnprintf(msg+prefix_len, BUFSIZE-prefix_len, msg_format, va);
 	}
-
-	/* prefix the message by the thread-id? we do this for non-errros that are normally only logged (for the few errros, the thread should be clear (enough)) */
-	if( event != MR_EVENT_ERROR ) {
-		char* temp = msg;
-		msg = mr_mprintf("T%i: %s", (int)mrmailbox_get_thread_index(), temp);
-		free(temp);
+	else
+	{
+		/* if we have still no message, create one based upon  the code */
+		     if( event == MR_EVENT_INFO )    { snprintf(msg+prefix_len, BUFSIZE-prefix_len, "Info: %i",    (int)code); }
+		else if( event == MR_EVENT_WARNING ) { snprintf(msg+prefix_len, BUFSIZE-prefix_len, "Warning: %i", (int)code); }
+		else                                 { snprintf(msg+prefix_len, BUFSIZE-prefix_len, "Error: %i",   (int)code); }
 	}
 
 	/* finally, log */
-	mailbox->m_cb(mailbox, event, (uintptr_t)code, (uintptr_t)msg);
+	mrmailbox_send_event(mailbox, event, (uintptr_t)code, (uintptr_t)msg);
 
 	/* remember the last N log entries */
-	pthread_mutex_lock(&mailbox->m_log_ringbuf_critical);
-		free(mailbox->m_log_ringbuf[mailbox->m_log_ringbuf_pos]);
-		mailbox->m_log_ringbuf[mailbox->m_log_ringbuf_pos] = msg;
-		mailbox->m_log_ringbuf_times[mailbox->m_log_ringbuf_pos] = time(NULL);
-		mailbox->m_log_ringbuf_pos = (mailbox->m_log_ringbuf_pos+1) % MR_LOG_RINGBUF_SIZE;
-	pthread_mutex_unlock(&mailbox->m_log_ringbuf_critical);
+	ring_add(mailbox->m_log_id, msg);
 }
 
 
@@ -20,12 +20,14 @@
  ******************************************************************************/
 
 
+#include <unistd.h> /* for sysconf() */
 #include "mrmailbox_internal.h"
 #include "mrmimeparser.h"
 #include "mrmimefactory.h"
 #include "mrimap.h"
 #include "mrjob.h"
 #include "mrarray-private.h"
+#include "mrosnative.h"
 #include <netpgp-extra.h>
 
 
@@ -271,6 +273,124 @@ static int mrmailbox_is_reply_to_messenger_message__(mrmailbox_t* mailbox, mrmim
 }
 
 
+/*******************************************************************************
+ * Check from the header if a message is needed in chat-only mode
+ ******************************************************************************/
+
+
+static int is_referenced_rfc724_mid_in_list__(mrmailbox_t* mailbox, const clist* mid_list)
+{
+	return is_known_rfc724_mid_in_list__(mailbox, mid_list) || is_msgrmsg_rfc724_mid_in_list__(mailbox, mid_list);
+}
+
+
+static int is_chat_sender__(mrmailbox_t* mailbox, const struct mailimf_mailbox_list* mb_list)
+{
+	/* check if the sender is ourself or a known, not blocked contact */
+	int        ret = 0;
+	char*      self_addr = mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", "");
+	clistiter* cur;
+
+	for( cur = clist_begin(mb_list->mb_list); cur!=NULL && !ret; cur=clist_next(cur) ) {
+		struct mailimf_mailbox* mb = (struct mailimf_mailbox*)clist_content(cur);
+		if( mb && mb->mb_addr_spec ) {
+			if( strcasecmp(mb->mb_addr_spec, self_addr)==0 ) {
+				ret = 1;
+			}
+			else {
+				sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_inao_FROM_contacts_a,
+					"SELECT id, name, addr, origin, authname, blocked FROM contacts WHERE addr=? COLLATE NOCASE;");
+				sqlite3_bind_text(stmt, 1, (const char*)mb->mb_addr_spec, -1, SQLITE_STATIC);
+				if( sqlite3_step(stmt) == SQLITE_ROW
+				 && sqlite3_column_int(stmt, 3) >= MR_ORIGIN_MIN_VERIFIED
+				 && sqlite3_column_int(stmt, 5) == 0 ) {
+					ret = 1;
+				}
+			}
+		}
+	}
+
+	free(self_addr);
+	return ret;
+}
+
+
+/**
+ * Check if a message has to be downloaded completely in chat-only mode, see
+ * the config-option `chat_only` at mrmailbox_set_config().  The function gets
+ * the header fields fetched by mrimap_t and returns 0 for messages that would
+ * only end up in the deaddrop or in the trash; these messages are not
+ * downloaded at all.
+ *
+ * Messages are needed if they are sent by a messenger, if they're Autocrypt
+ * Setup Messages or MDNs, if they reference a message in the database or if
+ * they're sent by ourself or by a known contact.
+ *
+ * @private @memberof mrmailbox_t
+ */
+int mrmailbox_precheck_imf(mrmailbox_t* mailbox, const char* imf_header_not_terminated, size_t imf_header_bytes)
+{
+	int                    needed = 1; /* if in doubt, download the message */
+	size_t                 dummy = 0;
+	struct mailimf_fields* fields = NULL;
+	clistiter*             cur;
+
+	if( mailbox == NULL || imf_header_not_terminated == NULL || imf_header_bytes == 0 ) {
+		goto cleanup;
+	}
+
+	if( mailimf_envelope_and_optional_fields_parse(imf_header_not_terminated, imf_header_bytes, &dummy, &fields)!=MAILIMF_NO_ERROR || fields == NULL ) {
+		goto cleanup;
+	}
+
+	needed = 0;
+
+	/* check the headers that need no database access first */
+	for( cur = clist_begin(fields->fld_list); cur!=NULL && !needed; cur=clist_next(cur) ) {
+		struct mailimf_field* field = (struct mailimf_field*)clist_content(cur);
+		if( field && field->fld_type == MAILIMF_FIELD_OPTIONAL_FIELD && field->fld_data.fld_optional_field ) {
+			const char* name  = field->fld_data.fld_optional_field->fld_name;
+			const char* value = field->fld_data.fld_optional_field->fld_value;
+			if( name ) {
+				if( strcasecmp(name, "Chat-Version")==0 || strcasecmp(name, "X-MrMsg")==0
+				 || strcasecmp(name, "Autocrypt-Setup-Message")==0 ) {
+					needed = 1;
+				}
+				else if( strcasecmp(name, "Content-Type")==0 && value && strncasecmp(value, "multipart/report", 16)==0 ) {
+					needed = 1; /* MDNs may not reference the original message in the header */
+				}
+			}
+		}
+	}
+
+	if( !needed ) {
+		mrsqlite3_lock(mailbox->m_sql);
+			for( cur = clist_begin(fields->fld_list); cur!=NULL && !needed; cur=clist_next(cur) ) {
+				struct mailimf_field* field = (struct mailimf_field*)clist_content(cur);
+				if( field == NULL ) {
+					continue;
+				}
+				if( field->fld_type == MAILIMF_FIELD_IN_REPLY_TO && field->fld_data.fld_in_reply_to ) {
+					needed = is_referenced_rfc724_mid_in_list__(mailbox, field->fld_data.fld_in_reply_to->mid_list);
+				}
+				else if( field->fld_type == MAILIMF_FIELD_REFERENCES && field->fld_data.fld_references ) {
+					needed = is_referenced_rfc724_mid_in_list__(mailbox, field->fld_data.fld_references->mid_list);
+				}
+				else if( field->fld_type == MAILIMF_FIELD_FROM && field->fld_data.fld_from && field->fld_data.fld_from->frm_mb_list ) {
+					needed = is_chat_sender__(mailbox, field->fld_data.fld_from->frm_mb_list);
+				}
+			}
+		mrsqlite3_unlock(mailbox->m_sql);
+	}
+
+cleanup:
+	if( fields ) {
+		mailimf_fields_free(fields);
+	}
+	return needed;
+}
+
+
 /*******************************************************************************
  * Misc. Tools
  ******************************************************************************/
@@ -578,7 +698,7 @@ static void create_or_lookup_adhoc_group__(mrmailbox_t* mailbox, mrmimeparser_t*
 		mrmailbox_add_contact_to_chat__(mailbox, chat_id, mrarray_get_id(member_ids, i));
 	}
 
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 cleanup:
 	mrarray_unref(member_ids);
@@ -748,7 +868,7 @@ static void create_or_lookup_group__(mrmailbox_t* mailbox, mrmimeparser_t* mime_
 		sqlite3_bind_int (stmt, 2, chat_id);
 		sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
-		mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 	}
 
 	if( X_MrGrpImageChanged )
@@ -817,7 +937,7 @@ static void create_or_lookup_group__(mrmailbox_t* mailbox, mrmimeparser_t* mime_
 	}
 
 	if( send_EVENT_CHAT_MODIFIED ) {
-		mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 	}
 
 	/* check the number of receivers -
@@ -845,8 +965,10 @@ cleanup:
  ******************************************************************************/
 
 
-void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
-                           const char* server_folder, uint32_t server_uid, uint32_t flags)
+static void receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                        const char* server_folder, uint32_t server_uid, uint32_t flags,
+                        mrmimeparser_t* parsed /*may be NULL; if set, the function takes ownership of the object*/,
+                        int bulk /*if set, the caller holds the database lock and a transaction; no events are sent*/)
 {
 	/* the function returns the number of created messages in the database */
 	int              incoming = 0;
@@ -871,8 +993,9 @@ void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_termina
 	time_t           sort_timestamp = MR_INVALID_TIMESTAMP;
 	time_t           sent_timestamp = MR_INVALID_TIMESTAMP;
 	time_t           rcvd_timestamp = MR_INVALID_TIMESTAMP;
-	mrmimeparser_t*  mime_parser = mrmimeparser_new(mailbox->m_blobdir, mailbox);
+	mrmimeparser_t*  mime_parser = parsed? parsed : mrmimeparser_new(mailbox->m_blobdir, mailbox);
 	int              db_locked = 0;
+	uint64_t         db_start_us = 0;
 	int              transaction_pending = 0;
 	const struct mailimf_field* field;
 
@@ -889,6 +1012,9 @@ void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_termina
 
 	mrmailbox_log_info(mailbox, 0, "Receiving message %s/%lu...", server_folder? server_folder:"?", server_uid);
 
+	mrmetrics_count(mailbox, MR_CNT_MSGS_RECEIVED, 1);
+	MR_TRACE_BEGIN(mailbox, "receive_imf", "\"uid\":%lu", (unsigned long)server_uid);
+
 	to_ids = mrarray_new(mailbox, 16);
 	if( to_ids==NULL || created_db_entries==NULL || rr_event_to_send==NULL || mime_parser == NULL ) {
 		mrmailbox_log_info(mailbox, 0, "Bad param.");
@@ -907,7 +1033,10 @@ void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_termina
 	normally, this is done by mailimf_message_parse(), however, as we also need the MIME data,
 	we use mailmime_parse() through MrMimeParser (both call mailimf_struct_multiple_parse() somewhen, I did not found out anything
 	that speaks against this approach yet) */
-	mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
+	if( parsed == NULL ) {
+		mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
+	}
+
 	if( mrhash_count(&mime_parser->m_header)==0 ) {
 		mrmailbox_log_info(mailbox, 0, "No header.");
 		goto cleanup; /* Error - even adding an empty record won't help as we do not know the message ID */
@@ -927,7 +1056,11 @@ void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_termina
 		incoming = 1;
 	}
 
-	mrsqlite3_lock(mailbox->m_sql);
+	db_start_us = mrmetrics_now_us();
+	MR_TRACE_BEGIN(mailbox, "receive_imf_db", NULL);
+	if( !bulk ) {
+		mrsqlite3_lock(mailbox->m_sql);
+	}
 	db_locked = 1;
 	mrsqlite3_begin_transaction__(mailbox->m_sql);
 	transaction_pending = 1;
@@ -1393,14 +1526,19 @@ void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_termina
 
 cleanup:
 	if( transaction_pending ) { mrsqlite3_rollback__(mailbox->m_sql); }
-	if( db_locked ) { mrsqlite3_unlock(mailbox->m_sql); }
+	if( db_locked ) { if( !bulk ) { mrsqlite3_unlock(mailbox->m_sql); } mrmetrics_add_time(mailbox, MR_HIST_RECEIVE_DB, db_start_us); MR_TRACE_END(mailbox, "receive_imf_db", NULL); }
 
-	if( is_handshake_message ) {
+	if( bulk ) {
+		if( is_handshake_message ) {
+			mrmailbox_log_info(mailbox, 0, "Handshake message not handled in bulk mode.");
+		}
+	}
+	else if( is_handshake_message ) {
 		mrmailbox_handle_securejoin_handshake(mailbox, mime_parser, chat_id); /* must be called after unlocking before deletion of mime_parser */
 	}
 	else if( mime_parser->m_degrade_event ) {
-		mailbox->m_cb(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, degrade_msg_id);
-		mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_MSGS_CHANGED, chat_id, degrade_msg_id);
+		mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 	}
 
 	mrmimeparser_unref(mime_parser);
@@ -1408,22 +1546,501 @@ cleanup:
 	mrarray_unref(to_ids);
 
 	if( created_db_entries ) {
-		if( create_event_to_send ) {
+		if( create_event_to_send && !bulk ) {
 			size_t i, icnt = carray_count(created_db_entries);
 			for( i = 0; i < icnt; i += 2 ) {
-				mailbox->m_cb(mailbox, create_event_to_send, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
+				mrmailbox_send_event(mailbox, create_event_to_send, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
 			}
 		}
 		carray_free(created_db_entries);
 	}
 
 	if( rr_event_to_send ) {
-		size_t i, icnt = carray_count(rr_event_to_send);
+		size_t i, icnt = bulk? 0 : carray_count(rr_event_to_send);
 		for( i = 0; i < icnt; i += 2 ) {
-			mailbox->m_cb(mailbox, MR_EVENT_MSG_READ, (uintptr_t)carray_get(rr_event_to_send, i), (uintptr_t)carray_get(rr_event_to_send, i+1));
+			mrmailbox_send_event(mailbox, MR_EVENT_MSG_READ, (uintptr_t)carray_get(rr_event_to_send, i), (uintptr_t)carray_get(rr_event_to_send, i+1));
 		}
 		carray_free(rr_event_to_send);
 	}
 
 	free(txt_raw);
+
+	MR_TRACE_END(mailbox, "receive_imf", "\"msg_id\":%lu,\"chat_id\":%lu", (unsigned long)first_dblocal_id, (unsigned long)chat_id);
+}
+
+
+void mrmailbox_receive_imf(mrmailbox_t* mailbox, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                           const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags, NULL, 0);
+}
+
+
+/*******************************************************************************
+ * Parse and decrypt fetched messages in parallel
+ ******************************************************************************/
+
+
+/* Parsing a message includes decryption and signature checks which may take
+some time.  When the IMAP thread fetches several messages, they're queued using
+mrmailbox_queue_imf() and parsed by a small pool of worker threads.  The
+parsed results are written to the database in the order they were queued by
+the queueing thread itself; so the database has still only one writer.
+
+If the mailbox uses an engine, the messages are parsed by tasks on the
+worker threads of the engine instead; as the queueing thread may be a worker
+itself, it parses pending messages on its own instead of waiting for them.
+
+Decryption may update the peerstates of the senders, this is done by the
+workers and may happen in a different order than the messages are written;
+mrapeerstate_apply_header() compares the message timestamps, so this is fine.
+
+Imported messages use an own queue in bulk mode, see mrmailbox_new_bulk_imf_queue(),
+so fetched messages are not held back by an import running at the same time. */
+
+
+#define MR_PARSE_THREADS_MAX    4
+#define MR_BULK_TRANSACTION_MAX 250 /* messages written in one transaction in bulk mode, see mrmailbox_new_bulk_imf_queue() */
+
+
+typedef struct mrparsejob_t
+{
+	char*                m_imf_raw;
+	size_t               m_imf_raw_bytes;
+	char*                m_server_folder;
+	uint32_t             m_server_uid;
+	uint32_t             m_flags;
+
+	mrmimeparser_t*      m_mime_parser; /* set by the worker */
+	int                  m_done;
+
+	struct mrparsejob_t* m_next;
+} mrparsejob_t;
+
+
+typedef struct mrparsepool_t
+{
+	mrmailbox_t*         m_mailbox;
+	int                  m_bulk;        /* set on creation, see mrmailbox_new_bulk_imf_queue() */
+
+	pthread_mutex_t      m_mutex;
+	pthread_cond_t       m_job_cond;    /* signalled when a job is added or the workers should exit */
+	pthread_cond_t       m_done_cond;   /* signalled when a job is parsed */
+	pthread_mutex_t      m_write_mutex; /* held while the parsed jobs are written to the database */
+
+	pthread_t            m_threads[MR_PARSE_THREADS_MAX];
+	int                  m_threads_cnt;
+	int                  m_do_exit;
+
+	mrparsejob_t*        m_first;       /* all pending jobs in the order they were queued */
+	mrparsejob_t*        m_last;
+	mrparsejob_t*        m_next_to_parse;
+	int                  m_pending_cnt;
+
+	mrengineowner_t      m_engine_owner; /* the parse tasks, if the mailbox uses an engine */
+} mrparsepool_t;
+
+
+static void mrparsejob_free(mrparsejob_t* job)
+{
+	if( job == NULL ) {
+		return;
+	}
+
+	mrmimeparser_unref(job->m_mime_parser);
+	free(job->m_imf_raw);
+	free(job->m_server_folder);
+	free(job);
+}
+
+
+/* must be called with m_mutex locked, returns NULL if all jobs are taken by a worker */
+static mrparsejob_t* claim_next_job__(mrparsepool_t* pool)
+{
+	mrparsejob_t* job = pool->m_next_to_parse;
+	if( job ) {
+		pool->m_next_to_parse = job->m_next;
+	}
+	return job;
+}
+
+
+static void parse_job(mrparsepool_t* pool, mrparsejob_t* job)
+{
+	mrmailbox_t* mailbox = pool->m_mailbox;
+
+	job->m_mime_parser = mrmimeparser_new(mailbox->m_blobdir, mailbox);
+	MR_TRACE_BEGIN(mailbox, "parse_job", "\"uid\":%lu", (unsigned long)job->m_server_uid);
+		mrmimeparser_parse(job->m_mime_parser, job->m_imf_raw, job->m_imf_raw_bytes);
+	MR_TRACE_END(mailbox, "parse_job", NULL);
+
+	pthread_mutex_lock(&pool->m_mutex);
+		job->m_done = 1;
+		pthread_cond_broadcast(&pool->m_done_cond);
+	pthread_mutex_unlock(&pool->m_mutex);
+}
+
+
+static void* parse_thread_entry_point(void* entry_arg)
+{
+	mrparsepool_t* pool = (mrparsepool_t*)entry_arg;
+	mrparsejob_t*  job;
+
+	mrosnative_setup_thread(pool->m_mailbox);
+
+	while( 1 )
+	{
+		pthread_mutex_lock(&pool->m_mutex);
+			while( pool->m_next_to_parse == NULL && !pool->m_do_exit ) {
+				pthread_cond_wait(&pool->m_job_cond, &pool->m_mutex);
+			}
+
+			if( pool->m_do_exit ) {
+				pthread_mutex_unlock(&pool->m_mutex);
+				break;
+			}
+
+			job = claim_next_job__(pool);
+		pthread_mutex_unlock(&pool->m_mutex);
+
+		parse_job(pool, job);
+	}
+
+	mrosnative_unsetup_thread(pool->m_mailbox);
+	return NULL;
+}
+
+
+static void parse_task(void* arg)
+{
+	/* one task is submitted per queued job; the task may parse another job than the one it was submitted for */
+	mrparsepool_t* pool = (mrparsepool_t*)arg;
+	mrparsejob_t*  job = NULL;
+
+	pthread_mutex_lock(&pool->m_mutex);
+		if( !pool->m_do_exit ) {
+			job = claim_next_job__(pool);
+		}
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	if( job ) {
+		parse_job(pool, job);
+	}
+}
+
+
+/* write parsed jobs in the order they were queued until there are no more than max_pending jobs left */
+static void write_parsed_jobs(mrparsepool_t* pool, int max_pending)
+{
+	mrmailbox_t*   mailbox = pool->m_mailbox;
+	mrparsejob_t*  job;
+	mrparsejob_t*  batch;
+	mrparsejob_t*  batch_last;
+	int            batch_cnt, bulk;
+
+	pthread_mutex_lock(&pool->m_write_mutex);
+	pthread_mutex_lock(&pool->m_mutex);
+
+		while( pool->m_first )
+		{
+			if( pool->m_bulk && pool->m_pending_cnt <= max_pending ) {
+				break; /* in bulk mode, wait until there are enough messages for a large transaction */
+			}
+
+			if( !pool->m_first->m_done ) {
+				if( pool->m_pending_cnt <= max_pending ) {
+					break;
+				}
+				if( (mailbox->m_engine || pool->m_bulk) && (job=claim_next_job__(pool))!=NULL ) {
+					pthread_mutex_unlock(&pool->m_mutex);
+						parse_job(pool, job); /* do not block a worker of the engine while the other workers are busy; in bulk mode, help the workers */
+					pthread_mutex_lock(&pool->m_mutex);
+					continue;
+				}
+				pthread_cond_wait(&pool->m_done_cond, &pool->m_mutex);
+				continue;
+			}
+
+			/* take the parsed jobs from the head; in bulk mode, they're written in one transaction */
+			bulk = pool->m_bulk;
+			batch = NULL;
+			batch_last = NULL;
+			batch_cnt = 0;
+			while( pool->m_first && pool->m_first->m_done && batch_cnt < (bulk? MR_BULK_TRANSACTION_MAX : 1) ) {
+				job = pool->m_first;
+				pool->m_first = job->m_next;
+				if( pool->m_first == NULL ) {
+					pool->m_last = NULL;
+				}
+				pool->m_pending_cnt--;
+
+				job->m_next = NULL;
+				if( batch_last ) {
+					batch_last->m_next = job;
+				}
+				else {
+					batch = job;
+				}
+				batch_last = job;
+				batch_cnt++;
+			}
+
+			pthread_mutex_unlock(&pool->m_mutex);
+
+				if( bulk ) {
+					mrsqlite3_lock(mailbox->m_sql);
+					mrsqlite3_begin_transaction__(mailbox->m_sql);
+				}
+
+				while( batch ) {
+					job = batch;
+					batch = job->m_next;
+					receive_imf(mailbox, job->m_imf_raw, job->m_imf_raw_bytes, job->m_server_folder, job->m_server_uid, job->m_flags, job->m_mime_parser, bulk);
+					job->m_mime_parser = NULL; /* owned by receive_imf() */
+					mrparsejob_free(job);
+				}
+
+				if( bulk ) {
+					mrsqlite3_commit__(mailbox->m_sql);
+					mrsqlite3_unlock(mailbox->m_sql);
+				}
+
+			pthread_mutex_lock(&pool->m_mutex);
+		}
+
+	pthread_mutex_unlock(&pool->m_mutex);
+	pthread_mutex_unlock(&pool->m_write_mutex);
+}
+
+
+static mrparsepool_t* parsepool_new(mrmailbox_t* mailbox, int bulk)
+{
+	mrparsepool_t* pool = NULL;
+
+	if( (pool=calloc(1, sizeof(mrparsepool_t)))==NULL ) {
+		exit(43); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	pool->m_mailbox = mailbox;
+	pool->m_bulk    = bulk;
+	pthread_mutex_init(&pool->m_mutex, NULL);
+	pthread_cond_init(&pool->m_job_cond, NULL);
+	pthread_cond_init(&pool->m_done_cond, NULL);
+	pthread_mutex_init(&pool->m_write_mutex, NULL);
+
+	return pool;
+}
+
+
+static void parsepool_unref(mrparsepool_t* pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->m_mutex);
+		pool->m_do_exit = 1;
+		pthread_cond_broadcast(&pool->m_job_cond);
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	for( i = 0; i < pool->m_threads_cnt; i++ ) {
+		pthread_join(pool->m_threads[i], NULL);
+	}
+	mrengine_drain(pool->m_mailbox->m_engine, &pool->m_engine_owner);
+
+	/* normally, the queue is flushed before; messages still pending here are fetched again on the next start */
+	while( pool->m_first ) {
+		mrparsejob_t* job = pool->m_first;
+		pool->m_first = job->m_next;
+		mrparsejob_free(job);
+	}
+
+	pthread_mutex_destroy(&pool->m_mutex);
+	pthread_cond_destroy(&pool->m_job_cond);
+	pthread_cond_destroy(&pool->m_done_cond);
+	pthread_mutex_destroy(&pool->m_write_mutex);
+	free(pool);
+}
+
+
+static void parsepool_queue(mrparsepool_t* pool, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                            const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	mrmailbox_t*   mailbox = pool->m_mailbox;
+	mrparsejob_t*  job = NULL;
+	int            max_pending = 0;
+
+	pthread_mutex_lock(&pool->m_mutex);
+		if( pool->m_threads_cnt == 0 && !pool->m_do_exit && mailbox->m_engine == NULL ) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			int  wanted = cpus < 2? 0 : (cpus > MR_PARSE_THREADS_MAX? MR_PARSE_THREADS_MAX : (int)cpus);
+			while( pool->m_threads_cnt < wanted ) {
+				if( pthread_create(&pool->m_threads[pool->m_threads_cnt], NULL, parse_thread_entry_point, pool) != 0 ) {
+					break;
+				}
+				pool->m_threads_cnt++;
+			}
+			pool->m_threads_cnt = pool->m_threads_cnt? pool->m_threads_cnt : -1; /* -1: do not try over */
+		}
+		max_pending = mailbox->m_engine? mrengine_get_threads(mailbox->m_engine)*2 : pool->m_threads_cnt*2;
+		if( pool->m_bulk ) {
+			max_pending = MR_BULK_TRANSACTION_MAX; /* even without workers, the queueing thread parses the messages */
+		}
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	if( flags&MR_IMAP_LARGE ) {
+		/* do not copy large messages mapped from the spool file, parse them after the messages queued before */
+		write_parsed_jobs(pool, 0);
+		max_pending = 0;
+	}
+
+	if( max_pending <= 0 ) {
+		receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags, NULL, 0);
+		return;
+	}
+
+	/* the IMAP buffer is freed after returning, so copy the message */
+	if( (job=calloc(1, sizeof(mrparsejob_t)))==NULL
+	 || (job->m_imf_raw=malloc(imf_raw_bytes+1))==NULL ) {
+		exit(44); /* cannot allocate memory, unrecoverable error */
+	}
+	memcpy(job->m_imf_raw, imf_raw_not_terminated, imf_raw_bytes);
+	job->m_imf_raw[imf_raw_bytes] = 0;
+	job->m_imf_raw_bytes = imf_raw_bytes;
+	job->m_server_folder = safe_strdup(server_folder);
+	job->m_server_uid    = server_uid;
+	job->m_flags         = flags;
+
+	pthread_mutex_lock(&pool->m_mutex);
+		if( pool->m_last ) {
+			pool->m_last->m_next = job;
+		}
+		else {
+			pool->m_first = job;
+		}
+		pool->m_last = job;
+		if( pool->m_next_to_parse == NULL ) {
+			pool->m_next_to_parse = job;
+		}
+		pool->m_pending_cnt++;
+		pthread_cond_signal(&pool->m_job_cond);
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	mrengine_submit(mailbox->m_engine, &pool->m_engine_owner, parse_task, pool);
+
+	/* write what is already parsed; if too many messages are pending, wait for the oldest ones */
+	write_parsed_jobs(pool, max_pending);
+}
+
+
+void mrmailbox_init_imf_queue(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL || mailbox->m_parsepool ) {
+		return;
+	}
+
+	mailbox->m_parsepool = parsepool_new(mailbox, 0);
+}
+
+
+void mrmailbox_exit_imf_queue(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL || mailbox->m_parsepool==NULL ) {
+		return;
+	}
+
+	parsepool_unref(mailbox->m_parsepool);
+	mailbox->m_parsepool = NULL;
+}
+
+
+/**
+ * Receive a fetched message in the background.  The message is parsed and
+ * decrypted by a worker thread and written to the database by a subsequent
+ * call to mrmailbox_queue_imf() or mrmailbox_flush_imf_queue() from the same
+ * thread.  Messages are written in the order they were queued.
+ *
+ * On single-core systems, the message is received directly.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_queue_imf(mrmailbox_t* mailbox, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                         const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	if( mailbox == NULL || mailbox->m_parsepool==NULL || imf_raw_not_terminated == NULL ) {
+		return;
+	}
+
+	parsepool_queue(mailbox->m_parsepool, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+}
+
+
+/**
+ * Wait until all messages queued by mrmailbox_queue_imf() are parsed and
+ * written to the database.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_flush_imf_queue(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL || mailbox->m_parsepool==NULL ) {
+		return;
+	}
+
+	write_parsed_jobs(mailbox->m_parsepool, 0);
+}
+
+
+/**
+ * Create a queue in bulk mode, used to import many messages.  The messages
+ * are queued using mrmailbox_queue_bulk_imf() and parsed in parallel as
+ * fetched messages, however, they're written in transactions of up to
+ * MR_BULK_TRANSACTION_MAX messages, no events are sent for them and
+ * secure-join handshakes are not handled.
+ *
+ * The queue is independent of the one used by mrmailbox_queue_imf(), so
+ * messages fetched meanwhile are received as usual.
+ *
+ * @private @memberof mrmailbox_t
+ *
+ * @return The queue, must be freed using mrmailbox_unref_bulk_imf_queue().
+ */
+mrparsepool_t* mrmailbox_new_bulk_imf_queue(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL ) {
+		return NULL;
+	}
+
+	return parsepool_new(mailbox, 1);
+}
+
+
+/**
+ * Queue a message to a queue created by mrmailbox_new_bulk_imf_queue().
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_queue_bulk_imf(mrparsepool_t* pool, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                              const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	if( pool == NULL || imf_raw_not_terminated == NULL ) {
+		return;
+	}
+
+	parsepool_queue(pool, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+}
+
+
+/**
+ * Write all messages of a queue created by mrmailbox_new_bulk_imf_queue() to
+ * the database and free the queue.
+ *
+ * @private @memberof mrmailbox_t
+ */
+void mrmailbox_unref_bulk_imf_queue(mrparsepool_t* pool)
+{
+	if( pool == NULL ) {
+		return;
+	}
+
+	write_parsed_jobs(pool, 0);
+	parsepool_unref(pool);
 }
@@ -268,7 +268,7 @@ static void secure_connection_established(mrmailbox_t* mailbox, uint32_t chat_id
 	mrmailbox_add_device_msg(mailbox, chat_id, msg);
 
 	// in addition to MR_EVENT_MSGS_CHANGED (sent by mrmailbox_add_device_msg()), also send MR_EVENT_CHAT_MODIFIED to update all views
-	mailbox->m_cb(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
+	mrmailbox_send_event(mailbox, MR_EVENT_CHAT_MODIFIED, chat_id, 0);
 
 	free(msg);
 	mrcontact_unref(contact);
@@ -524,7 +524,7 @@ void mrmailbox_handle_securejoin_handshake(mrmailbox_t* mailbox, mrmimeparser_t*
 
 		mrmailbox_log_info(mailbox, 0, "Secure-join requested.");
 
-		mailbox->m_cb(mailbox, MR_EVENT_SECUREJOIN_REQUESTED, contact_id, 0);
+		mrmailbox_send_event(mailbox, MR_EVENT_SECUREJOIN_REQUESTED, contact_id, 0);
 
 		send_handshake_msg(mailbox, chat_id, "please-provide-random-secret", NULL, NULL); // Alice -> Bob
 	}
@@ -0,0 +1,265 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+/* Counters and latency histograms, exported as JSON by mrmailbox_get_metrics().
+
+All values are updated using atomic operations, so recording a value never
+waits for a lock.  The histograms use log-linear buckets as HDR histograms do:
+values below 8 have their own bucket, larger values are split into 8 buckets per
+power of two, so the relative error of the reported percentiles is below 12.5%. */
+
+
+#include <time.h>
+#include "mrmailbox_internal.h"
+#include "mrmetrics.h"
+
+
+#define MR_HIST_SUB_BITS  3
+#define MR_HIST_SUB_CNT   (1<<MR_HIST_SUB_BITS)
+#define MR_HIST_BUCKETS   (MR_HIST_SUB_CNT + (64-MR_HIST_SUB_BITS)*MR_HIST_SUB_CNT)
+
+
+typedef struct mrhistogram_t
+{
+	uint64_t     m_count;
+	uint64_t     m_sum;
+	uint64_t     m_max;
+	uint64_t     m_buckets[MR_HIST_BUCKETS];
+} mrhistogram_t;
+
+
+struct mrmetrics_t
+{
+	uint64_t      m_start_us;
+	uint64_t      m_counters[MR_CNT_COUNT];
+	mrhistogram_t m_hists[MR_HIST_COUNT];
+};
+
+
+static const char* s_counter_names[MR_CNT_COUNT] = {
+	"events_sent", "events_coalesced", "events_dropped", "msgs_received", "msgs_sent", "smtp_errors", "imap_errors", "msgs_skipped"
+};
+
+
+static const char* s_hist_names[MR_HIST_COUNT] = {
+	"imap_cmd_us", "receive_parse_us", "receive_decrypt_us", "receive_db_us", "smtp_send_us", "db_lock_wait_us", "db_lock_hold_us"
+};
+
+
+static int bucket_index(uint64_t value)
+{
+	int exp;
+
+	if( value < MR_HIST_SUB_CNT ) {
+		return (int)value;
+	}
+
+	exp = 63 - __builtin_clzll(value); /* >= MR_HIST_SUB_BITS */
+	return MR_HIST_SUB_CNT + (exp-MR_HIST_SUB_BITS)*MR_HIST_SUB_CNT + (int)((value >> (exp-MR_HIST_SUB_BITS)) - MR_HIST_SUB_CNT);
+}
+
+
+static uint64_t bucket_highest_value(int index)
+{
+	int exp, sub;
+
+	if( index < MR_HIST_SUB_CNT ) {
+		return index;
+	}
+
+	exp = (index-MR_HIST_SUB_CNT) / MR_HIST_SUB_CNT + MR_HIST_SUB_BITS;
+	sub = (index-MR_HIST_SUB_CNT) % MR_HIST_SUB_CNT;
+	return (((uint64_t)(MR_HIST_SUB_CNT+sub+1)) << (exp-MR_HIST_SUB_BITS)) - 1;
+}
+
+
+mrmetrics_t* mrmetrics_new()
+{
+	mrmetrics_t* ths = NULL;
+
+	if( (ths=calloc(1, sizeof(mrmetrics_t)))==NULL ) {
+		exit(54); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	ths->m_start_us = mrmetrics_now_us();
+
+	return ths;
+}
+
+
+void mrmetrics_unref(mrmetrics_t* ths)
+{
+	free(ths);
+}
+
+
+uint64_t mrmetrics_now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+void mrmetrics_count(mrmailbox_t* mailbox, int counter, uint64_t add)
+{
+	if( mailbox == NULL || mailbox->m_metrics == NULL || counter < 0 || counter >= MR_CNT_COUNT ) {
+		return;
+	}
+
+	__atomic_add_fetch(&mailbox->m_metrics->m_counters[counter], add, __ATOMIC_RELAXED);
+}
+
+
+void mrmetrics_add_value(mrmailbox_t* mailbox, int hist, uint64_t value_us)
+{
+	mrhistogram_t* h;
+	uint64_t       max;
+
+	if( mailbox == NULL || mailbox->m_metrics == NULL || hist < 0 || hist >= MR_HIST_COUNT ) {
+		return;
+	}
+
+	h = &mailbox->m_metrics->m_hists[hist];
+	__atomic_add_fetch(&h->m_buckets[bucket_index(value_us)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->m_sum, value_us, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->m_count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->m_max, __ATOMIC_RELAXED);
+	while( value_us > max && !__atomic_compare_exchange_n(&h->m_max, &max, value_us, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+		;
+	}
+}
+
+
+void mrmetrics_add_time(mrmailbox_t* mailbox, int hist, uint64_t start_us)
+{
+	uint64_t now = mrmetrics_now_us();
+	mrmetrics_add_value(mailbox, hist, now > start_us? now-start_us : 0);
+}
+
+
+static void cat_histogram(mrstrbuilder_t* ret, const char* name, mrhistogram_t* h)
+{
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	static const char*  percentile_names[] = { "p50", "p90", "p99", "p999" };
+	uint64_t            buckets[MR_HIST_BUCKETS], count = 0, seen = 0, max;
+	int                 i, p = 0;
+	char                temp[128];
+
+	/* take a copy, values added meanwhile may be in the buckets but not in the count or vice versa */
+	for( i = 0; i < MR_HIST_BUCKETS; i++ ) {
+		buckets[i] = __atomic_load_n(&h->m_buckets[i], __ATOMIC_RELAXED);
+		count += buckets[i];
+	}
+	max = __atomic_load_n(&h->m_max, __ATOMIC_RELAXED);
+
+	snprintf(temp, sizeof(temp), "\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu",
+		name, (unsigned long long)count, (unsigned long long)__atomic_load_n(&h->m_sum, __ATOMIC_RELAXED), (unsigned long long)max);
+	mrstrbuilder_cat(ret, temp);
+
+	for( i = 0; i < MR_HIST_BUCKETS && p < 4; i++ ) {
+		seen += buckets[i];
+		while( p < 4 && count > 0 && (double)seen >= (double)count*percentiles[p]/100.0 ) {
+			uint64_t value = bucket_highest_value(i);
+			snprintf(temp, sizeof(temp), ",\"%s\":%llu", percentile_names[p], (unsigned long long)(value<max? value : max));
+			mrstrbuilder_cat(ret, temp);
+			p++;
+		}
+	}
+
+	for( ; p < 4; p++ ) {
+		snprintf(temp, sizeof(temp), ",\"%s\":0", percentile_names[p]);
+		mrstrbuilder_cat(ret, temp);
+	}
+
+	mrstrbuilder_cat(ret, "}");
+}
+
+
+/**
+ * Get performance metrics of the mailbox object as a JSON object.  The object
+ * contains the following members:
+ *
+ * - `uptime_s`: seconds since mrmailbox_new() was called
+ * - `counters`: `events_sent`, `events_coalesced`, `events_dropped`,
+ *   `msgs_received`, `msgs_sent`, `smtp_errors`, `imap_errors` and
+ *   `msgs_skipped` since mrmailbox_new() was called
+ * - `gauges`: `jobs_pending` and `jobs_due`, the jobs in the job queue,
+ *   `event_queue` the number of queued events, see mrmailbox_set_event_mode()
+ * - `histograms`: `imap_cmd_us`, `receive_parse_us`, `receive_decrypt_us`,
+ *   `receive_db_us`, `smtp_send_us`, `db_lock_wait_us` and `db_lock_hold_us`;
+ *   each histogram is an object with the members `count`, `sum`, `max`,
+ *   `p50`, `p90`, `p99` and `p999`, all times are in microseconds.
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @return JSON string, must be free()'d after usage.  Returns NULL on errors.
+ */
+char* mrmailbox_get_metrics(mrmailbox_t* mailbox)
+{
+	mrstrbuilder_t ret;
+	mrmetrics_t*   metrics = NULL;
+	int            i, jobs_pending = 0, jobs_due = 0;
+	char           temp[256];
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || (metrics=mailbox->m_metrics)==NULL ) {
+		return NULL;
+	}
+
+	mrsqlite3_lock(mailbox->m_sql);
+		if( mrsqlite3_is_open(mailbox->m_sql) ) {
+			sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(mailbox->m_sql,
+				"SELECT COUNT(*), SUM(desired_timestamp<=?) FROM jobs;");
+			if( stmt ) {
+				sqlite3_bind_int64(stmt, 1, time(NULL));
+				if( sqlite3_step(stmt) == SQLITE_ROW ) {
+					jobs_pending = sqlite3_column_int(stmt, 0);
+					jobs_due     = sqlite3_column_int(stmt, 1);
+				}
+				sqlite3_finalize(stmt);
+			}
+		}
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	mrstrbuilder_init(&ret, 0);
+
+	snprintf(temp, sizeof(temp), "{\"uptime_s\":%llu,\"counters\":{", (unsigned long long)((mrmetrics_now_us()-metrics->m_start_us)/1000000));
+	mrstrbuilder_cat(&ret, temp);
+	for( i = 0; i < MR_CNT_COUNT; i++ ) {
+		snprintf(temp, sizeof(temp), "%s\"%s\":%llu", i? "," : "", s_counter_names[i], (unsigned long long)__atomic_load_n(&metrics->m_counters[i], __ATOMIC_RELAXED));
+		mrstrbuilder_cat(&ret, temp);
+	}
+
+	snprintf(temp, sizeof(temp), "},\"gauges\":{\"jobs_pending\":%i,\"jobs_due\":%i,\"event_queue\":%i},\"histograms\":{",
+		jobs_pending, jobs_due, mrmailbox_get_event_queue_cnt(mailbox));
+	mrstrbuilder_cat(&ret, temp);
+	for( i = 0; i < MR_HIST_COUNT; i++ ) {
+		if( i ) { mrstrbuilder_cat(&ret, ","); }
+		cat_histogram(&ret, s_hist_names[i], &metrics->m_hists[i]);
+	}
+	mrstrbuilder_cat(&ret, "}}");
+
+	return ret.m_buf;
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+#ifndef __MRMETRICS_H__
+#define __MRMETRICS_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+typedef struct mrmetrics_t mrmetrics_t;
+
+
+/* counters */
+#define MR_CNT_EVENTS_SENT       0  /* events given to mrmailbox_send_event() */
+#define MR_CNT_EVENTS_COALESCED  1  /* events merged into a pending event of the same kind */
+#define MR_CNT_EVENTS_DROPPED    2  /* events dropped as the event queue was full */
+#define MR_CNT_MSGS_RECEIVED     3  /* messages given to receive_imf() */
+#define MR_CNT_MSGS_SENT         4  /* messages sent successfully via SMTP */
+#define MR_CNT_SMTP_ERRORS       5
+#define MR_CNT_IMAP_ERRORS       6
+#define MR_CNT_MSGS_SKIPPED      7  /* messages not downloaded in chat-only mode, see mrmailbox_precheck_imf() */
+#define MR_CNT_COUNT             8
+
+/* histograms, all values are microseconds */
+#define MR_HIST_IMAP_CMD         0  /* IMAP commands, except IDLE */
+#define MR_HIST_RECEIVE_PARSE    1  /* MIME parsing of a received message, without decryption */
+#define MR_HIST_RECEIVE_DECRYPT  2  /* decryption and Autocrypt-header handling of a received message */
+#define MR_HIST_RECEIVE_DB       3  /* writing a received message to the database */
+#define MR_HIST_SMTP_SEND        4  /* sending a message via SMTP, without connecting */
+#define MR_HIST_DB_LOCK_WAIT     5  /* waiting for mrsqlite3_lock() */
+#define MR_HIST_DB_LOCK_HOLD     6  /* time between mrsqlite3_lock() and mrsqlite3_unlock() */
+#define MR_HIST_COUNT            7
+
+
+mrmetrics_t* mrmetrics_new       ();
+void         mrmetrics_unref     (mrmetrics_t*);
+
+uint64_t     mrmetrics_now_us    (); /* monotonic clock, use as start time for mrmetrics_add_time() */
+void         mrmetrics_count     (mrmailbox_t*, int counter, uint64_t add);
+void         mrmetrics_add_value (mrmailbox_t*, int hist, uint64_t value_us);
+void         mrmetrics_add_time  (mrmailbox_t*, int hist, uint64_t start_us); /* adds the time elapsed since start_us */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRMETRICS_H__ */
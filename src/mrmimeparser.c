@@ -1086,16 +1086,11 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 
 				mr_replace_bad_utf8_chars(desired_filename);
 
-				/* create a free file name to use */
-				if( (pathNfilename=mr_get_fine_pathNfilename(ths->m_blobdir, desired_filename)) == NULL ) {
+				/* create a free file name to use and copy data to file */
+				if( (pathNfilename=mr_create_fine_file(ths->m_blobdir, desired_filename, decoded_data, decoded_data_bytes, ths->m_mailbox)) == NULL ) {
 					goto cleanup;
 				}
 
-				/* copy data to file */
-                if( mr_write_file(pathNfilename, decoded_data, decoded_data_bytes, ths->m_mailbox)==0 ) {
-					goto cleanup;
-                }
-
 				part = mrmimepart_new();
 				part->m_type  = msg_type;
 				part->m_int_mimetype = mime_type;
@@ -1412,6 +1407,9 @@ void mrmimeparser_parse(mrmimeparser_t* ths, const char* body_not_terminated, si
 {
 	int r;
 	size_t index = 0;
+	uint64_t start_us = mrmetrics_now_us(), decrypt_start_us, decrypt_us = 0;
+
+	MR_TRACE_BEGIN(ths->m_mailbox, "mrmimeparser_parse", "\"bytes\":%lu", (unsigned long)body_bytes);
 
 	mrmimeparser_empty(ths);
 
@@ -1426,6 +1424,8 @@ void mrmimeparser_parse(mrmimeparser_t* ths, const char* body_not_terminated, si
 	/* decrypt, if possible; handle Autocrypt:-header
 	(decryption may modifiy the given object) */
 	int validation_errors = 0;
+	decrypt_start_us = mrmetrics_now_us();
+	MR_TRACE_BEGIN(ths->m_mailbox, "mrmailbox_e2ee_decrypt", NULL);
 	if( mrmailbox_e2ee_decrypt(ths->m_mailbox, ths->m_mimeroot, &validation_errors, &ths->m_degrade_event) ) {
 		if( validation_errors == 0 ) {
 			ths->m_decrypted_and_validated = 1;
@@ -1434,6 +1434,9 @@ void mrmimeparser_parse(mrmimeparser_t* ths, const char* body_not_terminated, si
 			ths->m_decrypted_with_validation_errors = validation_errors;
 		}
 	}
+	MR_TRACE_END(ths->m_mailbox, "mrmailbox_e2ee_decrypt", "\"validation_errors\":%i", validation_errors);
+	decrypt_us = mrmetrics_now_us() - decrypt_start_us;
+	mrmetrics_add_value(ths->m_mailbox, MR_HIST_RECEIVE_DECRYPT, decrypt_us);
 
 	//printf("after decryption:\n"); mailmime_print(ths->m_mimeroot);
 
@@ -1621,6 +1624,9 @@ cleanup:
 		part->m_msg = safe_strdup(ths->m_subject? ths->m_subject : "Empty message");
 		carray_add(ths->m_parts, (void*)part, NULL);
 	}
+
+	mrmetrics_add_value(ths->m_mailbox, MR_HIST_RECEIVE_PARSE, mrmetrics_now_us() - start_us - decrypt_us);
+	MR_TRACE_END(ths->m_mailbox, "mrmimeparser_parse", "\"parts\":%i", (int)carray_count(ths->m_parts));
 }
 
 
@@ -47,7 +47,16 @@ one :-) */
 #include "mrpgp.h"
 
 
-static pgp_io_t s_io;
+/* netpgp only reads from the pgp_io_t structure, however, as several threads may
+decrypt or encrypt at the same time, we do not share a global structure but set up
+a fresh one on the stack for every call. */
+static void init_io(pgp_io_t* io)
+{
+	memset(io, 0, sizeof(pgp_io_t));
+	io->outs = stdout;
+	io->errs = stderr;
+	io->res  = stderr;
+}
 
 
 void mrpgp_init(mrmailbox_t* mailbox)
@@ -60,12 +69,6 @@ void mrpgp_init(mrmailbox_t* mailbox)
 							libEtPan may call SSL_library_init() again later, however, this should be no problem.
 							SSL_library_init() always returns "1", so it is safe to discard the return value */
 	#endif
-
-	/* setup i/o structure */
-	memset(&s_io, 0, sizeof(pgp_io_t));
-	s_io.outs = stdout;
-	s_io.errs = stderr;
-	s_io.res  = stderr;
 }
 
 
@@ -406,6 +409,7 @@ cleanup:
 
 int mrpgp_is_valid_key(mrmailbox_t* mailbox, const mrkey_t* raw_key)
 {
+	pgp_io_t        io;
 	int             key_is_valid = 0;
 	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
@@ -417,8 +421,10 @@ int mrpgp_is_valid_key(mrmailbox_t* mailbox, const mrkey_t* raw_key)
 		goto cleanup;
 	}
 
+	init_io(&io);
+
 	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. We check the details below therefore. */
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. We check the details below therefore. */
 
 	if( raw_key->m_type == MR_PUBLIC && public_keys->keyc >= 1 ) {
 		key_is_valid = 1;
@@ -437,6 +443,7 @@ cleanup:
 
 int mrpgp_calc_fingerprint(const mrkey_t* raw_key, uint8_t** ret_fingerprint, size_t* ret_fingerprint_bytes)
 {
+	pgp_io_t        io;
 	int             success = 0;
 	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
@@ -448,8 +455,10 @@ int mrpgp_calc_fingerprint(const mrkey_t* raw_key, uint8_t** ret_fingerprint, si
 		goto cleanup;
 	}
 
+	init_io(&io);
+
 	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem);
 
 	if( raw_key->m_type != MR_PUBLIC || public_keys->keyc <= 0 ) {
 		goto cleanup;
@@ -477,6 +486,7 @@ cleanup:
 
 int mrpgp_split_key(mrmailbox_t* mailbox, const mrkey_t* private_in, mrkey_t* ret_public_key)
 {
+	pgp_io_t        io;
 	int             success = 0;
 	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
@@ -489,8 +499,10 @@ int mrpgp_split_key(mrmailbox_t* mailbox, const mrkey_t* private_in, mrkey_t* re
 		goto cleanup;
 	}
 
+	init_io(&io);
+
 	pgp_memory_add(keysmem, private_in->m_binary, private_in->m_bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem);
 
 	if( private_in->m_type!=MR_PRIVATE || private_keys->keyc <= 0 ) {
 		mrmailbox_log_warning(mailbox, 0, "Split key: Given key is no private key.");
@@ -527,6 +539,318 @@ cleanup:
  ******************************************************************************/
 
 
+/* The ASCII armor is written here and not by netpgp's armor writer which works
+byte by byte; the binary data are collected in multiples of 57 bytes, each 57
+bytes result in a line of 76 base64 characters. */
+#define ARMOR_LINE_BYTES  57
+#define ARMOR_LINE_CHARS  76
+#define ARMOR_BUF_LINES   64
+#define ARMOR_HEADER      "-----BEGIN PGP MESSAGE-----\r\n\r\n"
+#define ARMOR_FOOTER      "-----END PGP MESSAGE-----\r\n"
+
+
+struct _mrpgp_encrypt
+{
+	mrmailbox_t*    m_mailbox;
+	pgp_io_t        m_io;
+	pgp_keyring_t*  m_public_keys;
+	pgp_keyring_t*  m_private_keys;
+	pgp_keyring_t*  m_dummy_keys;
+	pgp_output_t*   m_output;
+
+	char*           m_ctext;
+	size_t          m_ctext_bytes;
+	size_t          m_ctext_allocated;
+	int             m_error;
+
+	int             m_use_armor;
+	long            m_crc;
+	size_t          m_armor_bytes;
+	uint8_t         m_armor_buf[ARMOR_LINE_BYTES*ARMOR_BUF_LINES];
+	char            m_armor_out[(ARMOR_LINE_CHARS+2)*ARMOR_BUF_LINES];
+};
+
+
+static int encrypt_reserve(mrpgp_encrypt_t* ths, size_t bytes)
+{
+	if( bytes > ths->m_ctext_allocated ) {
+		size_t allocated = ths->m_ctext_allocated*2 > bytes? ths->m_ctext_allocated*2 : bytes;
+		char*  temp = realloc(ths->m_ctext, allocated);
+		if( temp == NULL ) {
+			return 0;
+		}
+		ths->m_ctext           = temp;
+		ths->m_ctext_allocated = allocated;
+	}
+	return 1;
+}
+
+
+static void encrypt_write(mrpgp_encrypt_t* ths, const void* buf, size_t bytes)
+{
+	if( ths->m_error || bytes == 0 ) {
+		return;
+	}
+
+	if( !encrypt_reserve(ths, ths->m_ctext_bytes + bytes) ) {
+		ths->m_error = 1;
+		return;
+	}
+
+	memcpy(ths->m_ctext + ths->m_ctext_bytes, buf, bytes);
+	ths->m_ctext_bytes += bytes;
+}
+
+
+static void encrypt_flush_armor(mrpgp_encrypt_t* ths)
+{
+	size_t pos, line_bytes;
+	char*  p = ths->m_armor_out;
+
+	ths->m_crc = mr_crc24(ths->m_crc, ths->m_armor_buf, ths->m_armor_bytes);
+
+	for( pos = 0; pos < ths->m_armor_bytes; pos += line_bytes ) {
+		line_bytes = ths->m_armor_bytes-pos > ARMOR_LINE_BYTES? ARMOR_LINE_BYTES : ths->m_armor_bytes-pos;
+		p += mr_encode_base64_to(&ths->m_armor_buf[pos], line_bytes, p);
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+
+	encrypt_write(ths, ths->m_armor_out, p - ths->m_armor_out);
+	ths->m_armor_bytes = 0;
+}
+
+
+/* the last writer on netpgp's writer stack */
+static unsigned encrypt_sink_writer(const uint8_t* src, unsigned len, pgp_error_t** errors, pgp_writer_t* writer)
+{
+	mrpgp_encrypt_t* ths = (mrpgp_encrypt_t*)pgp_writer_get_arg(writer);
+	size_t           n;
+
+	if( ths->m_error ) {
+		return 1; /* the message is discarded; the writers are only closed */
+	}
+
+	if( !ths->m_use_armor ) {
+		encrypt_write(ths, src, len);
+		return !ths->m_error;
+	}
+
+	while( len > 0 ) {
+		n = sizeof(ths->m_armor_buf) - ths->m_armor_bytes;
+		if( n > len ) {
+			n = len;
+		}
+		memcpy(&ths->m_armor_buf[ths->m_armor_bytes], src, n);
+		ths->m_armor_bytes += n;
+		src += n;
+		len -= n;
+		if( ths->m_armor_bytes == sizeof(ths->m_armor_buf) ) {
+			encrypt_flush_armor(ths);
+		}
+	}
+
+	return !ths->m_error;
+}
+
+
+static void encrypt_free(mrpgp_encrypt_t* ths)
+{
+	if( ths->m_output ) {
+		ths->m_error = 1;
+		pgp_writer_close(ths->m_output); /* the finalisers must run before the writers can be deleted */
+		pgp_output_delete(ths->m_output);
+	}
+	if( ths->m_public_keys )  { pgp_keyring_purge(ths->m_public_keys); free(ths->m_public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
+	if( ths->m_private_keys ) { pgp_keyring_purge(ths->m_private_keys); free(ths->m_private_keys); }
+	if( ths->m_dummy_keys )   { pgp_keyring_purge(ths->m_dummy_keys); free(ths->m_dummy_keys); }
+	free(ths->m_ctext);
+	free(ths);
+}
+
+
+/**
+ * Start encrypting a message that is passed in chunks to mrpgp_pk_encrypt_write(),
+ * so the caller need not hold the whole plaintext in memory.  The encrypted
+ * message is collected in memory and returned by mrpgp_pk_encrypt_close().
+ *
+ * @return An object to pass to mrpgp_pk_encrypt_write() and mrpgp_pk_encrypt_close();
+ *     NULL on errors.
+ */
+mrpgp_encrypt_t* mrpgp_pk_encrypt_open(mrmailbox_t*       mailbox,
+                                       const mrkeyring_t* raw_public_keys_for_encryption,
+                                       const mrkey_t*     raw_private_key_for_signing,
+                                       int                use_armor)
+{
+	mrpgp_encrypt_t* ths = NULL;
+	pgp_memory_t*    keysmem = pgp_memory_new();
+	int              i;
+
+	if( mailbox==NULL || keysmem==NULL
+	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->m_count<=0 ) {
+		goto cleanup;
+	}
+
+	if( (ths=calloc(1, sizeof(mrpgp_encrypt_t)))==NULL ) {
+		exit(50); /* cannot allocate little memory, unrecoverable error */
+	}
+	ths->m_mailbox      = mailbox;
+	ths->m_use_armor    = use_armor;
+	ths->m_crc          = MR_CRC24_INIT;
+	ths->m_public_keys  = calloc(1, sizeof(pgp_keyring_t));
+	ths->m_private_keys = calloc(1, sizeof(pgp_keyring_t));
+	ths->m_dummy_keys   = calloc(1, sizeof(pgp_keyring_t));
+	if( ths->m_public_keys==NULL || ths->m_private_keys==NULL || ths->m_dummy_keys==NULL ) {
+		goto cleanup;
+	}
+
+	init_io(&ths->m_io);
+
+	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
+	for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
+		pgp_memory_clear(keysmem);
+		pgp_memory_add(keysmem, raw_public_keys_for_encryption->m_keys[i]->m_binary, raw_public_keys_for_encryption->m_keys[i]->m_bytes);
+		pgp_filter_keys_from_mem(&ths->m_io, ths->m_public_keys, ths->m_private_keys/*should stay empty*/, NULL, 0, keysmem);
+	}
+
+	if( ths->m_public_keys->keyc <=0 || ths->m_private_keys->keyc!=0 ) {
+		mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (%i/%i)", ths->m_public_keys->keyc, ths->m_private_keys->keyc);
+		goto cleanup;
+	}
+
+	if( raw_private_key_for_signing ) {
+		pgp_memory_clear(keysmem);
+		pgp_memory_add(keysmem, raw_private_key_for_signing->m_binary, raw_private_key_for_signing->m_bytes);
+		pgp_filter_keys_from_mem(&ths->m_io, ths->m_dummy_keys, ths->m_private_keys, NULL, 0, keysmem);
+		if( ths->m_private_keys->keyc <= 0 ) {
+			mrmailbox_log_warning(mailbox, 0, "No key for signing found.");
+			goto cleanup;
+		}
+	}
+
+	/* setup the writer stack: [sign+literal data] -> encrypt -> compress [-> literal data] -> armor -> m_ctext */
+	if( use_armor ) {
+		encrypt_write(ths, ARMOR_HEADER, strlen(ARMOR_HEADER));
+	}
+
+	ths->m_output = pgp_output_new();
+	pgp_writer_set(ths->m_output, encrypt_sink_writer, NULL, NULL, ths);
+
+	/* AES-128 is supported by all Autocrypt-capable clients and is hardware-accelerated, netpgp's default CAST5 is not */
+	if( !pgp_push_stream_enc_se_ip(ths->m_output, ths->m_public_keys, "aes128", raw_private_key_for_signing? 1 : 0/*raw: signing adds the literal data packet*/) ) {
+		mrmailbox_log_warning(mailbox, 0, "Encryption failed.");
+		goto cleanup;
+	}
+
+	if( raw_private_key_for_signing ) {
+		pgp_key_t* sk0 = &ths->m_private_keys->keys[0];
+		if( !pgp_writer_push_stream_signed(ths->m_output, &sk0->key.seckey, PGP_HASH_SHA256, time(NULL)/*birthtime*/, 0/*duration*/) ) {
+			mrmailbox_log_warning(mailbox, 0, "Signing failed.");
+			goto cleanup;
+		}
+	}
+
+	if( ths->m_error ) {
+		goto cleanup;
+	}
+
+	pgp_memory_free(keysmem);
+	return ths;
+
+cleanup:
+	if( keysmem ) { pgp_memory_free(keysmem); }
+	if( ths )     { encrypt_free(ths); }
+	return NULL;
+}
+
+
+/**
+ * Encrypt the next chunk of a message started by mrpgp_pk_encrypt_open().
+ *
+ * @return 1=success, 0=error; on errors, the encryption should be aborted
+ *     using mrpgp_pk_encrypt_close().
+ */
+int mrpgp_pk_encrypt_write(mrpgp_encrypt_t* ths, const void* buf, size_t bytes)
+{
+	#define MAX_WRITE_BYTES 0x40000000 /* pgp_write() takes an unsigned */
+	const uint8_t* p = (const uint8_t*)buf;
+	size_t         n;
+
+	if( ths==NULL || ths->m_error || (buf==NULL && bytes>0) ) {
+		return 0;
+	}
+
+	while( bytes > 0 ) {
+		n = bytes > MAX_WRITE_BYTES? MAX_WRITE_BYTES : bytes;
+		if( !pgp_write(ths->m_output, p, (unsigned)n) ) {
+			ths->m_error = 1;
+			break;
+		}
+		p     += n;
+		bytes -= n;
+	}
+
+	return !ths->m_error;
+}
+
+
+/**
+ * Finish the message started by mrpgp_pk_encrypt_open() and return the
+ * encrypted message.  The object is freed in any case; to abort the
+ * encryption, pass NULL for ret_ctext.
+ *
+ * @return 1=the message was encrypted successfully, the encrypted message is
+ *     returned in ret_ctext and must be freed using free(); 0=error
+ */
+int mrpgp_pk_encrypt_close(mrpgp_encrypt_t* ths, void** ret_ctext, size_t* ret_ctext_bytes)
+{
+	int success = 0;
+
+	if( ths==NULL ) {
+		return 0;
+	}
+
+	if( ret_ctext==NULL || ret_ctext_bytes==NULL ) {
+		ths->m_error = 1;
+	}
+
+	if( !ths->m_error ) {
+		if( !pgp_writer_close(ths->m_output) ) {
+			ths->m_error = 1;
+		}
+		pgp_output_delete(ths->m_output);
+		ths->m_output = NULL;
+	}
+
+	if( ths->m_use_armor && !ths->m_error ) {
+		uint8_t c[3];
+		char    footer[1+4+2+sizeof(ARMOR_FOOTER)], *p = footer;
+
+		encrypt_flush_armor(ths);
+
+		c[0] = (uint8_t)((ths->m_crc >> 16)&0xFF);
+		c[1] = (uint8_t)((ths->m_crc >> 8)&0xFF);
+		c[2] = (uint8_t)((ths->m_crc)&0xFF);
+		*p++ = '=';
+		p += mr_encode_base64_to(c, 3, p);
+		*p++ = '\r';
+		*p++ = '\n';
+		strcpy(p, ARMOR_FOOTER);
+		encrypt_write(ths, footer, strlen(footer));
+	}
+
+	if( !ths->m_error && ths->m_ctext_bytes > 0 ) {
+		*ret_ctext       = ths->m_ctext;
+		*ret_ctext_bytes = ths->m_ctext_bytes;
+		ths->m_ctext     = NULL;
+		success = 1;
+	}
+
+	encrypt_free(ths);
+	return success;
+}
+
+
 int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
                        const void*        plain_text,
                        size_t             plain_bytes,
@@ -536,88 +860,150 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
                        void**             ret_ctext,
                        size_t*            ret_ctext_bytes)
 {
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
-	pgp_memory_t*   signedmem = NULL;
-	int             i, success = 0;
+	mrpgp_encrypt_t* encrypt = NULL;
 
-	if( mailbox==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL
-	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->m_count<=0
-	 || keysmem==NULL || public_keys==NULL || private_keys==NULL || dummy_keys==NULL ) {
-		goto cleanup;
+	if( mailbox==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL ) {
+		return 0;
 	}
 
 	*ret_ctext       = NULL;
 	*ret_ctext_bytes = 0;
 
-	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
-	for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
-		pgp_memory_clear(keysmem);
-		pgp_memory_add(keysmem, raw_public_keys_for_encryption->m_keys[i]->m_binary, raw_public_keys_for_encryption->m_keys[i]->m_bytes);
-		pgp_filter_keys_from_mem(&s_io, public_keys, private_keys/*should stay empty*/, NULL, 0, keysmem);
+	if( (encrypt=mrpgp_pk_encrypt_open(mailbox, raw_public_keys_for_encryption, raw_private_key_for_signing, use_armor))==NULL ) {
+		return 0;
+	}
+
+	/* compression is ignored, the armor adds 1/3 */
+	if( !encrypt_reserve(encrypt, plain_bytes + plain_bytes/3 + 4096)
+	 || !mrpgp_pk_encrypt_write(encrypt, plain_text, plain_bytes) ) {
+		mrpgp_pk_encrypt_close(encrypt, NULL, NULL);
+		return 0;
+	}
+
+	return mrpgp_pk_encrypt_close(encrypt, ret_ctext, ret_ctext_bytes);
+}
+
+
+/* Remove the ASCII armor from an encrypted message, this is faster than netpgp's
+armor reader which works byte by byte.  On errors, 0 is returned and the caller
+should let netpgp dearmor the message. */
+static int dearmor_message(const void* ctext, size_t ctext_bytes, char** ret_binary /*free with mmap_string_unref()*/, size_t* ret_binary_bytes)
+{
+	int    success = 0;
+	char*  buf = NULL, *headerline = NULL, *base64 = NULL, *checksum = NULL, *checksum_binary = NULL;
+	size_t indx = 0, checksum_bytes = 0;
+
+	if( (buf=malloc(ctext_bytes+1))==NULL ) {
+		goto cleanup;
 	}
+	memcpy(buf, ctext, ctext_bytes);
+	buf[ctext_bytes] = 0;
 
-	if( public_keys->keyc <=0 || private_keys->keyc!=0 ) {
-		mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
+	if( !mr_split_armored_data(buf, &headerline, NULL, NULL, &base64)
+	 || headerline==NULL || strcmp(headerline, "-----BEGIN PGP MESSAGE-----")!=0 || base64==NULL ) {
 		goto cleanup;
 	}
 
-	/* encrypt */
-	{
-		const void* signed_text = NULL;
-		size_t      signed_bytes = 0;
-		int         encrypt_raw_packet = 0;
-
-		if( raw_private_key_for_signing ) {
-			pgp_memory_clear(keysmem);
-			pgp_memory_add(keysmem, raw_private_key_for_signing->m_binary, raw_private_key_for_signing->m_bytes);
-			pgp_filter_keys_from_mem(&s_io, dummy_keys, private_keys, NULL, 0, keysmem);
-			if( private_keys->keyc <= 0 ) {
-				mrmailbox_log_warning(mailbox, 0, "No key for signing found.");
-				goto cleanup;
-			}
+	/* the optional CRC24 checksum (RFC 4880, 6.1) is in a line starting with `=` */
+	if( (checksum=strrchr(base64, '\n'))!=NULL && checksum[1]=='=' ) {
+		*checksum = 0;
+		checksum += 2;
+	}
+	else {
+		checksum = NULL;
+	}
 
-			pgp_key_t* sk0 = &private_keys->keys[0];
-			signedmem = pgp_sign_buf(&s_io, plain_text, plain_bytes, &sk0->key.seckey, time(NULL)/*birthtime*/, 0/*duration*/,
-				NULL/*hash, defaults to sha256*/, 0/*armored*/, 0/*cleartext*/);
-			if( signedmem == NULL ) {
-				mrmailbox_log_warning(mailbox, 0, "Signing failed.");
-				goto cleanup;
-			}
-			signed_text        = signedmem->buf;
-			signed_bytes       = signedmem->length;
-			encrypt_raw_packet = 1;
-		}
-		else {
-			signed_text        = plain_text;
-			signed_bytes       = plain_bytes;
-			encrypt_raw_packet = 0;
-		}
+	if( mailmime_base64_body_parse(base64, strlen(base64), &indx, ret_binary, ret_binary_bytes)!=MAILIMF_NO_ERROR
+	 || *ret_binary==NULL ) {
+		goto cleanup;
+	}
 
-		pgp_memory_t* outmem = pgp_encrypt_buf(&s_io, signed_text, signed_bytes, public_keys, use_armor, NULL/*cipher*/, encrypt_raw_packet);
-		if( outmem == NULL ) {
-			mrmailbox_log_warning(mailbox, 0, "Encryption failed.");
+	if( *ret_binary_bytes == 0 ) {
+		mmap_string_unref(*ret_binary);
+		*ret_binary = NULL;
+		goto cleanup;
+	}
+
+	if( checksum ) {
+		indx = 0;
+		if( mailmime_base64_body_parse(checksum, strlen(checksum), &indx, &checksum_binary, &checksum_bytes)!=MAILIMF_NO_ERROR
+		 || checksum_binary==NULL || checksum_bytes!=3
+		 || ((((long)(uint8_t)checksum_binary[0])<<16) | (((long)(uint8_t)checksum_binary[1])<<8) | ((long)(uint8_t)checksum_binary[2]))
+		     != mr_crc24(MR_CRC24_INIT, *ret_binary, *ret_binary_bytes) ) {
+			mmap_string_unref(*ret_binary); /* let netpgp report the bad armor */
+			*ret_binary = NULL;
 			goto cleanup;
 		}
-		*ret_ctext       = outmem->buf;
-		*ret_ctext_bytes = outmem->length;
-		free(outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
 	}
 
 	success = 1;
 
 cleanup:
-	if( keysmem )      { pgp_memory_free(keysmem); }
-	if( signedmem )    { pgp_memory_free(signedmem); }
-	if( public_keys )  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys ) { pgp_keyring_purge(private_keys); free(private_keys); }
-	if( dummy_keys )   { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	free(buf);
+	if( checksum_binary ) { mmap_string_unref(checksum_binary); }
 	return success;
 }
 
 
+static int load_decryption_keys(mrmailbox_t* mailbox, pgp_io_t* io, const mrkeyring_t* raw_private_keys_for_decryption, const mrkey_t* raw_public_key_for_validation,
+                                pgp_keyring_t* public_keys, pgp_keyring_t* private_keys, pgp_keyring_t* dummy_keys)
+{
+	pgp_memory_t* keysmem = pgp_memory_new();
+	int           i, success = 0;
+
+	if( keysmem==NULL ) {
+		goto cleanup;
+	}
+
+	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
+	for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
+		pgp_memory_clear(keysmem); /* a simple concatenate of private binary keys fails (works for public keys, however, we don't do it there either) */
+		pgp_memory_add(keysmem, raw_private_keys_for_decryption->m_keys[i]->m_binary, raw_private_keys_for_decryption->m_keys[i]->m_bytes);
+		pgp_filter_keys_from_mem(io, dummy_keys/*should stay empty*/, private_keys, NULL, 0, keysmem);
+	}
+
+	if( private_keys->keyc<=0 ) {
+		mrmailbox_log_warning(mailbox, 0, "Decryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
+		goto cleanup;
+	}
+
+	if( raw_public_key_for_validation ) {
+		pgp_memory_clear(keysmem);
+		pgp_memory_add(keysmem, raw_public_key_for_validation->m_binary, raw_public_key_for_validation->m_bytes);
+		pgp_filter_keys_from_mem(io, public_keys, dummy_keys/*should stay empty*/, NULL, 0, keysmem);
+	}
+
+	success = 1;
+
+cleanup:
+	if( keysmem ) { pgp_memory_free(keysmem); }
+	return success;
+}
+
+
+static int get_validation_errors(const pgp_validation_t* vresult, const mrkey_t* raw_public_key_for_validation)
+{
+	if( vresult->validc <= 0 && vresult->invalidc <= 0 && vresult->unknownc <= 0 )
+	{
+		/* no valid nor invalid signatures found */
+		return MR_VALIDATE_NO_SIGNATURE;
+	}
+	else if( raw_public_key_for_validation==NULL || vresult->unknownc > 0 )
+	{
+		/* at least one valid or invalid signature found, but no key for verification */
+		return MR_VALIDATE_UNKNOWN_SIGNATURE;
+	}
+	else if( vresult->invalidc > 0 )
+	{
+		/* at least one invalid signature found */
+		return MR_VALIDATE_BAD_SIGNATURE;
+	}
+
+	/* only valid signatures found */
+	return 0;
+}
+
+
 int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
                        const void*        ctext,
                        size_t             ctext_bytes,
@@ -628,45 +1014,42 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
                        size_t*            ret_plain_bytes,
                        int*               ret_validation_errors)
 {
+	pgp_io_t          io;
 	pgp_keyring_t*    public_keys = calloc(1, sizeof(pgp_keyring_t)); /*should be 0 after parsing*/
 	pgp_keyring_t*    private_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*    dummy_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_validation_t* vresult = calloc(1, sizeof(pgp_validation_t));
 	key_id_t*         recipients_key_ids = NULL;
 	unsigned          recipients_count = 0;
-	pgp_memory_t*     keysmem = pgp_memory_new();
-	int               i, success = 0;
+	char*             binary = NULL;
+	size_t            binary_bytes = 0;
+	int               success = 0;
 
 	if( mailbox==NULL || ctext==NULL || ctext_bytes==0 || ret_plain==NULL || ret_plain_bytes==NULL || ret_validation_errors==NULL
 	 || raw_private_keys_for_decryption==NULL || raw_private_keys_for_decryption->m_count<=0
-	 || vresult==NULL || keysmem==NULL || public_keys==NULL || private_keys==NULL ) {
+	 || vresult==NULL || public_keys==NULL || private_keys==NULL || dummy_keys==NULL ) {
 		goto cleanup;
 	}
 
+	init_io(&io);
+
 	*ret_plain             = NULL;
 	*ret_plain_bytes       = 0;
 
-	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
-	for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
-		pgp_memory_clear(keysmem); /* a simple concatenate of private binary keys fails (works for public keys, however, we don't do it there either) */
-		pgp_memory_add(keysmem, raw_private_keys_for_decryption->m_keys[i]->m_binary, raw_private_keys_for_decryption->m_keys[i]->m_bytes);
-		pgp_filter_keys_from_mem(&s_io, dummy_keys/*should stay empty*/, private_keys, NULL, 0, keysmem);
-	}
-
-	if( private_keys->keyc<=0 ) {
-		mrmailbox_log_warning(mailbox, 0, "Decryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
+	if( !load_decryption_keys(mailbox, &io, raw_private_keys_for_decryption, raw_public_key_for_validation, public_keys, private_keys, dummy_keys) ) {
 		goto cleanup;
 	}
 
-	if( raw_public_key_for_validation ) {
-		pgp_memory_clear(keysmem);
-		pgp_memory_add(keysmem, raw_public_key_for_validation->m_binary, raw_public_key_for_validation->m_bytes);
-		pgp_filter_keys_from_mem(&s_io, public_keys, dummy_keys/*should stay empty*/, NULL, 0, keysmem);
+	/* dearmor */
+	if( use_armor && dearmor_message(ctext, ctext_bytes, &binary, &binary_bytes) ) {
+		ctext       = binary;
+		ctext_bytes = binary_bytes;
+		use_armor   = 0;
 	}
 
 	/* decrypt */
 	{
-		pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&s_io, vresult, ctext, ctext_bytes, private_keys, public_keys,
+		pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&io, vresult, ctext, ctext_bytes, private_keys, public_keys,
 			use_armor, &recipients_key_ids, &recipients_count);
 		if( outmem == NULL ) {
 			mrmailbox_log_warning(mailbox, 0, "Decryption failed.");
@@ -677,37 +1060,17 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
 		free(outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
 
 		/* validate */
-		*ret_validation_errors = 0;
-		if( vresult->validc <= 0 && vresult->invalidc <= 0 && vresult->unknownc <= 0 )
-		{
-			/* no valid nor invalid signatures found */
-			*ret_validation_errors = MR_VALIDATE_NO_SIGNATURE;
-		}
-		else if( raw_public_key_for_validation==NULL || vresult->unknownc > 0 )
-		{
-			/* at least one valid or invalid signature found, but no key for verification */
-			*ret_validation_errors = MR_VALIDATE_UNKNOWN_SIGNATURE;
-		}
-		else if( vresult->invalidc > 0 )
-		{
-			/* at least one invalid signature found */
-			*ret_validation_errors = MR_VALIDATE_BAD_SIGNATURE;
-		}
-		else
-		{
-			/* only valid signatures found */
-			;
-		}
+		*ret_validation_errors = get_validation_errors(vresult, raw_public_key_for_validation);
 	}
 
 	success = 1;
 
 cleanup:
-	if( keysmem )            { pgp_memory_free(keysmem); }
 	if( public_keys )        { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
 	if( private_keys )       { pgp_keyring_purge(private_keys); free(private_keys); }
 	if( dummy_keys )         { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
 	if( vresult )            { pgp_validate_result_free(vresult); }
 	if( recipients_key_ids ) { free(recipients_key_ids); }
+	if( binary )             { mmap_string_unref(binary); }
 	return success;
 }
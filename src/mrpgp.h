@@ -53,6 +53,13 @@ int  mrpgp_split_key        (mrmailbox_t*, const mrkey_t* private_in, mrkey_t* p
 int  mrpgp_pk_encrypt       (mrmailbox_t*, const void* plain, size_t plain_bytes, const mrkeyring_t*, const mrkey_t* sign_key, int use_armor, void** ret_ctext, size_t* ret_ctext_bytes);
 int  mrpgp_pk_decrypt       (mrmailbox_t*, const void* ctext, size_t ctext_bytes, const mrkeyring_t*, const mrkey_t* validate_key, int use_armor, void** plain, size_t* plain_bytes, int* ret_validation_errors);
 
+/* public key encryption of a plaintext passed in chunks, the ciphertext is collected in memory */
+typedef struct _mrpgp_encrypt mrpgp_encrypt_t;
+
+mrpgp_encrypt_t* mrpgp_pk_encrypt_open (mrmailbox_t*, const mrkeyring_t*, const mrkey_t* sign_key, int use_armor);
+int              mrpgp_pk_encrypt_write(mrpgp_encrypt_t*, const void* plain, size_t plain_bytes);
+int              mrpgp_pk_encrypt_close(mrpgp_encrypt_t*, void** ret_ctext, size_t* ret_ctext_bytes);
+
 
 #ifdef __cplusplus
 } /* /extern "C" */
@@ -62,6 +62,7 @@ void mrsmtp_unref(mrsmtp_t* ths)
 	mrsmtp_disconnect(ths);
 	pthread_mutex_destroy(&ths->m_mutex);
 	free(ths->m_from);
+	mr_tls_session_clear(&ths->m_tls_session);
 	free(ths);
 }
 
@@ -137,6 +138,8 @@ int mrsmtp_connect(mrsmtp_t* ths, const mrloginparam_t* lp)
 		#endif
 
 		/* connect to SMTP server */
+		mr_tls_session_check(&ths->m_tls_session, lp->m_send_server, lp->m_send_port);
+
 		if( lp->m_server_flags&(MR_SMTP_SOCKET_STARTTLS|MR_SMTP_SOCKET_PLAIN) )
 		{
 			mrmailbox_log_info(ths->m_mailbox, 0, "Connecting to SMTP-server \"%s:%i\" via Socket...", lp->m_send_server, (int)lp->m_send_port);
@@ -148,7 +151,7 @@ int mrsmtp_connect(mrsmtp_t* ths, const mrloginparam_t* lp)
 		else
 		{
 			mrmailbox_log_info(ths->m_mailbox, 0, "Connecting to SMTP-server \"%s:%i\" via SSL...", lp->m_send_server, (int)lp->m_send_port);
-			if( (r=mailsmtp_ssl_connect(ths->m_hEtpan, lp->m_send_server, lp->m_send_port)) != MAILSMTP_NO_ERROR ) {
+			if( (r=mailsmtp_ssl_connect_with_callback(ths->m_hEtpan, lp->m_send_server, lp->m_send_port, mr_tls_session_cb, &ths->m_tls_session)) != MAILSMTP_NO_ERROR ) {
 				mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "SMPT-SSL connection to %s:%i failed (%s)", lp->m_send_server, (int)lp->m_send_port, mailsmtp_strerror(r));
 				goto cleanup;
 			}
@@ -171,7 +174,7 @@ int mrsmtp_connect(mrsmtp_t* ths, const mrloginparam_t* lp)
 		if( lp->m_server_flags&MR_SMTP_SOCKET_STARTTLS )
 		{
 			mrmailbox_log_info(ths->m_mailbox, 0, "Switching to SMTP-STARTTLS.");
-			if( (r=mailsmtp_socket_starttls(ths->m_hEtpan)) != MAILSMTP_NO_ERROR ) {
+			if( (r=mailsmtp_socket_starttls_with_callback(ths->m_hEtpan, mr_tls_session_cb, &ths->m_tls_session)) != MAILSMTP_NO_ERROR ) {
 				mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "SMTP-STARTTLS failed (%s)", mailsmtp_strerror(r));
 				goto cleanup;
 			}
@@ -203,6 +206,10 @@ int mrsmtp_connect(mrsmtp_t* ths, const mrloginparam_t* lp)
 			mrmailbox_log_info(ths->m_mailbox, 0, "SMTP-Login ok.");
 		}
 
+		if( mr_tls_session_save(&ths->m_tls_session, ths->m_hEtpan->stream, lp->m_send_server, lp->m_send_port) ) {
+			mrmailbox_log_info(ths->m_mailbox, 0, "SMTP-TLS-session resumed.");
+		}
+
 		success = 1;
 
 cleanup:
@@ -248,6 +255,7 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 {
 	int           success = 0, r, smtp_locked = 0;
 	clistiter*    iter;
+	uint64_t      start_us = 0;
 
 	if( ths == NULL ) {
 		return 0;
@@ -263,6 +271,8 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 			goto cleanup;
 		}
 
+		start_us = mrmetrics_now_us();
+
 		/* set source */
 		if( (r=(ths->m_esmtp?
 				mailesmtp_mail(ths->m_hEtpan, ths->m_from, 1, "etPanSMTPTest") :
@@ -302,6 +312,10 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 		success = 1;
 
 cleanup:
+		if( start_us ) {
+			mrmetrics_add_time(ths->m_mailbox, MR_HIST_SMTP_SEND, start_us);
+		}
+		mrmetrics_count(ths->m_mailbox, success? MR_CNT_MSGS_SENT : MR_CNT_SMTP_ERRORS, 1);
 
 	UNLOCK_SMTP
 
@@ -42,6 +42,8 @@ typedef struct mrsmtp_t
 	int             m_log_connect_errors;
 	int             m_log_usual_error;
 
+	mrtlssession_t  m_tls_session; /* resumed on reconnects */
+
 	mrmailbox_t*    m_mailbox; /* only for logging! */
 } mrsmtp_t;
 
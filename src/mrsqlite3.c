@@ -375,6 +375,26 @@ int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile, int flags)
 			}
 		#undef NEW_DB_VERSION
 
+		#define NEW_DB_VERSION 32
+			if( dbversion < NEW_DB_VERSION )
+			{
+				mrsqlite3_execute__(ths, "CREATE INDEX msgs_index6 ON msgs (chat_id, type, timestamp, id);"); /* needed to get the next/previous media and to page through the gallery without loading all IDs */
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 33
+			if( dbversion < NEW_DB_VERSION )
+			{
+				mrsqlite3_execute__(ths, "ALTER TABLE acpeerstates ADD COLUMN key_changed INTEGER DEFAULT 0;");
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
 		// (2) updates that require high-level objects (the structure is complete now and all objects are usable)
 		if( recalc_fingerprints )
 		{
@@ -632,9 +652,27 @@ int mrsqlite3_set_config_int__(mrsqlite3_t* ths, const char* key, int32_t value)
  ******************************************************************************/
 
 
+#ifdef MR_LOCK_PROFILER
+#undef mrsqlite3_lock
+void mrsqlite3_lock(mrsqlite3_t* ths)
+{
+	mrsqlite3_lock_at(ths, "unknown");
+}
+void mrsqlite3_lock_at(mrsqlite3_t* ths, const char* label) /* wait and lock */
+#else
 void mrsqlite3_lock(mrsqlite3_t* ths) /* wait and lock */
+#endif
 {
-	pthread_mutex_lock(&ths->m_critical_);
+	uint64_t start_us = mrmetrics_now_us();
+
+	#ifdef MR_LOCK_PROFILER
+		mrlockprof_lock(ths->m_mailbox, &ths->m_critical_, "sqlite", label);
+	#else
+		pthread_mutex_lock(&ths->m_critical_);
+	#endif
+
+	ths->m_lock_acquired_us = mrmetrics_now_us();
+	mrmetrics_add_value(ths->m_mailbox, MR_HIST_DB_LOCK_WAIT, ths->m_lock_acquired_us-start_us);
 
 	//mrmailbox_wake_lock(ths->m_mailbox);
 }
@@ -644,7 +682,9 @@ void mrsqlite3_unlock(mrsqlite3_t* ths)
 {
 	//mrmailbox_wake_unlock(ths->m_mailbox);
 
-	pthread_mutex_unlock(&ths->m_critical_);
+	mrmetrics_add_time(ths->m_mailbox, MR_HIST_DB_LOCK_HOLD, ths->m_lock_acquired_us);
+
+	MR_UNLOCK_MUTEX(ths->m_mailbox, &ths->m_critical_);
 }
 
 
@@ -681,6 +721,12 @@ void mrsqlite3_rollback__(mrsqlite3_t* ths)
 			if( sqlite3_step(stmt) != SQLITE_DONE ) {
 				mrsqlite3_log_error(ths, "Cannot rollback transaction.");
 			}
+
+			/* the caches may contain data written inside the transaction */
+			if( ths->m_mailbox && ths->m_mailbox->m_sql == ths ) {
+				mrmailbox_clear_contact_cache__(ths->m_mailbox);
+				mrapeerstate_clear_cache__(ths->m_mailbox);
+			}
 		}
 
 		ths->m_transactionCount--;
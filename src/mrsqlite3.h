@@ -99,6 +99,11 @@ enum
 	,SELECT_COUNT_FROM_msgs_WHERE_rfc724_mid
 	,SELECT_COUNT_FROM_msgs_WHERE_ft
 	,SELECT_i_FROM_msgs_WHERE_ctt
+	,SELECT_ctt_FROM_msgs_WHERE_id
+	,SELECT_i_FROM_msgs_WHERE_ctt_next
+	,SELECT_i_FROM_msgs_WHERE_ctt_prev
+	,SELECT_i_FROM_msgs_WHERE_cttti_next
+	,SELECT_i_FROM_msgs_WHERE_cttti_prev
 	,SELECT_id_FROM_msgs_WHERE_cm
 	,SELECT_id_FROM_msgs_WHERE_mcm
 	,SELECT_id_FROM_msgs_WHERE_fresh_AND_deaddrop
@@ -144,6 +149,7 @@ enum
 	,SELECT_fields_FROM_acpeerstates_WHERE_fingerprint
 	,UPDATE_acpeerstates_SET_l_WHERE_a
 	,UPDATE_acpeerstates_SET_lcpp_WHERE_a
+	,UPDATE_acpeerstates_SET_lcgpv_WHERE_a
 
 	,INSERT_INTO_keypairs_aippc
 	,SELECT_private_key_FROM_keypairs_WHERE_default
@@ -170,6 +176,7 @@ typedef struct mrsqlite3_t
 	int           m_transactionCount;   /**< helper for transactions */
 	mrmailbox_t*  m_mailbox;            /**< used for logging and to acquire wakelocks, there may be N mrsqlite3_t objects per mrmailbox! In practise, we use 2 on backup, 1 otherwise. */
 	pthread_mutex_t m_critical_;        /**< the user must make sure, only one thread uses sqlite at the same time! for this purpose, all calls must be enclosed by a locked m_critical; use mrsqlite3_lock() for this purpose */
+	uint64_t      m_lock_acquired_us;   /**< time m_critical_ was locked, for the lock hold histogram */
 
 } mrsqlite3_t;
 
@@ -205,6 +212,10 @@ In general, we will lock the hightest level as possible - this avoids deadlocks
 Low-level-functions, eg. the MrSqlite3-methods, do not lock. */
 void          mrsqlite3_lock             (mrsqlite3_t*); /* lock or wait; these calls must not be nested in a single thread */
 void          mrsqlite3_unlock           (mrsqlite3_t*);
+#ifdef MR_LOCK_PROFILER
+void          mrsqlite3_lock_at          (mrsqlite3_t*, const char* label); /* remembers the call site for mrmailbox_get_lock_report() */
+#define       mrsqlite3_lock(a)          mrsqlite3_lock_at((a), MR_LOCK_LABEL)
+#endif
 
 /* nestable transactions, only the outest is really used */
 void          mrsqlite3_begin_transaction__(mrsqlite3_t*);
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <sys/types.h> /* for getpid() */
 #include <unistd.h>    /* for getpid() */
 #include <openssl/rand.h>
@@ -1648,7 +1649,7 @@ int mr_copy_file(const char* src, const char* dest, mrmailbox_t* log/*may be NUL
         goto cleanup;
 	}
 
-    if( (fd_dest=open(dest, O_WRONLY|O_CREAT|O_EXCL, 0666)) < 0 ) {
+    if( (fd_dest=open(dest, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0 ) { /* the destination may be a file reserved by mr_create_fine_file() */
 		mrmailbox_log_error(log, 0, "Cannot open destination file \"%s\".", dest);
         goto cleanup;
 	}
@@ -1776,6 +1777,27 @@ cleanup:
 }
 
 
+static pthread_mutex_t s_fine_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* finds a free file name as mr_get_fine_pathNfilename() and creates the file with the given content (buf may be NULL to reserve an empty file);
+as files may be created by several threads at the same time, finding the name and creating the file is done under a lock */
+char* mr_create_fine_file(const char* folder, const char* desired_name, const void* buf, size_t buf_bytes, mrmailbox_t* log)
+{
+	char* pathNfilename = NULL;
+
+	pthread_mutex_lock(&s_fine_file_mutex);
+		if( (pathNfilename=mr_get_fine_pathNfilename(folder, desired_name)) != NULL
+		 && !mr_write_file(pathNfilename, buf, buf_bytes, log) ) {
+			free(pathNfilename);
+			pathNfilename = NULL;
+		}
+	pthread_mutex_unlock(&s_fine_file_mutex);
+
+	return pathNfilename;
+}
+
+
 int mr_write_file(const char* pathNfilename, const void* buf, size_t buf_bytes, mrmailbox_t* log)
 {
 	int success = 0;
@@ -1887,3 +1909,73 @@ int mr_get_filemeta(const void* buf_start, size_t buf_bytes, uint32_t* ret_width
 
 	return 0;
 }
+
+
+/*******************************************************************************
+ * TLS session tools
+ ******************************************************************************/
+
+
+void mr_tls_session_cb(struct mailstream_ssl_context* ssl_context, void* tlssession)
+{
+	#ifdef MAILSTREAM_SSL_HAS_SESSION_DATA
+	mrtlssession_t* ths = (mrtlssession_t*)tlssession;
+	if( ths && ths->m_data ) {
+		mailstream_ssl_set_session_data(ssl_context, ths->m_data, ths->m_bytes); /* on errors, we simply do a full handshake */
+	}
+	#endif
+}
+
+
+void mr_tls_session_check(mrtlssession_t* ths, const char* host, int port)
+{
+	char* host_port;
+
+	if( ths == NULL || ths->m_data == NULL ) {
+		return;
+	}
+
+	/* a session must only be offered to the server it was negotiated with, the server or the port may have been changed in the settings */
+	host_port = mr_mprintf("%s:%i", host? host : "", port);
+	if( ths->m_host_port == NULL || strcasecmp(ths->m_host_port, host_port)!=0 ) {
+		mr_tls_session_clear(ths);
+	}
+	free(host_port);
+}
+
+
+int mr_tls_session_save(mrtlssession_t* ths, mailstream* stream, const char* host, int port)
+{
+	#ifdef MAILSTREAM_SSL_HAS_SESSION_DATA
+	unsigned char* data = NULL;
+	ssize_t        bytes;
+
+	if( ths == NULL || stream == NULL ) {
+		return 0;
+	}
+
+	/* call this after some data were read; TLS 1.3 sends the session tickets after the handshake */
+	if( (bytes=mailstream_ssl_get_session_data(stream, &data)) > 0 ) {
+		mr_tls_session_clear(ths);
+		ths->m_data      = data;
+		ths->m_bytes     = bytes;
+		ths->m_host_port = mr_mprintf("%s:%i", host? host : "", port);
+	}
+
+	return mailstream_ssl_session_reused(stream);
+	#else
+	return 0;
+	#endif
+}
+
+
+void mr_tls_session_clear(mrtlssession_t* ths)
+{
+	if( ths ) {
+		free(ths->m_data);
+		ths->m_data  = NULL;
+		ths->m_bytes = 0;
+		free(ths->m_host_port);
+		ths->m_host_port = NULL;
+	}
+}
@@ -85,6 +85,18 @@ void  mrstrbuilder_empty   (mrstrbuilder_t* ths); /* set the string to a lenght
 void    clist_free_content         (const clist*); /* calls free() for each item content */
 int     clist_search_string_nocase (const clist*, const char* str);
 
+/* TLS session tools, sessions are resumed on reconnects to save the full handshake */
+typedef struct mrtlssession_t
+{
+	unsigned char* m_data;
+	size_t         m_bytes;
+	char*          m_host_port; /* the server the session belongs to, `host:port` */
+} mrtlssession_t;
+void mr_tls_session_cb    (struct mailstream_ssl_context*, void* tlssession); /* callback for the *_with_callback() connect functions of libetpan */
+void mr_tls_session_check (mrtlssession_t*, const char* host, int port); /* call before connecting, forgets the session if it belongs to another server */
+int  mr_tls_session_save  (mrtlssession_t*, mailstream*, const char* host, int port); /* remember the session of a connected stream, returns 1 if the session was resumed */
+void mr_tls_session_clear (mrtlssession_t*);
+
 /* date/time tools */
 #define                    MR_INVALID_TIMESTAMP               (-1)
 time_t                     mr_timestamp_from_date             (struct mailimf_date_time * date_time); /* the result is UTC or MR_INVALID_TIMESTAMP */
@@ -120,6 +132,7 @@ char*    mr_get_filesuffix_lc       (const char* pathNfilename); /* the returned
 void     mr_split_filename          (const char* pathNfilename, char** ret_basename, char** ret_all_suffixes_incl_dot); /* the case of the suffix is preserved! */
 int      mr_get_filemeta            (const void* buf, size_t buf_bytes, uint32_t* ret_width, uint32_t *ret_height);
 char*    mr_get_fine_pathNfilename  (const char* folder, const char* desired_name);
+char*    mr_create_fine_file        (const char* folder, const char* desired_name, const void* buf, size_t buf_bytes, mrmailbox_t* log); /* the return value must be free()'d */
 
 
 /* macros */
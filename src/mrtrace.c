@@ -0,0 +1,188 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+/* Tracing in the Chrome trace_event format, the resulting file can be loaded
+eg. into chrome://tracing or https://ui.perfetto.dev .  The file is a JSON array
+of events; if the trace is not stopped properly, the closing bracket is missing,
+which the viewers accept. */
+
+
+#include <stdarg.h>
+#include <unistd.h>
+#include "mrmailbox_internal.h"
+
+
+typedef struct mrtrace_t
+{
+	pthread_mutex_t  m_mutex;     /* protects all members */
+	FILE*            m_file;      /* NULL if tracing is not enabled */
+	int              m_event_cnt;
+	uint64_t         m_start_us;
+	int              m_pid;
+} mrtrace_t;
+
+
+void mrtrace_add(mrmailbox_t* mailbox, char phase, const char* name, const char* args_fmt, ...)
+{
+	mrtrace_t* trace = NULL;
+	uint64_t   ts = mrmetrics_now_us();
+	int        tid = mrmailbox_get_thread_index();
+	char       args[512];
+
+	if( mailbox == NULL || (trace=mailbox->m_trace)==NULL || name == NULL ) {
+		return;
+	}
+
+	args[0] = 0;
+	if( args_fmt ) {
+		va_list va;
+		va_start(va, args_fmt);
+			vsnprintf(args, sizeof(args), args_fmt, va);
+		va_end(va);
+	}
+
+	pthread_mutex_lock(&trace->m_mutex);
+
+		if( trace->m_file ) {
+			fprintf(trace->m_file, "%s{\"name\":\"%s\",\"cat\":\"core\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%i,\"tid\":%i%s,\"args\":{%s}}",
+				trace->m_event_cnt? ",\n" : "", name, phase, (unsigned long long)(ts - trace->m_start_us), trace->m_pid, tid,
+				phase=='i'? ",\"s\":\"t\"" : "", args);
+			trace->m_event_cnt++;
+		}
+
+	pthread_mutex_unlock(&trace->m_mutex);
+}
+
+
+void mrmailbox_init_trace(mrmailbox_t* mailbox)
+{
+	mrtrace_t* trace = NULL;
+
+	if( mailbox == NULL || mailbox->m_trace ) {
+		return;
+	}
+
+	if( (trace=calloc(1, sizeof(mrtrace_t)))==NULL ) {
+		exit(56); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	pthread_mutex_init(&trace->m_mutex, NULL);
+
+	mailbox->m_trace = trace;
+}
+
+
+void mrmailbox_exit_trace(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL || mailbox->m_trace == NULL ) {
+		return;
+	}
+
+	mrmailbox_stop_trace(mailbox);
+
+	pthread_mutex_destroy(&mailbox->m_trace->m_mutex);
+	free(mailbox->m_trace);
+	mailbox->m_trace = NULL;
+}
+
+
+/**
+ * Start writing a trace in the Chrome trace_event JSON format.  The trace
+ * contains spans for fetching, parsing, decrypting and storing messages,
+ * annotated with the server UIDs and the database IDs of the messages, as
+ * well as the events sent to the frontend.  The file can be loaded into a
+ * trace viewer as chrome://tracing or https://ui.perfetto.dev .
+ *
+ * If a trace is already written, it is stopped first.
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @param filename The file to write the trace to; an existing file is overwritten.
+ *
+ * @return 1=success, 0=error.
+ */
+int mrmailbox_start_trace(mrmailbox_t* mailbox, const char* filename)
+{
+	mrtrace_t* trace = NULL;
+	FILE*      file = NULL;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || (trace=mailbox->m_trace)==NULL || filename == NULL ) {
+		return 0;
+	}
+
+	mrmailbox_stop_trace(mailbox);
+
+	if( (file=fopen(filename, "w"))==NULL ) {
+		mrmailbox_log_error(mailbox, 0, "Cannot write trace to \"%s\".", filename);
+		return 0;
+	}
+
+	pthread_mutex_lock(&trace->m_mutex);
+		fputs("[\n", file);
+		trace->m_file      = file;
+		trace->m_event_cnt = 0;
+		trace->m_start_us  = mrmetrics_now_us();
+		trace->m_pid       = (int)getpid();
+		__atomic_store_n(&mailbox->m_tracing, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&trace->m_mutex);
+
+	mrmailbox_log_info(mailbox, 0, "Writing trace to \"%s\".", filename);
+	return 1;
+}
+
+
+/**
+ * Stop writing the trace started by mrmailbox_start_trace() and close the file.
+ *
+ * @memberof mrmailbox_t
+ *
+ * @param mailbox The mailbox object as created by mrmailbox_new().
+ *
+ * @return None.
+ */
+void mrmailbox_stop_trace(mrmailbox_t* mailbox)
+{
+	mrtrace_t* trace = NULL;
+	int        event_cnt = 0, was_tracing = 0;
+
+	if( mailbox == NULL || mailbox->m_magic != MR_MAILBOX_MAGIC || (trace=mailbox->m_trace)==NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&trace->m_mutex);
+		__atomic_store_n(&mailbox->m_tracing, 0, __ATOMIC_RELAXED);
+		if( trace->m_file ) {
+			fputs("\n]\n", trace->m_file);
+			fclose(trace->m_file);
+			trace->m_file = NULL;
+			event_cnt = trace->m_event_cnt;
+			was_tracing = 1;
+		}
+	pthread_mutex_unlock(&trace->m_mutex);
+
+	if( was_tracing ) {
+		mrmailbox_log_info(mailbox, 0, "Trace stopped, %i events written.", event_cnt);
+	}
+}
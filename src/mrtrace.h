@@ -0,0 +1,54 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                      Copyright (C) 2017 Björn Petersen
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ ******************************************************************************/
+
+
+
+#ifndef __MRTRACE_H__
+#define __MRTRACE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+/* Tracing of begin/end spans and instant events, written in the Chrome
+trace_event JSON format, see mrmailbox_start_trace().  If tracing is not
+enabled, the macros only check a flag; the arguments are not evaluated.
+
+args_fmt is a printf()-format creating the JSON members of the "args" object,
+eg. "\"uid\":%lu", or NULL; string values must not contain quotes or
+backslashes. */
+
+#define MR_TRACE_ENABLED(mailbox)                 ((mailbox)!=NULL && __atomic_load_n(&(mailbox)->m_tracing, __ATOMIC_RELAXED))
+#define MR_TRACE_BEGIN(mailbox, name, ...)        { if( MR_TRACE_ENABLED((mailbox)) ) { mrtrace_add((mailbox), 'B', (name), __VA_ARGS__); } }
+#define MR_TRACE_END(mailbox, name, ...)          { if( MR_TRACE_ENABLED((mailbox)) ) { mrtrace_add((mailbox), 'E', (name), __VA_ARGS__); } }
+#define MR_TRACE_INSTANT(mailbox, name, ...)      { if( MR_TRACE_ENABLED((mailbox)) ) { mrtrace_add((mailbox), 'i', (name), __VA_ARGS__); } }
+
+void    mrtrace_add                 (mrmailbox_t*, char phase, const char* name, const char* args_fmt, ...);
+void    mrmailbox_init_trace        (mrmailbox_t*);
+void    mrmailbox_exit_trace        (mrmailbox_t*);
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRTRACE_H__ */